@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "AsciiConvert.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define ASCIICONVERT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+size_t AsciiConvert::WidenPrefix(const char* src, size_t length, char16_t* dest)
+{
+	size_t i = 0;
+
+#ifdef ASCIICONVERT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	while ((length - i) >= 16)
+	{
+		const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+		// The high bit of every byte is clear if the block is pure ASCII.
+		if (_mm_movemask_epi8(chars) != 0)
+		{
+			break;
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_unpacklo_epi8(chars, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i + 8), _mm_unpackhi_epi8(chars, zero));
+		i += 16;
+	}
+#endif // ASCIICONVERT_USE_SSE2
+
+	for (; i < length; i++)
+	{
+		const unsigned char c = static_cast<unsigned char>(src[i]);
+
+		if (c >= 0x80)
+		{
+			break;
+		}
+
+		dest[i] = static_cast<char16_t>(c);
+	}
+
+	return i;
+}
+
+size_t AsciiConvert::NarrowPrefix(const char16_t* src, size_t length, char* dest)
+{
+	size_t i = 0;
+
+#ifdef ASCIICONVERT_USE_SSE2
+	const __m128i nonAsciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i zero = _mm_setzero_si128();
+
+	while ((length - i) >= 16)
+	{
+		const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+
+		// Every code unit in the block must be less than 0x80.
+		const __m128i nonAsciiBits = _mm_and_si128(_mm_or_si128(lo, hi), nonAsciiMask);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAsciiBits, zero)) != 0xFFFF)
+		{
+			break;
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(lo, hi));
+		i += 16;
+	}
+#endif // ASCIICONVERT_USE_SSE2
+
+	for (; i < length; i++)
+	{
+		const char16_t c = src[i];
+
+		if (c >= 0x80)
+		{
+			break;
+		}
+
+		dest[i] = static_cast<char>(c);
+	}
+
+	return i;
+}
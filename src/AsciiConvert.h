@@ -0,0 +1,30 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstddef>
+
+// Converts the leading ASCII characters of a string between UTF-8 and UTF-16.
+// The conversion stops at the first non-ASCII character, which is always on a code
+// point boundary, so the caller can convert the rest of the string with a full UTF
+// converter and get the same result as converting the whole string.
+// The functions do not depend on the OS, so they can be tested on any platform.
+namespace AsciiConvert
+{
+	// Copies the leading ASCII characters of a UTF-8 string into a UTF-16 buffer.
+	// Returns the number of characters that were copied.
+	size_t WidenPrefix(const char* src, size_t length, char16_t* dest);
+
+	// Copies the leading ASCII characters of a UTF-16 string into a UTF-8 buffer.
+	// Returns the number of characters that were copied.
+	size_t NarrowPrefix(const char16_t* src, size_t length, char* dest);
+}
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// A first in first out queue with a fixed capacity that is used to pass items
+// between a producer and a consumer thread.
+// The producer blocks when the queue is full, and the consumer blocks when the
+// queue is empty.
+template<typename T>
+class BoundedBlockingQueue
+{
+public:
+	explicit BoundedBlockingQueue(size_t capacity)
+		: capacity(capacity), items(), mutex(), notEmpty(), notFull(), completed(false), canceled(false)
+	{
+	}
+
+	BoundedBlockingQueue(const BoundedBlockingQueue&) = delete;
+	BoundedBlockingQueue& operator=(const BoundedBlockingQueue&) = delete;
+
+	// Adds an item to the end of the queue, waiting until there is space for it.
+	// Returns false if the consumer has canceled the queue.
+	bool Push(T&& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		notFull.wait(lock, [this] { return items.size() < capacity || canceled; });
+
+		if (canceled)
+		{
+			return false;
+		}
+
+		items.push_back(std::move(item));
+
+		lock.unlock();
+		notEmpty.notify_one();
+
+		return true;
+	}
+
+	// Removes the item at the start of the queue, waiting until one is available.
+	// Returns false when the producer has completed and all items have been removed.
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		notEmpty.wait(lock, [this] { return !items.empty() || completed || canceled; });
+
+		if (items.empty() || canceled)
+		{
+			return false;
+		}
+
+		item = std::move(items.front());
+		items.pop_front();
+
+		lock.unlock();
+		notFull.notify_one();
+
+		return true;
+	}
+
+	// Called by the producer to signal that no more items will be added.
+	void Complete()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			completed = true;
+		}
+
+		notEmpty.notify_all();
+	}
+
+	// Called by the consumer to signal that it will not remove any more items.
+	// Any waiting or future Push calls will return false.
+	void Cancel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			canceled = true;
+			items.clear();
+		}
+
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	const size_t capacity;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	bool completed;
+	bool canceled;
+};
@@ -0,0 +1,592 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CityAccessHistory.h"
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include "StringViewUtil.h"
+#include "cIGZPersistDBSegment.h"
+#include "cRZBaseString.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <Windows.h>
+#include "wil/resource.h"
+
+using namespace std::string_view_literals;
+
+namespace
+{
+	// The prewarming stops after this many bytes have been read, so that a large
+	// history does not push the rest of the game's data out of the file cache.
+	constexpr uint64_t MaxPrewarmBytes = 256ULL * 1024 * 1024;
+
+	// The size of the buffer that each worker thread reads the record data into.
+	constexpr uint32_t PrewarmBufferSize = 1024 * 1024;
+
+	// Records that are closer together than this are read with a single call.
+	constexpr uint32_t MaxRangeGap = 64 * 1024;
+
+	constexpr uint32_t MaxPrewarmThreads = 4;
+
+	struct FileRange
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	bool HasSC4Extension(const std::string_view& path)
+	{
+		return path.size() > 4 && StringViewUtil::EqualsIgnoreCase(path.substr(path.size() - 4), ".sc4"sv);
+	}
+
+	// A 64-bit FNV-1a hash of the path, the ASCII letters are converted to lower case
+	// because the Windows file system is case insensitive.
+	uint64_t HashPath(const std::string_view& path)
+	{
+		uint64_t hash = 0xCBF29CE484222325ULL;
+
+		for (char c : path)
+		{
+			if (c >= 'A' && c <= 'Z')
+			{
+				c = static_cast<char>(c + ('a' - 'A'));
+			}
+
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 0x100000001B3ULL;
+		}
+
+		return hash;
+	}
+
+	std::wstring GetWin32Path(const std::string& utf8Path)
+	{
+		std::wstring path = GZStringConvert::ToUtf16(cRZBaseString(utf8Path));
+
+		if (PathUtil::MustAddExtendedPathPrefix(path))
+		{
+			path = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(path));
+		}
+
+		return path;
+	}
+
+	bool ReadAt(HANDLE hFile, uint32_t offset, void* buffer, uint32_t size)
+	{
+		OVERLAPPED overlapped{};
+		overlapped.Offset = offset;
+
+		DWORD bytesRead = 0;
+
+		return ReadFile(hFile, buffer, size, &bytesRead, &overlapped) && bytesRead == size;
+	}
+
+	bool ParseKeyValue(std::string_view& text, uint32_t& value)
+	{
+		while (!text.empty() && text.front() == ' ')
+		{
+			text.remove_prefix(1);
+		}
+
+		const std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+
+		if (result.ec != std::errc() || result.ptr == text.data())
+		{
+			return false;
+		}
+
+		text.remove_prefix(static_cast<size_t>(result.ptr - text.data()));
+		return true;
+	}
+}
+
+CityAccessHistory& CityAccessHistory::GetInstance()
+{
+	static CityAccessHistory instance;
+
+	return instance;
+}
+
+CityAccessHistory::CityAccessHistory()
+	: enabled(false),
+	  prewarmRecords(false),
+	  historyFolderPath(),
+	  cityFileMutex(),
+	  lastCityFilePath(),
+	  loadingCityPath(),
+	  cityLoadStopwatch(),
+	  recording(false),
+	  accessMutex(),
+	  accesses(),
+	  recordedKeys(),
+	  prewarmFiles(),
+	  prewarmThreads(),
+	  nextPrewarmFile(0),
+	  stopPrewarming(false),
+	  prewarmedRecordCount(0),
+	  missingRecordCount(0),
+	  prewarmedBytes(0),
+	  finishedPrewarmThreads(0),
+	  prewarmEndTimestamp(0),
+	  prewarmStartTimestamp(0),
+	  prewarmThreadCount(0),
+	  prewarmRecordCount(0)
+{
+}
+
+void CityAccessHistory::Enable(const std::filesystem::path& historyFolderPath, bool prewarmRecords)
+{
+	this->historyFolderPath = historyFolderPath;
+	this->prewarmRecords = prewarmRecords;
+	enabled = true;
+}
+
+bool CityAccessHistory::IsEnabled() const
+{
+	return enabled;
+}
+
+void CityAccessHistory::FileOpened(const cIGZString& path)
+{
+	const std::string_view pathView(path.ToChar(), path.Strlen());
+
+	if (HasSC4Extension(pathView))
+	{
+		std::lock_guard<std::mutex> lock(cityFileMutex);
+
+		lastCityFilePath = pathView;
+	}
+}
+
+void CityAccessHistory::StartCityLoad()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(cityFileMutex);
+
+		loadingCityPath = lastCityFilePath;
+	}
+
+	cityLoadStopwatch.Reset();
+	cityLoadStopwatch.Start();
+
+	if (loadingCityPath.empty())
+	{
+		Logger::GetInstance().WriteLine(
+			LogLevel::Error,
+			"Unable to identify the city file, the records that the city load reads will not be recorded.");
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(accessMutex);
+
+		accesses.clear();
+		recordedKeys.clear();
+	}
+
+	recording = true;
+
+	if (prewarmRecords)
+	{
+		try
+		{
+			std::vector<HistoryFile> files = LoadHistory(GetHistoryFilePath(loadingCityPath));
+
+			if (!files.empty())
+			{
+				StartPrewarming(std::move(files));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			Logger::GetInstance().WriteLineFormatted(
+				LogLevel::Error,
+				"Failed to start prewarming the records for %s: %s",
+				loadingCityPath.c_str(),
+				e.what());
+		}
+	}
+}
+
+void CityAccessHistory::EndCityLoad()
+{
+	if (!enabled || loadingCityPath.empty())
+	{
+		return;
+	}
+
+	recording = false;
+	cityLoadStopwatch.Stop();
+
+	Logger& logger = Logger::GetInstance();
+
+	if (prewarmThreads.empty())
+	{
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"City load of %s took %lld ms without prewarming.",
+			loadingCityPath.c_str(),
+			cityLoadStopwatch.ElapsedMilliseconds());
+	}
+	else
+	{
+		// The prewarming is stopped if it is still running when the city has loaded.
+		const bool finished = finishedPrewarmThreads == prewarmThreadCount;
+
+		StopPrewarming();
+
+		const double prewarmMilliseconds = static_cast<double>(prewarmEndTimestamp - prewarmStartTimestamp) * 1000.0
+			/ static_cast<double>(Stopwatch::GetFrequency());
+
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"City load of %s took %lld ms with prewarming: %u of %u records (%.1f MB) from %zu files in %.0f ms%s,"
+			" %u records were not found.",
+			loadingCityPath.c_str(),
+			cityLoadStopwatch.ElapsedMilliseconds(),
+			prewarmedRecordCount.load(),
+			prewarmRecordCount,
+			static_cast<double>(prewarmedBytes) / (1024.0 * 1024.0),
+			prewarmFiles.size(),
+			prewarmMilliseconds,
+			finished ? "" : ", stopped at the end of the city load",
+			missingRecordCount.load());
+
+		prewarmFiles.clear();
+	}
+
+	try
+	{
+		SaveHistory(GetHistoryFilePath(loadingCityPath), loadingCityPath);
+	}
+	catch (const std::exception& e)
+	{
+		logger.WriteLineFormatted(
+			LogLevel::Error,
+			"Failed to save the record history for %s: %s",
+			loadingCityPath.c_str(),
+			e.what());
+	}
+
+	loadingCityPath.clear();
+}
+
+void CityAccessHistory::RecordAccess(cIGZPersistDBSegment* pSegment, const cGZPersistResourceKey& key)
+{
+	std::lock_guard<std::mutex> lock(accessMutex);
+
+	if (recording && recordedKeys.insert(key).second)
+	{
+		accesses.push_back(Access{ pSegment, key });
+	}
+}
+
+void CityAccessHistory::Shutdown()
+{
+	recording = false;
+	StopPrewarming();
+}
+
+std::filesystem::path CityAccessHistory::GetHistoryFilePath(const std::string& cityPath) const
+{
+	char fileName[32]{};
+	std::snprintf(fileName, sizeof(fileName), "%016llx.txt", static_cast<unsigned long long>(HashPath(cityPath)));
+
+	std::filesystem::path path = historyFolderPath;
+	path /= fileName;
+
+	return path;
+}
+
+std::vector<CityAccessHistory::HistoryFile> CityAccessHistory::LoadHistory(const std::filesystem::path& path) const
+{
+	std::vector<HistoryFile> files;
+
+	std::ifstream stream(path, std::ifstream::in | std::ifstream::binary);
+
+	if (stream)
+	{
+		boost::unordered::unordered_flat_map<std::string, size_t> fileIndexes;
+
+		std::string line;
+
+		while (std::getline(stream, line))
+		{
+			std::string_view lineView(line);
+
+			if (lineView.ends_with('\r'))
+			{
+				lineView.remove_suffix(1);
+			}
+
+			const size_t separatorIndex = lineView.find('\t');
+
+			if (lineView.starts_with('#') || separatorIndex == std::string_view::npos || separatorIndex == 0)
+			{
+				continue;
+			}
+
+			std::string_view keyText = lineView.substr(separatorIndex + 1);
+			uint32_t type = 0;
+			uint32_t group = 0;
+			uint32_t instance = 0;
+
+			if (ParseKeyValue(keyText, type) && ParseKeyValue(keyText, group) && ParseKeyValue(keyText, instance))
+			{
+				const std::string filePath(lineView.substr(0, separatorIndex));
+
+				const auto result = fileIndexes.try_emplace(filePath, files.size());
+
+				if (result.second)
+				{
+					files.push_back(HistoryFile{ filePath, {} });
+				}
+
+				files[result.first->second].keys.emplace_back(type, group, instance);
+			}
+		}
+	}
+
+	return files;
+}
+
+void CityAccessHistory::SaveHistory(const std::filesystem::path& path, const std::string& cityPath)
+{
+	std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream stream(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+	if (!stream)
+	{
+		throw std::runtime_error("Failed to open the file for writing.");
+	}
+
+	stream << "# " << cityPath << "\r\n";
+
+	boost::unordered::unordered_flat_map<cIGZPersistDBSegment*, std::string> segmentPaths;
+	char keyText[32]{};
+
+	std::lock_guard<std::mutex> lock(accessMutex);
+
+	for (const Access& access : accesses)
+	{
+		auto segmentPath = segmentPaths.find(access.segment);
+
+		if (segmentPath == segmentPaths.end())
+		{
+			cRZBaseString segmentPathString;
+			access.segment->GetPath(segmentPathString);
+
+			segmentPath = segmentPaths.emplace(access.segment, std::string(segmentPathString.ToChar(), segmentPathString.Strlen())).first;
+		}
+
+		std::snprintf(
+			keyText,
+			sizeof(keyText),
+			"%08X %08X %08X",
+			access.key.type,
+			access.key.group,
+			access.key.instance);
+
+		stream << segmentPath->second << '\t' << keyText << "\r\n";
+	}
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Saved %zu records from %zu files to the city record history.",
+		accesses.size(),
+		segmentPaths.size());
+}
+
+void CityAccessHistory::StartPrewarming(std::vector<HistoryFile>&& files)
+{
+	prewarmFiles = std::move(files);
+	nextPrewarmFile = 0;
+	stopPrewarming = false;
+	prewarmedRecordCount = 0;
+	missingRecordCount = 0;
+	prewarmedBytes = 0;
+	finishedPrewarmThreads = 0;
+	prewarmEndTimestamp = 0;
+	prewarmStartTimestamp = Stopwatch::GetTimestamp();
+
+	prewarmRecordCount = 0;
+
+	for (const HistoryFile& file : prewarmFiles)
+	{
+		prewarmRecordCount += static_cast<uint32_t>(file.keys.size());
+	}
+
+	// The prewarming uses at most half of the CPU cores, the game is loading the city
+	// on the main thread at the same time.
+	prewarmThreadCount = std::clamp<uint32_t>(std::thread::hardware_concurrency() / 2, 1, MaxPrewarmThreads);
+	prewarmThreadCount = std::min<uint32_t>(prewarmThreadCount, static_cast<uint32_t>(prewarmFiles.size()));
+
+	prewarmThreads.reserve(prewarmThreadCount);
+
+	for (uint32_t i = 0; i < prewarmThreadCount; i++)
+	{
+		prewarmThreads.emplace_back(&CityAccessHistory::PrewarmWorker, this);
+	}
+}
+
+void CityAccessHistory::StopPrewarming()
+{
+	stopPrewarming = true;
+
+	for (std::thread& thread : prewarmThreads)
+	{
+		thread.join();
+	}
+
+	prewarmThreads.clear();
+
+	if (prewarmEndTimestamp == 0)
+	{
+		prewarmEndTimestamp = Stopwatch::GetTimestamp();
+	}
+}
+
+void CityAccessHistory::PrewarmWorker()
+{
+	std::vector<uint8_t> buffer(PrewarmBufferSize);
+
+	size_t fileIndex = 0;
+
+	while (!stopPrewarming && (fileIndex = nextPrewarmFile.fetch_add(1)) < prewarmFiles.size())
+	{
+		try
+		{
+			PrewarmFile(prewarmFiles[fileIndex], buffer);
+		}
+		catch (const std::exception&)
+		{
+			missingRecordCount += static_cast<uint32_t>(prewarmFiles[fileIndex].keys.size());
+		}
+	}
+
+	if (finishedPrewarmThreads.fetch_add(1) + 1 == prewarmThreadCount && !stopPrewarming)
+	{
+		prewarmEndTimestamp = Stopwatch::GetTimestamp();
+	}
+}
+
+void CityAccessHistory::PrewarmFile(const HistoryFile& file, std::vector<uint8_t>& buffer)
+{
+	const std::wstring path = GetWin32Path(file.path);
+
+	wil::unique_hfile hFile(CreateFileW(
+		path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_RANDOM_ACCESS,
+		nullptr));
+
+	DBPFHeader header{};
+	LARGE_INTEGER fileSize{};
+
+	if (!hFile
+		|| !GetFileSizeEx(hFile.get(), &fileSize)
+		|| !ReadAt(hFile.get(), 0, &header, sizeof(header))
+		|| !DBPFIndexReader::IsValidHeader(header, static_cast<uint64_t>(fileSize.QuadPart)))
+	{
+		missingRecordCount += static_cast<uint32_t>(file.keys.size());
+		return;
+	}
+
+	std::vector<uint8_t> index(DBPFIndexReader::GetIndexSize(header));
+
+	if (!ReadAt(hFile.get(), header.indexOffset, index.data(), static_cast<uint32_t>(index.size())))
+	{
+		missingRecordCount += static_cast<uint32_t>(file.keys.size());
+		return;
+	}
+
+	const DBPFIndexReader indexReader(header, index.data(), static_cast<uint64_t>(fileSize.QuadPart));
+
+	boost::unordered::unordered_flat_set<
+		cGZPersistResourceKey,
+		PersistResourceKeyHashers::TgiMapHasher,
+		std::equal_to<const cGZPersistResourceKey>> remainingKeys(file.keys.begin(), file.keys.end());
+
+	std::vector<FileRange> ranges;
+	ranges.reserve(file.keys.size());
+
+	for (uint32_t i = 0; i < indexReader.GetEntryCount() && !remainingKeys.empty(); i++)
+	{
+		DBPFIndexReader::Entry entry{};
+
+		// The records that are outside the file are left for the game to report.
+		if (indexReader.TryGetEntry(i, entry)
+			&& remainingKeys.erase(cGZPersistResourceKey(entry.type, entry.group, entry.instance)) > 0)
+		{
+			ranges.push_back(FileRange{ entry.offset, entry.size });
+		}
+	}
+
+	missingRecordCount += static_cast<uint32_t>(remainingKeys.size());
+
+	// The records are read in file order, and the records that are close together
+	// are read with a single call.
+	std::sort(ranges.begin(), ranges.end(), [](const FileRange& lhs, const FileRange& rhs) { return lhs.offset < rhs.offset; });
+
+	size_t rangeIndex = 0;
+
+	while (rangeIndex < ranges.size())
+	{
+		const uint32_t start = ranges[rangeIndex].offset;
+		uint64_t end = static_cast<uint64_t>(start) + ranges[rangeIndex].size;
+		uint32_t recordCount = 1;
+
+		rangeIndex++;
+
+		while (rangeIndex < ranges.size() && ranges[rangeIndex].offset <= end + MaxRangeGap)
+		{
+			end = std::max<uint64_t>(end, static_cast<uint64_t>(ranges[rangeIndex].offset) + ranges[rangeIndex].size);
+			recordCount++;
+			rangeIndex++;
+		}
+
+		for (uint64_t offset = start; offset < end;)
+		{
+			const uint32_t chunkSize = static_cast<uint32_t>(std::min<uint64_t>(end - offset, buffer.size()));
+
+			if (stopPrewarming || prewarmedBytes.fetch_add(chunkSize) >= MaxPrewarmBytes)
+			{
+				return;
+			}
+
+			if (!ReadAt(hFile.get(), static_cast<uint32_t>(offset), buffer.data(), chunkSize))
+			{
+				break;
+			}
+
+			offset += chunkSize;
+		}
+
+		prewarmedRecordCount += recordCount;
+	}
+}
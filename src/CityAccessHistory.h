@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyHashers.h"
+#include "Stopwatch.h"
+#include "boost/unordered/unordered_flat_set.hpp"
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class cIGZPersistDBSegment;
+class cIGZString;
+
+// Records the plugin records that the game reads while a city is loading, and reads
+// those records on worker threads the next time the city is opened.
+//
+// The worker threads read the record data from the DBPF files with the Windows API,
+// this places the data in the operating system's file cache before the game reads
+// it through its own file handles.
+//
+// The city is identified by the last .sc4 file that the game opened before the city
+// load started. The histories are stored in a folder with one file per city, the file
+// name is a hash of the city path and each line is:
+//
+// <DBPF file path><tab><type> <group> <instance>
+class CityAccessHistory
+{
+public:
+
+	static CityAccessHistory& GetInstance();
+
+	void Enable(const std::filesystem::path& historyFolderPath, bool prewarmRecords);
+
+	bool IsEnabled() const;
+
+	// Returns true if the records that the game reads are being recorded.
+	bool IsRecording() const
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	// Called by the cRZFile hook for every file that the game opens.
+	void FileOpened(const cIGZString& path);
+
+	// Called when the city load starts, this starts prewarming the records from
+	// the city's previous load.
+	void StartCityLoad();
+
+	// Called when the city load has finished, this stops the prewarming and saves
+	// the records that were read during the load.
+	void EndCityLoad();
+
+	// Adds a record that the game read to the history of the city that is loading.
+	void RecordAccess(cIGZPersistDBSegment* pSegment, const cGZPersistResourceKey& key);
+
+	void Shutdown();
+
+private:
+
+	struct HistoryFile
+	{
+		std::string path;
+		std::vector<cGZPersistResourceKey> keys;
+	};
+
+	struct Access
+	{
+		cIGZPersistDBSegment* segment;
+		cGZPersistResourceKey key;
+	};
+
+	CityAccessHistory();
+
+	std::filesystem::path GetHistoryFilePath(const std::string& cityPath) const;
+
+	std::vector<HistoryFile> LoadHistory(const std::filesystem::path& path) const;
+
+	void SaveHistory(const std::filesystem::path& path, const std::string& cityPath);
+
+	void StartPrewarming(std::vector<HistoryFile>&& files);
+
+	void StopPrewarming();
+
+	void PrewarmWorker();
+
+	void PrewarmFile(const HistoryFile& file, std::vector<uint8_t>& buffer);
+
+	bool enabled;
+	bool prewarmRecords;
+	std::filesystem::path historyFolderPath;
+
+	std::mutex cityFileMutex;
+	std::string lastCityFilePath;
+	std::string loadingCityPath;
+	Stopwatch cityLoadStopwatch;
+
+	std::atomic<bool> recording;
+	std::mutex accessMutex;
+	std::vector<Access> accesses;
+	boost::unordered::unordered_flat_set<
+		cGZPersistResourceKey,
+		PersistResourceKeyHashers::TgiMapHasher,
+		std::equal_to<const cGZPersistResourceKey>> recordedKeys;
+
+	std::vector<HistoryFile> prewarmFiles;
+	std::vector<std::thread> prewarmThreads;
+	std::atomic<size_t> nextPrewarmFile;
+	std::atomic<bool> stopPrewarming;
+	std::atomic<uint32_t> prewarmedRecordCount;
+	std::atomic<uint32_t> missingRecordCount;
+	std::atomic<uint64_t> prewarmedBytes;
+	std::atomic<uint32_t> finishedPrewarmThreads;
+	std::atomic<int64_t> prewarmEndTimestamp;
+	int64_t prewarmStartTimestamp;
+	uint32_t prewarmThreadCount;
+	uint32_t prewarmRecordCount;
+};
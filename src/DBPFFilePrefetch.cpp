@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DBPFFilePrefetch.h"
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "GZStringConvert.h"
+#include "PathUtil.h"
+#include "cIGZString.h"
+#include <Windows.h>
+#include "wil/resource.h"
+
+namespace
+{
+	std::wstring GetWin32Path(const cIGZString& path)
+	{
+		std::wstring win32Path = GZStringConvert::ToUtf16(path);
+
+		if (PathUtil::MustAddExtendedPathPrefix(win32Path))
+		{
+			win32Path = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(win32Path));
+		}
+
+		return win32Path;
+	}
+
+	bool ReadAt(HANDLE hFile, uint32_t offset, void* buffer, uint32_t size)
+	{
+		OVERLAPPED overlapped{};
+		overlapped.Offset = offset;
+
+		DWORD bytesRead = 0;
+
+		return ReadFile(hFile, buffer, size, &bytesRead, &overlapped) && bytesRead == size;
+	}
+}
+
+bool DBPFFilePrefetch::Prefetch(const cIGZString& path, uint64_t wholeFileSizeLimit, std::vector<uint8_t>& buffer)
+{
+	wil::unique_hfile hFile(CreateFileW(
+		GetWin32Path(path).c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_RANDOM_ACCESS,
+		nullptr));
+
+	LARGE_INTEGER fileSize{};
+
+	if (!hFile || !GetFileSizeEx(hFile.get(), &fileSize))
+	{
+		return false;
+	}
+
+	const uint64_t size = static_cast<uint64_t>(fileSize.QuadPart);
+
+	if (size <= wholeFileSizeLimit)
+	{
+		// The small files are read in full by the memory-backed segments.
+		buffer.resize(static_cast<size_t>(size));
+
+		return size == 0 || ReadAt(hFile.get(), 0, buffer.data(), static_cast<uint32_t>(size));
+	}
+
+	DBPFHeader header{};
+
+	if (!ReadAt(hFile.get(), 0, &header, sizeof(header))
+		|| !DBPFIndexReader::IsValidHeader(header, size))
+	{
+		return false;
+	}
+
+	buffer.resize(DBPFIndexReader::GetIndexSize(header));
+
+	return buffer.empty() || ReadAt(hFile.get(), header.indexOffset, buffer.data(), static_cast<uint32_t>(buffer.size()));
+}
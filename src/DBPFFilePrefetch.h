@@ -0,0 +1,29 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class cIGZString;
+
+// Reads the parts of a DBPF file that are read when the file is opened as a segment,
+// so that the segment's reads are served from the file system cache.
+// Only Win32 calls are used, so the files can be prefetched on any thread while the
+// game's segment objects are only used on the thread that opens them.
+namespace DBPFFilePrefetch
+{
+	// Reads the header and index of the file, or the whole file if it is not larger
+	// than wholeFileSizeLimit bytes. The buffer is reused between calls.
+	// Returns false if the file could not be read.
+	bool Prefetch(const cIGZString& path, uint64_t wholeFileSizeLimit, std::vector<uint8_t>& buffer);
+}
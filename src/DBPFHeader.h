@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+
+// The header at the start of every DBPF file.
+// All values are stored in little-endian byte order.
+struct DBPFHeader
+{
+	static constexpr uint32_t Signature = 0x46504244; // DBPF
+	static constexpr uint32_t Size = 96;
+
+	uint32_t signature;
+	uint32_t majorVersion;
+	uint32_t minorVersion;
+	uint32_t reserved1[3];
+	uint32_t dateCreated;
+	uint32_t dateModified;
+	uint32_t indexMajorVersion;
+	uint32_t indexEntryCount;
+	uint32_t indexOffset;
+	uint32_t indexSize;
+	uint32_t holeEntryCount;
+	uint32_t holeOffset;
+	uint32_t holeSize;
+	uint32_t indexMinorVersion;
+	uint32_t reserved2[8];
+};
+static_assert(sizeof(DBPFHeader) == DBPFHeader::Size);
@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "DBPFHeaderCheck.h"
+#include "DBPFHeader.h"
+#include "PathUtil.h"
+#include <Windows.h>
+#include "wil/resource.h"
+
+namespace
+{
+	std::wstring GetNativeFilePath(const std::wstring& path)
+	{
+		if (PathUtil::MustAddExtendedPathPrefix(path))
+		{
+			// The extended path must be normalized because the OS won't do it for us.
+			return PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(path));
+		}
+
+		return path;
+	}
+
+	bool ReadHeader(const std::wstring& path, DBPFHeader& header)
+	{
+		wil::unique_hfile file(CreateFileW(
+			GetNativeFilePath(path).c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			nullptr));
+
+		if (!file)
+		{
+			return false;
+		}
+
+		DWORD bytesRead = 0;
+
+		return ReadFile(file.get(), &header, sizeof(header), &bytesRead, nullptr)
+			&& bytesRead == sizeof(header);
+	}
+}
+
+DBPFHeaderCheck::Result DBPFHeaderCheck::CheckFile(const std::wstring& path, uint64_t fileSize)
+{
+	if (fileSize == 0)
+	{
+		return Result::EmptyFile;
+	}
+	else if (fileSize < DBPFHeader::Size)
+	{
+		return Result::FileTooSmall;
+	}
+
+	DBPFHeader header{};
+
+	if (!ReadHeader(path, header))
+	{
+		return Result::ReadError;
+	}
+
+	if (header.signature != DBPFHeader::Signature)
+	{
+		return Result::MissingSignature;
+	}
+
+	// The index location is only checked for the DBPF 1.x format that SC4 uses,
+	// the other versions store it in a different header field.
+	if (header.majorVersion == 1 && header.indexEntryCount > 0)
+	{
+		const uint64_t indexEnd = static_cast<uint64_t>(header.indexOffset) + header.indexSize;
+
+		if (header.indexOffset < DBPFHeader::Size || indexEnd > fileSize)
+		{
+			return Result::IndexOutOfRange;
+		}
+	}
+
+	return Result::Valid;
+}
+
+const char* DBPFHeaderCheck::GetResultDescription(Result result)
+{
+	switch (result)
+	{
+	case Result::Valid:
+		return "valid DBPF header";
+	case Result::EmptyFile:
+		return "the file is empty";
+	case Result::FileTooSmall:
+		return "the file is smaller than a DBPF header";
+	case Result::MissingSignature:
+		return "the file does not start with the DBPF signature";
+	case Result::IndexOutOfRange:
+		return "the DBPF index extends past the end of the file, the file may be truncated";
+	case Result::ReadError:
+	default:
+		return "the file header could not be read";
+	}
+}
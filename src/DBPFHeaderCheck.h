@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Performs a quick validity check of a DBPF file's header.
+// This allows the directory scan to skip files that the game would fail to open,
+// e.g. README files without an extension, empty files or truncated downloads.
+namespace DBPFHeaderCheck
+{
+	enum class Result
+	{
+		Valid = 0,
+		EmptyFile,
+		FileTooSmall,
+		MissingSignature,
+		IndexOutOfRange,
+		ReadError
+	};
+
+	// Checks the header of the specified file.
+	// The file size is passed in because the directory scan already knows it.
+	Result CheckFile(const std::wstring& path, uint64_t fileSize);
+
+	const char* GetResultDescription(Result result);
+}
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "DBPFHeader.h"
+#include <cstdint>
+#include <cstring>
+
+// Reads the index entries of a DBPF 1.x file, the index and the location of each
+// record are checked against the file size.
+// The reader is used by the plugin and the tools, so it only depends on the header.
+class DBPFIndexReader
+{
+public:
+
+	struct Entry
+	{
+		uint32_t type;
+		uint32_t group;
+		uint32_t instance;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	// Returns true if the header is a DBPF 1.x header with an index that is
+	// inside a file of the specified size.
+	static bool IsValidHeader(const DBPFHeader& header, uint64_t fileSize)
+	{
+		if (header.signature != DBPFHeader::Signature
+			|| header.majorVersion != 1
+			|| fileSize < DBPFHeader::Size)
+		{
+			return false;
+		}
+
+		const uint64_t indexSize = static_cast<uint64_t>(header.indexEntryCount) * GetEntrySize(header);
+
+		// The DBPF sizes are 32-bit values.
+		return indexSize <= UINT32_MAX
+			&& header.indexOffset <= fileSize
+			&& indexSize <= fileSize - header.indexOffset;
+	}
+
+	// Gets the size of each index entry, index minor version 2 adds a second instance ID.
+	static uint32_t GetEntrySize(const DBPFHeader& header)
+	{
+		return (header.indexMinorVersion == 2 ? 6 : 5) * sizeof(uint32_t);
+	}
+
+	// Gets the size of the index in bytes.
+	// The header must have been checked with IsValidHeader.
+	static uint32_t GetIndexSize(const DBPFHeader& header)
+	{
+		return header.indexEntryCount * GetEntrySize(header);
+	}
+
+	// The index data must be GetIndexSize bytes, and remain valid for the lifetime of the reader.
+	DBPFIndexReader(const DBPFHeader& header, const void* indexData, uint64_t fileSize)
+		: indexData(static_cast<const uint8_t*>(indexData)),
+		  fileSize(fileSize),
+		  entryCount(header.indexEntryCount),
+		  entrySize(GetEntrySize(header))
+	{
+	}
+
+	uint32_t GetEntryCount() const
+	{
+		return entryCount;
+	}
+
+	// Reads the specified index entry.
+	// Returns false if the record is not inside the file.
+	bool TryGetEntry(uint32_t index, Entry& entry) const
+	{
+		const uint8_t* const data = indexData + (static_cast<size_t>(index) * entrySize);
+
+		std::memcpy(&entry.type, data, sizeof(uint32_t));
+		std::memcpy(&entry.group, data + 4, sizeof(uint32_t));
+		std::memcpy(&entry.instance, data + 8, sizeof(uint32_t));
+		// The location is the last two values of the entry.
+		std::memcpy(&entry.offset, data + entrySize - 8, sizeof(uint32_t));
+		std::memcpy(&entry.size, data + entrySize - 4, sizeof(uint32_t));
+
+		return entry.offset <= fileSize && entry.size <= fileSize - entry.offset;
+	}
+
+private:
+
+	const uint8_t* const indexData;
+	const uint64_t fileSize;
+	const uint32_t entryCount;
+	const uint32_t entrySize;
+};
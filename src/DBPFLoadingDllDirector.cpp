@@ -12,13 +12,27 @@
 
 #include "version.h"
 #include "cRZFileHooks.h"
+#include "CityAccessHistory.h"
 #include "DebugUtil.h"
+#include "GlobalKeyIndex.h"
+#include "IndexedResourceKeyList.h"
 #include "Logger.h"
 #include "LooseSC4PluginScanPatch.h"
 #include "DatMultiPackedFile.h"
+#include "LoadCostReport.h"
+#include "MemoryDBSegment.h"
+#include "NegativeLookupFilter.h"
 #include "Patcher.h"
+#include "RegionPrefetcher.h"
+#include "PluginPackMultiPackedFile.h"
 #include "SC4PluginMultiPackedFile.h"
+#include "ResourceAccessTrace.h"
+#include "ScanExclusionRules.h"
+#include "SegmentOpenCostHistory.h"
 #include "SC4VersionDetection.h"
+#include "ScopedTimer.h"
+#include "Settings.h"
+#include "StartupTrace.h"
 #include "Stopwatch.h"
 #include "StringViewUtil.h"
 #include "cIGZApp.h"
@@ -27,14 +41,16 @@
 #include "cIGZCOM.h"
 #include "cIGZDBSegmentPackedFile.h"
 #include "cIGZFrameWork.h"
+#include "cIGZMessage2Standard.h"
 #include "cIGZPersistDBSegment.h"
 #include "cIGZPersistDBSegmentMultiPackedFiles.h"
 #include "cIGZPersistResourceKeyFilter.h"
 #include "cIGZPersistResourceKeyList.h"
+#include "cIGZMessageServer2.h"
 #include "cIGZPersistResourceManager.h"
 #include "cRZAutoRefCount.h"
 #include "cRZBaseString.h"
-#include "cRZCOMDllDirector.h"
+#include "cRZMessage2COMDirector.h"
 #include "cISC4App.h"
 #include "GZServPtrs.h"
 #include "SC4Preferences.h"
@@ -51,7 +67,21 @@
 
 static constexpr uint32_t kDBPFLoadingDirectorID = 0x87A74BF8;
 
+static constexpr uint32_t kMessageCheatIssued = 0x230E27AC;
+static constexpr uint32_t kRecordAccessStatisticsCheatID = 0x4A1C7E35;
+
+static constexpr uint32_t kSC4MessagePreCityInit = 0x26D31EC0;
+static constexpr uint32_t kSC4MessagePostCityInit = 0x26D31EC1;
+static constexpr uint32_t kSC4MessagePostCityShutdown = 0x26D31EC3;
+
 static constexpr std::string_view PluginLogFileName = "SC4DBPFLoading.log";
+static constexpr std::string_view PluginSettingsFileName = "SC4DBPFLoading.ini";
+static constexpr std::string_view PluginExclusionRulesFileName = "SC4DBPFLoadingExclusions.txt";
+static constexpr std::string_view PluginOpenCostHistoryFileName = "SC4DBPFLoadingOpenCosts.txt";
+static constexpr std::string_view PluginStartupTraceFileName = "SC4DBPFLoadingTrace.json";
+static constexpr std::string_view PluginLoadCostReportFileName = "SC4DBPFLoadingLoadCosts.csv";
+static constexpr std::string_view PluginResourceAccessTraceFileName = "SC4DBPFLoadingAccessTrace.bin";
+static constexpr std::string_view PluginCityAccessHistoryFolderName = "SC4DBPFLoadingCityHistory";
 
 using namespace std::literals::string_view_literals;
 
@@ -195,6 +225,10 @@ namespace
 		WindowsAPILogWait,
 		// Writes a list of the loaded fies to the plugin's log file.
 		ListLoadedFiles,
+		// Writes a timeline of the resource loading to a file in the Chrome trace event format.
+		ChromeTrace,
+		// Writes the cost of loading each DBPF file to the plugin's log file and a CSV file.
+		LoadCostReport,
 	};
 
 	static ResourceLoadingTraceOption resourceLoadingTraceOption = ResourceLoadingTraceOption::None;
@@ -232,6 +266,41 @@ namespace
 		return result;
 	}
 
+	bool ChromeTraceSetupResources(void* pSC4App)
+	{
+		bool result = false;
+
+		{
+			StartupTrace::Span span("cSC4App::SetupResources");
+
+			result = RealSetupResources(pSC4App);
+		}
+
+		std::filesystem::path traceFilePath = GetDllFolderPath();
+		traceFilePath /= PluginStartupTraceFileName;
+
+		Logger& logger = Logger::GetInstance();
+
+		try
+		{
+			StartupTrace::GetInstance().WriteFile(traceFilePath);
+
+			logger.WriteLineFormatted(
+				LogLevel::Info,
+				"Wrote the resource loading trace to %s.",
+				traceFilePath.string().c_str());
+		}
+		catch (const std::exception& e)
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Error,
+				"Failed to write the resource loading trace: %s",
+				e.what());
+		}
+
+		return result;
+	}
+
 	bool __fastcall HookedSetupResources(void* pSC4App, void* edxUnused)
 	{
 		bool result = false;
@@ -244,8 +313,12 @@ namespace
 		case ResourceLoadingTraceOption::WindowsAPILogWait:
 			result = WindowsAPILogSetupResources(pSC4App);
 			break;
+		case ResourceLoadingTraceOption::ChromeTrace:
+			result = ChromeTraceSetupResources(pSC4App);
+			break;
 		case ResourceLoadingTraceOption::None:
 		case ResourceLoadingTraceOption::ListLoadedFiles:
+		case ResourceLoadingTraceOption::LoadCostReport:
 		default:
 			result = RealSetupResources(pSC4App);
 			break;
@@ -293,6 +366,7 @@ namespace
 			{
 			case ResourceLoadingTraceOption::ShowLoadTime:
 			case ResourceLoadingTraceOption::WindowsAPILogWait:
+			case ResourceLoadingTraceOption::ChromeTrace:
 				InstallSC4AppSetupResourcesHook(gameVersion);
 				break;
 			}
@@ -307,8 +381,31 @@ namespace
 		}
 	}
 
+	void CalibrateKeyListIndexThreshold()
+	{
+		// The threshold is measured on the player's machine with the hash map that the
+		// plugin uses, before the first plugin folder is loaded.
+		Stopwatch stopwatch;
+		stopwatch.Start();
+
+		const size_t threshold = IndexedResourceKeyList::CalibrateIndexThreshold();
+
+		stopwatch.Stop();
+
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"Resource key lists with more than %zu keys use a hash index, the threshold was measured in %lld ms.",
+			threshold,
+			stopwatch.ElapsedMilliseconds());
+	}
+
 	cIGZUnknown* CreateDatMultiPackedFile()
 	{
+		if (Settings::GetInstance().PluginPacks())
+		{
+			return static_cast<cIGZPersistDBSegment*>(new PluginPackMultiPackedFile());
+		}
+
 		return static_cast<cIGZPersistDBSegment*>(new DatMultiPackedFile());
 	}
 
@@ -318,7 +415,7 @@ namespace
 	}
 }
 
-class DBPFLoadingDllDirector : public cRZCOMDllDirector
+class DBPFLoadingDllDirector : public cRZMessage2COMDirector
 {
 public:
 
@@ -335,6 +432,92 @@ public:
 		Logger& logger = Logger::GetInstance();
 		logger.Init(logFilePath, LogLevel::Error);
 		logger.WriteLogFileHeader("SC4DBPFLoading v" PLUGIN_VERSION_STR);
+
+		std::filesystem::path settingsFilePath = dllFolderPath;
+		settingsFilePath /= PluginSettingsFileName;
+
+		try
+		{
+			Settings::GetInstance().Load(settingsFilePath);
+		}
+		catch (const std::exception& e)
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Error,
+				"Error reading the settings file: %s",
+				e.what());
+		}
+
+		if (Settings::GetInstance().AsyncLogging())
+		{
+			logger.StartAsyncWriter();
+		}
+
+		std::filesystem::path exclusionRulesFilePath = dllFolderPath;
+		exclusionRulesFilePath /= PluginExclusionRulesFileName;
+
+		try
+		{
+			ScanExclusionRules::GetInstance().Load(exclusionRulesFilePath);
+		}
+		catch (const std::exception& e)
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Error,
+				"Error reading the exclusion rules file: %s",
+				e.what());
+		}
+
+		if (Settings::GetInstance().ResourceAccessTrace())
+		{
+			std::filesystem::path accessTraceFilePath = dllFolderPath;
+			accessTraceFilePath /= PluginResourceAccessTraceFileName;
+
+			try
+			{
+				ResourceAccessTrace::GetInstance().Start(accessTraceFilePath);
+			}
+			catch (const std::exception& e)
+			{
+				logger.WriteLineFormatted(
+					LogLevel::Error,
+					"Error starting the resource access trace: %s",
+					e.what());
+			}
+		}
+
+		if (Settings::GetInstance().CityAccessHistory() || Settings::GetInstance().CityRecordPrewarming())
+		{
+			std::filesystem::path cityAccessHistoryFolderPath = dllFolderPath;
+			cityAccessHistoryFolderPath /= PluginCityAccessHistoryFolderName;
+
+			CityAccessHistory::GetInstance().Enable(
+				cityAccessHistoryFolderPath,
+				Settings::GetInstance().CityRecordPrewarming());
+		}
+
+		if (Settings::GetInstance().RegionCityFilePrefetch())
+		{
+			RegionPrefetcher::GetInstance().Enable();
+		}
+
+		if (Settings::GetInstance().ParallelSegmentOpenThreads() > 1)
+		{
+			std::filesystem::path openCostHistoryFilePath = dllFolderPath;
+			openCostHistoryFilePath /= PluginOpenCostHistoryFileName;
+
+			try
+			{
+				SegmentOpenCostHistory::GetInstance().Load(openCostHistoryFilePath);
+			}
+			catch (const std::exception& e)
+			{
+				logger.WriteLineFormatted(
+					LogLevel::Error,
+					"Error reading the file open times: %s",
+					e.what());
+			}
+		}
 	}
 
 private:
@@ -386,15 +569,49 @@ private:
 			{
 				resourceLoadingTraceOption = ResourceLoadingTraceOption::ListLoadedFiles;
 			}
+			else if (StringViewUtil::EqualsIgnoreCase(valueAsStringView, "ChromeTrace"sv))
+			{
+				resourceLoadingTraceOption = ResourceLoadingTraceOption::ChromeTrace;
+				StartupTrace::GetInstance().Enable();
+			}
+			else if (StringViewUtil::EqualsIgnoreCase(valueAsStringView, "LoadCostReport"sv))
+			{
+				resourceLoadingTraceOption = ResourceLoadingTraceOption::LoadCostReport;
+
+				std::filesystem::path csvFilePath = GetDllFolderPath();
+				csvFilePath /= PluginLoadCostReportFileName;
+
+				LoadCostReport::GetInstance().Enable(csvFilePath);
+			}
 		}
 
 		InstallMemoryPatches();
+		CalibrateKeyListIndexThreshold();
+
+		// The asynchronous logger and the resource access trace are stopped in PostAppShutdown,
+		// this ensures that all of the pending data is written to their files.
+		// The record access statistics cheat code is registered in PostAppInit.
+		const Settings& settings = Settings::GetInstance();
+		bool addFrameworkHook = settings.AsyncLogging()
+			|| settings.RecordAccessStatistics()
+			|| settings.ResourceAccessTrace()
+			|| settings.NegativeLookupFilter()
+			|| settings.GlobalKeyIndex()
+			|| CityAccessHistory::GetInstance().IsEnabled()
+			|| RegionPrefetcher::GetInstance().IsEnabled()
+			|| settings.SmallFileMemoryThreshold() > 0
+			|| settings.CombineSC4PluginFolders();
+
+#ifdef SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
+		// The scoped timer summary is written in PostAppShutdown.
+		addFrameworkHook = true;
+#endif // SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
 
 		if (resourceLoadingTraceOption == ResourceLoadingTraceOption::ListLoadedFiles)
 		{
 			if (pFramework->GetState() < cIGZFrameWork::kStatePreAppInit)
 			{
-				pFramework->AddHook(this);
+				addFrameworkHook = true;
 			}
 			else
 			{
@@ -402,11 +619,118 @@ private:
 			}
 		}
 
+		if (addFrameworkHook)
+		{
+			pFramework->AddHook(this);
+		}
+
+		return true;
+	}
+
+	bool PostAppShutdown()
+	{
+		SCOPED_TIMER_WRITE_SUMMARY();
+		CityAccessHistory::GetInstance().Shutdown();
+		RegionPrefetcher::GetInstance().Shutdown();
+		ResourceAccessTrace::GetInstance().Stop();
+		Logger::GetInstance().Shutdown();
+		return true;
+	}
+
+	bool DoMessage(cIGZMessage2* pMsg)
+	{
+		switch (pMsg->GetType())
+		{
+		case kMessageCheatIssued:
+		{
+			cIGZMessage2Standard* pStandardMsg = static_cast<cIGZMessage2Standard*>(pMsg);
+
+			if (pStandardMsg->GetData1() == kRecordAccessStatisticsCheatID)
+			{
+				BaseMultiPackedFile::WriteAllRecordAccessStatistics();
+			}
+			break;
+		}
+		case kSC4MessagePreCityInit:
+			RegionPrefetcher::GetInstance().CityOpened();
+			NegativeLookupFilter::StartCityLoadStatistics();
+			GlobalKeyIndex::GetInstance().StartCityLoad();
+			CityAccessHistory::GetInstance().StartCityLoad();
+			break;
+		case kSC4MessagePostCityInit:
+			CityAccessHistory::GetInstance().EndCityLoad();
+			NegativeLookupFilter::WriteCityLoadStatistics();
+			GlobalKeyIndex::GetInstance().WriteCityLoadStatistics();
+			MemoryDBSegment::WriteStatistics();
+			break;
+		case kSC4MessagePostCityShutdown:
+			RegionPrefetcher::GetInstance().CityClosed();
+			break;
+		}
+
 		return true;
 	}
 
+	void RegisterCityLoadNotifications()
+	{
+		cIGZMessageServer2Ptr pMsgServ;
+
+		if (pMsgServ)
+		{
+			// The negative lookup filter results and the city record history are
+			// updated for each city load, and the region prefetching is paused while
+			// a city is open. The memory-backed file statistics are logged after each
+			// city load.
+			pMsgServ->AddNotification(this, kSC4MessagePreCityInit);
+			pMsgServ->AddNotification(this, kSC4MessagePostCityInit);
+			pMsgServ->AddNotification(this, kSC4MessagePostCityShutdown);
+		}
+	}
+
+	void RegisterRecordAccessStatisticsCheatCode()
+	{
+		cISC4AppPtr pSC4App;
+
+		if (pSC4App)
+		{
+			cIGZCheatCodeManager* pCheatMgr = pSC4App->GetCheatCodeManager();
+
+			if (pCheatMgr)
+			{
+				pCheatMgr->AddNotification2(this, 0);
+				pCheatMgr->RegisterCheatCode(kRecordAccessStatisticsCheatID, cRZBaseString("DBPFStats"));
+			}
+		}
+	}
+
 	bool PostAppInit()
 	{
+		if (Settings::GetInstance().CombineSC4PluginFolders())
+		{
+			LooseSC4PluginScanPatch::LoadPendingInstallationPlugins();
+		}
+
+		// The index is built after all of the plugin folders have been registered, the
+		// folders that are loaded later add their keys when they are opened.
+		if (Settings::GetInstance().GlobalKeyIndex())
+		{
+			BaseMultiPackedFile::BuildGlobalKeyIndex();
+		}
+
+		if (Settings::GetInstance().RecordAccessStatistics())
+		{
+			RegisterRecordAccessStatisticsCheatCode();
+		}
+
+		if (Settings::GetInstance().NegativeLookupFilter()
+			|| Settings::GetInstance().GlobalKeyIndex()
+			|| CityAccessHistory::GetInstance().IsEnabled()
+			|| RegionPrefetcher::GetInstance().IsEnabled()
+			|| Settings::GetInstance().SmallFileMemoryThreshold() > 0)
+		{
+			RegisterCityLoadNotifications();
+		}
+
 		if (resourceLoadingTraceOption == ResourceLoadingTraceOption::ListLoadedFiles)
 		{
 			cIGZPersistResourceManagerPtr pResMan;
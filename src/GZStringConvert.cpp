@@ -11,8 +11,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "GZStringConvert.h"
+#include "AsciiConvert.h"
+#include <climits>
 #include <Windows.h>
 
+// The ASCII conversion uses char16_t, which has the same representation as wchar_t on Windows.
+static_assert(sizeof(wchar_t) == sizeof(char16_t));
+
 namespace
 {
 	void ThrowExceptionForWin32Error(const char* win32MethodName, DWORD error)
@@ -39,39 +44,54 @@ cRZBaseString GZStringConvert::FromUtf16(const std::wstring& str)
 
 	if (utf16Length > 0)
 	{
-		const int utf8Length = WideCharToMultiByte(
-			CP_UTF8,
-			0,
-			utf16Chars,
-			utf16Length,
-			nullptr,
-			0,
-			nullptr,
-			nullptr);
-
-		if (utf8Length == 0)
+		// A UTF-16 code unit produces at most 3 UTF-8 bytes, a surrogate pair
+		// uses 2 code units and produces 4 bytes.
+		// Allocating the worst case up front allows the conversion to be done
+		// in a single pass instead of querying the output size first.
+		const size_t maxUtf8Length = static_cast<size_t>(utf16Length) * 3;
+
+		if (maxUtf8Length > static_cast<size_t>(INT_MAX))
 		{
-			DWORD lastError = GetLastError();
-			ThrowExceptionForWin32Error("WideCharToMultiByte", lastError);
+			ThrowExceptionForWin32Error("WideCharToMultiByte", ERROR_INSUFFICIENT_BUFFER);
 		}
 
-		result.Resize(static_cast<uint32_t>(utf8Length));
+		result.Resize(static_cast<uint32_t>(maxUtf8Length));
 
-		const int convertResult = WideCharToMultiByte(
-			CP_UTF8,
-			0,
-			utf16Chars,
-			utf16Length,
-			result.Data(),
-			utf8Length,
-			nullptr,
-			nullptr);
-
-		if (convertResult == 0)
+		char* const utf8Chars = result.Data();
+
+		// Most plugin paths are pure ASCII, those are converted without calling
+		// into the OS.
+		const size_t asciiLength = AsciiConvert::NarrowPrefix(
+			reinterpret_cast<const char16_t*>(utf16Chars),
+			static_cast<size_t>(utf16Length),
+			utf8Chars);
+		size_t utf8Length = asciiLength;
+
+		if (asciiLength < static_cast<size_t>(utf16Length))
 		{
-			DWORD lastError = GetLastError();
-			ThrowExceptionForWin32Error("WideCharToMultiByte", lastError);
+			// The remaining text starts on a code point boundary because an ASCII
+			// code unit is never part of a surrogate pair, so the OS handles any
+			// unpaired surrogates exactly as it would for the whole string.
+			const int convertResult = WideCharToMultiByte(
+				CP_UTF8,
+				0,
+				utf16Chars + asciiLength,
+				utf16Length - static_cast<int>(asciiLength),
+				utf8Chars + asciiLength,
+				static_cast<int>(maxUtf8Length - asciiLength),
+				nullptr,
+				nullptr);
+
+			if (convertResult == 0)
+			{
+				DWORD lastError = GetLastError();
+				ThrowExceptionForWin32Error("WideCharToMultiByte", lastError);
+			}
+
+			utf8Length += static_cast<size_t>(convertResult);
 		}
+
+		result.Resize(static_cast<uint32_t>(utf8Length));
 	}
 
 	return result;
@@ -91,35 +111,46 @@ std::wstring GZStringConvert::ToUtf16(const cIGZString& str)
 
 	if (utf8Length > 0)
 	{
-		const int utf16Length = MultiByteToWideChar(
-			CP_UTF8,
-			0,
+		// A UTF-8 sequence never produces more UTF-16 code units than it has bytes,
+		// this is also true for invalid sequences because each one is replaced with
+		// a single U+FFFD character.
+		// Allocating the worst case up front allows the conversion to be done
+		// in a single pass instead of querying the output size first.
+		result.resize(static_cast<size_t>(utf8Length));
+
+		wchar_t* const utf16Chars = result.data();
+
+		// Most plugin paths are pure ASCII, those are converted without calling
+		// into the OS.
+		const size_t asciiLength = AsciiConvert::WidenPrefix(
 			utf8Chars,
-			utf8Length,
-			nullptr,
-			0);
+			static_cast<size_t>(utf8Length),
+			reinterpret_cast<char16_t*>(utf16Chars));
+		size_t utf16Length = asciiLength;
 
-		if (utf16Length == 0)
+		if (asciiLength < static_cast<size_t>(utf8Length))
 		{
-			DWORD lastError = GetLastError();
-			ThrowExceptionForWin32Error("MultiByteToWideChar", lastError);
+			// The remaining text starts on a code point boundary because an ASCII
+			// byte is never part of a multi-byte sequence, so the OS handles any
+			// invalid sequences exactly as it would for the whole string.
+			const int convertResult = MultiByteToWideChar(
+				CP_UTF8,
+				0,
+				utf8Chars + asciiLength,
+				utf8Length - static_cast<int>(asciiLength),
+				utf16Chars + asciiLength,
+				utf8Length - static_cast<int>(asciiLength));
+
+			if (convertResult == 0)
+			{
+				DWORD lastError = GetLastError();
+				ThrowExceptionForWin32Error("MultiByteToWideChar", lastError);
+			}
+
+			utf16Length += static_cast<size_t>(convertResult);
 		}
 
-		result.resize(static_cast<size_t>(utf16Length), L'\0');
-
-		const int convertResult = MultiByteToWideChar(
-			CP_UTF8,
-			0,
-			utf8Chars,
-			utf8Length,
-			result.data(),
-			utf16Length);
-
-		if (convertResult == 0)
-		{
-			DWORD lastError = GetLastError();
-			ThrowExceptionForWin32Error("MultiByteToWideChar", lastError);
-		}
+		result.resize(utf16Length);
 	}
 
 	return result;
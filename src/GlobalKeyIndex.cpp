@@ -0,0 +1,211 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "GlobalKeyIndex.h"
+#include "Logger.h"
+#include "MissingKeySamples.h"
+#include "Stopwatch.h"
+#include <vector>
+
+namespace
+{
+	// The last key that the thread looked up, the resource manager asks each registered
+	// plugin folder for the same key in turn.
+	struct CachedLookup
+	{
+		cGZPersistResourceKey key;
+		uint32_t generation = 0;
+		uint32_t owner = GlobalKeyIndex::NoFile;
+	};
+
+	thread_local CachedLookup cachedLookup;
+}
+
+GlobalKeyIndex& GlobalKeyIndex::GetInstance()
+{
+	static GlobalKeyIndex instance;
+
+	return instance;
+}
+
+GlobalKeyIndex::GlobalKeyIndex()
+	: mutex(),
+	  index(),
+	  generation(1),
+	  nextPriority(1),
+	  enabled(false),
+	  lookupCount(0),
+	  answeredCount(0),
+	  cityLoadStartLookupCount(0),
+	  cityLoadStartAnsweredCount(0),
+	  fileLookupNanoseconds(0),
+	  indexLookupNanoseconds(0)
+{
+}
+
+uint32_t GlobalKeyIndex::AllocatePriority()
+{
+	return nextPriority.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool GlobalKeyIndex::IsEnabled() const
+{
+	return enabled.load(std::memory_order_acquire);
+}
+
+void GlobalKeyIndex::Enable(double fileLookupNanoseconds)
+{
+	this->fileLookupNanoseconds = fileLookupNanoseconds;
+
+	MeasureLookupCost();
+
+	enabled.store(true, std::memory_order_release);
+
+	std::shared_lock<std::shared_mutex> lock(mutex);
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Global key index: %zu keys in %u plugin folders, %zu KB, %.1f ns per index lookup, %.1f ns per folder lookup.",
+		index.size(),
+		nextPriority.load(std::memory_order_relaxed) - 1,
+		(index.bucket_count() * (sizeof(cGZPersistResourceKey) + sizeof(uint32_t))) / 1024,
+		indexLookupNanoseconds,
+		fileLookupNanoseconds);
+}
+
+void GlobalKeyIndex::AddKey(const cGZPersistResourceKey& key, uint32_t priority)
+{
+	std::unique_lock<std::shared_mutex> lock(mutex);
+
+	AddLocked(key, priority);
+
+	generation.fetch_add(1, std::memory_order_release);
+}
+
+void GlobalKeyIndex::RemoveKey(const cGZPersistResourceKey& key, uint32_t priority)
+{
+	std::unique_lock<std::shared_mutex> lock(mutex);
+
+	const auto item = index.find(key);
+
+	// The index does not know if a lower priority file also has the key, so the
+	// files search their own indexes for it.
+	if (item != index.end() && item->second == priority)
+	{
+		item->second = UnknownFile;
+
+		generation.fetch_add(1, std::memory_order_release);
+	}
+}
+
+bool GlobalKeyIndex::MayContain(const cGZPersistResourceKey& key, uint32_t priority)
+{
+	if (!enabled.load(std::memory_order_acquire))
+	{
+		return true;
+	}
+
+	lookupCount.fetch_add(1, std::memory_order_relaxed);
+
+	const uint32_t owner = FindOwner(key);
+
+	// A file with a higher priority than the key's owner does not have the key,
+	// otherwise it would be the owner.
+	if (owner == NoFile || (owner != UnknownFile && owner < priority))
+	{
+		answeredCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	return true;
+}
+
+void GlobalKeyIndex::StartCityLoad()
+{
+	cityLoadStartLookupCount = lookupCount.load(std::memory_order_relaxed);
+	cityLoadStartAnsweredCount = answeredCount.load(std::memory_order_relaxed);
+}
+
+void GlobalKeyIndex::WriteCityLoadStatistics() const
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	const uint64_t lookups = lookupCount.load(std::memory_order_relaxed) - cityLoadStartLookupCount;
+	const uint64_t answered = answeredCount.load(std::memory_order_relaxed) - cityLoadStartAnsweredCount;
+
+	// The lookups that the index answered skip the plugin folder's lock and index, and
+	// every lookup pays for an index check. Most checks are answered from the per-thread
+	// cache, so this underestimates the time saved.
+	const double savedMilliseconds = (static_cast<double>(answered) * fileLookupNanoseconds
+		- static_cast<double>(lookups) * indexLookupNanoseconds) / 1e6;
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"City load: %llu plugin folder lookups checked the global key index, %llu (%.1f%%) were answered by it, about %.1f ms saved.",
+		lookups,
+		answered,
+		lookups > 0 ? 100.0 * static_cast<double>(answered) / static_cast<double>(lookups) : 0.0,
+		savedMilliseconds);
+}
+
+void GlobalKeyIndex::AddLocked(const cGZPersistResourceKey& key, uint32_t priority)
+{
+	const auto result = index.try_emplace(key, priority);
+
+	if (!result.second && result.first->second != UnknownFile && result.first->second < priority)
+	{
+		result.first->second = priority;
+	}
+}
+
+uint32_t GlobalKeyIndex::FindOwner(const cGZPersistResourceKey& key) const
+{
+	if (cachedLookup.generation == generation.load(std::memory_order_acquire) && cachedLookup.key == key)
+	{
+		return cachedLookup.owner;
+	}
+
+	std::shared_lock<std::shared_mutex> lock(mutex);
+
+	const auto item = index.find(key);
+	const uint32_t owner = item != index.end() ? item->second : NoFile;
+
+	// The generation is read under the lock, so it matches the index contents.
+	cachedLookup.key = key;
+	cachedLookup.generation = generation.load(std::memory_order_relaxed);
+	cachedLookup.owner = owner;
+
+	return owner;
+}
+
+void GlobalKeyIndex::MeasureLookupCost()
+{
+	constexpr uint32_t SampleKeyCount = 4096;
+
+	const std::vector<cGZPersistResourceKey> sampleKeys = MissingKeySamples::Create(SampleKeyCount);
+
+	const int64_t start = Stopwatch::GetTimestamp();
+
+	for (const cGZPersistResourceKey& key : sampleKeys)
+	{
+		FindOwner(key);
+	}
+
+	const int64_t end = Stopwatch::GetTimestamp();
+
+	const double nanosecondsPerTick = 1e9 / static_cast<double>(Stopwatch::GetFrequency());
+
+	indexLookupNanoseconds = static_cast<double>(end - start) * nanosecondsPerTick / SampleKeyCount;
+}
@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyHashers.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+
+// An index of the keys in every multi-packed file that the plugin has registered with the
+// resource manager, it maps each key to the highest priority file that contains it.
+//
+// The resource manager asks each registered segment for a key until one of them has it, and
+// the newest segment is asked first because it adds new segments to the start of its list.
+// Each file gets a priority when it is opened, with the later files having the higher
+// priorities. BaseMultiPackedFile::BuildGlobalKeyIndex checks that the registered files are
+// in this order before it enables the index. A file can answer that it does not have a key
+// without searching its own index when no file has the key, or when the key's owner has
+// a lower priority than the file.
+// The index answers the consecutive requests for the same key from a per-thread cache,
+// so the resource manager's walk over the plugin folders costs one index lookup.
+class GlobalKeyIndex
+{
+public:
+	// The priority of a file that does not use the index.
+	static constexpr uint32_t NoFile = 0;
+	// The owner of a key that was removed from the file with the highest priority,
+	// every file searches its own index for these keys.
+	static constexpr uint32_t UnknownFile = UINT32_MAX;
+
+	static GlobalKeyIndex& GetInstance();
+
+	// Returns the priority of a file that is about to be registered with the resource manager.
+	uint32_t AllocatePriority();
+
+	bool IsEnabled() const;
+
+	// Adds the keys of a file, the callback is called with a function that adds one key.
+	// This must be called before Enable, or for a file that was opened after it.
+	template<typename TForEachKey> void AddFile(uint32_t priority, size_t keyCount, TForEachKey&& forEachKey)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+
+		index.reserve(index.size() + keyCount);
+
+		forEachKey([this, priority](const cGZPersistResourceKey& key) { AddLocked(key, priority); });
+
+		generation.fetch_add(1, std::memory_order_release);
+	}
+
+	// Starts answering the lookups, fileLookupNanoseconds is the measured cost of a
+	// multi-packed file lookup for a missing key. It is used to estimate the time saved.
+	void Enable(double fileLookupNanoseconds);
+
+	// Updates the owner of a key that the game added to a file.
+	void AddKey(const cGZPersistResourceKey& key, uint32_t priority);
+
+	// Updates the owner of a key that the game removed from a file.
+	void RemoveKey(const cGZPersistResourceKey& key, uint32_t priority);
+
+	// Returns false if the file with the specified priority does not have the key, true
+	// if the file must search its own index. This can be called from multiple threads.
+	bool MayContain(const cGZPersistResourceKey& key, uint32_t priority);
+
+	// Starts counting the lookups of a city load.
+	void StartCityLoad();
+
+	// Writes the lookup counts since StartCityLoad to the log file.
+	void WriteCityLoadStatistics() const;
+
+private:
+	GlobalKeyIndex();
+
+	void AddLocked(const cGZPersistResourceKey& key, uint32_t priority);
+
+	uint32_t FindOwner(const cGZPersistResourceKey& key) const;
+
+	void MeasureLookupCost();
+
+	mutable std::shared_mutex mutex;
+	boost::unordered::unordered_flat_map<
+		const cGZPersistResourceKey,
+		uint32_t,
+		PersistResourceKeyHashers::TgiMapHasher,
+		std::equal_to<const cGZPersistResourceKey>> index;
+	// Incremented after each change to the index, this invalidates the per-thread caches.
+	std::atomic<uint32_t> generation;
+	std::atomic<uint32_t> nextPriority;
+	std::atomic<bool> enabled;
+	std::atomic<uint64_t> lookupCount;
+	std::atomic<uint64_t> answeredCount;
+	uint64_t cityLoadStartLookupCount;
+	uint64_t cityLoadStartAnsweredCount;
+	double fileLookupNanoseconds;
+	double indexLookupNanoseconds;
+};
@@ -0,0 +1,380 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "IndexedResourceKeyList.h"
+#include "MissingKeySamples.h"
+#include "Stopwatch.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define INDEXEDRESOURCEKEYLIST_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// The number of times each list size is measured, the fastest run is used.
+	constexpr uint32_t CalibrationRunCount = 5;
+
+	std::atomic<size_t> defaultIndexThreshold = IndexedResourceKeyList::DefaultIndexThreshold;
+
+	bool KeysEqual(const cGZPersistResourceKey& lhs, const cGZPersistResourceKey& rhs)
+	{
+		return lhs.instance == rhs.instance && lhs.group == rhs.group && lhs.type == rhs.type;
+	}
+
+	// Returns the ticks of the fastest run that fills a list with the first count keys,
+	// and then looks up each of them and the same number of missing keys.
+	int64_t MeasureLookups(
+		const std::vector<cGZPersistResourceKey>& keys,
+		size_t count,
+		size_t indexThreshold)
+	{
+		// The second half of the keys are never inserted.
+		const size_t missingKeyOffset = keys.size() / 2;
+
+		int64_t fastest = INT64_MAX;
+		size_t foundCount = 0;
+
+		for (uint32_t run = 0; run < CalibrationRunCount; run++)
+		{
+			IndexedResourceKeyList list(indexThreshold);
+			list.Reserve(count);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				list.Insert(keys[i]);
+			}
+
+			const int64_t start = Stopwatch::GetTimestamp();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				foundCount += list.IsPresent(keys[i]);
+				foundCount += list.IsPresent(keys[missingKeyOffset + i]);
+			}
+
+			fastest = std::min(fastest, Stopwatch::GetTimestamp() - start);
+		}
+
+		// The found count keeps the lookups from being optimized out.
+		return foundCount > 0 ? fastest : INT64_MAX;
+	}
+}
+
+IndexedResourceKeyList::IndexedResourceKeyList()
+	: IndexedResourceKeyList(GetDefaultIndexThreshold())
+{
+}
+
+IndexedResourceKeyList::IndexedResourceKeyList(size_t indexThreshold)
+	: keys(),
+	  erased(),
+	  index(),
+	  instances(),
+	  erasedCount(0),
+	  indexed(false),
+	  hasInstanceLane(false),
+	  indexThreshold(indexThreshold)
+{
+}
+
+void IndexedResourceKeyList::Insert(const cGZPersistResourceKey& key)
+{
+	const uint32_t position = static_cast<uint32_t>(keys.size());
+
+	keys.push_back(key);
+
+	if (hasInstanceLane)
+	{
+		instances.push_back(key.instance);
+	}
+
+	if (indexed)
+	{
+		erased.push_back(false);
+
+		const auto result = index.try_emplace(key, IndexEntry{ position, 1 });
+
+		if (!result.second)
+		{
+			result.first->second.count++;
+		}
+	}
+}
+
+bool IndexedResourceKeyList::Erase(const cGZPersistResourceKey& key)
+{
+	if (!UseIndex())
+	{
+		const size_t position = FindLinear(key);
+
+		if (position == NotFound)
+		{
+			return false;
+		}
+
+		keys.erase(keys.begin() + position);
+
+		if (hasInstanceLane)
+		{
+			instances.erase(instances.begin() + position);
+		}
+
+		return true;
+	}
+
+	const auto item = index.find(key);
+
+	if (item == index.end())
+	{
+		return false;
+	}
+
+	IndexEntry& entry = item->second;
+	const uint32_t position = entry.firstPosition;
+
+	erased[position] = true;
+	erasedCount++;
+
+	if (--entry.count == 0)
+	{
+		index.erase(item);
+	}
+	else
+	{
+		// The list has duplicate keys, find the next occurrence.
+		for (uint32_t i = position + 1; i < keys.size(); i++)
+		{
+			if (!erased[i] && KeysEqual(keys[i], key))
+			{
+				entry.firstPosition = i;
+				break;
+			}
+		}
+	}
+
+	if (erasedCount > keys.size() / 2)
+	{
+		Compact();
+	}
+
+	return true;
+}
+
+void IndexedResourceKeyList::Clear()
+{
+	// The key vector keeps its capacity, so that a list that is reused for
+	// a series of segments does not have to grow it again.
+	keys.clear();
+	erased.clear();
+	index.clear();
+	instances.clear();
+	erasedCount = 0;
+	indexed = false;
+	hasInstanceLane = false;
+}
+
+void IndexedResourceKeyList::Reserve(size_t count)
+{
+	keys.reserve(count);
+}
+
+size_t IndexedResourceKeyList::GetCapacity() const
+{
+	return keys.capacity();
+}
+
+bool IndexedResourceKeyList::IsPresent(const cGZPersistResourceKey& key) const
+{
+	if (UseIndex())
+	{
+		return index.contains(key);
+	}
+
+	return FindLinear(key) != NotFound;
+}
+
+size_t IndexedResourceKeyList::Size() const
+{
+	return keys.size() - erasedCount;
+}
+
+const cGZPersistResourceKey& IndexedResourceKeyList::GetKey(size_t index) const
+{
+	Compact();
+
+	return keys[index];
+}
+
+const std::vector<cGZPersistResourceKey>& IndexedResourceKeyList::GetKeys() const
+{
+	Compact();
+
+	return keys;
+}
+
+size_t IndexedResourceKeyList::GetDefaultIndexThreshold()
+{
+	return defaultIndexThreshold.load(std::memory_order_relaxed);
+}
+
+size_t IndexedResourceKeyList::CalibrateIndexThreshold()
+{
+	const std::vector<cGZPersistResourceKey> keys = MissingKeySamples::Create(MaxCalibratedIndexThreshold * 2);
+
+	size_t threshold = MaxCalibratedIndexThreshold;
+
+	for (size_t size = MinCalibratedIndexThreshold; size <= MaxCalibratedIndexThreshold; size *= 2)
+	{
+		const int64_t linearTicks = MeasureLookups(keys, size, SIZE_MAX);
+		const int64_t hashedTicks = MeasureLookups(keys, size, 0);
+
+		if (hashedTicks < linearTicks)
+		{
+			threshold = size;
+			break;
+		}
+	}
+
+	defaultIndexThreshold.store(threshold, std::memory_order_relaxed);
+
+	return threshold;
+}
+
+bool IndexedResourceKeyList::UseIndex() const
+{
+	if (!indexed && keys.size() > indexThreshold)
+	{
+		BuildIndex();
+	}
+
+	return indexed;
+}
+
+void IndexedResourceKeyList::BuildIndex() const
+{
+	index.clear();
+	index.reserve(keys.size());
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		const auto result = index.try_emplace(keys[i], IndexEntry{ static_cast<uint32_t>(i), 1 });
+
+		if (!result.second)
+		{
+			result.first->second.count++;
+		}
+	}
+
+	erased.assign(keys.size(), false);
+	indexed = true;
+
+	// The instance lane is only used by the linear search.
+	instances.clear();
+	instances.shrink_to_fit();
+	hasInstanceLane = false;
+}
+
+size_t IndexedResourceKeyList::FindLinear(const cGZPersistResourceKey& key) const
+{
+	const size_t count = keys.size();
+	size_t i = 0;
+
+#ifdef INDEXEDRESOURCEKEYLIST_USE_SSE2
+	// The scalar search is faster than building the instance lane for the smallest lists.
+	if (!hasInstanceLane && count >= MinInstanceLaneSize)
+	{
+		instances.clear();
+		instances.reserve(keys.size());
+
+		for (const cGZPersistResourceKey& entry : keys)
+		{
+			instances.push_back(entry.instance);
+		}
+
+		hasInstanceLane = true;
+	}
+
+	if (hasInstanceLane)
+	{
+		// The instance IDs are compared 8 at a time, the type and group are only checked
+		// for the keys with a matching instance ID.
+		const uint32_t* const lane = instances.data();
+		const __m128i instance = _mm_set1_epi32(static_cast<int>(key.instance));
+
+		for (; (count - i) >= 8; i += 8)
+		{
+			const __m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lane + i)), instance);
+			const __m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lane + i + 4)), instance);
+
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(lo)))
+				| (static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(hi))) << 4);
+
+			while (mask != 0)
+			{
+				const size_t position = i + std::countr_zero(mask);
+
+				if (KeysEqual(keys[position], key))
+				{
+					return position;
+				}
+
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif // INDEXEDRESOURCEKEYLIST_USE_SSE2
+
+	for (; i < count; i++)
+	{
+		if (KeysEqual(keys[i], key))
+		{
+			return i;
+		}
+	}
+
+	return NotFound;
+}
+
+void IndexedResourceKeyList::Compact() const
+{
+	if (erasedCount > 0)
+	{
+		size_t count = 0;
+
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if (!erased[i])
+			{
+				keys[count++] = keys[i];
+			}
+		}
+
+		keys.resize(count);
+		erasedCount = 0;
+
+		if (keys.size() > indexThreshold)
+		{
+			// The key positions have changed.
+			BuildIndex();
+		}
+		else
+		{
+			index.clear();
+			erased.clear();
+			indexed = false;
+		}
+	}
+}
@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyBoostHash.h"
+#include "PersistResourceKeyHash.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <stdint.h>
+#include <vector>
+
+// An insertion ordered list of resource keys that builds a hash index when it is
+// searched and has more keys than the index threshold.
+//
+// Small lists are searched with a linear scan, which is faster than hashing the key.
+// When SSE2 is available the scan of lists with at least 32 keys compares the instance IDs from a separate array,
+// the keys themselves stay in one array so GetKey and GetKeys return stable references.
+// The index is only built by IsPresent and Erase, so lists that are filled and then
+// enumerated, e.g. the segment key lists that are merged during the multi-packed file
+// Open, never pay for it.
+//
+// Erasing a key from an indexed list marks it as erased instead of moving the keys
+// that follow it. The erased keys are removed when more than half of the list has
+// been erased, or when the keys are accessed by position. The index is dropped if
+// the list is at or below the threshold after the erased keys are removed.
+//
+// The list must only be used by one thread at a time, including the const methods.
+// IsPresent, GetKey and GetKeys can build the index or remove the erased keys, so two
+// threads that call them at the same time race. A list that is shared between threads
+// must be locked by the caller.
+class IndexedResourceKeyList
+{
+public:
+	// The list size above which a hash index is used until CalibrateIndexThreshold has run.
+	// This is the crossover point that the KeyListBenchmark tool measured with
+	// std::unordered_map standing in for boost::unordered_flat_map.
+	static constexpr size_t DefaultIndexThreshold = 256;
+
+	// The range of list sizes that CalibrateIndexThreshold measures.
+	static constexpr size_t MinCalibratedIndexThreshold = 16;
+	static constexpr size_t MaxCalibratedIndexThreshold = 2048;
+
+	// Creates a list that uses the current default index threshold.
+	IndexedResourceKeyList();
+
+	explicit IndexedResourceKeyList(size_t indexThreshold);
+
+	void Insert(const cGZPersistResourceKey& key);
+
+	// Erases the first occurrence of the key.
+	bool Erase(const cGZPersistResourceKey& key);
+
+	void Clear();
+
+	void Reserve(size_t count);
+
+	size_t GetCapacity() const;
+
+	bool IsPresent(const cGZPersistResourceKey& key) const;
+
+	size_t Size() const;
+
+	const cGZPersistResourceKey& GetKey(size_t index) const;
+
+	const std::vector<cGZPersistResourceKey>& GetKeys() const;
+
+	// Gets the index threshold of the lists that are created with the default constructor.
+	static size_t GetDefaultIndexThreshold();
+
+	// Measures the smallest list size where a lookup with the hash index, including the
+	// index build, is faster than the linear search on this machine, and uses it as the
+	// default index threshold. This measures the boost::unordered_flat_map that the lists
+	// use. Returns the new threshold.
+	static size_t CalibrateIndexThreshold();
+
+	template<typename TCallback> void ForEach(TCallback&& callback) const
+	{
+		if (erasedCount == 0)
+		{
+			for (const cGZPersistResourceKey& key : keys)
+			{
+				callback(key);
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if (!erased[i])
+				{
+					callback(keys[i]);
+				}
+			}
+		}
+	}
+
+private:
+	struct IndexEntry
+	{
+		// The position of the first key occurrence that has not been erased.
+		uint32_t firstPosition;
+		uint32_t count;
+	};
+
+	static constexpr size_t NotFound = SIZE_MAX;
+	// The list size where the SSE2 instance search is faster than the scalar search,
+	// including the time to build the instance lane.
+	static constexpr size_t MinInstanceLaneSize = 32;
+
+	bool UseIndex() const;
+	size_t FindLinear(const cGZPersistResourceKey& key) const;
+	void BuildIndex() const;
+	void Compact() const;
+
+	// The index and the erased keys are updated by the const methods.
+	mutable std::vector<cGZPersistResourceKey> keys;
+	mutable std::vector<bool> erased;
+	mutable boost::unordered::unordered_flat_map<const cGZPersistResourceKey, IndexEntry> index;
+	// The instance IDs of the keys, this is built by the first linear search.
+	mutable std::vector<uint32_t> instances;
+	mutable size_t erasedCount;
+	mutable bool indexed;
+	mutable bool hasInstanceLane;
+	size_t indexThreshold;
+};
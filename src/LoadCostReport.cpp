@@ -0,0 +1,234 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "LoadCostReport.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include <algorithm>
+#include <numeric>
+#include <Windows.h>
+
+namespace
+{
+	// The number of files that are listed in each section of the summary.
+	constexpr size_t SummaryFileCount = 10;
+
+	uint64_t GetFileSize(const cIGZString& path)
+	{
+		std::wstring nativePath = GZStringConvert::ToUtf16(path);
+
+		if (PathUtil::MustAddExtendedPathPrefix(nativePath))
+		{
+			// The extended path must be normalized because the OS won't do it for us.
+			nativePath = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(nativePath));
+		}
+
+		WIN32_FILE_ATTRIBUTE_DATA data{};
+
+		if (GetFileAttributesExW(nativePath.c_str(), GetFileExInfoStandard, &data))
+		{
+			return (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		}
+
+		return 0;
+	}
+
+	template<typename TValue>
+	void WriteTopFiles(
+		const std::vector<LoadCostReport::FileCost>& files,
+		const char* const title,
+		const char* const format,
+		TValue(*getValue)(const LoadCostReport::FileCost&))
+	{
+		std::vector<size_t> indexes(files.size());
+		std::iota(indexes.begin(), indexes.end(), 0);
+
+		const size_t count = std::min(indexes.size(), SummaryFileCount);
+
+		std::partial_sort(
+			indexes.begin(),
+			indexes.begin() + count,
+			indexes.end(),
+			[&](size_t lhs, size_t rhs) { return getValue(files[lhs]) > getValue(files[rhs]); });
+
+		Logger& logger = Logger::GetInstance();
+
+		logger.WriteLine(LogLevel::Info, title);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const LoadCostReport::FileCost& file = files[indexes[i]];
+			const TValue value = getValue(file);
+
+			if (value == 0)
+			{
+				break;
+			}
+
+			logger.WriteLineFormatted(LogLevel::Info, format, value, file.path.c_str());
+		}
+	}
+
+	void WriteCsvString(std::ofstream& stream, const std::string_view& value)
+	{
+		stream << '"';
+
+		for (const char c : value)
+		{
+			if (c == '"')
+			{
+				stream << '"';
+			}
+
+			stream << c;
+		}
+
+		stream << '"';
+	}
+}
+
+LoadCostReport::FileCost::FileCost(const cIGZString& path, bool loaded, uint32_t openMicroseconds)
+	: path(path.ToChar(), path.Strlen()),
+	  fileSize(GetFileSize(path)),
+	  openMicroseconds(openMicroseconds),
+	  indexEntryCount(0),
+	  overridingKeyCount(0),
+	  shadowedKeyCount(0),
+	  loaded(loaded)
+{
+}
+
+LoadCostReport& LoadCostReport::GetInstance()
+{
+	static LoadCostReport instance;
+
+	return instance;
+}
+
+LoadCostReport::LoadCostReport()
+	: enabled(false),
+	  writeMutex(),
+	  csvFile()
+{
+}
+
+void LoadCostReport::Enable(const std::filesystem::path& csvFilePath)
+{
+	if (!enabled)
+	{
+		enabled = true;
+
+		csvFile.open(csvFilePath, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+
+		if (csvFile)
+		{
+			csvFile << "Folder,Path,Loaded,OpenMicroseconds,FileSize,IndexEntries,OverridingKeys,ShadowedKeys\r\n";
+		}
+		else
+		{
+			Logger::GetInstance().WriteLine(LogLevel::Error, "Failed to create the load cost report CSV file.");
+		}
+	}
+}
+
+bool LoadCostReport::IsEnabled() const
+{
+	return enabled;
+}
+
+void LoadCostReport::Write(const cIGZString& folderPath, const std::vector<FileCost>& files)
+{
+	if (enabled && !files.empty())
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+
+		WriteSummary(folderPath, files);
+		WriteCsvRows(folderPath, files);
+	}
+}
+
+void LoadCostReport::WriteSummary(const cIGZString& folderPath, const std::vector<FileCost>& files) const
+{
+	Logger& logger = Logger::GetInstance();
+
+	uint64_t totalOpenMicroseconds = 0;
+	uint64_t totalFileSize = 0;
+	uint32_t failedCount = 0;
+
+	for (const FileCost& file : files)
+	{
+		totalOpenMicroseconds += file.openMicroseconds;
+		totalFileSize += file.fileSize;
+
+		if (!file.loaded)
+		{
+			failedCount++;
+		}
+	}
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"Load cost report for %s: %u files (%u failed), %llu MB, %llu ms opening files.",
+		folderPath.ToChar(),
+		static_cast<uint32_t>(files.size()),
+		failedCount,
+		totalFileSize / (1024 * 1024),
+		totalOpenMicroseconds / 1000);
+
+	WriteTopFiles<uint32_t>(
+		files,
+		"Slowest files to open:",
+		"  %8u us  %s",
+		[](const FileCost& file) { return file.openMicroseconds; });
+	WriteTopFiles<uint64_t>(
+		files,
+		"Largest files:",
+		"  %8llu KB  %s",
+		[](const FileCost& file) { return file.fileSize / 1024; });
+	WriteTopFiles<uint32_t>(
+		files,
+		"Most index entries:",
+		"  %8u     %s",
+		[](const FileCost& file) { return file.indexEntryCount; });
+	WriteTopFiles<uint32_t>(
+		files,
+		"Most keys overridden by later files:",
+		"  %8u     %s",
+		[](const FileCost& file) { return file.shadowedKeyCount; });
+}
+
+void LoadCostReport::WriteCsvRows(const cIGZString& folderPath, const std::vector<FileCost>& files)
+{
+	if (!csvFile)
+	{
+		return;
+	}
+
+	const std::string_view folder(folderPath.ToChar(), folderPath.Strlen());
+
+	for (const FileCost& file : files)
+	{
+		WriteCsvString(csvFile, folder);
+		csvFile << ',';
+		WriteCsvString(csvFile, file.path);
+		csvFile << ',' << (file.loaded ? "true" : "false")
+			<< ',' << file.openMicroseconds
+			<< ',' << file.fileSize
+			<< ',' << file.indexEntryCount
+			<< ',' << file.overridingKeyCount
+			<< ',' << file.shadowedKeyCount
+			<< "\r\n";
+	}
+
+	csvFile.flush();
+}
@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZString.h"
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Reports the cost of loading each DBPF file in a plugin folder, this is used to find
+// the files that are responsible for a slow startup.
+// A summary with the slowest, largest, and most overridden files is written to the log
+// file, and the details of every file are written to a CSV file.
+class LoadCostReport
+{
+public:
+
+	struct FileCost
+	{
+		FileCost(const cIGZString& path, bool loaded, uint32_t openMicroseconds);
+
+		std::string path;
+		uint64_t fileSize;
+		uint32_t openMicroseconds;
+		uint32_t indexEntryCount;
+		// The number of keys in this file that replaced a key from an earlier file.
+		uint32_t overridingKeyCount;
+		// The number of keys in this file that were replaced by a later file.
+		uint32_t shadowedKeyCount;
+		bool loaded;
+	};
+
+	static LoadCostReport& GetInstance();
+
+	void Enable(const std::filesystem::path& csvFilePath);
+
+	bool IsEnabled() const;
+
+	void Write(const cIGZString& folderPath, const std::vector<FileCost>& files);
+
+private:
+
+	LoadCostReport();
+
+	void WriteSummary(const cIGZString& folderPath, const std::vector<FileCost>& files) const;
+
+	void WriteCsvRows(const cIGZString& folderPath, const std::vector<FileCost>& files);
+
+	bool enabled;
+	// Serializes the reports of the multi-packed files that finish their background
+	// indexing on different threads, so their summaries are not interleaved.
+	std::mutex writeMutex;
+	std::ofstream csvFile;
+};
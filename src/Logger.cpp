@@ -11,7 +11,17 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Logger.h"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#ifdef _DEBUG
 #include <Windows.h>
+#endif // _DEBUG
 
 namespace
 {
@@ -22,8 +32,267 @@ namespace
 		OutputDebugStringA("\n");
 	}
 #endif // _DEBUG
+
+	// The asynchronous writer uses a fixed buffer of 512 records with 1 KB per record.
+	// Messages that are longer than a record are truncated.
+	constexpr size_t AsyncRecordCount = 512;
+	constexpr size_t AsyncRecordTextCapacity = 1024 - sizeof(size_t) - sizeof(uint32_t);
+
+	static_assert((AsyncRecordCount & (AsyncRecordCount - 1)) == 0, "AsyncRecordCount must be a power of 2.");
+
+	constexpr std::string_view TruncatedMessageSuffix = "...";
 }
 
+// A bounded multi-producer single-consumer queue of log records, based on
+// Dmitry Vyukov's bounded MPMC queue.
+// Each record has a sequence number that tells the producers when the record
+// is free and tells the writer thread when the record has been published.
+// The producers format their message directly into the record, so no locks or
+// memory allocations are needed on the calling thread.
+class AsyncLogWriter
+{
+public:
+
+	AsyncLogWriter(std::ofstream& logFile)
+		: records(std::make_unique<Record[]>(AsyncRecordCount)),
+		  enqueuePosition(0),
+		  dequeuePosition(0),
+		  droppedCount(0),
+		  writerSignaled(false),
+		  stopRequested(false),
+		  writerThread(),
+		  logFile(logFile),
+		  batch()
+	{
+		for (size_t i = 0; i < AsyncRecordCount; i++)
+		{
+			records[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		batch.reserve(AsyncRecordCount * 128);
+
+		writerThread = std::thread(&AsyncLogWriter::WriterThreadProc, this);
+	}
+
+	~AsyncLogWriter()
+	{
+		if (writerThread.joinable())
+		{
+			// The writer thread was not stopped before the process started exiting.
+			// Windows terminates the other threads before the DLL's static destructors
+			// run, so the remaining records are written from this thread.
+			writerThread.detach();
+		}
+
+		// This also writes the records of any caller that was still publishing
+		// when the writer was stopped.
+		WritePendingRecords();
+	}
+
+	void Write(const char* const message)
+	{
+		size_t position;
+		Record* record = TryAcquireRecord(position);
+
+		if (record)
+		{
+			const size_t length = strnlen(message, AsyncRecordTextCapacity);
+
+			std::memcpy(record->text, message, length);
+			record->length = static_cast<uint32_t>(length);
+
+			if (length == AsyncRecordTextCapacity && message[length] != '\0')
+			{
+				MarkTruncated(*record);
+			}
+
+			Publish(*record, position);
+		}
+	}
+
+	void WriteFormatted(const char* const format, va_list args)
+	{
+		size_t position;
+		Record* record = TryAcquireRecord(position);
+
+		if (record)
+		{
+			const int length = std::vsnprintf(record->text, AsyncRecordTextCapacity, format, args);
+
+			if (length < 0)
+			{
+				record->length = 0;
+			}
+			else if (static_cast<size_t>(length) >= AsyncRecordTextCapacity)
+			{
+				record->length = static_cast<uint32_t>(AsyncRecordTextCapacity);
+				MarkTruncated(*record);
+			}
+			else
+			{
+				record->length = static_cast<uint32_t>(length);
+			}
+
+			Publish(*record, position);
+		}
+	}
+
+	void Stop()
+	{
+		stopRequested.store(true, std::memory_order_release);
+		writerSignaled.store(true, std::memory_order_release);
+		writerSignaled.notify_one();
+
+		writerThread.join();
+
+		// Write any records that were published after the writer thread exited.
+		WritePendingRecords();
+	}
+
+private:
+
+	struct Record
+	{
+		std::atomic<size_t> sequence;
+		uint32_t length;
+		char text[AsyncRecordTextCapacity];
+	};
+
+	Record* TryAcquireRecord(size_t& position)
+	{
+		position = enqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Record& record = records[position & (AsyncRecordCount - 1)];
+
+			const size_t sequence = record.sequence.load(std::memory_order_acquire);
+			const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (difference == 0)
+			{
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					return &record;
+				}
+			}
+			else if (difference < 0)
+			{
+				// The buffer is full.
+				droppedCount.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			else
+			{
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void Publish(Record& record, size_t position)
+	{
+		record.sequence.store(position + 1, std::memory_order_release);
+
+		// Only the first producer after the writer thread has started waiting needs to
+		// wake it, this keeps the system call out of the common case.
+		if (!writerSignaled.exchange(true, std::memory_order_acq_rel))
+		{
+			writerSignaled.notify_one();
+		}
+	}
+
+	static void MarkTruncated(Record& record)
+	{
+		std::memcpy(
+			record.text + AsyncRecordTextCapacity - TruncatedMessageSuffix.size(),
+			TruncatedMessageSuffix.data(),
+			TruncatedMessageSuffix.size());
+	}
+
+	bool TryDequeue(std::string& output)
+	{
+		Record& record = records[dequeuePosition & (AsyncRecordCount - 1)];
+
+		const size_t sequence = record.sequence.load(std::memory_order_acquire);
+
+		if (sequence != dequeuePosition + 1)
+		{
+			// The buffer is empty, or the next record is still being written.
+			return false;
+		}
+
+#ifdef _DEBUG
+		PrintLineToDebugOutput(std::string(record.text, record.length).c_str());
+#endif // _DEBUG
+
+		output.append(record.text, record.length);
+		output.push_back('\n');
+
+		record.sequence.store(dequeuePosition + AsyncRecordCount, std::memory_order_release);
+		dequeuePosition++;
+
+		return true;
+	}
+
+	void WritePendingRecords()
+	{
+		batch.clear();
+
+		while (TryDequeue(batch))
+		{
+		}
+
+		const uint32_t dropped = droppedCount.exchange(0, std::memory_order_relaxed);
+
+		if (dropped > 0)
+		{
+			char buffer[128]{};
+
+			std::snprintf(
+				buffer,
+				sizeof(buffer),
+				"Dropped %u log messages because the log buffer was full.\n",
+				dropped);
+
+			batch.append(buffer);
+		}
+
+		if (!batch.empty())
+		{
+			logFile.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+			logFile.flush();
+		}
+	}
+
+	void WriterThreadProc()
+	{
+		while (!stopRequested.load(std::memory_order_acquire))
+		{
+			// Waits until a producer or Stop sets the flag, the wait does not block if
+			// the flag was set while the previous batch was being written.
+			writerSignaled.wait(false, std::memory_order_acquire);
+
+			// Clear the flag before reading the records, so that any record published
+			// after this point wakes the writer again.
+			// This must be an exchange instead of a store, a store could be reordered after
+			// the record reads and miss a record whose producer saw the flag as still set.
+			writerSignaled.exchange(false, std::memory_order_acq_rel);
+
+			WritePendingRecords();
+		}
+	}
+
+	std::unique_ptr<Record[]> records;
+	alignas(64) std::atomic<size_t> enqueuePosition;
+	alignas(64) size_t dequeuePosition;
+	std::atomic<uint32_t> droppedCount;
+	std::atomic<bool> writerSignaled;
+	std::atomic<bool> stopRequested;
+	std::thread writerThread;
+	std::ofstream& logFile;
+	std::string batch;
+};
+
 Logger& Logger::GetInstance()
 {
 	static Logger logger;
@@ -34,12 +303,17 @@ Logger& Logger::GetInstance()
 Logger::Logger()
 	: initialized(false),
 	  logFile(),
-	  logLevel(LogLevel::Error)
+	  logLevel(LogLevel::Error),
+	  logFileMutex(),
+	  asyncWriter(),
+	  asyncWriterRunning(false)
 {
 }
 
 Logger::~Logger()
 {
+	asyncWriterRunning = false;
+	asyncWriter.reset();
 	initialized = false;
 }
 
@@ -65,6 +339,8 @@ void Logger::WriteLogFileHeader(const char* const text)
 {
 	if (initialized && logFile)
 	{
+		std::lock_guard<std::mutex> lock(logFileMutex);
+
 		logFile << text << std::endl;
 	}
 }
@@ -76,7 +352,14 @@ void Logger::WriteLine(LogLevel level, const char* const message)
 		return;
 	}
 
-	WriteLineCore(message);
+	if (asyncWriterRunning.load(std::memory_order_acquire))
+	{
+		asyncWriter->Write(message);
+	}
+	else
+	{
+		WriteLineCore(message);
+	}
 }
 
 void Logger::WriteLineFormatted(LogLevel level, const char* const format, ...)
@@ -89,40 +372,72 @@ void Logger::WriteLineFormatted(LogLevel level, const char* const format, ...)
 	va_list args;
 	va_start(args, format);
 
-	va_list argsCopy;
-	va_copy(argsCopy, args);
+	if (asyncWriterRunning.load(std::memory_order_acquire))
+	{
+		asyncWriter->WriteFormatted(format, args);
+	}
+	else
+	{
+		// Most messages fit in the stack buffer, so the string is formatted once and
+		// only formatted a second time if it is too long for the stack buffer.
+		constexpr size_t stackBufferSize = 1024;
 
-	int formattedStringLength = std::vsnprintf(nullptr, 0, format, argsCopy);
+		char buffer[stackBufferSize];
 
-	va_end(argsCopy);
+		va_list argsCopy;
+		va_copy(argsCopy, args);
 
-	if (formattedStringLength > 0)
-	{
-		size_t formattedStringLengthWithNull = static_cast<size_t>(formattedStringLength) + 1;
+		int formattedStringLength = std::vsnprintf(buffer, stackBufferSize, format, argsCopy);
 
-		constexpr size_t stackBufferSize = 1024;
+		va_end(argsCopy);
 
-		if (formattedStringLengthWithNull >= stackBufferSize)
+		if (formattedStringLength > 0)
 		{
-			std::unique_ptr<char[]> buffer = std::make_unique_for_overwrite<char[]>(formattedStringLengthWithNull);
+			size_t formattedStringLengthWithNull = static_cast<size_t>(formattedStringLength) + 1;
 
-			std::vsnprintf(buffer.get(), formattedStringLengthWithNull, format, args);
+			if (formattedStringLengthWithNull > stackBufferSize)
+			{
+				std::unique_ptr<char[]> heapBuffer = std::make_unique_for_overwrite<char[]>(formattedStringLengthWithNull);
 
-			WriteLineCore(buffer.get());
-		}
-		else
-		{
-			char buffer[stackBufferSize]{};
+				std::vsnprintf(heapBuffer.get(), formattedStringLengthWithNull, format, args);
 
-			std::vsnprintf(buffer, stackBufferSize, format, args);
-
-			WriteLineCore(buffer);
+				WriteLineCore(heapBuffer.get());
+			}
+			else
+			{
+				WriteLineCore(buffer);
+			}
 		}
 	}
 
 	va_end(args);
 }
 
+void Logger::StartAsyncWriter()
+{
+	if (initialized && logFile && !asyncWriter)
+	{
+		std::lock_guard<std::mutex> lock(logFileMutex);
+
+		asyncWriter = std::make_unique<AsyncLogWriter>(logFile);
+		asyncWriterRunning.store(true, std::memory_order_release);
+	}
+}
+
+void Logger::Shutdown()
+{
+	if (asyncWriterRunning.exchange(false, std::memory_order_acq_rel))
+	{
+		// The writer is kept until the Logger is destroyed, the plugin's worker threads
+		// may have checked asyncWriterRunning before it was cleared and still be writing
+		// a record. The later messages are written directly to the file, the mutex keeps
+		// them from being written while the writer is flushing.
+		std::lock_guard<std::mutex> lock(logFileMutex);
+
+		asyncWriter->Stop();
+	}
+}
+
 void Logger::WriteLineCore(const char* const message)
 {
 	if (initialized && logFile)
@@ -131,6 +446,8 @@ void Logger::WriteLineCore(const char* const message)
 		PrintLineToDebugOutput(message);
 #endif // _DEBUG
 
+		std::lock_guard<std::mutex> lock(logFileMutex);
+
 		logFile << message << '\n';
 	}
-}
\ No newline at end of file
+}
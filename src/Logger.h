@@ -11,8 +11,11 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #pragma once
+#include <atomic>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
 
 enum class LogLevel : int32_t
 {
@@ -22,6 +25,8 @@ enum class LogLevel : int32_t
 	Trace = 3
 };
 
+class AsyncLogWriter;
+
 class Logger
 {
 public:
@@ -38,6 +43,15 @@ public:
 
 	void WriteLineFormatted(LogLevel level, const char* const format, ...);
 
+	// Starts a background thread that writes the log messages to the file.
+	// The calling threads copy their messages into a fixed size buffer instead
+	// of waiting for the file I/O, and messages are dropped if the buffer is full.
+	void StartAsyncWriter();
+
+	// Stops the background writer thread, and writes any pending messages to the file.
+	// The messages that are written after this call are written on the calling thread.
+	void Shutdown();
+
 private:
 
 	Logger();
@@ -48,5 +62,8 @@ private:
 	bool initialized;
 	LogLevel logLevel;
 	std::ofstream logFile;
+	std::mutex logFileMutex;
+	std::unique_ptr<AsyncLogWriter> asyncWriter;
+	std::atomic<bool> asyncWriterRunning;
 };
 
@@ -14,6 +14,7 @@
 #include "SC4PluginMultiPackedFile.h"
 #include "Logger.h"
 #include "Patcher.h"
+#include "Settings.h"
 #include "cIGZCOM.h"
 #include "cIGZDBSegmentPackedFile.h"
 #include "cIGZPersistDBSegment.h"
@@ -23,19 +24,93 @@
 #include "cRZBaseString.h"
 #include "cRZCOMDllDirector.h"
 #include "GZServPtrs.h"
+#include <algorithm>
+#include <vector>
 
 namespace
 {
-	void LoadSC4FilesFromDirectory(const cIGZString& rootDir)
+	// The installation Plugins folder, when its .SC4* files are waiting to be loaded
+	// with the user Plugins folder.
+	cRZBaseString pendingInstallationPluginsDir;
+	bool hasPendingInstallationPluginsDir = false;
+	// The resource manager's segments when the installation Plugins folder was scanned, in
+	// the resource manager's order. The pointers are only compared, they are not used.
+	std::vector<cIGZPersistDBSegment*> installationPluginsSegments;
+
+	std::vector<cIGZPersistDBSegment*> GetResourceManagerSegments()
+	{
+		std::vector<cIGZPersistDBSegment*> segments;
+
+		cIGZPersistResourceManagerPtr resMan;
+
+		if (resMan)
+		{
+			const uint32_t segmentCount = resMan->GetSegmentCount();
+
+			segments.reserve(segmentCount);
+
+			for (uint32_t i = 0; i < segmentCount; i++)
+			{
+				segments.push_back(resMan->GetSegmentByIndex(i));
+			}
+		}
+
+		return segments;
+	}
+
+	void AddSegmentsRegisteredSinceInstallationPlugins(SC4PluginMultiPackedFile& multiPackedFile)
+	{
+		const std::vector<cIGZPersistDBSegment*> segments = GetResourceManagerSegments();
+
+		// The resource manager is expected to add new segments to the start of its list, which
+		// makes the segments that were registered between the two Plugins folder scans the ones
+		// before the segments from the installation Plugins folder scan. The interleaving is
+		// skipped if the list does not have that layout.
+		const size_t previousCount = installationPluginsSegments.size();
+
+		if (segments.size() < previousCount
+			|| !std::equal(installationPluginsSegments.begin(), installationPluginsSegments.end(), segments.end() - previousCount))
+		{
+			Logger::GetInstance().WriteLine(
+				LogLevel::Error,
+				"The resource manager did not add the segments that were registered after the installation Plugins"
+				" folder scan to the start of its list. The user Plugins folder .dat files may not override the"
+				" installation Plugins folder .SC4* files.");
+			return;
+		}
+
+		// The segments are added from the oldest to the newest.
+		for (size_t i = segments.size() - previousCount; i > 0; i--)
+		{
+			cIGZPersistDBSegment* segment = segments[i - 1];
+
+			if (segment)
+			{
+				multiPackedFile.AddInterleavedSegment(*segment);
+			}
+		}
+	}
+
+	void LoadSC4FilesFromDirectory(const cIGZString& rootDir, const cIGZString* pLowerPriorityRootDir)
 	{
 		bool result = false;
 
-		cRZAutoRefCount<cIGZPersistDBSegment> looseSC4MultiPackedFile(
+		cRZAutoRefCount<SC4PluginMultiPackedFile> looseSC4MultiPackedFile(
 			new SC4PluginMultiPackedFile(),
-			cRZAutoRefCount<cIGZPersistDBSegment>::kAddRef);
+			cRZAutoRefCount<SC4PluginMultiPackedFile>::kAddRef);
 
 		if (looseSC4MultiPackedFile->Init())
 		{
+			if (pLowerPriorityRootDir)
+			{
+				looseSC4MultiPackedFile->AddLowerPriorityFolder(*pLowerPriorityRootDir);
+
+				// The lower priority folder was scanned before the segments that the game registered
+				// after it, such as the user Plugins folder .dat files. Those segments must still
+				// override the lower priority folder's records.
+				AddSegmentsRegisteredSinceInstallationPlugins(*looseSC4MultiPackedFile);
+			}
+
 			if (looseSC4MultiPackedFile->SetPath(rootDir))
 			{
 				if (looseSC4MultiPackedFile->Open(true, false))
@@ -56,6 +131,43 @@ namespace
 		}
 	}
 
+	void LoadSC4FilesForInstallationPlugins(const cIGZString& rootDir)
+	{
+		if (Settings::GetInstance().CombineSC4PluginFolders())
+		{
+			// The files are loaded with the user Plugins folder, as one segment that the
+			// resource manager searches in place of the two per-folder segments.
+			pendingInstallationPluginsDir.Copy(rootDir);
+			hasPendingInstallationPluginsDir = true;
+			installationPluginsSegments = GetResourceManagerSegments();
+		}
+		else
+		{
+			LoadSC4FilesFromDirectory(rootDir, nullptr);
+		}
+	}
+
+	void LoadSC4FilesForUserPlugins(const cIGZString& rootDir)
+	{
+		if (hasPendingInstallationPluginsDir)
+		{
+			hasPendingInstallationPluginsDir = false;
+
+			Logger::GetInstance().WriteLineFormatted(
+				LogLevel::Info,
+				"Loading the .SC4* files from %s and %s as one segment.",
+				pendingInstallationPluginsDir.ToChar(),
+				rootDir.ToChar());
+
+			LoadSC4FilesFromDirectory(rootDir, &pendingInstallationPluginsDir);
+			installationPluginsSegments.clear();
+		}
+		else
+		{
+			LoadSC4FilesFromDirectory(rootDir, nullptr);
+		}
+	}
+
 	static constexpr uintptr_t SC4InstallationPluginDirectoryScan_Inject = 0x457a07;
 	static constexpr uintptr_t SC4InstallationPluginDirectoryScan_Continue = 0x457B50;
 
@@ -66,7 +178,7 @@ namespace
 			// We do not need to preserve any registers.
 			lea eax, [esp + 0x3c]
 			push eax // directory path
-			call LoadSC4FilesFromDirectory // (cdecl)
+			call LoadSC4FilesForInstallationPlugins // (cdecl)
 			add esp, 4
 			mov eax, SC4InstallationPluginDirectoryScan_Continue
 			jmp eax
@@ -83,7 +195,7 @@ namespace
 			// We do not need to preserve any registers.
 			lea eax, [esp + 0x3c]
 			push eax // directory path
-			call LoadSC4FilesFromDirectory // (cdecl)
+			call LoadSC4FilesForUserPlugins // (cdecl)
 			add esp, 4
 			mov eax, UserPluginDirectoryScan_Continue
 			jmp eax
@@ -120,3 +232,18 @@ void LooseSC4PluginScanPatch::Install()
 			e.what());
 	}
 }
+
+void LooseSC4PluginScanPatch::LoadPendingInstallationPlugins()
+{
+	if (hasPendingInstallationPluginsDir)
+	{
+		hasPendingInstallationPluginsDir = false;
+
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"The user Plugins folder scan did not run, loading the .SC4* files from %s on their own.",
+			pendingInstallationPluginsDir.ToChar());
+
+		LoadSC4FilesFromDirectory(pendingInstallationPluginsDir, nullptr);
+	}
+}
@@ -15,4 +15,9 @@
 namespace LooseSC4PluginScanPatch
 {
 	void Install();
+
+	// Loads the installation Plugins folder's .SC4* files if they are still waiting to be
+	// combined with the user Plugins folder, this is called after the game has loaded
+	// its plugins in case the user Plugins folder scan did not run.
+	void LoadPendingInstallationPlugins();
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MissingKeySamples.h"
+
+std::vector<cGZPersistResourceKey> MissingKeySamples::Create(uint32_t count)
+{
+	std::vector<cGZPersistResourceKey> sampleKeys;
+	sampleKeys.reserve(count);
+
+	uint32_t state = 0x9E3779B9;
+
+	const auto next = [&state]()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	};
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		sampleKeys.emplace_back(next(), next(), next());
+	}
+
+	return sampleKeys;
+}
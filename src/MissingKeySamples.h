@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include <cstdint>
+#include <vector>
+
+// Creates the keys that are used to measure the cost of a lookup for a key that is not in
+// an index, the negative lookup filter and the global key index use the same keys.
+namespace MissingKeySamples
+{
+	// Creates keys from a fixed seed. Each key is different, so none of the lookups are
+	// answered from a cache, and keys with random instance IDs are almost never in a
+	// plugin folder.
+	std::vector<cGZPersistResourceKey> Create(uint32_t count);
+}
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyBoostHash.h"
+#include "PersistResourceKeyHash.h"
+#include <stdint.h>
+#include <type_traits>
+
+// The candidate hash functions for cGZPersistResourceKey, the TgiHashBenchmark tool
+// compares their distribution and lookup speed.
+//
+// SC4DBPFLOADING_TGI_HASHER selects the hasher that the multi-packed file index uses:
+//
+// 0 - BoostHashCombine, the default.
+// 1 - PrimeMultiply
+// 2 - MultiplyXorShift
+// 3 - Crc32c, this requires a build that targets SSE 4.2 or AVX.
+//
+// The Boost flat map applies its own mixing step to hashers that are not marked
+// as avalanching, so MultiplyXorShift also saves that step.
+namespace PersistResourceKeyHashers
+{
+	// The boost::hash_combine hash from PersistResourceKeyBoostHash.h.
+	struct BoostHashCombine
+	{
+		size_t operator()(const cGZPersistResourceKey& key) const noexcept
+		{
+			return boost::hash<const cGZPersistResourceKey>()(key);
+		}
+	};
+
+	// The prime multiply hash from PersistResourceKeyHash.h.
+	struct PrimeMultiply
+	{
+		size_t operator()(const cGZPersistResourceKey& key) const noexcept
+		{
+			return std::hash<const cGZPersistResourceKey>()(key);
+		}
+	};
+
+	// Multiplies the 96-bit key by two odd constants and mixes the result with
+	// a xorshift-multiply finalizer.
+	struct MultiplyXorShift
+	{
+		using is_avalanching = std::true_type;
+
+		size_t operator()(const cGZPersistResourceKey& key) const noexcept
+		{
+			uint64_t hash = ((static_cast<uint64_t>(key.type) << 32) | key.group) * 0x9E3779B97F4A7C15ULL;
+			hash ^= static_cast<uint64_t>(key.instance) * 0xC2B2AE3D27D4EB4FULL;
+			hash ^= hash >> 32;
+			hash *= 0xD6E8FEB86659FD93ULL;
+			hash ^= hash >> 32;
+
+			return static_cast<size_t>(hash);
+		}
+	};
+}
+
+#if defined(__SSE4_2__) || defined(__AVX__)
+#define PERSISTRESOURCEKEYHASHERS_HAS_CRC32C
+#include <nmmintrin.h>
+
+namespace PersistResourceKeyHashers
+{
+	// The CRC32C of the key fields, using the SSE 4.2 CRC32 instruction.
+	struct Crc32c
+	{
+		size_t operator()(const cGZPersistResourceKey& key) const noexcept
+		{
+			uint32_t hash = _mm_crc32_u32(0xFFFFFFFF, key.type);
+			hash = _mm_crc32_u32(hash, key.group);
+			hash = _mm_crc32_u32(hash, key.instance);
+
+			return hash;
+		}
+	};
+}
+#endif // defined(__SSE4_2__) || defined(__AVX__)
+
+#ifndef SC4DBPFLOADING_TGI_HASHER
+#define SC4DBPFLOADING_TGI_HASHER 0
+#endif
+
+namespace PersistResourceKeyHashers
+{
+#if SC4DBPFLOADING_TGI_HASHER == 0
+	using TgiMapHasher = BoostHashCombine;
+#elif SC4DBPFLOADING_TGI_HASHER == 1
+	using TgiMapHasher = PrimeMultiply;
+#elif SC4DBPFLOADING_TGI_HASHER == 2
+	using TgiMapHasher = MultiplyXorShift;
+#elif SC4DBPFLOADING_TGI_HASHER == 3
+#ifndef PERSISTRESOURCEKEYHASHERS_HAS_CRC32C
+#error The Crc32c TGI hasher requires a build that targets SSE 4.2 or AVX.
+#endif
+	using TgiMapHasher = Crc32c;
+#else
+#error Unknown SC4DBPFLOADING_TGI_HASHER value.
+#endif
+}
@@ -22,7 +22,17 @@ PersistResourceKeyList::~PersistResourceKeyList()
 
 const PersistResourceKeyList::container& PersistResourceKeyList::GetKeys() const
 {
-	return keys;
+	return keys.GetKeys();
+}
+
+void PersistResourceKeyList::Reserve(size_t count)
+{
+	keys.Reserve(count);
+}
+
+size_t PersistResourceKeyList::GetCapacity() const
+{
+	return keys.GetCapacity();
 }
 
 bool PersistResourceKeyList::QueryInterface(uint32_t riid, void** ppvObj)
@@ -50,7 +60,7 @@ uint32_t PersistResourceKeyList::Release()
 
 bool PersistResourceKeyList::Insert(cGZPersistResourceKey const& key)
 {
-	keys.push_back(key);
+	keys.Insert(key);
 	return true;
 }
 
@@ -62,26 +72,12 @@ bool PersistResourceKeyList::Insert(cIGZPersistResourceKeyList const& list)
 
 bool PersistResourceKeyList::Erase(cGZPersistResourceKey const& key)
 {
-	bool result = false;
-
-	for (auto entry = keys.begin(); entry != keys.end(); entry++)
-	{
-		if (entry->instance == key.instance
-			&& entry->group == key.group
-			&& entry->type == key.type)
-		{
-			keys.erase(entry);
-			result = true;
-			break;
-		}
-	}
-
-	return result;
+	return keys.Erase(key);
 }
 
 bool PersistResourceKeyList::EraseAll()
 {
-	keys.clear();
+	keys.Clear();
 	return true;
 }
 
@@ -89,44 +85,28 @@ void PersistResourceKeyList::EnumKeys(EnumKeysFunctionPtr pCallback, void* pCont
 {
 	if (pCallback)
 	{
-		for (const auto& key : keys)
-		{
-			pCallback(key, pContext);
-		}
+		keys.ForEach([pCallback, pContext](const cGZPersistResourceKey& key) { pCallback(key, pContext); });
 	}
 }
 
 bool PersistResourceKeyList::IsPresent(cGZPersistResourceKey const& key) const
 {
-	bool result = false;
-
-	for (const auto& entry : keys)
-	{
-		if (entry.instance == key.instance
-			&& entry.group == key.group
-			&& entry.type == key.type)
-		{
-			result = true;
-			break;
-		}
-	}
-
-	return result;
+	return keys.IsPresent(key);
 }
 
 uint32_t PersistResourceKeyList::Size() const
 {
-	return static_cast<uint32_t>(keys.size());
+	return static_cast<uint32_t>(keys.Size());
 }
 
 const cGZPersistResourceKey& PersistResourceKeyList::GetKey(uint32_t index) const
 {
-	return keys[index];
+	return keys.GetKey(index);
 }
 
 void PersistResourceKeyList::InsertKeyCallback(cGZPersistResourceKey const& key, void* pContext)
 {
 	PersistResourceKeyList* pThis = static_cast<PersistResourceKeyList*>(pContext);
 
-	pThis->keys.push_back(key);
+	pThis->keys.Insert(key);
 }
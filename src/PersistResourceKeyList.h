@@ -13,9 +13,12 @@
 #pragma once
 #include "cIGZPersistResourceKeyList.h"
 #include "cRZBaseUnknown.h"
-#include "PersistResourceKeyHash.h"
+#include "IndexedResourceKeyList.h"
 #include <vector>
 
+// The list is not thread safe, the const methods such as IsPresent can build the
+// index of the IndexedResourceKeyList. A list that is shared between threads must
+// be locked by the caller.
 class PersistResourceKeyList final : public cRZBaseUnknown, public cIGZPersistResourceKeyList
 {
 public:
@@ -27,6 +30,10 @@ public:
 
 	const container& GetKeys() const;
 
+	void Reserve(size_t count);
+
+	size_t GetCapacity() const;
+
 	// cIGZPersistResourceKeyList
 
 	bool QueryInterface(uint32_t riid, void** ppvObj) override;
@@ -50,6 +57,6 @@ public:
 private:
 	static void InsertKeyCallback(cGZPersistResourceKey const& key, void* pContext);
 
-	container keys;
+	IndexedResourceKeyList keys;
 };
 
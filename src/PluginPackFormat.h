@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+
+// The layout of the consolidated plugin pack that the PluginPackBuilder tool writes, and
+// that PluginPackDBSegment reads.
+// All values are stored in little-endian byte order.
+//
+// A pack is a DBPF 1.0 file with a 7.0 index that holds the effective records of a plugin
+// folder's .dat files, the records that remain after the later files have overridden the
+// earlier ones. Because it is a valid DBPF file, the game's cGZDBSegmentPackedFile can open
+// it for the calls that need a cIGZPersistDBRecord.
+//
+// The file is laid out so that everything the loader needs is at the start of the file and
+// can be mapped with one view:
+//
+// DBPFHeader
+// The pack info record - an InfoHeader followed by a SourceFile entry for each .dat file.
+// The directory record - a DirectoryEntry for each compressed record, sorted by key.
+// Padding to an IndexAlignment boundary.
+// The index - an IndexEntry for every record, sorted by key so that it can be binary searched.
+// The record data, in the order that the game first accessed the records, followed by the
+// records that were not accessed in the source file order.
+namespace PluginPackFormat
+{
+	static constexpr uint32_t Signature = 0x4B504C50; // PLPK
+	static constexpr uint32_t Version = 1;
+	static constexpr uint32_t IndexAlignment = 64;
+
+	// The name of the pack file in the root of the plugin folder, the extension keeps
+	// it out of the .dat file scan.
+	static constexpr const char* FileName = "SC4DBPFLoading.PluginPack";
+
+	static constexpr uint32_t InfoRecordType = 0x4B504C50;
+	static constexpr uint32_t InfoRecordGroup = 0x4B504C50;
+	static constexpr uint32_t InfoRecordInstance = 0x00000001;
+
+	static constexpr uint32_t DirectoryRecordType = 0xE86B1EEF;
+	static constexpr uint32_t DirectoryRecordGroup = 0xE86B1EEF;
+	static constexpr uint32_t DirectoryRecordInstance = 0x286B1F03;
+
+	struct IndexEntry
+	{
+		uint32_t type;
+		uint32_t group;
+		uint32_t instance;
+		uint32_t offset;
+		uint32_t size;
+	};
+	static_assert(sizeof(IndexEntry) == 20);
+
+	struct DirectoryEntry
+	{
+		uint32_t type;
+		uint32_t group;
+		uint32_t instance;
+		uint32_t uncompressedSize;
+	};
+	static_assert(sizeof(DirectoryEntry) == 16);
+
+	struct InfoHeader
+	{
+		uint32_t signature;
+		uint32_t version;
+		uint32_t sourceFileCount;
+		// The number of records in the pack, excluding the info and directory records.
+		uint32_t recordCount;
+	};
+	static_assert(sizeof(InfoHeader) == 16);
+
+	// The fingerprint of a .dat file that the pack was built from, the loader compares it
+	// to the plugin folder to detect a pack that is out of date.
+	// The entries are in the plugin's scan order, and each one is followed by its UTF-8
+	// path relative to the plugin folder, using backslashes as the separator.
+	struct SourceFile
+	{
+		uint64_t size;
+		// The last write time in 100 nanosecond ticks since 1970-01-01 UTC.
+		int64_t lastWriteTime;
+		uint32_t pathLength;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(SourceFile) == 24);
+
+	// The number of 100 nanosecond ticks between the FILETIME epoch, 1601-01-01 UTC,
+	// and 1970-01-01 UTC.
+	static constexpr int64_t FileTimeToUnixEpochTicks = 116444736000000000;
+
+	// Compares two keys in the order of the pack index.
+	inline bool KeyLess(
+		uint32_t leftType,
+		uint32_t leftGroup,
+		uint32_t leftInstance,
+		uint32_t rightType,
+		uint32_t rightGroup,
+		uint32_t rightInstance)
+	{
+		if (leftType != rightType)
+		{
+			return leftType < rightType;
+		}
+
+		if (leftGroup != rightGroup)
+		{
+			return leftGroup < rightGroup;
+		}
+
+		return leftInstance < rightInstance;
+	}
+}
@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "QfsCompression.h"
+
+namespace
+{
+	// The QFS header starts with the flags and the 0xFB signature byte, DBPF records
+	// place the compressed size in the 4 bytes before the header.
+	constexpr uint8_t QfsSignature = 0xFB;
+	constexpr uint8_t LargeSizesFlag = 0x80;
+	constexpr uint8_t CompressedSizeFlag = 0x01;
+
+	struct QfsHeader
+	{
+		uint32_t dataOffset;
+		uint32_t uncompressedSize;
+	};
+
+	uint32_t ReadBigEndian(const uint8_t* data, uint32_t byteCount)
+	{
+		uint32_t value = 0;
+
+		for (uint32_t i = 0; i < byteCount; i++)
+		{
+			value = (value << 8) | data[i];
+		}
+
+		return value;
+	}
+
+	bool ParseHeader(const uint8_t* data, uint32_t dataSize, QfsHeader& header)
+	{
+		uint32_t offset = 0;
+
+		if (dataSize >= 9 && data[5] == QfsSignature)
+		{
+			offset = 4;
+		}
+		else if (dataSize < 5 || data[1] != QfsSignature)
+		{
+			return false;
+		}
+
+		const uint8_t flags = data[offset];
+		const uint32_t sizeByteCount = (flags & LargeSizesFlag) != 0 ? 4 : 3;
+
+		offset += 2;
+
+		if ((flags & CompressedSizeFlag) != 0)
+		{
+			offset += sizeByteCount;
+		}
+
+		if (dataSize < offset + sizeByteCount)
+		{
+			return false;
+		}
+
+		header.uncompressedSize = ReadBigEndian(data + offset, sizeByteCount);
+		header.dataOffset = offset + sizeByteCount;
+
+		return true;
+	}
+}
+
+bool QfsCompression::GetUncompressedSize(const uint8_t* data, uint32_t dataSize, uint32_t& uncompressedSize)
+{
+	QfsHeader header{};
+
+	if (!ParseHeader(data, dataSize, header))
+	{
+		return false;
+	}
+
+	uncompressedSize = header.uncompressedSize;
+	return true;
+}
+
+bool QfsCompression::Decompress(const uint8_t* data, uint32_t dataSize, uint8_t* buffer, uint32_t bufferSize)
+{
+	QfsHeader header{};
+
+	if (!ParseHeader(data, dataSize, header) || bufferSize < header.uncompressedSize)
+	{
+		return false;
+	}
+
+	const uint8_t* src = data + header.dataOffset;
+	const uint8_t* const srcEnd = data + dataSize;
+	uint8_t* dst = buffer;
+	uint8_t* const dstEnd = buffer + header.uncompressedSize;
+
+	while (src < srcEnd)
+	{
+		const uint8_t control = src[0];
+		uint32_t plainCount = 0;
+		uint32_t copyCount = 0;
+		uint32_t copyOffset = 0;
+		bool end = false;
+
+		if (control < 0x80)
+		{
+			if (srcEnd - src < 2)
+			{
+				return false;
+			}
+
+			plainCount = control & 0x03;
+			copyCount = ((control & 0x1C) >> 2) + 3;
+			copyOffset = ((control & 0x60) << 3) + src[1] + 1;
+			src += 2;
+		}
+		else if (control < 0xC0)
+		{
+			if (srcEnd - src < 3)
+			{
+				return false;
+			}
+
+			plainCount = (src[1] >> 6) & 0x03;
+			copyCount = (control & 0x3F) + 4;
+			copyOffset = ((src[1] & 0x3F) << 8) + src[2] + 1;
+			src += 3;
+		}
+		else if (control < 0xE0)
+		{
+			if (srcEnd - src < 4)
+			{
+				return false;
+			}
+
+			plainCount = control & 0x03;
+			copyCount = ((control & 0x0C) << 6) + src[3] + 5;
+			copyOffset = ((control & 0x10) << 12) + (src[1] << 8) + src[2] + 1;
+			src += 4;
+		}
+		else if (control < 0xFC)
+		{
+			plainCount = ((control & 0x1F) << 2) + 4;
+			src += 1;
+		}
+		else
+		{
+			plainCount = control & 0x03;
+			src += 1;
+			end = true;
+		}
+
+		if (static_cast<uint32_t>(srcEnd - src) < plainCount
+			|| static_cast<uint32_t>(dstEnd - dst) < plainCount + copyCount)
+		{
+			return false;
+		}
+
+		for (uint32_t i = 0; i < plainCount; i++)
+		{
+			*dst++ = *src++;
+		}
+
+		if (copyCount > 0)
+		{
+			if (static_cast<uint32_t>(dst - buffer) < copyOffset)
+			{
+				return false;
+			}
+
+			// The source and destination can overlap, so the bytes are copied one at a time.
+			const uint8_t* copySource = dst - copyOffset;
+
+			for (uint32_t i = 0; i < copyCount; i++)
+			{
+				*dst++ = *copySource++;
+			}
+		}
+
+		if (end)
+		{
+			break;
+		}
+	}
+
+	return dst == dstEnd;
+}
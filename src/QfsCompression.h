@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+
+// Decompresses the QFS (RefPack) format that DBPF files use for compressed records.
+namespace QfsCompression
+{
+	// Gets the uncompressed size from the header of a compressed record.
+	// Returns false if the data does not start with a QFS header.
+	bool GetUncompressedSize(const uint8_t* data, uint32_t dataSize, uint32_t& uncompressedSize);
+
+	// Decompresses a record into a buffer that is at least as large as its uncompressed size.
+	// Returns false if the data is not valid QFS data or the buffer is too small.
+	bool Decompress(const uint8_t* data, uint32_t dataSize, uint8_t* buffer, uint32_t bufferSize);
+}
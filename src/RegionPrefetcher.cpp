@@ -0,0 +1,574 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RegionPrefetcher.h"
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include "Stopwatch.h"
+#include "StringViewUtil.h"
+#include "cIGZString.h"
+#include <algorithm>
+#include <filesystem>
+#include <Windows.h>
+#include "wil/resource.h"
+
+using namespace std::string_view_literals;
+
+namespace
+{
+	// The region view reads these records from every city file.
+	constexpr uint32_t RegionViewSubfileType = 0xCA027EDB;
+	constexpr uint32_t RegionViewThumbnailType = 0x8A2482B9;
+
+	// The prefetching stops after this many bytes have been read, the region view data
+	// is normally a few hundred KB for each city.
+	constexpr uint64_t MaxPrefetchBytes = 128ULL * 1024 * 1024;
+
+	// The size of the buffer that each worker thread reads the record data into.
+	constexpr uint32_t PrefetchBufferSize = 1024 * 1024;
+
+	// Records that are closer together than this are read with a single call.
+	constexpr uint32_t MaxRangeGap = 16 * 1024;
+
+	constexpr uint32_t MaxPrefetchThreads = 4;
+
+	bool IsDirectorySeparator(char value)
+	{
+		return value == '\\' || value == '/';
+	}
+
+	// Splits the path of a city file in a region folder, which is <Regions folder>\<region name>\<file name>.sc4.
+	bool GetRegionCityFile(const std::string_view& path, std::string_view& regionFolder, std::string_view& fileName)
+	{
+		if (path.size() <= 4 || !StringViewUtil::EqualsIgnoreCase(path.substr(path.size() - 4), ".sc4"sv))
+		{
+			return false;
+		}
+
+		const size_t fileNameSeparator = path.find_last_of("\\/");
+
+		if (fileNameSeparator == std::string_view::npos || fileNameSeparator == 0)
+		{
+			return false;
+		}
+
+		regionFolder = path.substr(0, fileNameSeparator);
+		fileName = path.substr(fileNameSeparator + 1);
+
+		const size_t regionNameSeparator = regionFolder.find_last_of("\\/");
+
+		if (regionNameSeparator == std::string_view::npos)
+		{
+			return false;
+		}
+
+		const std::string_view regionsFolder = regionFolder.substr(0, regionNameSeparator);
+		const size_t regionsFolderSeparator = regionsFolder.find_last_of("\\/");
+		const std::string_view regionsFolderName = regionsFolderSeparator == std::string_view::npos
+			? regionsFolder
+			: regionsFolder.substr(regionsFolderSeparator + 1);
+
+		return StringViewUtil::EqualsIgnoreCase(regionsFolderName, "Regions"sv);
+	}
+
+	// The ASCII letters are converted to lower case because the Windows file system is case insensitive.
+	std::string GetFileNameKey(const std::string_view& fileName)
+	{
+		std::string key(fileName);
+
+		for (char& c : key)
+		{
+			if (c >= 'A' && c <= 'Z')
+			{
+				c = static_cast<char>(c + ('a' - 'A'));
+			}
+		}
+
+		return key;
+	}
+
+	std::wstring GetWin32Path(const std::string& utf8Path)
+	{
+		std::wstring path = GZStringConvert::ToUtf16(cRZBaseString(utf8Path));
+
+		if (PathUtil::MustAddExtendedPathPrefix(path))
+		{
+			path = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(path));
+		}
+
+		return path;
+	}
+
+	bool ReadAt(HANDLE hFile, uint32_t offset, void* buffer, uint32_t size)
+	{
+		OVERLAPPED overlapped{};
+		overlapped.Offset = offset;
+
+		DWORD bytesRead = 0;
+
+		return ReadFile(hFile, buffer, size, &bytesRead, &overlapped) && bytesRead == size;
+	}
+
+	double GetMilliseconds(int64_t startTimestamp, int64_t endTimestamp)
+	{
+		return static_cast<double>(endTimestamp - startTimestamp) * 1000.0 / static_cast<double>(Stopwatch::GetFrequency());
+	}
+
+	double GetMegabytes(uint64_t bytes)
+	{
+		return static_cast<double>(bytes) / (1024.0 * 1024.0);
+	}
+}
+
+RegionPrefetcher& RegionPrefetcher::GetInstance()
+{
+	static RegionPrefetcher instance;
+
+	return instance;
+}
+
+RegionPrefetcher::RegionPrefetcher()
+	: enabled(false),
+	  cityOpen(false),
+	  tracking(false),
+	  regionOpenStartTimestamp(0),
+	  lastReadTimestamp(0),
+	  gameReadBytes(0),
+	  gamePrefetchedReadBytes(0),
+	  nextPrefetchFile(0),
+	  stopPrefetching(false),
+	  prefetchedBytes(0),
+	  prefetchedFileCount(0),
+	  finishedPrefetchThreads(0),
+	  prefetchEndTimestamp(0),
+	  prefetchThreadCount(0)
+{
+}
+
+void RegionPrefetcher::Enable()
+{
+	enabled = true;
+}
+
+bool RegionPrefetcher::IsEnabled() const
+{
+	return enabled;
+}
+
+void RegionPrefetcher::FileOpened(const cIGZString& path, void* fileHandle)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	const std::string_view pathView(path.ToChar(), path.Strlen());
+
+	std::string_view regionFolderView;
+	std::string_view fileName;
+
+	{
+		std::lock_guard<std::mutex> lock(regionMutex);
+
+		if (tracking)
+		{
+			// The file handle may have been reused after the game closed a city file.
+			openCityFiles.erase(fileHandle);
+		}
+
+		if (cityOpen || !GetRegionCityFile(pathView, regionFolderView, fileName))
+		{
+			return;
+		}
+
+		if (tracking && StringViewUtil::EqualsIgnoreCase(regionFolderView, regionFolder))
+		{
+			// Only the first open of each city file is part of the region open, the game
+			// opens the file again when the city is loaded.
+			auto cityFileIndex = cityFileIndexes.find(GetFileNameKey(fileName));
+
+			if (cityFileIndex != cityFileIndexes.end() && !cityFiles[cityFileIndex->second].opened)
+			{
+				cityFiles[cityFileIndex->second].opened = true;
+				openCityFiles.emplace(fileHandle, cityFileIndex->second);
+			}
+
+			return;
+		}
+	}
+
+	EndRegionOpen();
+	StartRegionOpen(std::string(regionFolderView), std::string(fileName), fileHandle);
+}
+
+void RegionPrefetcher::CityOpened()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	EndRegionOpen();
+
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	cityOpen = true;
+}
+
+void RegionPrefetcher::CityClosed()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	cityOpen = false;
+}
+
+void RegionPrefetcher::Shutdown()
+{
+	if (enabled)
+	{
+		EndRegionOpen();
+	}
+}
+
+void RegionPrefetcher::StartRegionOpen(
+	const std::string& regionFolder,
+	const std::string& openedFileName,
+	void* openedFileHandle)
+{
+	std::vector<CityFile> regionCityFiles;
+
+	try
+	{
+		std::error_code ec;
+
+		for (const auto& entry : std::filesystem::directory_iterator(GetWin32Path(regionFolder), ec))
+		{
+			if (entry.is_regular_file(ec)
+				&& StringViewUtil::EqualsIgnoreCase(GZStringConvert::FromFileSystemPath(entry.path().extension()).ToChar(), ".sc4"sv))
+			{
+				const cRZBaseString fileName = GZStringConvert::FromFileSystemPath(entry.path().filename());
+
+				CityFile& cityFile = regionCityFiles.emplace_back();
+				cityFile.path = regionFolder;
+				cityFile.path.push_back('\\');
+				cityFile.path.append(fileName.ToChar(), fileName.Strlen());
+				cityFile.opened = false;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Error,
+			"Failed to enumerate the city files in %s: %s",
+			regionFolder.c_str(),
+			e.what());
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	this->regionFolder = regionFolder;
+	cityFiles = std::move(regionCityFiles);
+	cityFileIndexes.clear();
+	openCityFiles.clear();
+	prefetchQueue.clear();
+
+	const std::string openedFileKey = GetFileNameKey(openedFileName);
+
+	for (size_t i = 0; i < cityFiles.size(); i++)
+	{
+		std::string key = GetFileNameKey(std::string_view(cityFiles[i].path).substr(regionFolder.size() + 1));
+
+		if (key == openedFileKey)
+		{
+			// The game is already reading the file that it opened.
+			cityFiles[i].opened = true;
+			openCityFiles.emplace(openedFileHandle, i);
+		}
+		else
+		{
+			prefetchQueue.push_back(i);
+		}
+
+		cityFileIndexes.emplace(std::move(key), i);
+	}
+
+	regionOpenStartTimestamp = Stopwatch::GetTimestamp();
+	lastReadTimestamp = regionOpenStartTimestamp;
+	gameReadBytes = 0;
+	gamePrefetchedReadBytes = 0;
+	nextPrefetchFile = 0;
+	stopPrefetching = false;
+	prefetchedBytes = 0;
+	prefetchedFileCount = 0;
+	finishedPrefetchThreads = 0;
+	prefetchEndTimestamp = prefetchQueue.empty() ? regionOpenStartTimestamp : 0;
+
+	// The prefetching uses at most half of the CPU cores, the game is reading the city
+	// files on the main thread at the same time.
+	prefetchThreadCount = std::clamp<uint32_t>(std::thread::hardware_concurrency() / 2, 1, MaxPrefetchThreads);
+	prefetchThreadCount = std::min<uint32_t>(prefetchThreadCount, static_cast<uint32_t>(prefetchQueue.size()));
+
+	prefetchThreads.reserve(prefetchThreadCount);
+
+	for (uint32_t i = 0; i < prefetchThreadCount; i++)
+	{
+		prefetchThreads.emplace_back(&RegionPrefetcher::PrefetchWorker, this);
+	}
+
+	tracking = true;
+}
+
+void RegionPrefetcher::EndRegionOpen()
+{
+	std::vector<std::thread> threads;
+	bool finished = false;
+
+	{
+		std::lock_guard<std::mutex> lock(regionMutex);
+
+		if (!tracking)
+		{
+			return;
+		}
+
+		tracking = false;
+		finished = finishedPrefetchThreads == prefetchThreadCount;
+		stopPrefetching = true;
+		threads = std::move(prefetchThreads);
+		prefetchThreads.clear();
+	}
+
+	// The worker threads are joined without holding the lock, they take it to
+	// publish the ranges that they have read.
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	if (prefetchEndTimestamp == 0)
+	{
+		prefetchEndTimestamp = Stopwatch::GetTimestamp();
+	}
+
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	const size_t openedFileCount = static_cast<size_t>(std::count_if(
+		cityFiles.begin(),
+		cityFiles.end(),
+		[](const CityFile& cityFile) { return cityFile.opened; }));
+
+	const uint64_t totalPrefetchedBytes = prefetchedBytes;
+	const uint64_t unreadPrefetchedBytes = totalPrefetchedBytes - std::min(totalPrefetchedBytes, gamePrefetchedReadBytes);
+
+	Logger& logger = Logger::GetInstance();
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"Region open of %s: the game read %.1f MB from %zu of %zu city files in %.0f ms.",
+		regionFolder.c_str(),
+		GetMegabytes(gameReadBytes),
+		openedFileCount,
+		cityFiles.size(),
+		GetMilliseconds(regionOpenStartTimestamp, lastReadTimestamp));
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"Prefetched %.1f MB from %u of %zu city files in %.0f ms using %u threads%s, %.1f MB (%.0f%%) of the game's"
+		" reads had been prefetched and %.1f MB of the prefetched data was not read by the game.",
+		GetMegabytes(totalPrefetchedBytes),
+		prefetchedFileCount.load(),
+		prefetchQueue.size(),
+		GetMilliseconds(regionOpenStartTimestamp, prefetchEndTimestamp),
+		prefetchThreadCount,
+		finished ? "" : ", stopped when the region was left",
+		GetMegabytes(gamePrefetchedReadBytes),
+		gameReadBytes > 0 ? static_cast<double>(gamePrefetchedReadBytes) * 100.0 / static_cast<double>(gameReadBytes) : 0.0,
+		GetMegabytes(unreadPrefetchedBytes));
+
+	cityFiles.clear();
+	cityFileIndexes.clear();
+	openCityFiles.clear();
+	prefetchQueue.clear();
+}
+
+void RegionPrefetcher::RecordFileRead(void* fileHandle, uint32_t position, uint32_t byteCount)
+{
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	auto openCityFile = openCityFiles.find(fileHandle);
+
+	if (openCityFile == openCityFiles.end())
+	{
+		return;
+	}
+
+	const uint64_t start = position;
+	const uint64_t end = start + byteCount;
+
+	for (const FileRange& range : cityFiles[openCityFile->second].prefetchedRanges)
+	{
+		const uint64_t overlapStart = std::max<uint64_t>(start, range.offset);
+		const uint64_t overlapEnd = std::min<uint64_t>(end, static_cast<uint64_t>(range.offset) + range.size);
+
+		if (overlapStart < overlapEnd)
+		{
+			gamePrefetchedReadBytes += overlapEnd - overlapStart;
+		}
+	}
+
+	gameReadBytes += byteCount;
+	lastReadTimestamp = Stopwatch::GetTimestamp();
+}
+
+void RegionPrefetcher::PrefetchWorker()
+{
+	std::vector<uint8_t> buffer(PrefetchBufferSize);
+
+	size_t queueIndex = 0;
+
+	while (!stopPrefetching && (queueIndex = nextPrefetchFile.fetch_add(1)) < prefetchQueue.size())
+	{
+		try
+		{
+			PrefetchFile(prefetchQueue[queueIndex], buffer);
+		}
+		catch (const std::exception&)
+		{
+			// A city file that cannot be prefetched is read by the game as usual.
+		}
+	}
+
+	if (finishedPrefetchThreads.fetch_add(1) + 1 == prefetchThreadCount && !stopPrefetching)
+	{
+		prefetchEndTimestamp = Stopwatch::GetTimestamp();
+	}
+}
+
+void RegionPrefetcher::PrefetchFile(size_t cityFileIndex, std::vector<uint8_t>& buffer)
+{
+	// The city file list is not modified while the worker threads are running.
+	const std::wstring path = GetWin32Path(cityFiles[cityFileIndex].path);
+
+	wil::unique_hfile hFile(CreateFileW(
+		path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_RANDOM_ACCESS,
+		nullptr));
+
+	DBPFHeader header{};
+	LARGE_INTEGER fileSize{};
+
+	if (prefetchedBytes >= MaxPrefetchBytes
+		|| !hFile
+		|| !GetFileSizeEx(hFile.get(), &fileSize)
+		|| !ReadAt(hFile.get(), 0, &header, sizeof(header))
+		|| !DBPFIndexReader::IsValidHeader(header, static_cast<uint64_t>(fileSize.QuadPart)))
+	{
+		return;
+	}
+
+	const uint32_t indexSize = DBPFIndexReader::GetIndexSize(header);
+	std::vector<uint8_t> index(indexSize);
+
+	if (!ReadAt(hFile.get(), header.indexOffset, index.data(), indexSize))
+	{
+		return;
+	}
+
+	prefetchedBytes += sizeof(header) + indexSize;
+
+	const DBPFIndexReader indexReader(header, index.data(), static_cast<uint64_t>(fileSize.QuadPart));
+	std::vector<FileRange> recordRanges;
+
+	for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+	{
+		DBPFIndexReader::Entry entry{};
+
+		if (indexReader.TryGetEntry(i, entry)
+			&& (entry.type == RegionViewSubfileType || entry.type == RegionViewThumbnailType))
+		{
+			recordRanges.push_back(FileRange{ entry.offset, entry.size });
+		}
+	}
+
+	std::vector<FileRange> readRanges;
+	readRanges.push_back(FileRange{ 0, static_cast<uint32_t>(sizeof(header)) });
+	readRanges.push_back(FileRange{ header.indexOffset, indexSize });
+
+	// The records are read in file order, and the records that are close together
+	// are read with a single call.
+	std::sort(recordRanges.begin(), recordRanges.end(), [](const FileRange& lhs, const FileRange& rhs) { return lhs.offset < rhs.offset; });
+
+	size_t rangeIndex = 0;
+
+	while (rangeIndex < recordRanges.size() && !stopPrefetching)
+	{
+		const uint32_t start = recordRanges[rangeIndex].offset;
+		uint64_t end = static_cast<uint64_t>(start) + recordRanges[rangeIndex].size;
+
+		rangeIndex++;
+
+		while (rangeIndex < recordRanges.size() && recordRanges[rangeIndex].offset <= end + MaxRangeGap)
+		{
+			end = std::max<uint64_t>(end, static_cast<uint64_t>(recordRanges[rangeIndex].offset) + recordRanges[rangeIndex].size);
+			rangeIndex++;
+		}
+
+		uint64_t offset = start;
+
+		while (offset < end)
+		{
+			const uint32_t chunkSize = static_cast<uint32_t>(std::min<uint64_t>(end - offset, buffer.size()));
+
+			if (stopPrefetching
+				|| prefetchedBytes >= MaxPrefetchBytes
+				|| !ReadAt(hFile.get(), static_cast<uint32_t>(offset), buffer.data(), chunkSize))
+			{
+				break;
+			}
+
+			prefetchedBytes += chunkSize;
+			offset += chunkSize;
+		}
+
+		if (offset > start)
+		{
+			readRanges.push_back(FileRange{ start, static_cast<uint32_t>(offset - start) });
+		}
+
+		if (offset < end)
+		{
+			break;
+		}
+	}
+
+	prefetchedFileCount++;
+
+	// The ranges are published after they have been read, so a game read that
+	// arrives first is not counted as prefetched.
+	std::lock_guard<std::mutex> lock(regionMutex);
+
+	cityFiles[cityFileIndex].prefetchedRanges = std::move(readRanges);
+}
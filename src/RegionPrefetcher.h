@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class cIGZString;
+
+// Reads the region view data of a region's city files on worker threads when the
+// game starts opening the region.
+//
+// The region view reads the DBPF header, the index, the region view subfile and the
+// thumbnails from every .sc4 file in the region folder, one file at a time. When the
+// game opens the first city file of a region, the worker threads read those parts of
+// the other city files with the Windows API. This places the data in the operating
+// system's file cache before the game reads it through its own file handles.
+//
+// The game's reads of each city file are compared with the prefetched ranges, and
+// the region open time and byte counts are written to the log when the region is left.
+class RegionPrefetcher
+{
+public:
+
+	static RegionPrefetcher& GetInstance();
+
+	void Enable();
+
+	bool IsEnabled() const;
+
+	// Called by the cRZFile hook for every file that the game opens.
+	void FileOpened(const cIGZString& path, void* fileHandle);
+
+	// Called by the cRZFile hook after the game has read from a file.
+	void FileRead(void* fileHandle, uint32_t position, uint32_t byteCount)
+	{
+		if (tracking.load(std::memory_order_relaxed))
+		{
+			RecordFileRead(fileHandle, position, byteCount);
+		}
+	}
+
+	// Called when a city starts loading, this ends the region open.
+	void CityOpened();
+
+	// Called when the game returns to the region view.
+	void CityClosed();
+
+	void Shutdown();
+
+private:
+
+	struct FileRange
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct CityFile
+	{
+		std::string path;
+		std::vector<FileRange> prefetchedRanges;
+		bool opened;
+	};
+
+	RegionPrefetcher();
+
+	void StartRegionOpen(const std::string& regionFolder, const std::string& openedFileName, void* openedFileHandle);
+
+	void EndRegionOpen();
+
+	void RecordFileRead(void* fileHandle, uint32_t position, uint32_t byteCount);
+
+	void PrefetchWorker();
+
+	void PrefetchFile(size_t cityFileIndex, std::vector<uint8_t>& buffer);
+
+	bool enabled;
+	bool cityOpen;
+
+	// The mutex protects the region state and the city files, the worker threads
+	// only access a city file's prefetched ranges through it.
+	std::mutex regionMutex;
+	std::atomic<bool> tracking;
+	std::string regionFolder;
+	std::vector<CityFile> cityFiles;
+	boost::unordered::unordered_flat_map<std::string, size_t> cityFileIndexes;
+	boost::unordered::unordered_flat_map<void*, size_t> openCityFiles;
+	int64_t regionOpenStartTimestamp;
+	int64_t lastReadTimestamp;
+	uint64_t gameReadBytes;
+	uint64_t gamePrefetchedReadBytes;
+
+	std::vector<size_t> prefetchQueue;
+	std::vector<std::thread> prefetchThreads;
+	std::atomic<size_t> nextPrefetchFile;
+	std::atomic<bool> stopPrefetching;
+	std::atomic<uint64_t> prefetchedBytes;
+	std::atomic<uint32_t> prefetchedFileCount;
+	std::atomic<uint32_t> finishedPrefetchThreads;
+	std::atomic<int64_t> prefetchEndTimestamp;
+	uint32_t prefetchThreadCount;
+};
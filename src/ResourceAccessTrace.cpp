@@ -0,0 +1,227 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ResourceAccessTrace.h"
+#include "Logger.h"
+#include "Stopwatch.h"
+#include "cIGZString.h"
+#include "cRZBaseString.h"
+#include <algorithm>
+#include <Windows.h>
+
+using namespace ResourceAccessTraceFormat;
+
+namespace
+{
+	// The records are buffered in memory and written to the file in 1 MB blocks.
+	constexpr size_t BufferFlushSize = 1024 * 1024;
+}
+
+ResourceAccessTrace::Container::Container(uint16_t id, const std::vector<cIGZPersistDBSegment*>& segments)
+	: id(id),
+	  segmentIndexes()
+{
+	segmentIndexes.reserve(segments.size());
+
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		segmentIndexes.emplace(segments[i], static_cast<uint32_t>(i));
+	}
+}
+
+uint32_t ResourceAccessTrace::Container::GetSegmentIndex(cIGZPersistDBSegment* const segment) const
+{
+	const auto it = segmentIndexes.find(segment);
+
+	return it != segmentIndexes.end() ? it->second : NoSegment;
+}
+
+ResourceAccessTrace::Recorder::Recorder(
+	const Container* const container,
+	RecordType type,
+	const cGZPersistResourceKey& key)
+	: container(container),
+	  record{},
+	  startTimeStamp(0)
+{
+	if (container)
+	{
+		record.type = type;
+		record.containerID = container->id;
+		record.keyType = key.type;
+		record.keyGroup = key.group;
+		record.keyInstance = key.instance;
+		record.segmentIndex = NoSegment;
+
+		startTimeStamp = Stopwatch::GetTimestamp();
+	}
+}
+
+ResourceAccessTrace::Recorder::~Recorder()
+{
+	if (container)
+	{
+		ResourceAccessTrace::GetInstance().AddAccess(record, startTimeStamp);
+	}
+}
+
+void ResourceAccessTrace::Recorder::SetSegment(cIGZPersistDBSegment* const segment)
+{
+	if (container)
+	{
+		record.found = 1;
+		record.segmentIndex = container->GetSegmentIndex(segment);
+	}
+}
+
+void ResourceAccessTrace::Recorder::SetSize(uint32_t size)
+{
+	record.size = size;
+}
+
+ResourceAccessTrace& ResourceAccessTrace::GetInstance()
+{
+	static ResourceAccessTrace instance;
+
+	return instance;
+}
+
+ResourceAccessTrace::ResourceAccessTrace()
+	: enabled(false),
+	  traceStartTimeStamp(0),
+	  nextContainerID(0),
+	  mutex(),
+	  buffer(),
+	  file()
+{
+}
+
+void ResourceAccessTrace::Start(const std::filesystem::path& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!enabled)
+	{
+		file.open(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+		if (!file)
+		{
+			throw std::runtime_error("Failed to create the resource access trace file.");
+		}
+
+		buffer.reserve(BufferFlushSize * 2);
+
+		FileHeader header{};
+		header.signature = Signature;
+		header.version = Version;
+		header.timeStampFrequency = Stopwatch::GetFrequency();
+
+		Append(&header, sizeof(header));
+
+		traceStartTimeStamp = Stopwatch::GetTimestamp();
+		enabled = true;
+	}
+}
+
+void ResourceAccessTrace::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (enabled)
+	{
+		enabled = false;
+		FlushBuffer();
+		file.close();
+	}
+}
+
+bool ResourceAccessTrace::IsEnabled() const
+{
+	return enabled;
+}
+
+std::unique_ptr<ResourceAccessTrace::Container> ResourceAccessTrace::AddContainer(
+	const cIGZString& folderPath,
+	const std::vector<cIGZPersistDBSegment*>& segments)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!enabled)
+	{
+		return nullptr;
+	}
+
+	// Container ID 0 is not used, this allows it to be used as an invalid value
+	// when the trace is read.
+	const uint16_t containerID = ++nextContainerID;
+
+	AddPath(RecordType::Container, containerID, folderPath);
+
+	for (cIGZPersistDBSegment* segment : segments)
+	{
+		cRZBaseString path;
+		segment->GetPath(path);
+
+		AddPath(RecordType::Segment, containerID, path);
+	}
+
+	return std::make_unique<Container>(containerID, segments);
+}
+
+void ResourceAccessTrace::AddAccess(AccessRecord& record, int64_t startTimeStamp)
+{
+	const int64_t endTimeStamp = Stopwatch::GetTimestamp();
+
+	record.threadID = GetCurrentThreadId();
+	record.durationTicks = static_cast<uint32_t>(std::min<int64_t>(endTimeStamp - startTimeStamp, UINT32_MAX));
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (enabled)
+	{
+		record.timeStamp = startTimeStamp - traceStartTimeStamp;
+
+		Append(&record, sizeof(record));
+	}
+}
+
+void ResourceAccessTrace::AddPath(RecordType type, uint16_t containerID, const cIGZString& path)
+{
+	PathRecord record{};
+	record.type = type;
+	record.containerID = containerID;
+	record.pathLength = path.Strlen();
+
+	Append(&record, sizeof(record));
+	Append(path.ToChar(), record.pathLength);
+}
+
+void ResourceAccessTrace::Append(const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+	buffer.insert(buffer.end(), bytes, bytes + size);
+
+	if (buffer.size() >= BufferFlushSize)
+	{
+		FlushBuffer();
+	}
+}
+
+void ResourceAccessTrace::FlushBuffer()
+{
+	if (!buffer.empty())
+	{
+		file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+		buffer.clear();
+	}
+}
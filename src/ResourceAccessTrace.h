@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "ResourceAccessTraceFormat.h"
+#include "cGZPersistResourceKey.h"
+#include "cIGZPersistDBSegment.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+class cIGZString;
+
+// Records the multi-packed file calls to a binary file, so that the workload can
+// be replayed outside of the game with the DBPFTraceReplay tool.
+// See ResourceAccessTraceFormat.h for the file format.
+class ResourceAccessTrace
+{
+public:
+
+	// The trace state of an open multi-packed file.
+	struct Container
+	{
+		Container(uint16_t id, const std::vector<cIGZPersistDBSegment*>& segments);
+
+		uint32_t GetSegmentIndex(cIGZPersistDBSegment* const segment) const;
+
+		const uint16_t id;
+		boost::unordered::unordered_flat_map<cIGZPersistDBSegment*, uint32_t> segmentIndexes;
+	};
+
+	// Records a single call when it goes out of scope.
+	class Recorder
+	{
+	public:
+		Recorder(
+			const Container* const container,
+			ResourceAccessTraceFormat::RecordType type,
+			const cGZPersistResourceKey& key);
+		~Recorder();
+
+		Recorder(const Recorder&) = delete;
+		Recorder& operator=(const Recorder&) = delete;
+
+		void SetSegment(cIGZPersistDBSegment* const segment);
+
+		void SetSize(uint32_t size);
+
+	private:
+		const Container* const container;
+		ResourceAccessTraceFormat::AccessRecord record;
+		int64_t startTimeStamp;
+	};
+
+	static ResourceAccessTrace& GetInstance();
+
+	void Start(const std::filesystem::path& path);
+
+	void Stop();
+
+	bool IsEnabled() const;
+
+	// Writes the folder and segment paths of a multi-packed file that was opened.
+	std::unique_ptr<Container> AddContainer(
+		const cIGZString& folderPath,
+		const std::vector<cIGZPersistDBSegment*>& segments);
+
+private:
+
+	ResourceAccessTrace();
+
+	void AddAccess(ResourceAccessTraceFormat::AccessRecord& record, int64_t startTimeStamp);
+
+	void AddPath(ResourceAccessTraceFormat::RecordType type, uint16_t containerID, const cIGZString& path);
+
+	void Append(const void* data, size_t size);
+
+	void FlushBuffer();
+
+	bool enabled;
+	int64_t traceStartTimeStamp;
+	uint16_t nextContainerID;
+	std::mutex mutex;
+	std::vector<uint8_t> buffer;
+	std::ofstream file;
+};
@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+
+// The binary format of the resource access trace that the plugin records, and that the
+// DBPFTraceReplay tool reads.
+// All values are stored in little-endian byte order.
+//
+// The file starts with a FileHeader, followed by a sequence of records.
+// Each record starts with a one byte RecordType:
+//
+// Container - a multi-packed file was opened, followed by the UTF-8 folder path.
+// Segment   - a DBPF file that the previous container loaded, followed by the UTF-8 file path.
+//             The segments are numbered in the order they are written, starting at 0.
+// The other types are AccessRecords for the multi-packed file methods of the same name.
+namespace ResourceAccessTraceFormat
+{
+	static constexpr uint32_t Signature = 0x54415253; // SRAT
+	static constexpr uint32_t Version = 1;
+	static constexpr uint32_t NoSegment = UINT32_MAX;
+
+	enum class RecordType : uint8_t
+	{
+		Container = 1,
+		Segment = 2,
+		TestForRecord = 3,
+		GetRecordSize = 4,
+		OpenRecord = 5,
+		ReadRecord = 6,
+	};
+
+	struct FileHeader
+	{
+		uint32_t signature;
+		uint32_t version;
+		// The number of time stamp ticks per second.
+		int64_t timeStampFrequency;
+	};
+	static_assert(sizeof(FileHeader) == 16);
+
+	struct PathRecord
+	{
+		RecordType type;
+		uint8_t reserved;
+		uint16_t containerID;
+		uint32_t pathLength;
+	};
+	static_assert(sizeof(PathRecord) == 8);
+
+	struct AccessRecord
+	{
+		RecordType type;
+		uint8_t found;
+		uint16_t containerID;
+		uint32_t threadID;
+		// The time stamp ticks since the trace started.
+		int64_t timeStamp;
+		uint32_t durationTicks;
+		uint32_t keyType;
+		uint32_t keyGroup;
+		uint32_t keyInstance;
+		// The record size for GetRecordSize and ReadRecord, otherwise 0.
+		uint32_t size;
+		// The index of the segment that contains the key, or NoSegment.
+		uint32_t segmentIndex;
+	};
+	static_assert(sizeof(AccessRecord) == 40);
+}
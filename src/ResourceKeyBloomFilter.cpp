@@ -0,0 +1,138 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ResourceKeyBloomFilter.h"
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+	// The odd constants that select the bit in each word of a block, these are
+	// the salt values of the Apache Parquet split block Bloom filter.
+	constexpr uint32_t BlockSalts[8] =
+	{
+		0x47B6137B,
+		0x44974D91,
+		0x8824AD5B,
+		0xA2B7289D,
+		0x705495C7,
+		0x2DF1424B,
+		0x9EFC4947,
+		0x5C6BFB31,
+	};
+
+	constexpr size_t BitsPerBlock = 256;
+
+	constexpr uint32_t GetWordMask(uint32_t hash, size_t wordIndex)
+	{
+		return 1U << ((hash * BlockSalts[wordIndex]) >> 27);
+	}
+}
+
+ResourceKeyBloomFilter::ResourceKeyBloomFilter() : blocks()
+{
+}
+
+void ResourceKeyBloomFilter::Reset(size_t expectedKeyCount)
+{
+	const size_t blockCount = std::max<size_t>(1, (expectedKeyCount * BitsPerKey + BitsPerBlock - 1) / BitsPerBlock);
+
+	blocks.assign(blockCount, Block{});
+}
+
+void ResourceKeyBloomFilter::Clear()
+{
+	blocks.clear();
+	blocks.shrink_to_fit();
+}
+
+void ResourceKeyBloomFilter::Insert(const cGZPersistResourceKey& key)
+{
+	if (!blocks.empty())
+	{
+		const uint64_t hash = Hash(key);
+		Block& block = blocks[GetBlockIndex(hash)];
+
+		for (size_t i = 0; i < 8; i++)
+		{
+			block.words[i] |= GetWordMask(static_cast<uint32_t>(hash), i);
+		}
+	}
+}
+
+void ResourceKeyBloomFilter::InsertConcurrent(const cGZPersistResourceKey& key)
+{
+	if (!blocks.empty())
+	{
+		const uint64_t hash = Hash(key);
+		Block& block = blocks[GetBlockIndex(hash)];
+
+		for (size_t i = 0; i < 8; i++)
+		{
+			std::atomic_ref<uint32_t>(block.words[i]).fetch_or(
+				GetWordMask(static_cast<uint32_t>(hash), i),
+				std::memory_order_relaxed);
+		}
+	}
+}
+
+bool ResourceKeyBloomFilter::MayContain(const cGZPersistResourceKey& key) const
+{
+	if (blocks.empty())
+	{
+		return true;
+	}
+
+	const uint64_t hash = Hash(key);
+	Block& block = const_cast<Block&>(blocks[GetBlockIndex(hash)]);
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		const uint32_t mask = GetWordMask(static_cast<uint32_t>(hash), i);
+
+		// The relaxed load is a plain load on x86, it only prevents a data race
+		// with InsertConcurrent.
+		if ((std::atomic_ref<uint32_t>(block.words[i]).load(std::memory_order_relaxed) & mask) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ResourceKeyBloomFilter::IsEmpty() const
+{
+	return blocks.empty();
+}
+
+size_t ResourceKeyBloomFilter::GetMemoryUsage() const
+{
+	return blocks.capacity() * sizeof(Block);
+}
+
+uint64_t ResourceKeyBloomFilter::Hash(const cGZPersistResourceKey& key)
+{
+	uint64_t hash = ((static_cast<uint64_t>(key.type) << 32) | key.group) * 0x9E3779B97F4A7C15ULL;
+	hash ^= static_cast<uint64_t>(key.instance) * 0xC2B2AE3D27D4EB4FULL;
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+size_t ResourceKeyBloomFilter::GetBlockIndex(uint64_t hash) const
+{
+	// Maps the high 32 bits of the hash onto the block count without a division.
+	return static_cast<size_t>(((hash >> 32) * blocks.size()) >> 32);
+}
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A blocked Bloom filter of resource keys, it is used to answer the lookups for keys
+// that are not in a multi-packed file without taking its lock.
+//
+// Each key sets one bit in each of the eight 32-bit words of a 32-byte block, so a
+// lookup reads a single cache line. The filter has no false negatives, MayContain
+// returns true for every key that was inserted.
+//
+// Keys cannot be removed from a Bloom filter, a key that is removed from the index
+// stays in the filter and is answered as a false positive.
+class ResourceKeyBloomFilter
+{
+public:
+	// The filter size in bits per expected key, this gives a false positive rate of
+	// about 0.15%.
+	static constexpr size_t BitsPerKey = 16;
+
+	ResourceKeyBloomFilter();
+
+	// Clears the filter and sizes it for the expected number of keys.
+	void Reset(size_t expectedKeyCount);
+
+	void Clear();
+
+	// Inserts a key into the filter, this must not be called while other threads
+	// are using the filter.
+	void Insert(const cGZPersistResourceKey& key);
+
+	// Inserts a key into the filter while other threads may be calling MayContain.
+	void InsertConcurrent(const cGZPersistResourceKey& key);
+
+	// Returns false if the key was never inserted, true if it may have been inserted.
+	// This can be called from multiple threads.
+	bool MayContain(const cGZPersistResourceKey& key) const;
+
+	bool IsEmpty() const;
+
+	size_t GetMemoryUsage() const;
+
+private:
+	struct alignas(32) Block
+	{
+		uint32_t words[8];
+	};
+
+	static uint64_t Hash(const cGZPersistResourceKey& key);
+
+	size_t GetBlockIndex(uint64_t hash) const;
+
+	std::vector<Block> blocks;
+};
@@ -11,9 +11,16 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "SC4DirectoryEnumerator.h"
+#include "DBPFHeaderCheck.h"
 #include "GZStringConvert.h"
+#include "Logger.h"
 #include "PathUtil.h"
+#include "ScanExclusionRules.h"
+#include "ScopedTimer.h"
+#include "StartupTrace.h"
+#include "Stopwatch.h"
 #include "StringViewUtil.h"
+#include <array>
 #include <format>
 #include <stdexcept>
 #include <Windows.h>
@@ -73,6 +80,8 @@ namespace
 			//
 			// If the file is not a DBPF file, it will fail the signature check that the game
 			// performs when loading DBPF files and the plugin will log it as an error.
+			// When the optional DBPF header check is enabled, these files are skipped during
+			// the scan instead.
 			result = true;
 		}
 
@@ -101,16 +110,106 @@ namespace
 		return directory;
 	}
 
+	struct DBPFHeaderCheckStatistics
+	{
+		DBPFHeaderCheckStatistics() : checkedFileCount(0), resultCounts{}, stopwatch()
+		{
+		}
+
+		uint32_t checkedFileCount;
+		std::array<uint32_t, static_cast<size_t>(DBPFHeaderCheck::Result::ReadError) + 1> resultCounts;
+		Stopwatch stopwatch;
+	};
+
+	struct ScanContext
+	{
+		ScanContext(
+			const SC4DirectoryEnumerator::ScanOptions& options,
+			FileNamePredicate predicate,
+			const SC4DirectoryEnumerator::FileFoundCallback& callback)
+			: options(options),
+			  Predicate(predicate),
+			  FileFound(callback),
+			  headerCheckStatistics(),
+			  prunedDirectoryCount(0),
+			  excludedFileCount(0)
+		{
+		}
+
+		const SC4DirectoryEnumerator::ScanOptions& options;
+		FileNamePredicate Predicate;
+		const SC4DirectoryEnumerator::FileFoundCallback& FileFound;
+		DBPFHeaderCheckStatistics headerCheckStatistics;
+		uint32_t prunedDirectoryCount;
+		uint32_t excludedFileCount;
+	};
+
+	struct DBPFFileCandidate
+	{
+		DBPFFileCandidate(const std::wstring_view& fileName, uint64_t fileSize)
+			: fileName(fileName), fileSize(fileSize)
+		{
+		}
+
+		std::wstring fileName;
+		uint64_t fileSize;
+	};
+
+	void CheckDBPFFileCandidates(
+		const std::wstring& directory,
+		const std::vector<DBPFFileCandidate>& candidates,
+		ScanContext& context)
+	{
+		SCOPED_TIMER("CheckDBPFFileCandidates");
+
+		// The candidates are checked as a batch after the directory has been enumerated,
+		// this keeps the find handle's directory reads separate from the file header reads.
+
+		DBPFHeaderCheckStatistics& statistics = context.headerCheckStatistics;
+
+		statistics.stopwatch.Start();
+
+		for (const DBPFFileCandidate& candidate : candidates)
+		{
+			const std::wstring path = PathUtil::Combine(directory, candidate.fileName);
+			const DBPFHeaderCheck::Result result = DBPFHeaderCheck::CheckFile(path, candidate.fileSize);
+
+			statistics.checkedFileCount++;
+			statistics.resultCounts[static_cast<size_t>(result)]++;
+
+			// Files with a header that could not be read are passed to the game, it will
+			// report the error if it also fails to read the file.
+			if (result == DBPFHeaderCheck::Result::Valid || result == DBPFHeaderCheck::Result::ReadError)
+			{
+				context.FileFound(CreateUtf8FilePath(directory, candidate.fileName), candidate.fileSize);
+			}
+			else
+			{
+				const cRZBaseString utf8Path = CreateUtf8FilePath(directory, candidate.fileName);
+
+				Logger::GetInstance().WriteLineFormatted(
+					LogLevel::Info,
+					"Skipped %s: %s.",
+					utf8Path.ToChar(),
+					DBPFHeaderCheck::GetResultDescription(result));
+			}
+		}
+
+		statistics.stopwatch.Stop();
+	}
+
 	void NativeScanDirectoryRecursive(
 		const std::wstring& directory,
 		bool normalizeExtendedPath,
-		std::vector<cRZBaseString>& files,
-		FileNamePredicate Predicate)
+		ScanContext& context)
 	{
 		std::vector<std::wstring> subFolders;
+		std::vector<DBPFFileCandidate> candidates;
 
 		WIN32_FIND_DATAW findData{};
 
+		const ScanExclusionRules* const exclusionRules = context.options.exclusionRules;
+
 		const std::wstring searchDirectory = GetSearchDirectoryPath(directory, normalizeExtendedPath);
 		const std::wstring searchPattern = PathUtil::Combine(searchDirectory, L"*"sv);
 
@@ -130,16 +229,38 @@ namespace
 				{
 					if (!wil::path_is_dot_or_dotdot(findData.cFileName))
 					{
-						subFolders.push_back(PathUtil::Combine(directory, std::wstring_view(findData.cFileName)));
+						const std::wstring_view directoryName(findData.cFileName);
+
+						if (exclusionRules && exclusionRules->IsDirectoryExcluded(directoryName))
+						{
+							context.prunedDirectoryCount++;
+						}
+						else
+						{
+							subFolders.push_back(PathUtil::Combine(directory, directoryName));
+						}
 					}
 				}
 				else
 				{
 					const std::wstring_view fileName(findData.cFileName);
 
-					if (Predicate(fileName))
+					if (exclusionRules && exclusionRules->IsFileExcluded(fileName))
+					{
+						context.excludedFileCount++;
+					}
+					else if (context.Predicate(fileName))
 					{
-						files.push_back(CreateUtf8FilePath(directory, fileName));
+						const uint64_t fileSize = (static_cast<uint64_t>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+
+						if (context.options.checkDBPFHeaders)
+						{
+							candidates.emplace_back(fileName, fileSize);
+						}
+						else
+						{
+							context.FileFound(CreateUtf8FilePath(directory, fileName), fileSize);
+						}
 					}
 				}
 			} while (FindNextFileW(findHandle.get(), &findData));
@@ -161,28 +282,91 @@ namespace
 			}
 		}
 
+		if (!candidates.empty())
+		{
+			CheckDBPFFileCandidates(directory, candidates, context);
+		}
+
 		// Recursively search the sub-directories.
 		for (const auto& path : subFolders)
 		{
-			NativeScanDirectoryRecursive(path, false, files, Predicate);
+			NativeScanDirectoryRecursive(path, false, context);
 		}
 	}
-}
 
-std::vector<cRZBaseString> SC4DirectoryEnumerator::GetDatFilesRecurseSubdirectories(const cIGZString& root)
-{
-	std::vector<cRZBaseString> files;
+	void LogDBPFHeaderCheckStatistics(const cIGZString& root, const DBPFHeaderCheckStatistics& statistics)
+	{
+		const auto& counts = statistics.resultCounts;
+
+		const uint32_t skippedFileCount = statistics.checkedFileCount
+			- counts[static_cast<size_t>(DBPFHeaderCheck::Result::Valid)]
+			- counts[static_cast<size_t>(DBPFHeaderCheck::Result::ReadError)];
+
+		// Every skipped file is a segment open that the game would have attempted and failed.
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"DBPF header check for %s: checked %u files in %lld ms, skipped %u (%u empty, %u too small,"
+			" %u without a DBPF signature, %u truncated), %u unreadable. Avoided %u failed segment opens.",
+			root.ToChar(),
+			statistics.checkedFileCount,
+			statistics.stopwatch.ElapsedMilliseconds(),
+			skippedFileCount,
+			counts[static_cast<size_t>(DBPFHeaderCheck::Result::EmptyFile)],
+			counts[static_cast<size_t>(DBPFHeaderCheck::Result::FileTooSmall)],
+			counts[static_cast<size_t>(DBPFHeaderCheck::Result::MissingSignature)],
+			counts[static_cast<size_t>(DBPFHeaderCheck::Result::IndexOutOfRange)],
+			counts[static_cast<size_t>(DBPFHeaderCheck::Result::ReadError)],
+			skippedFileCount);
+	}
+
+	void ScanDirectory(
+		const cIGZString& root,
+		const SC4DirectoryEnumerator::ScanOptions& options,
+		FileNamePredicate predicate,
+		const SC4DirectoryEnumerator::FileFoundCallback& callback)
+	{
+		StartupTrace::Span span("Directory scan", root.ToChar());
+		SCOPED_TIMER("ScanDirectory");
+
+		ScanContext context(options, predicate, callback);
 
-	NativeScanDirectoryRecursive(GZStringConvert::ToUtf16(root), true, files, DatFilesPredicate);
+		NativeScanDirectoryRecursive(GZStringConvert::ToUtf16(root), true, context);
+
+		if (options.checkDBPFHeaders)
+		{
+			LogDBPFHeaderCheckStatistics(root, context.headerCheckStatistics);
+		}
 
-	return files;
+		if (options.exclusionRules)
+		{
+			Logger::GetInstance().WriteLineFormatted(
+				LogLevel::Info,
+				"Exclusion rules for %s: pruned %u directories and %u files.",
+				root.ToChar(),
+				context.prunedDirectoryCount,
+				context.excludedFileCount);
+		}
+	}
 }
 
-std::vector<cRZBaseString> SC4DirectoryEnumerator::GetLooseSC4FilesRecurseSubdirectories(const cIGZString& root)
+SC4DirectoryEnumerator::ScanOptions::ScanOptions()
+	: checkDBPFHeaders(false),
+	  exclusionRules(nullptr)
 {
-	std::vector<cRZBaseString> files;
+}
 
-	NativeScanDirectoryRecursive(GZStringConvert::ToUtf16(root), true, files, SC4FilesPredicate);
+void SC4DirectoryEnumerator::EnumerateDatFilesRecurseSubdirectories(
+	const cIGZString& root,
+	const ScanOptions& options,
+	const FileFoundCallback& callback)
+{
+	ScanDirectory(root, options, DatFilesPredicate, callback);
+}
 
-	return files;
+void SC4DirectoryEnumerator::EnumerateLooseSC4FilesRecurseSubdirectories(
+	const cIGZString& root,
+	const ScanOptions& options,
+	const FileFoundCallback& callback)
+{
+	ScanDirectory(root, options, SC4FilesPredicate, callback);
 }
@@ -12,10 +12,35 @@
 
 #pragma once
 #include "cRZBaseString.h"
-#include <vector>
+#include <functional>
+
+class ScanExclusionRules;
 
 namespace SC4DirectoryEnumerator
 {
-	std::vector<cRZBaseString> GetDatFilesRecurseSubdirectories(const cIGZString& root);
-	std::vector<cRZBaseString> GetLooseSC4FilesRecurseSubdirectories(const cIGZString& root);
-};
\ No newline at end of file
+	struct ScanOptions
+	{
+		ScanOptions();
+
+		// Reads the header of each candidate file and skips the files that are
+		// not valid DBPF files.
+		bool checkDBPFHeaders;
+
+		// The directory and file name patterns that the scan skips, or nullptr
+		// if every directory and file should be scanned.
+		const ScanExclusionRules* exclusionRules;
+	};
+
+	// Called for each file that the scan finds, in the order the files are found.
+	// The file size is the one the directory listing reported.
+	typedef std::function<void(cRZBaseString&& path, uint64_t fileSize)> FileFoundCallback;
+
+	void EnumerateDatFilesRecurseSubdirectories(
+		const cIGZString& root,
+		const ScanOptions& options,
+		const FileFoundCallback& callback);
+	void EnumerateLooseSC4FilesRecurseSubdirectories(
+		const cIGZString& root,
+		const ScanOptions& options,
+		const FileFoundCallback& callback);
+};
@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ScanExclusionRules.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "cRZBaseString.h"
+#include <fstream>
+#include <Windows.h>
+#include "boost/algorithm/string.hpp"
+
+using namespace std::string_view_literals;
+
+namespace
+{
+	// The file names returned by FindFirstFileExW are limited to MAX_PATH characters.
+	constexpr size_t MaxNameLength = MAX_PATH;
+
+	std::wstring ToUpperCase(const std::wstring_view& value)
+	{
+		std::wstring result(value);
+
+		if (!result.empty())
+		{
+			CharUpperBuffW(result.data(), static_cast<DWORD>(result.size()));
+		}
+
+		return result;
+	}
+
+	// Converts the name to upper case using a caller-provided buffer.
+	// ASCII names are converted without calling into the OS.
+	std::wstring_view ToUpperCase(const std::wstring_view& name, wchar_t (&buffer)[MaxNameLength + 1])
+	{
+		const size_t length = std::min(name.size(), MaxNameLength);
+		bool isAscii = true;
+
+		for (size_t i = 0; i < length; i++)
+		{
+			wchar_t c = name[i];
+
+			if (c >= L'a' && c <= L'z')
+			{
+				c -= (L'a' - L'A');
+			}
+			else if (c >= 0x80)
+			{
+				isAscii = false;
+			}
+
+			buffer[i] = c;
+		}
+
+		if (!isAscii)
+		{
+			CharUpperBuffW(buffer, static_cast<DWORD>(length));
+		}
+
+		return std::wstring_view(buffer, length);
+	}
+
+	bool WildcardMatch(const std::wstring_view& pattern, const std::wstring_view& name)
+	{
+		size_t patternIndex = 0;
+		size_t nameIndex = 0;
+		size_t starPatternIndex = std::wstring_view::npos;
+		size_t starNameIndex = 0;
+
+		while (nameIndex < name.size())
+		{
+			if (patternIndex < pattern.size()
+				&& (pattern[patternIndex] == L'?' || pattern[patternIndex] == name[nameIndex]))
+			{
+				patternIndex++;
+				nameIndex++;
+			}
+			else if (patternIndex < pattern.size() && pattern[patternIndex] == L'*')
+			{
+				starPatternIndex = patternIndex++;
+				starNameIndex = nameIndex;
+			}
+			else if (starPatternIndex != std::wstring_view::npos)
+			{
+				// Backtrack and let the last * consume one more character.
+				patternIndex = starPatternIndex + 1;
+				nameIndex = ++starNameIndex;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		while (patternIndex < pattern.size() && pattern[patternIndex] == L'*')
+		{
+			patternIndex++;
+		}
+
+		return patternIndex == pattern.size();
+	}
+
+	bool IsMatch(const std::vector<ScanExclusionRules::Pattern>& patterns, const std::wstring_view& name)
+	{
+		if (!patterns.empty())
+		{
+			wchar_t buffer[MaxNameLength + 1];
+
+			const std::wstring_view upperCaseName = ToUpperCase(name, buffer);
+
+			for (const ScanExclusionRules::Pattern& pattern : patterns)
+			{
+				if (pattern.IsMatch(upperCaseName))
+				{
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+}
+
+ScanExclusionRules::Pattern::Pattern(const std::wstring_view& pattern)
+	: value(), kind(Kind::Exact)
+{
+	// The pattern is classified when it is loaded, so that the common forms
+	// can be matched without the general wildcard algorithm.
+
+	const std::wstring upperCasePattern = ToUpperCase(pattern);
+	const std::wstring_view view(upperCasePattern);
+
+	const size_t wildcardCount = std::count_if(
+		view.begin(),
+		view.end(),
+		[](wchar_t c) { return c == L'*' || c == L'?'; });
+	const bool hasQuestionMark = view.find(L'?') != std::wstring_view::npos;
+
+	if (wildcardCount == 0)
+	{
+		kind = Kind::Exact;
+		value = upperCasePattern;
+	}
+	else if (!hasQuestionMark && wildcardCount == 1 && view.back() == L'*')
+	{
+		kind = Kind::Prefix;
+		value = view.substr(0, view.size() - 1);
+	}
+	else if (!hasQuestionMark && wildcardCount == 1 && view.front() == L'*')
+	{
+		kind = Kind::Suffix;
+		value = view.substr(1);
+	}
+	else if (!hasQuestionMark && wildcardCount == 2 && view.size() > 2 && view.front() == L'*' && view.back() == L'*')
+	{
+		kind = Kind::Contains;
+		value = view.substr(1, view.size() - 2);
+	}
+	else
+	{
+		kind = Kind::Wildcard;
+		value = upperCasePattern;
+	}
+}
+
+bool ScanExclusionRules::Pattern::IsMatch(const std::wstring_view& upperCaseName) const
+{
+	switch (kind)
+	{
+	case Kind::Exact:
+		return upperCaseName == value;
+	case Kind::Prefix:
+		return upperCaseName.starts_with(value);
+	case Kind::Suffix:
+		return upperCaseName.ends_with(value);
+	case Kind::Contains:
+		return upperCaseName.find(value) != std::wstring_view::npos;
+	case Kind::Wildcard:
+	default:
+		return WildcardMatch(value, upperCaseName);
+	}
+}
+
+ScanExclusionRules& ScanExclusionRules::GetInstance()
+{
+	static ScanExclusionRules instance;
+
+	return instance;
+}
+
+ScanExclusionRules::ScanExclusionRules()
+	: directoryPatterns(), filePatterns()
+{
+}
+
+void ScanExclusionRules::Load(const std::filesystem::path& path)
+{
+	std::ifstream stream(path, std::ifstream::in | std::ifstream::binary);
+
+	if (stream)
+	{
+		Logger& logger = Logger::GetInstance();
+
+		std::string line;
+		uint32_t lineNumber = 0;
+
+		while (std::getline(stream, line))
+		{
+			lineNumber++;
+
+			std::string_view lineView(line);
+
+			// Skip the UTF-8 BOM, if present.
+			if (lineNumber == 1 && lineView.starts_with("\xEF\xBB\xBF"sv))
+			{
+				lineView.remove_prefix(3);
+			}
+
+			lineView = boost::trim_copy(lineView);
+
+			if (lineView.empty() || lineView.starts_with('#'))
+			{
+				continue;
+			}
+
+			const size_t separatorIndex = lineView.find(':');
+
+			if (separatorIndex == std::string_view::npos || separatorIndex == (lineView.size() - 1))
+			{
+				logger.WriteLineFormatted(
+					LogLevel::Error,
+					"Ignored exclusion rule on line %u, the rule must start with dir: or file: and include a pattern.",
+					lineNumber);
+				continue;
+			}
+
+			const std::string_view ruleType = boost::trim_copy(lineView.substr(0, separatorIndex));
+			const std::string_view patternText = boost::trim_copy(lineView.substr(separatorIndex + 1));
+
+			const cRZBaseString utf8Pattern(patternText.data(), static_cast<uint32_t>(patternText.size()));
+			const std::wstring pattern = GZStringConvert::ToUtf16(utf8Pattern);
+
+			if (boost::iequals(ruleType, "dir"sv))
+			{
+				directoryPatterns.emplace_back(pattern);
+			}
+			else if (boost::iequals(ruleType, "file"sv))
+			{
+				filePatterns.emplace_back(pattern);
+			}
+			else
+			{
+				logger.WriteLineFormatted(
+					LogLevel::Error,
+					"Ignored exclusion rule on line %u, unknown rule type: %.*s.",
+					lineNumber,
+					static_cast<int>(ruleType.size()),
+					ruleType.data());
+			}
+		}
+
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"Loaded %u directory and %u file exclusion rules.",
+			static_cast<uint32_t>(directoryPatterns.size()),
+			static_cast<uint32_t>(filePatterns.size()));
+	}
+}
+
+bool ScanExclusionRules::IsEmpty() const
+{
+	return directoryPatterns.empty() && filePatterns.empty();
+}
+
+bool ScanExclusionRules::IsDirectoryExcluded(const std::wstring_view& name) const
+{
+	return IsMatch(directoryPatterns, name);
+}
+
+bool ScanExclusionRules::IsFileExcluded(const std::wstring_view& name) const
+{
+	return IsMatch(filePatterns, name);
+}
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The directory and file name patterns that the plugin directory scan skips.
+// The rules are read from SC4DBPFLoadingExclusions.txt, one rule per line:
+//
+// dir:<pattern>  - skips any directory with a matching name, along with its contents.
+// file:<pattern> - skips any file with a matching name.
+//
+// Patterns are matched against the entry name, ignoring case.
+// They can use the * and ? wildcards. Lines starting with # are comments.
+class ScanExclusionRules
+{
+public:
+
+	static ScanExclusionRules& GetInstance();
+
+	void Load(const std::filesystem::path& path);
+
+	bool IsEmpty() const;
+
+	bool IsDirectoryExcluded(const std::wstring_view& name) const;
+
+	bool IsFileExcluded(const std::wstring_view& name) const;
+
+	class Pattern
+	{
+	public:
+		explicit Pattern(const std::wstring_view& pattern);
+
+		// The name must already be upper case.
+		bool IsMatch(const std::wstring_view& upperCaseName) const;
+
+	private:
+		enum class Kind
+		{
+			Exact,
+			Prefix,
+			Suffix,
+			Contains,
+			Wildcard
+		};
+
+		std::wstring value;
+		Kind kind;
+	};
+
+private:
+
+	ScanExclusionRules();
+
+	std::vector<Pattern> directoryPatterns;
+	std::vector<Pattern> filePatterns;
+};
@@ -0,0 +1,298 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ScopedTimer.h"
+
+#ifdef SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
+
+#include "Logger.h"
+#include "Stopwatch.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef SC4DBPFLOADING_SCOPED_TIMER_USE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif // _MSC_VER
+#endif // SC4DBPFLOADING_SCOPED_TIMER_USE_TSC
+
+namespace
+{
+	struct TimerNode
+	{
+		TimerNode(const char* name, uint32_t parentIndex)
+			: name(name),
+			  parentIndex(parentIndex),
+			  children(),
+			  count(0),
+			  totalTicks(0),
+			  minTicks(UINT64_MAX),
+			  maxTicks(0)
+		{
+		}
+
+		const char* name;
+		uint32_t parentIndex;
+		std::vector<uint32_t> children;
+		uint64_t count;
+		uint64_t totalTicks;
+		uint64_t minTicks;
+		uint64_t maxTicks;
+	};
+
+	// The scope tree of a single thread, node 0 is the root.
+	// Only the owning thread modifies the tree.
+	struct ThreadTimerData
+	{
+		ThreadTimerData()
+			: nodes(), currentNodeIndex(0)
+		{
+			nodes.emplace_back("", 0);
+		}
+
+		std::vector<TimerNode> nodes;
+		uint32_t currentNodeIndex;
+	};
+
+	// The thread data is owned by the registry so that the results of threads
+	// that have exited are included in the summary.
+	std::mutex threadDataMutex;
+	std::vector<std::unique_ptr<ThreadTimerData>> allThreadData;
+
+	ThreadTimerData& GetThreadData()
+	{
+		thread_local ThreadTimerData* threadData = nullptr;
+
+		if (!threadData)
+		{
+			std::unique_ptr<ThreadTimerData> data = std::make_unique<ThreadTimerData>();
+			threadData = data.get();
+
+			std::lock_guard<std::mutex> lock(threadDataMutex);
+			allThreadData.push_back(std::move(data));
+		}
+
+		return *threadData;
+	}
+
+#ifdef SC4DBPFLOADING_SCOPED_TIMER_USE_TSC
+	uint64_t GetTimeStamp()
+	{
+		return __rdtsc();
+	}
+
+	double CalibrateTicksPerSecond()
+	{
+		// Measure the time stamp counter against the performance counter for 10 ms.
+		const int64_t frequency = Stopwatch::GetFrequency();
+		const int64_t calibrationTicks = frequency / 100;
+
+		const int64_t start = Stopwatch::GetTimestamp();
+		const uint64_t tscStart = __rdtsc();
+
+		int64_t end;
+
+		do
+		{
+			end = Stopwatch::GetTimestamp();
+		} while ((end - start) < calibrationTicks);
+
+		const uint64_t tscEnd = __rdtsc();
+
+		return (static_cast<double>(tscEnd - tscStart) * static_cast<double>(frequency)) / static_cast<double>(end - start);
+	}
+
+	const char* const ClockName = "time stamp counter";
+#else
+	uint64_t GetTimeStamp()
+	{
+		return static_cast<uint64_t>(Stopwatch::GetTimestamp());
+	}
+
+	double CalibrateTicksPerSecond()
+	{
+		return static_cast<double>(Stopwatch::GetFrequency());
+	}
+
+#ifdef _WIN32
+	const char* const ClockName = "QueryPerformanceCounter";
+#else
+	const char* const ClockName = "steady_clock";
+#endif // _WIN32
+#endif // SC4DBPFLOADING_SCOPED_TIMER_USE_TSC
+
+	double GetTicksPerSecond()
+	{
+		static const double ticksPerSecond = CalibrateTicksPerSecond();
+
+		return ticksPerSecond;
+	}
+
+	struct MergedScope
+	{
+		MergedScope()
+			: depth(0), threadCount(0), count(0), totalTicks(0), minTicks(UINT64_MAX), maxTicks(0)
+		{
+		}
+
+		uint32_t depth;
+		uint32_t threadCount;
+		uint64_t count;
+		uint64_t totalTicks;
+		uint64_t minTicks;
+		uint64_t maxTicks;
+	};
+
+	void MergeNode(
+		const ThreadTimerData& data,
+		uint32_t nodeIndex,
+		const std::string& parentPath,
+		uint32_t depth,
+		std::map<std::string, MergedScope>& scopes)
+	{
+		const TimerNode& node = data.nodes[nodeIndex];
+
+		std::string path = parentPath;
+		path.push_back('\x01');
+		path.append(node.name);
+
+		MergedScope& scope = scopes[path];
+		scope.depth = depth;
+		scope.threadCount++;
+		scope.count += node.count;
+		scope.totalTicks += node.totalTicks;
+		scope.minTicks = std::min(scope.minTicks, node.minTicks);
+		scope.maxTicks = std::max(scope.maxTicks, node.maxTicks);
+
+		for (uint32_t childIndex : node.children)
+		{
+			MergeNode(data, childIndex, path, depth + 1, scopes);
+		}
+	}
+}
+
+ScopedTimer::ScopedTimer(const char* const name) noexcept
+{
+	ThreadTimerData& data = GetThreadData();
+
+	TimerNode& parent = data.nodes[data.currentNodeIndex];
+
+	uint32_t index = 0;
+
+	for (uint32_t childIndex : parent.children)
+	{
+		if (data.nodes[childIndex].name == name)
+		{
+			index = childIndex;
+			break;
+		}
+	}
+
+	if (index == 0)
+	{
+		index = static_cast<uint32_t>(data.nodes.size());
+
+		// The parent reference is invalidated when the node is added.
+		data.nodes[data.currentNodeIndex].children.push_back(index);
+		data.nodes.emplace_back(name, data.currentNodeIndex);
+	}
+
+	data.currentNodeIndex = index;
+
+	nodeIndex = index;
+	startTimeStamp = GetTimeStamp();
+}
+
+ScopedTimer::~ScopedTimer() noexcept
+{
+	const uint64_t elapsed = GetTimeStamp() - startTimeStamp;
+
+	ThreadTimerData& data = GetThreadData();
+
+	TimerNode& node = data.nodes[nodeIndex];
+	node.count++;
+	node.totalTicks += elapsed;
+	node.minTicks = std::min(node.minTicks, elapsed);
+	node.maxTicks = std::max(node.maxTicks, elapsed);
+
+	data.currentNodeIndex = node.parentIndex;
+}
+
+void ScopedTimer::WriteSummary()
+{
+	// The map is sorted by the scope path, which places each scope after its parent.
+	std::map<std::string, MergedScope> scopes;
+
+	{
+		std::lock_guard<std::mutex> lock(threadDataMutex);
+
+		for (const std::unique_ptr<ThreadTimerData>& data : allThreadData)
+		{
+			for (uint32_t childIndex : data->nodes[0].children)
+			{
+				MergeNode(*data, childIndex, std::string(), 0, scopes);
+			}
+		}
+	}
+
+	if (scopes.empty())
+	{
+		return;
+	}
+
+	Logger& logger = Logger::GetInstance();
+
+	const double ticksPerMicrosecond = GetTicksPerSecond() / 1000000.0;
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"Scoped timer summary (%s, %.0f ticks per second):",
+		ClockName,
+		GetTicksPerSecond());
+	logger.WriteLine(
+		LogLevel::Info,
+		"Scope                                             Threads      Count     Total ms     Avg us     Min us     Max us");
+
+	for (const auto& item : scopes)
+	{
+		const MergedScope& scope = item.second;
+
+		if (scope.count == 0)
+		{
+			continue;
+		}
+
+		const size_t nameStart = item.first.rfind('\x01') + 1;
+		const std::string_view name = std::string_view(item.first).substr(nameStart);
+
+		const std::string indentedName = std::string(scope.depth * 2, ' ').append(name);
+
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"%-48.48s %8u %10llu %12.3f %10.3f %10.3f %10.3f",
+			indentedName.c_str(),
+			scope.threadCount,
+			scope.count,
+			static_cast<double>(scope.totalTicks) / (ticksPerMicrosecond * 1000.0),
+			static_cast<double>(scope.totalTicks) / (ticksPerMicrosecond * static_cast<double>(scope.count)),
+			static_cast<double>(scope.minTicks) / ticksPerMicrosecond,
+			static_cast<double>(scope.maxTicks) / ticksPerMicrosecond);
+	}
+}
+
+#endif // SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
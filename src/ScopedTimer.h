@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Hierarchical scoped timers for profiling the plugin code.
+//
+// The timers only exist when SC4DBPFLOADING_ENABLE_SCOPED_TIMERS is defined. Otherwise
+// the SCOPED_TIMER macro expands to nothing and this header declares nothing.
+// Defining SC4DBPFLOADING_SCOPED_TIMER_USE_TSC uses the processor time stamp counter
+// instead of QueryPerformanceCounter, the counter is calibrated against the Stopwatch
+// frequency when it is first used.
+//
+// Each thread records the count, total, minimum and maximum time of every scope,
+// grouped by the scopes that enclose it. The per-thread results are merged when
+// the summary is written to the log file.
+//
+// Usage:
+//
+// void Foo()
+// {
+//     SCOPED_TIMER("Foo");
+//     ...
+// }
+
+#ifdef SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
+
+#include <stdint.h>
+
+class ScopedTimer
+{
+public:
+	// The name must be a string literal, or another string that lives as long as the process.
+	explicit ScopedTimer(const char* const name) noexcept;
+	~ScopedTimer() noexcept;
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	// Writes the merged results of all threads to the log file.
+	// This must be called when no timed scopes are running, e.g. during shutdown.
+	static void WriteSummary();
+
+private:
+	uint32_t nodeIndex;
+	uint64_t startTimeStamp;
+};
+
+#define SCOPED_TIMER_CONCAT_INNER(a, b) a##b
+#define SCOPED_TIMER_CONCAT(a, b) SCOPED_TIMER_CONCAT_INNER(a, b)
+#define SCOPED_TIMER(name) ScopedTimer SCOPED_TIMER_CONCAT(scopedTimer, __LINE__)(name)
+#define SCOPED_TIMER_WRITE_SUMMARY() ScopedTimer::WriteSummary()
+
+#else
+
+#define SCOPED_TIMER(name) ((void)0)
+#define SCOPED_TIMER_WRITE_SUMMARY() ((void)0)
+
+#endif // SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
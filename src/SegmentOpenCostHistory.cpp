@@ -0,0 +1,155 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "SegmentOpenCostHistory.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include <charconv>
+#include <fstream>
+
+using namespace std::string_view_literals;
+
+namespace
+{
+	bool IsInFolder(const std::string_view& path, const std::string_view& folderPath)
+	{
+		if (path.size() > folderPath.size() && path.starts_with(folderPath))
+		{
+			// The folder path must be followed by a directory separator, or already end with one.
+			// This prevents a folder named Plugins from matching the files in a folder named Plugins2.
+			return PathUtil::IsDirectorySeparator(folderPath.back())
+				|| PathUtil::IsDirectorySeparator(path[folderPath.size()]);
+		}
+
+		return false;
+	}
+}
+
+SegmentOpenCostHistory::Entry::Entry(const std::string_view& path, uint32_t cost)
+	: path(path), cost(cost)
+{
+}
+
+SegmentOpenCostHistory& SegmentOpenCostHistory::GetInstance()
+{
+	static SegmentOpenCostHistory instance;
+
+	return instance;
+}
+
+SegmentOpenCostHistory::SegmentOpenCostHistory()
+	: mutex(), historyFilePath(), costs()
+{
+}
+
+void SegmentOpenCostHistory::Load(const std::filesystem::path& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	historyFilePath = path;
+
+	std::ifstream stream(path, std::ifstream::in | std::ifstream::binary);
+
+	if (stream)
+	{
+		std::string line;
+
+		while (std::getline(stream, line))
+		{
+			std::string_view lineView(line);
+
+			if (lineView.ends_with('\r'))
+			{
+				lineView.remove_suffix(1);
+			}
+
+			const size_t separatorIndex = lineView.find('\t');
+
+			if (separatorIndex != std::string_view::npos && separatorIndex < (lineView.size() - 1))
+			{
+				uint32_t cost = 0;
+
+				const char* const costStart = lineView.data();
+				const char* const costEnd = costStart + separatorIndex;
+
+				const std::from_chars_result result = std::from_chars(costStart, costEnd, cost);
+
+				if (result.ec == std::errc() && result.ptr == costEnd)
+				{
+					costs.insert_or_assign(std::string(lineView.substr(separatorIndex + 1)), cost);
+				}
+			}
+		}
+
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"Loaded the open times of %u files from the previous run.",
+			static_cast<uint32_t>(costs.size()));
+	}
+}
+
+void SegmentOpenCostHistory::Save() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (historyFilePath.empty())
+	{
+		return;
+	}
+
+	std::ofstream stream(historyFilePath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+	if (!stream)
+	{
+		throw std::runtime_error("Failed to open the file for writing.");
+	}
+
+	for (const auto& item : costs)
+	{
+		stream << item.second << '\t' << item.first << "\r\n";
+	}
+}
+
+uint32_t SegmentOpenCostHistory::GetCost(const std::string_view& path) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const auto it = costs.find(path);
+
+	return it != costs.end() ? it->second : UnknownCost;
+}
+
+void SegmentOpenCostHistory::Update(const std::string_view& rootFolderPath, const std::vector<Entry>& entries)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Remove the files that were previously loaded from the folder, this prevents
+	// the history from growing when files are deleted or renamed.
+	auto it = costs.lower_bound(rootFolderPath);
+
+	while (it != costs.end() && it->first.starts_with(rootFolderPath))
+	{
+		if (IsInFolder(it->first, rootFolderPath))
+		{
+			it = costs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	for (const Entry& entry : entries)
+	{
+		costs.insert_or_assign(entry.path, entry.cost);
+	}
+}
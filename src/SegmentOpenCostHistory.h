@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The time that each DBPF file took to open on the previous run, used to schedule
+// the most expensive files first when the files are opened in parallel.
+// The history is stored in SC4DBPFLoadingOpenCosts.txt, one file per line:
+//
+// <open time in microseconds><tab><file path>
+//
+// The history is shared by every multi-packed file, the methods can be called from
+// the threads that finish the background indexing while another folder is being opened.
+class SegmentOpenCostHistory
+{
+public:
+
+	static constexpr uint32_t UnknownCost = UINT32_MAX;
+
+	struct Entry
+	{
+		Entry(const std::string_view& path, uint32_t cost);
+
+		std::string path;
+		uint32_t cost;
+	};
+
+	static SegmentOpenCostHistory& GetInstance();
+
+	void Load(const std::filesystem::path& path);
+
+	void Save() const;
+
+	// Gets the open time of the specified file from the previous run, or UnknownCost
+	// if the file is not in the history.
+	uint32_t GetCost(const std::string_view& path) const;
+
+	// Replaces the history for the files in the root folder and its sub-folders.
+	void Update(const std::string_view& rootFolderPath, const std::vector<Entry>& entries);
+
+private:
+
+	SegmentOpenCostHistory();
+
+	mutable std::mutex mutex;
+	std::filesystem::path historyFilePath;
+	std::map<std::string, uint32_t, std::less<>> costs;
+};
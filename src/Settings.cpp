@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Settings.h"
+#include <algorithm>
+#include <fstream>
+#include "boost/property_tree/ptree.hpp"
+#include "boost/property_tree/ini_parser.hpp"
+
+namespace
+{
+	constexpr uint32_t MaxParallelSegmentOpenThreads = 16;
+	constexpr uint32_t MaxSmallFileMemoryThreshold = 1024;
+}
+
+Settings& Settings::GetInstance()
+{
+	static Settings instance;
+
+	return instance;
+}
+
+Settings::Settings()
+	: checkDBPFHeadersDuringScan(false),
+	  pipelinedScanAndOpen(false),
+	  parallelSegmentOpenThreads(0),
+	  asyncLogging(false),
+	  recordAccessStatistics(false),
+	  resourceAccessTrace(false),
+	  negativeLookupFilter(false),
+	  globalKeyIndex(false),
+	  backgroundIndexing(false),
+	  cityAccessHistory(false),
+	  cityRecordPrewarming(false),
+	  regionCityFilePrefetch(false),
+	  smallFileMemoryThreshold(0),
+	  combineSC4PluginFolders(false),
+	  pluginPacks(false)
+{
+}
+
+void Settings::Load(const std::filesystem::path& path)
+{
+	std::ifstream stream(path, std::ifstream::in);
+
+	if (stream)
+	{
+		boost::property_tree::ptree tree;
+
+		boost::property_tree::ini_parser::read_ini(stream, tree);
+
+		checkDBPFHeadersDuringScan = tree.get<bool>("SC4DBPFLoading.CheckDBPFHeadersDuringScan", false);
+		pipelinedScanAndOpen = tree.get<bool>("SC4DBPFLoading.PipelinedScanAndOpen", false);
+		parallelSegmentOpenThreads = std::min(
+			tree.get<uint32_t>("SC4DBPFLoading.ParallelSegmentOpenThreads", 0),
+			MaxParallelSegmentOpenThreads);
+		asyncLogging = tree.get<bool>("SC4DBPFLoading.AsyncLogging", false);
+		recordAccessStatistics = tree.get<bool>("SC4DBPFLoading.RecordAccessStatistics", false);
+		resourceAccessTrace = tree.get<bool>("SC4DBPFLoading.ResourceAccessTrace", false);
+		negativeLookupFilter = tree.get<bool>("SC4DBPFLoading.NegativeLookupFilter", false);
+		globalKeyIndex = tree.get<bool>("SC4DBPFLoading.GlobalKeyIndex", false);
+		backgroundIndexing = tree.get<bool>("SC4DBPFLoading.BackgroundIndexing", false);
+		cityAccessHistory = tree.get<bool>("SC4DBPFLoading.CityAccessHistory", false);
+		cityRecordPrewarming = tree.get<bool>("SC4DBPFLoading.CityRecordPrewarming", false);
+		regionCityFilePrefetch = tree.get<bool>("SC4DBPFLoading.RegionCityFilePrefetch", false);
+		smallFileMemoryThreshold = std::min(
+			tree.get<uint32_t>("SC4DBPFLoading.SmallFileMemoryThreshold", 0),
+			MaxSmallFileMemoryThreshold);
+		combineSC4PluginFolders = tree.get<bool>("SC4DBPFLoading.CombineSC4PluginFolders", false);
+		pluginPacks = tree.get<bool>("SC4DBPFLoading.PluginPacks", false);
+	}
+}
+
+bool Settings::CheckDBPFHeadersDuringScan() const
+{
+	return checkDBPFHeadersDuringScan;
+}
+
+bool Settings::PipelinedScanAndOpen() const
+{
+	return pipelinedScanAndOpen;
+}
+
+uint32_t Settings::ParallelSegmentOpenThreads() const
+{
+	return parallelSegmentOpenThreads;
+}
+
+bool Settings::AsyncLogging() const
+{
+	return asyncLogging;
+}
+
+bool Settings::RecordAccessStatistics() const
+{
+	return recordAccessStatistics;
+}
+
+bool Settings::ResourceAccessTrace() const
+{
+	return resourceAccessTrace;
+}
+
+bool Settings::NegativeLookupFilter() const
+{
+	return negativeLookupFilter;
+}
+
+bool Settings::GlobalKeyIndex() const
+{
+	return globalKeyIndex;
+}
+
+bool Settings::BackgroundIndexing() const
+{
+	return backgroundIndexing;
+}
+
+bool Settings::CityAccessHistory() const
+{
+	return cityAccessHistory;
+}
+
+bool Settings::CityRecordPrewarming() const
+{
+	return cityRecordPrewarming;
+}
+
+bool Settings::RegionCityFilePrefetch() const
+{
+	return regionCityFilePrefetch;
+}
+
+uint32_t Settings::SmallFileMemoryThreshold() const
+{
+	return smallFileMemoryThreshold;
+}
+
+bool Settings::CombineSC4PluginFolders() const
+{
+	return combineSC4PluginFolders;
+}
+
+bool Settings::PluginPacks() const
+{
+	return pluginPacks;
+}
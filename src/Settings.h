@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <filesystem>
+#include <stdint.h>
+
+// The optional plugin settings that are read from SC4DBPFLoading.ini.
+// Every setting defaults to the plugin's standard behavior when the file
+// or the setting is not present.
+class Settings
+{
+public:
+
+	static Settings& GetInstance();
+
+	void Load(const std::filesystem::path& path);
+
+	// Gets a value indicating whether the directory scan reads the header of each
+	// candidate file and skips the files that are not valid DBPF files.
+	bool CheckDBPFHeadersDuringScan() const;
+
+	// Gets a value indicating whether the directory scan runs on a background thread
+	// while the files it has already found are being opened.
+	bool PipelinedScanAndOpen() const;
+
+	// Gets the number of threads that are used to open the DBPF files, values less
+	// than 2 open the files on the calling thread.
+	uint32_t ParallelSegmentOpenThreads() const;
+
+	// Gets a value indicating whether the log messages are written to the file
+	// on a background thread.
+	bool AsyncLogging() const;
+
+	// Gets a value indicating whether the plugin counts and times the record access
+	// calls that are made after the plugins are loaded.
+	bool RecordAccessStatistics() const;
+
+	// Gets a value indicating whether the multi-packed file calls are recorded to a
+	// trace file that can be replayed by the DBPFTraceReplay tool.
+	bool ResourceAccessTrace() const;
+
+	// Gets a value indicating whether each multi-packed file builds a Bloom filter of its keys
+	// that answers the lookups for missing keys without taking the file's lock.
+	bool NegativeLookupFilter() const;
+
+	// Gets a value indicating whether the multi-packed files share an index of their keys
+	// that answers the lookups for the keys that a file does not have.
+	bool GlobalKeyIndex() const;
+
+	// Gets a value indicating whether the plugin files are prefetched on a background thread,
+	// the first lookup in a plugin folder waits for the prefetch and opens and indexes the files.
+	bool BackgroundIndexing() const;
+
+	// Gets a value indicating whether the plugin records the records that are read
+	// while each city is loading, and logs the city load time.
+	bool CityAccessHistory() const;
+
+	// Gets a value indicating whether the records from a city's previous load are read
+	// on worker threads when the city is opened.
+	bool CityRecordPrewarming() const;
+
+	// Gets a value indicating whether the region view data of a region's city files
+	// is read on worker threads when the region is opened.
+	bool RegionCityFilePrefetch() const;
+
+	// Gets the size in KB of the largest plugin file that is read into memory instead
+	// of being kept open, or 0 if the files are not read into memory.
+	uint32_t SmallFileMemoryThreshold() const;
+
+	// Gets a value indicating whether the .SC4* files in the installation and user
+	// Plugins folders are loaded as one segment.
+	bool CombineSC4PluginFolders() const;
+
+	// Gets a value indicating whether the .dat files of a plugin folder are loaded from
+	// the folder's consolidated plugin pack when it is up to date.
+	bool PluginPacks() const;
+
+private:
+
+	Settings();
+
+	bool checkDBPFHeadersDuringScan;
+	bool pipelinedScanAndOpen;
+	uint32_t parallelSegmentOpenThreads;
+	bool asyncLogging;
+	bool recordAccessStatistics;
+	bool resourceAccessTrace;
+	bool negativeLookupFilter;
+	bool globalKeyIndex;
+	bool backgroundIndexing;
+	bool cityAccessHistory;
+	bool cityRecordPrewarming;
+	bool regionCityFilePrefetch;
+	uint32_t smallFileMemoryThreshold;
+	bool combineSC4PluginFolders;
+	bool pluginPacks;
+};
@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "StartupTrace.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <Windows.h>
+
+namespace
+{
+	// The buffers use approximately 6 MB, enough for the spans of more than 30,000 DBPF files.
+	constexpr size_t MaxSpanCount = 65536;
+	constexpr size_t DetailBufferSize = 4 * 1024 * 1024;
+
+	int64_t GetTimeStamp()
+	{
+		LARGE_INTEGER li{};
+
+		QueryPerformanceCounter(&li);
+
+		return li.QuadPart;
+	}
+
+	void WriteJsonString(std::ofstream& stream, const char* const value, size_t length)
+	{
+		stream << '"';
+
+		for (size_t i = 0; i < length; i++)
+		{
+			const char c = value[i];
+
+			switch (c)
+			{
+			case '"':
+				stream << "\\\"";
+				break;
+			case '\\':
+				stream << "\\\\";
+				break;
+			case '\n':
+				stream << "\\n";
+				break;
+			case '\r':
+				stream << "\\r";
+				break;
+			case '\t':
+				stream << "\\t";
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char buffer[8]{};
+					std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(c));
+					stream << buffer;
+				}
+				else
+				{
+					stream << c;
+				}
+				break;
+			}
+		}
+
+		stream << '"';
+	}
+}
+
+StartupTrace::Span::Span(const char* const name)
+	: Span(name, nullptr)
+{
+}
+
+StartupTrace::Span::Span(const char* const name, const char* const detail)
+	: name(name),
+	  detail(detail),
+	  startTimeStamp(0)
+{
+	if (StartupTrace::GetInstance().IsEnabled())
+	{
+		startTimeStamp = GetTimeStamp();
+	}
+}
+
+StartupTrace::Span::~Span()
+{
+	if (startTimeStamp != 0)
+	{
+		StartupTrace::GetInstance().AddSpan(name, detail, startTimeStamp);
+	}
+}
+
+StartupTrace& StartupTrace::GetInstance()
+{
+	static StartupTrace instance;
+
+	return instance;
+}
+
+StartupTrace::StartupTrace()
+	: enabled(false),
+	  activeWriterCount(0),
+	  traceStartTimeStamp(0),
+	  timeStampFrequency(1),
+	  spans(),
+	  detailBuffer(),
+	  spanCount(0),
+	  detailBufferUsed(0),
+	  droppedSpanCount(0)
+{
+}
+
+void StartupTrace::Enable()
+{
+	if (!enabled)
+	{
+		spans = std::make_unique_for_overwrite<SpanRecord[]>(MaxSpanCount);
+		detailBuffer = std::make_unique_for_overwrite<char[]>(DetailBufferSize);
+
+		LARGE_INTEGER frequency{};
+		QueryPerformanceFrequency(&frequency);
+
+		timeStampFrequency = frequency.QuadPart;
+		traceStartTimeStamp = GetTimeStamp();
+		enabled = true;
+	}
+}
+
+bool StartupTrace::IsEnabled() const
+{
+	return enabled;
+}
+
+void StartupTrace::WriteFile(const std::filesystem::path& path)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	enabled = false;
+
+	// A thread that saw the trace as enabled may still be filling its span record.
+	while (activeWriterCount.load() != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	std::ofstream stream(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+	if (!stream)
+	{
+		throw std::runtime_error("Failed to open the trace file for writing.");
+	}
+
+	const size_t count = std::min(spanCount.load(std::memory_order_relaxed), MaxSpanCount);
+	const uint32_t processID = GetCurrentProcessId();
+
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const SpanRecord& span = spans[i];
+
+		// The time stamps are converted to microseconds, the unit used by the trace format.
+		const int64_t start = ((span.startTimeStamp - traceStartTimeStamp) * 1000000) / timeStampFrequency;
+		const int64_t duration = ((span.endTimeStamp - span.startTimeStamp) * 1000000) / timeStampFrequency;
+
+		if (i > 0)
+		{
+			stream << ',';
+		}
+
+		stream << "\n{\"name\":";
+		WriteJsonString(stream, span.name, std::strlen(span.name));
+		stream << ",\"cat\":\"dbpf\",\"ph\":\"X\",\"ts\":" << start
+			<< ",\"dur\":" << duration
+			<< ",\"pid\":" << processID
+			<< ",\"tid\":" << span.threadID;
+
+		if (span.detail)
+		{
+			stream << ",\"args\":{\"path\":";
+			WriteJsonString(stream, span.detail, span.detailLength);
+			stream << '}';
+		}
+
+		stream << '}';
+	}
+
+	stream << "\n],\"otherData\":{\"droppedSpans\":" << droppedSpanCount.load(std::memory_order_relaxed) << "}}\n";
+
+	spans.reset();
+	detailBuffer.reset();
+}
+
+void StartupTrace::AddSpan(const char* const name, const char* const detail, int64_t startTimeStamp)
+{
+	const int64_t endTimeStamp = GetTimeStamp();
+
+	// The writer count is incremented before the enabled flag is checked, so WriteFile
+	// either sees this thread as active or this thread sees the trace as stopped.
+	activeWriterCount.fetch_add(1);
+
+	if (enabled)
+	{
+		const size_t index = spanCount.fetch_add(1, std::memory_order_relaxed);
+
+		if (index < MaxSpanCount)
+		{
+			SpanRecord& span = spans[index];
+			span.name = name;
+			span.detail = CopyDetail(detail, span.detailLength);
+			span.threadID = GetCurrentThreadId();
+			span.startTimeStamp = startTimeStamp;
+			span.endTimeStamp = endTimeStamp;
+		}
+		else
+		{
+			droppedSpanCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	activeWriterCount.fetch_sub(1);
+}
+
+const char* StartupTrace::CopyDetail(const char* const detail, uint32_t& length)
+{
+	length = 0;
+
+	if (detail)
+	{
+		const size_t detailLength = std::strlen(detail);
+		const size_t offset = detailBufferUsed.fetch_add(detailLength, std::memory_order_relaxed);
+
+		if (detailLength <= DetailBufferSize && offset <= (DetailBufferSize - detailLength))
+		{
+			char* const destination = detailBuffer.get() + offset;
+
+			std::memcpy(destination, detail, detailLength);
+			length = static_cast<uint32_t>(detailLength);
+
+			return destination;
+		}
+	}
+
+	return nullptr;
+}
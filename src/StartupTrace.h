@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <stdint.h>
+
+// Records timed spans of the startup DBPF loading and writes them to a file in the
+// Chrome trace event format, which can be viewed in Perfetto or chrome://tracing.
+// The spans are stored in buffers that are allocated when the trace is enabled, so
+// recording a span does not allocate memory or take a lock.
+class StartupTrace
+{
+public:
+
+	// Times the lifetime of the object, and adds it as a span when the trace is enabled.
+	class Span
+	{
+	public:
+		explicit Span(const char* const name);
+		Span(const char* const name, const char* const detail);
+		~Span();
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+	private:
+		const char* const name;
+		const char* const detail;
+		int64_t startTimeStamp;
+	};
+
+	static StartupTrace& GetInstance();
+
+	void Enable();
+
+	bool IsEnabled() const;
+
+	// Writes the recorded spans to the specified file and stops the trace.
+	// The spans that end after the trace was stopped, such as the background
+	// indexing of the plugin folders, are not recorded.
+	void WriteFile(const std::filesystem::path& path);
+
+private:
+
+	struct SpanRecord
+	{
+		const char* name;
+		const char* detail;
+		uint32_t detailLength;
+		uint32_t threadID;
+		int64_t startTimeStamp;
+		int64_t endTimeStamp;
+	};
+
+	StartupTrace();
+
+	void AddSpan(const char* const name, const char* const detail, int64_t startTimeStamp);
+
+	const char* CopyDetail(const char* const detail, uint32_t& length);
+
+	std::atomic<bool> enabled;
+	// The number of threads that are in AddSpan, WriteFile waits for them
+	// to finish before it reads the spans and frees the buffers.
+	std::atomic<uint32_t> activeWriterCount;
+	int64_t traceStartTimeStamp;
+	int64_t timeStampFrequency;
+	std::unique_ptr<SpanRecord[]> spans;
+	std::unique_ptr<char[]> detailBuffer;
+	std::atomic<size_t> spanCount;
+	std::atomic<size_t> detailBufferUsed;
+	std::atomic<uint32_t> droppedSpanCount;
+};
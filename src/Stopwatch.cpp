@@ -11,7 +11,12 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Stopwatch.h"
+
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <chrono>
+#endif // _WIN32
 
 // This code is based on the .NET runtime Stopwatch and TimeSpan types.
 
@@ -21,11 +26,13 @@ namespace
 	constexpr int64_t SecondsPerMinute = 60;
 	constexpr int64_t MinutesPerHour = 60;
 
+	constexpr int64_t TicksPerMicrosecond = 10;
 	constexpr int64_t TicksPerMillisecond = 10000;
 	constexpr int64_t TicksPerSecond = TicksPerMillisecond * MillisecondsPerSecond;
 	constexpr int64_t TicksPerMinute = TicksPerSecond * SecondsPerMinute;
 	constexpr int64_t TicksPerHour = TicksPerMinute * MinutesPerHour;
 
+#ifdef _WIN32
 	int64_t GetTimeStamp()
 	{
 		LARGE_INTEGER li{};
@@ -35,13 +42,33 @@ namespace
 		return li.QuadPart;
 	}
 
-	int64_t GetTickFrequency()
+	int64_t GetCounterFrequency()
 	{
 		LARGE_INTEGER li{};
 
 		QueryPerformanceFrequency(&li);
 
-		return TicksPerSecond / li.QuadPart;
+		return li.QuadPart;
+	}
+#else
+	// The tools that use this class on other platforms get a counter with the
+	// 10 MHz frequency that QueryPerformanceCounter has on current Windows versions.
+	using CounterDuration = std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
+
+	int64_t GetTimeStamp()
+	{
+		return std::chrono::duration_cast<CounterDuration>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	int64_t GetCounterFrequency()
+	{
+		return CounterDuration::period::den;
+	}
+#endif // _WIN32
+
+	int64_t GetTickFrequency()
+	{
+		return TicksPerSecond / GetCounterFrequency();
 	}
 }
 
@@ -50,6 +77,21 @@ Stopwatch::Stopwatch() noexcept
 {
 }
 
+int64_t Stopwatch::GetTimestamp()
+{
+	return GetTimeStamp();
+}
+
+int64_t Stopwatch::GetFrequency()
+{
+	return GetCounterFrequency();
+}
+
+int64_t Stopwatch::ElapsedMicroseconds() const
+{
+	return (GetElapsedTicks() / TicksPerMicrosecond);
+}
+
 int64_t Stopwatch::ElapsedMilliseconds() const
 {
 	return (GetElapsedTicks() / TicksPerMillisecond);
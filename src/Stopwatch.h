@@ -20,6 +20,14 @@ public:
 
 	Stopwatch() noexcept;
 
+	// Gets the current value of the high resolution performance counter.
+	static int64_t GetTimestamp();
+
+	// Gets the number of performance counter ticks per second.
+	static int64_t GetFrequency();
+
+	int64_t ElapsedMicroseconds() const;
+
 	int64_t ElapsedMilliseconds() const;
 
 	int64_t ElapsedSeconds() const;
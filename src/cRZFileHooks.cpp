@@ -11,12 +11,14 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "cRZFileHooks.h"
+#include "CityAccessHistory.h"
 #include "cIGZString.h"
 #include "DebugUtil.h"
 #include "GZStringConvert.h"
 #include "Logger.h"
 #include "Patcher.h"
 #include "PathUtil.h"
+#include "RegionPrefetcher.h"
 #include <stdexcept>
 
 #define NOMINMAX
@@ -261,6 +263,20 @@ namespace
 						pThis->currentFilePosition = currentFilePosition;
 						pThis->position = currentFilePosition;
 						result = true;
+
+						CityAccessHistory& cityAccessHistory = CityAccessHistory::GetInstance();
+
+						if (cityAccessHistory.IsEnabled())
+						{
+							cityAccessHistory.FileOpened(*utf8FilePath);
+						}
+
+						RegionPrefetcher& regionPrefetcher = RegionPrefetcher::GetInstance();
+
+						if (regionPrefetcher.IsEnabled())
+						{
+							regionPrefetcher.FileOpened(*utf8FilePath, hFile);
+						}
 					}
 				}
 				catch (const std::bad_alloc&)
@@ -294,6 +310,8 @@ namespace
 
 		if (pThis->isOpen)
 		{
+			const uint32_t position = pThis->position;
+
 			if (byteCount == 0)
 			{
 				result = true;
@@ -340,6 +358,11 @@ namespace
 					result = RealReadWithCount(pThis, outBuffer, byteCount);
 				}
 			}
+
+			if (result)
+			{
+				RegionPrefetcher::GetInstance().FileRead(pThis->fileHandle, position, byteCount);
+			}
 		}
 
 		return result;
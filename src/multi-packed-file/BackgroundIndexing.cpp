@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BackgroundIndexing.h"
+
+BackgroundIndexing::BackgroundIndexing()
+	: thread(),
+	  pending(false),
+	  canceled(false),
+	  mutex(),
+	  finishThreadID(),
+	  finishWork(),
+	  backgroundStopwatch(),
+	  waitStopwatch(),
+	  finishStopwatch()
+{
+}
+
+BackgroundIndexing::~BackgroundIndexing()
+{
+	Cancel();
+}
+
+void BackgroundIndexing::Start(BackgroundWork&& backgroundWork, FinishWork&& finishWork)
+{
+	this->finishWork = std::move(finishWork);
+	canceled = false;
+	pending.store(true, std::memory_order_release);
+
+	thread = std::thread(
+		[this, backgroundWork = std::move(backgroundWork)]()
+		{
+			backgroundStopwatch.Start();
+
+			backgroundWork(canceled);
+
+			backgroundStopwatch.Stop();
+		});
+}
+
+bool BackgroundIndexing::IsPending() const
+{
+	return pending.load(std::memory_order_acquire);
+}
+
+bool BackgroundIndexing::Wait()
+{
+	if (!pending.load(std::memory_order_acquire)
+		|| finishThreadID.load(std::memory_order_relaxed) == std::this_thread::get_id())
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!pending.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	finishThreadID.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+	waitStopwatch.Start();
+
+	thread.join();
+
+	waitStopwatch.Stop();
+	finishStopwatch.Start();
+
+	try
+	{
+		finishWork();
+	}
+	catch (...)
+	{
+		Complete();
+		throw;
+	}
+
+	Complete();
+
+	return true;
+}
+
+void BackgroundIndexing::Cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (pending.load(std::memory_order_relaxed))
+	{
+		canceled = true;
+		thread.join();
+		pending.store(false, std::memory_order_release);
+		finishWork = nullptr;
+	}
+}
+
+int64_t BackgroundIndexing::GetBackgroundMilliseconds() const
+{
+	return backgroundStopwatch.ElapsedMilliseconds();
+}
+
+int64_t BackgroundIndexing::GetWaitMilliseconds() const
+{
+	return waitStopwatch.ElapsedMilliseconds();
+}
+
+int64_t BackgroundIndexing::GetFinishMilliseconds() const
+{
+	return finishStopwatch.ElapsedMilliseconds();
+}
+
+void BackgroundIndexing::Complete()
+{
+	finishStopwatch.Stop();
+	finishWork = nullptr;
+	finishThreadID.store(std::thread::id(), std::memory_order_relaxed);
+	pending.store(false, std::memory_order_release);
+}
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "Stopwatch.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs the part of a multi-packed file's open that does not use the game's objects on a
+// background thread, the rest of the open runs on the first thread that waits for it.
+// The finishing work can use the game's segment objects and the file's critical section,
+// a thread that is waiting must not hold the critical section.
+class BackgroundIndexing
+{
+public:
+	// The background work must return soon after canceled is set, and must not throw.
+	typedef std::function<void(const std::atomic<bool>& canceled)> BackgroundWork;
+	typedef std::function<void()> FinishWork;
+
+	BackgroundIndexing();
+
+	// Cancels the work that is still pending.
+	~BackgroundIndexing();
+
+	void Start(BackgroundWork&& backgroundWork, FinishWork&& finishWork);
+
+	bool IsPending() const;
+
+	// Waits for the background work and then runs the finishing work on the calling thread.
+	// The other threads that call this wait until the finishing work has completed, a call
+	// from the finishing work returns immediately.
+	// Returns true if the calling thread ran the finishing work.
+	bool Wait();
+
+	// Stops the background work, the finishing work is not run.
+	void Cancel();
+
+	int64_t GetBackgroundMilliseconds() const;
+
+	// Gets the time that the first Wait call was blocked by the background work.
+	int64_t GetWaitMilliseconds() const;
+
+	int64_t GetFinishMilliseconds() const;
+
+private:
+	void Complete();
+
+	std::thread thread;
+	std::atomic<bool> pending;
+	std::atomic<bool> canceled;
+	std::mutex mutex;
+	std::atomic<std::thread::id> finishThreadID;
+	FinishWork finishWork;
+	Stopwatch backgroundStopwatch;
+	Stopwatch waitStopwatch;
+	Stopwatch finishStopwatch;
+};
@@ -11,9 +11,16 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "BaseMultiPackedFile.h"
+#include "CityAccessHistory.h"
+#include "GlobalKeyIndex.h"
 #include "PersistResourceKeyList.h"
 #include "Logger.h"
+#include "MissingKeySamples.h"
+#include "ScanExclusionRules.h"
+#include "ScopedTimer.h"
+#include "StartupTrace.h"
 #include "SC4DirectoryEnumerator.h"
+#include "Settings.h"
 #include "cGZPersistResourceKey.h"
 #include "cIGZCOM.h"
 #include "cIGZFrameWork.h"
@@ -26,19 +33,66 @@
 #include "cRZCOMDllDirector.h"
 #include "GZServPtrs.h"
 #include "wil/resource.h"
+#include <Psapi.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+namespace
+{
+	// The open multi-packed files that are collecting record access statistics.
+	std::mutex recordAccessStatisticsFilesMutex;
+	std::vector<BaseMultiPackedFile*> recordAccessStatisticsFiles;
+
+	// The multi-packed files that use the global key index.
+	std::mutex globalKeyIndexFilesMutex;
+	std::vector<BaseMultiPackedFile*> globalKeyIndexFiles;
+
+	// The size of the blocks that the memory-backed segments allocate their file data from.
+	constexpr size_t MemoryBlockPoolBlockSize = 4 * 1024 * 1024;
+
+	DWORD GetProcessHandleCount()
+	{
+		DWORD handleCount = 0;
+
+		if (!::GetProcessHandleCount(GetCurrentProcess(), &handleCount))
+		{
+			handleCount = 0;
+		}
+
+		return handleCount;
+	}
+}
 
 BaseMultiPackedFile::BaseMultiPackedFile(bool enumerateSegmentsLastInFirstOut)
 	: segmentID(0),
 	  isOpen(false),
 	  initialized(false),
 	  enumerateSegmentsLastInFirstOut(enumerateSegmentsLastInFirstOut),
-	  criticalSection{}
+	  criticalSection{},
+	  negativeLookupFilter(),
+	  globalKeyIndexPriority(GlobalKeyIndex::NoFile),
+	  keyListsUseIndex(false),
+	  backgroundIndexing(),
+	  memoryBlockPool(),
+	  recordAccessStatistics(),
+	  accessTraceContainer()
 {
 	InitializeCriticalSectionEx(&criticalSection, 0, 0);
 }
 
 BaseMultiPackedFile::~BaseMultiPackedFile()
 {
+	backgroundIndexing.Cancel();
+	StopRecordAccessStatistics();
+
+	{
+		std::lock_guard<std::mutex> lock(globalKeyIndexFilesMutex);
+
+		std::erase(globalKeyIndexFiles, this);
+	}
+
 	DeleteCriticalSection(&criticalSection);
 }
 
@@ -87,6 +141,7 @@ bool BaseMultiPackedFile::Shutdown()
 	if (initialized)
 	{
 		initialized = false;
+		negativeLookupFilter.Clear();
 	}
 
 	return true;
@@ -99,33 +154,77 @@ bool BaseMultiPackedFile::Open(bool openRead, bool openWrite)
 	// cIGZPersistMultiPackedFiles are always read only.
 	if (openRead && !openWrite && folderPath.Strlen() > 0)
 	{
+		StartupTrace::Span span("BaseMultiPackedFile::Open", folderPath.ToChar());
+		SCOPED_TIMER("BaseMultiPackedFile::Open");
+
 		try
 		{
-			std::vector<cRZBaseString> files = GetDBPFFiles(folderPath);
+			const SC4DirectoryEnumerator::ScanOptions scanOptions = GetScanOptions();
+			const Settings& settings = Settings::GetInstance();
+			const uint32_t parallelThreadCount = settings.ParallelSegmentOpenThreads();
+			const bool parallel = parallelThreadCount > 1;
+			const bool pipelined = !parallel && settings.PipelinedScanAndOpen();
+
+			cIGZCOM* pCOM = RZGetFramework()->GetCOMObject();
+			MultiPackedFileOpenStatistics statistics;
+			GetProcessMemoryUsage(statistics.memoryUsageBeforeOpen);
+			statistics.handleCountBeforeOpen = GetProcessHandleCount();
+
+			if (settings.SmallFileMemoryThreshold() > 0)
+			{
+				memoryBlockPool = std::make_shared<MemoryBlockPool>(MemoryBlockPoolBlockSize);
+			}
 
-			if (!files.empty())
+			// The global key index bypasses the critical section, so it is not used when the
+			// record access statistics or the access trace need to see every lookup.
+			if (settings.GlobalKeyIndex()
+				&& !settings.RecordAccessStatistics()
+				&& !ResourceAccessTrace::GetInstance().IsEnabled())
 			{
-				segments.reserve(files.size());
+				std::lock_guard<std::mutex> lock(globalKeyIndexFilesMutex);
+
+				globalKeyIndexPriority = GlobalKeyIndex::GetInstance().AllocatePriority();
+				globalKeyIndexFiles.push_back(this);
+			}
+
+			Stopwatch totalStopwatch;
+			totalStopwatch.Start();
 
-				cIGZCOM* pCOM = RZGetFramework()->GetCOMObject();
-				cRZAutoRefCount<PersistResourceKeyList> keyList(
-					new PersistResourceKeyList(),
-					cRZAutoRefCount<PersistResourceKeyList>::kAddRef);
+			if (settings.BackgroundIndexing())
+			{
+				// The segments are created on this thread, and the files are prefetched on a
+				// background thread. The segments are opened and indexed by the first thread
+				// that uses this file.
+				StartBackgroundIndexing(
+					scanOptions,
+					pCOM,
+					std::max<uint32_t>(parallelThreadCount, 1),
+					std::move(statistics),
+					totalStopwatch);
+			}
+			else
+			{
+				SegmentOpener opener = CreateSegmentOpener(scanOptions, pCOM, statistics);
 
-				for (const cRZBaseString& path : files)
+				if (parallel)
 				{
-					if (!SetupGZPersistDBSegment(path, pCOM, keyList))
-					{
-						Logger::GetInstance().WriteLineFormatted(
-							LogLevel::Error,
-							"Failed to load: %s",
-							path.ToChar());
-					}
+					opener.OpenParallel(parallelThreadCount);
+				}
+				else if (pipelined)
+				{
+					opener.OpenPipelined();
+				}
+				else
+				{
+					opener.OpenSerial();
 				}
 
+				FinishOpen(statistics, totalStopwatch, parallel ? "parallel" : pipelined ? "pipelined" : "serial");
+
 				isOpen = segments.size() > 0;
-				result = isOpen;
 			}
+
+			result = isOpen;
 		}
 		catch (const std::exception& e)
 		{
@@ -137,6 +236,188 @@ bool BaseMultiPackedFile::Open(bool openRead, bool openWrite)
 	return result;
 }
 
+SC4DirectoryEnumerator::ScanOptions BaseMultiPackedFile::GetScanOptions()
+{
+	SC4DirectoryEnumerator::ScanOptions scanOptions;
+	scanOptions.checkDBPFHeaders = Settings::GetInstance().CheckDBPFHeadersDuringScan();
+
+	const ScanExclusionRules& exclusionRules = ScanExclusionRules::GetInstance();
+
+	if (!exclusionRules.IsEmpty())
+	{
+		scanOptions.exclusionRules = &exclusionRules;
+	}
+
+	return scanOptions;
+}
+
+void BaseMultiPackedFile::FinishOpen(MultiPackedFileOpenStatistics& statistics, Stopwatch& totalStopwatch, const char* openMode)
+{
+	MergeSegmentIndexes(statistics);
+	OnSegmentIndexesMerged(segments);
+
+	// The files that are opened after the global key index was built add their keys here,
+	// the other files are added by BuildGlobalKeyIndex.
+	if (globalKeyIndexPriority != GlobalKeyIndex::NoFile && GlobalKeyIndex::GetInstance().IsEnabled())
+	{
+		AddToGlobalKeyIndex();
+	}
+
+	totalStopwatch.Stop();
+
+	if (statistics.fileCount > 0)
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"Loaded %u of %u files from %s in %lld ms (%s): scan %lld ms, open %lld ms, merge %lld ms.",
+			static_cast<uint32_t>(segments.size()),
+			statistics.fileCount,
+			folderPath.ToChar(),
+			totalStopwatch.ElapsedMilliseconds(),
+			openMode,
+			statistics.scanStopwatch.ElapsedMilliseconds(),
+			statistics.openStopwatch.ElapsedMilliseconds(),
+			statistics.mergeStopwatch.ElapsedMilliseconds());
+
+		LogIndexMemoryUsage(statistics);
+
+		if (memoryBlockPool)
+		{
+			LogMemoryBackedFiles(statistics);
+		}
+	}
+
+	if (statistics.collectFileCosts)
+	{
+		LoadCostReport::GetInstance().Write(folderPath, statistics.fileCosts);
+	}
+
+	if (segments.empty())
+	{
+		return;
+	}
+
+	const Settings& settings = Settings::GetInstance();
+
+	if (settings.RecordAccessStatistics())
+	{
+		StartRecordAccessStatistics();
+	}
+
+	if (ResourceAccessTrace::GetInstance().IsEnabled())
+	{
+		accessTraceContainer = ResourceAccessTrace::GetInstance().AddContainer(folderPath, segments);
+	}
+
+	// The filter bypasses the critical section, so it is not used when the
+	// record access statistics or the access trace need to see every lookup.
+	if (settings.NegativeLookupFilter() && !recordAccessStatistics && !accessTraceContainer)
+	{
+		BuildNegativeLookupFilter();
+	}
+}
+
+void BaseMultiPackedFile::OnSegmentIndexesMerged(const std::vector<cIGZPersistDBSegment*>&)
+{
+}
+
+SegmentOpener BaseMultiPackedFile::CreateSegmentOpener(
+	const SC4DirectoryEnumerator::ScanOptions& scanOptions,
+	cIGZCOM* const pCOM,
+	MultiPackedFileOpenStatistics& statistics)
+{
+	return SegmentOpener(
+		folderPath,
+		[this, scanOptions](const SC4DirectoryEnumerator::FileFoundCallback& callback)
+		{
+			EnumerateDBPFFiles(folderPath, scanOptions, callback);
+		},
+		pCOM,
+		memoryBlockPool,
+		statistics,
+		segments);
+}
+
+void BaseMultiPackedFile::StartBackgroundIndexing(
+	const SC4DirectoryEnumerator::ScanOptions& scanOptions,
+	cIGZCOM* const pCOM,
+	uint32_t threadCount,
+	MultiPackedFileOpenStatistics&& statistics,
+	const Stopwatch& totalStopwatch)
+{
+	struct State
+	{
+		MultiPackedFileOpenStatistics statistics;
+		Stopwatch totalStopwatch;
+		std::optional<SegmentOpener> opener;
+	};
+
+	std::shared_ptr<State> state = std::make_shared<State>(State{ std::move(statistics), totalStopwatch });
+	state->opener.emplace(CreateSegmentOpener(scanOptions, pCOM, state->statistics));
+
+	if (!state->opener->CreateSegments())
+	{
+		return;
+	}
+
+	isOpen = true;
+
+	// The background thread only reads the files with Win32 calls, it does not use the
+	// game's segment objects or take the critical section. A thread that holds the
+	// critical section of another file can still run this file's finishing work.
+	backgroundIndexing.Start(
+		[this, state, threadCount](const std::atomic<bool>& canceled)
+		{
+			StartupTrace::Span span("Background prefetch", folderPath.ToChar());
+
+			try
+			{
+				state->opener->PrefetchCreatedSegments(threadCount, canceled);
+			}
+			catch (const std::exception& e)
+			{
+				Logger::GetInstance().WriteLine(LogLevel::Error, e.what());
+			}
+		},
+		[this, state]()
+		{
+			StartupTrace::Span span("Background indexing", folderPath.ToChar());
+
+			try
+			{
+				state->opener->OpenPrefetchedSegments();
+				FinishOpen(state->statistics, state->totalStopwatch, "background");
+			}
+			catch (const std::exception& e)
+			{
+				Logger::GetInstance().WriteLine(LogLevel::Error, e.what());
+			}
+
+			isOpen = !segments.empty();
+		});
+}
+
+void BaseMultiPackedFile::WaitForIndexing()
+{
+	if (backgroundIndexing.Wait())
+	{
+		const int64_t prefetchMilliseconds = backgroundIndexing.GetBackgroundMilliseconds();
+		const int64_t waitMilliseconds = backgroundIndexing.GetWaitMilliseconds();
+		const int64_t hiddenMilliseconds = std::max<int64_t>(0, prefetchMilliseconds - waitMilliseconds);
+
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"Background prefetch of %s took %lld ms, the first lookup waited %lld ms for it and %lld ms to open"
+			" and index the files. %lld ms (%.0f%%) of the prefetch was hidden behind the game's other startup work.",
+			folderPath.ToChar(),
+			prefetchMilliseconds,
+			waitMilliseconds,
+			backgroundIndexing.GetFinishMilliseconds(),
+			hiddenMilliseconds,
+			prefetchMilliseconds > 0 ? 100.0 * hiddenMilliseconds / prefetchMilliseconds : 100.0);
+	}
+}
+
 bool BaseMultiPackedFile::IsOpen() const
 {
 	return isOpen;
@@ -144,8 +425,31 @@ bool BaseMultiPackedFile::IsOpen() const
 
 bool BaseMultiPackedFile::Close()
 {
+	WaitForIndexing();
+
 	if (isOpen)
 	{
+		// The statistics are written before the segments are released, the
+		// report uses the segment paths.
+		StopRecordAccessStatistics();
+
+		if (globalKeyIndexPriority != GlobalKeyIndex::NoFile)
+		{
+			// The file's keys stay in the global key index, a closed file has no records
+			// so the answers that the index gives for it are still correct.
+			std::lock_guard<std::mutex> lock(globalKeyIndexFilesMutex);
+
+			std::erase(globalKeyIndexFiles, this);
+		}
+
+		{
+			auto lock = wil::EnterCriticalSection(&criticalSection);
+			accessTraceContainer.reset();
+		}
+
+		// The filter storage is freed by Shutdown.
+		negativeLookupFilter.Disable();
+
 		isOpen = false;
 
 		// Release the cIGZPersistDBSegments that we
@@ -158,7 +462,11 @@ bool BaseMultiPackedFile::Close()
 		}
 
 		segments.clear();
-		tgiMap.clear();
+		tgiMap.Clear();
+		keyListsUseIndex = false;
+
+		// The memory-backed segments keep the pool alive while the game holds a reference to them.
+		memoryBlockPool.reset();
 	}
 
 	return false;
@@ -186,6 +494,10 @@ bool BaseMultiPackedFile::SetPath(cIGZString const& path)
 
 bool BaseMultiPackedFile::Lock()
 {
+	// The finishing work of the background indexing takes the critical section, so it
+	// must run before the caller holds it.
+	WaitForIndexing();
+
 	EnterCriticalSection(&criticalSection);
 	return true;
 }
@@ -211,6 +523,8 @@ bool BaseMultiPackedFile::SetSegmentID(uint32_t const& segmentID)
 
 uint32_t BaseMultiPackedFile::GetRecordCount(cIGZPersistResourceKeyFilter* filter)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	uint32_t count = 0;
@@ -219,17 +533,11 @@ uint32_t BaseMultiPackedFile::GetRecordCount(cIGZPersistResourceKeyFilter* filte
 	{
 		if (filter)
 		{
-			for (const auto& item : tgiMap)
-			{
-				if (filter->IsKeyIncluded(item.first))
-				{
-					count++;
-				}
-			}
+			count = tgiMap.GetCount([filter](const cGZPersistResourceKey& key) { return filter->IsKeyIncluded(key); });
 		}
 		else
 		{
-			count = static_cast<uint32_t>(tgiMap.size());
+			count = tgiMap.GetCount();
 		}
 	}
 
@@ -238,13 +546,27 @@ uint32_t BaseMultiPackedFile::GetRecordCount(cIGZPersistResourceKeyFilter* filte
 
 uint32_t BaseMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	uint32_t totalResourceCount = 0;
 
 	if (isOpen && list)
 	{
-		if (enumerateSegmentsLastInFirstOut)
+		if (keyListsUseIndex)
+		{
+			tgiMap.ForEachKey(
+				[list, filter, &totalResourceCount](const cGZPersistResourceKey& key)
+				{
+					if (!filter || filter->IsKeyIncluded(key))
+					{
+						list->Insert(key);
+						totalResourceCount++;
+					}
+				});
+		}
+		else if (enumerateSegmentsLastInFirstOut)
 		{
 			for (auto iter = segments.rbegin(); iter != segments.rend(); iter++)
 			{
@@ -265,13 +587,19 @@ uint32_t BaseMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList* lis
 
 bool BaseMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList& list)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
 
 	if (isOpen)
 	{
-		if (enumerateSegmentsLastInFirstOut)
+		if (keyListsUseIndex)
+		{
+			tgiMap.ForEachKey([&list](const cGZPersistResourceKey& key) { list.Insert(key); });
+		}
+		else if (enumerateSegmentsLastInFirstOut)
 		{
 			for (auto iter = segments.rbegin(); iter != segments.rend(); iter++)
 			{
@@ -293,17 +621,28 @@ bool BaseMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList& list)
 
 bool BaseMultiPackedFile::TestForRecord(cGZPersistResourceKey const& key)
 {
+	WaitForIndexing();
+
+	if (!MayContainRecord(key))
+	{
+		return false;
+	}
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
+	RecordAccessStatistics::Timer timer(recordAccessStatistics.get(), RecordAccessStatistics::Operation::TestForRecord);
+	ResourceAccessTrace::Recorder traceRecorder(accessTraceContainer.get(), ResourceAccessTraceFormat::RecordType::TestForRecord, key);
 
 	bool result = false;
 
 	if (isOpen)
 	{
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = FindSegment(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->TestForRecord(key);
+			timer.SetSegment(pSegment);
+			traceRecorder.SetSegment(pSegment);
+			result = pSegment->TestForRecord(key);
 		}
 	}
 
@@ -312,17 +651,29 @@ bool BaseMultiPackedFile::TestForRecord(cGZPersistResourceKey const& key)
 
 uint32_t BaseMultiPackedFile::GetRecordSize(cGZPersistResourceKey const& key)
 {
+	WaitForIndexing();
+
+	if (!MayContainRecord(key))
+	{
+		return 0;
+	}
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
+	RecordAccessStatistics::Timer timer(recordAccessStatistics.get(), RecordAccessStatistics::Operation::GetRecordSize);
+	ResourceAccessTrace::Recorder traceRecorder(accessTraceContainer.get(), ResourceAccessTraceFormat::RecordType::GetRecordSize, key);
 
 	uint32_t result = 0;
 
 	if (isOpen)
 	{
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = FindSegment(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->GetRecordSize(key);
+			timer.SetSegment(pSegment);
+			traceRecorder.SetSegment(pSegment);
+			result = pSegment->GetRecordSize(key);
+			traceRecorder.SetSize(result);
 		}
 	}
 
@@ -331,17 +682,34 @@ uint32_t BaseMultiPackedFile::GetRecordSize(cGZPersistResourceKey const& key)
 
 bool BaseMultiPackedFile::OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode)
 {
+	WaitForIndexing();
+
+	if (!MayContainRecord(key))
+	{
+		return false;
+	}
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
+	RecordAccessStatistics::Timer timer(recordAccessStatistics.get(), RecordAccessStatistics::Operation::OpenRecord);
+	ResourceAccessTrace::Recorder traceRecorder(accessTraceContainer.get(), ResourceAccessTraceFormat::RecordType::OpenRecord, key);
 
 	bool result = false;
 
 	if (isOpen)
 	{
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = FindSegment(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->OpenRecord(key, record, accessMode);
+			timer.SetSegment(pSegment);
+			traceRecorder.SetSegment(pSegment);
+			result = pSegment->OpenRecord(key, record, accessMode);
+
+			if (result && CityAccessHistory::GetInstance().IsRecording())
+			{
+				CityAccessHistory::GetInstance().RecordAccess(pSegment, key);
+			}
+
 		}
 	}
 
@@ -355,6 +723,8 @@ bool BaseMultiPackedFile::CreateNewRecord(cGZPersistResourceKey const& key, cIGZ
 
 bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord* record)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
@@ -364,11 +734,11 @@ bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord* record)
 		cGZPersistResourceKey key;
 		record->GetKey(key);
 
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = tgiMap.Find(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->CloseRecord(record);
+			result = pSegment->CloseRecord(record);
 		}
 	}
 
@@ -377,6 +747,8 @@ bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord* record)
 
 bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord** record)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
@@ -386,11 +758,11 @@ bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord** record)
 		cGZPersistResourceKey key;
 		(*record)->GetKey(key);
 
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = tgiMap.Find(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->CloseRecord(record);
+			result = pSegment->CloseRecord(record);
 		}
 	}
 
@@ -399,6 +771,8 @@ bool BaseMultiPackedFile::CloseRecord(cIGZPersistDBRecord** record)
 
 bool BaseMultiPackedFile::AbortRecord(cIGZPersistDBRecord* record)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
@@ -408,11 +782,11 @@ bool BaseMultiPackedFile::AbortRecord(cIGZPersistDBRecord* record)
 		cGZPersistResourceKey key;
 		record->GetKey(key);
 
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = tgiMap.Find(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->AbortRecord(record);
+			result = pSegment->AbortRecord(record);
 		}
 	}
 
@@ -421,6 +795,8 @@ bool BaseMultiPackedFile::AbortRecord(cIGZPersistDBRecord* record)
 
 bool BaseMultiPackedFile::AbortRecord(cIGZPersistDBRecord** record)
 {
+	WaitForIndexing();
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
@@ -430,11 +806,11 @@ bool BaseMultiPackedFile::AbortRecord(cIGZPersistDBRecord** record)
 		cGZPersistResourceKey key;
 		(*record)->GetKey(key);
 
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = tgiMap.Find(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->AbortRecord(record);
+			result = pSegment->AbortRecord(record);
 		}
 	}
 
@@ -448,17 +824,35 @@ bool BaseMultiPackedFile::DeleteRecord(cGZPersistResourceKey const& key)
 
 uint32_t BaseMultiPackedFile::ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize)
 {
+	WaitForIndexing();
+
+	if (!MayContainRecord(key))
+	{
+		return 0;
+	}
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
+	RecordAccessStatistics::Timer timer(recordAccessStatistics.get(), RecordAccessStatistics::Operation::ReadRecord);
+	ResourceAccessTrace::Recorder traceRecorder(accessTraceContainer.get(), ResourceAccessTraceFormat::RecordType::ReadRecord, key);
 
 	uint32_t result = 0;
 
 	if (isOpen)
 	{
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = FindSegment(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			result = item->second->ReadRecord(key, buffer, recordSize);
+			timer.SetSegment(pSegment);
+			traceRecorder.SetSegment(pSegment);
+			result = pSegment->ReadRecord(key, buffer, recordSize);
+
+			if (result && CityAccessHistory::GetInstance().IsRecording())
+			{
+				CityAccessHistory::GetInstance().RecordAccess(pSegment, key);
+			}
+
+			traceRecorder.SetSize(recordSize);
 		}
 	}
 
@@ -489,21 +883,15 @@ void BaseMultiPackedFile::SetPathFilter(cIGZString const&)
 
 int32_t BaseMultiPackedFile::ConsolidateDatabaseRecords(cIGZPersistDBSegment* target, cIGZPersistResourceKeyFilter* filter)
 {
+	WaitForIndexing();
+
 	int32_t totalCopiedRecords = 0;
 
 	if (enumerateSegmentsLastInFirstOut)
 	{
 		for (auto iter = segments.rbegin(); iter != segments.rend(); iter++)
 		{
-			cIGZDBSegmentPackedFile* pPackedFile = nullptr;
-
-			if ((*iter)->QueryInterface(GZIID_cIGZDBSegmentPackedFile, reinterpret_cast<void**>(&pPackedFile)))
-			{
-				int32_t copiedRecordCount = pPackedFile->CopyDatabaseRecords(target, filter, false, true);
-				totalCopiedRecords += copiedRecordCount;
-
-				pPackedFile->Release();
-			}
+			totalCopiedRecords += CopySegmentRecords(*iter, target, filter);
 		}
 	}
 	else
@@ -511,23 +899,65 @@ int32_t BaseMultiPackedFile::ConsolidateDatabaseRecords(cIGZPersistDBSegment* ta
 
 		for (cIGZPersistDBSegment* pSegment : segments)
 		{
-			cIGZDBSegmentPackedFile* pPackedFile = nullptr;
+			totalCopiedRecords += CopySegmentRecords(pSegment, target, filter);
+		}
+	}
+
+	return totalCopiedRecords;
+}
+
+int32_t BaseMultiPackedFile::CopySegmentRecords(
+	cIGZPersistDBSegment* pSegment,
+	cIGZPersistDBSegment* target,
+	cIGZPersistResourceKeyFilter* filter)
+{
+	int32_t copiedRecordCount = 0;
+
+	cRZAutoRefCount<cIGZDBSegmentPackedFile> pPackedFile;
 
-			if (pSegment->QueryInterface(GZIID_cIGZDBSegmentPackedFile, reinterpret_cast<void**>(&pPackedFile)))
+	if (pSegment->QueryInterface(GZIID_cIGZDBSegmentPackedFile, pPackedFile.AsPPVoid()))
+	{
+		copiedRecordCount = pPackedFile->CopyDatabaseRecords(target, filter, false, true);
+	}
+	else
+	{
+		// The memory-backed segments are not packed files, their file is opened as
+		// one for the copy.
+		cRZBaseString segmentPath;
+		pSegment->GetPath(segmentPath);
+
+		cIGZCOM* const pCOM = RZGetFramework()->GetCOMObject();
+
+		cRZAutoRefCount<cIGZPersistDBSegment> pFileSegment;
+
+		if (pCOM->GetClassObject(
+			GZCLSID_cGZDBSegmentPackedFile,
+			GZIID_cIGZPersistDBSegment,
+			pFileSegment.AsPPVoid()))
+		{
+			if (pFileSegment->Init())
 			{
-				int32_t copiedRecordCount = pPackedFile->CopyDatabaseRecords(target, filter, false, true);
-				totalCopiedRecords += copiedRecordCount;
+				if (pFileSegment->SetPath(segmentPath)
+					&& pFileSegment->Open(true, false)
+					&& pFileSegment->QueryInterface(GZIID_cIGZDBSegmentPackedFile, pPackedFile.AsPPVoid()))
+				{
+					copiedRecordCount = pPackedFile->CopyDatabaseRecords(target, filter, false, true);
+					pPackedFile.Reset();
+					pFileSegment->Close();
+				}
 
-				pPackedFile->Release();
+				pFileSegment->Shutdown();
 			}
 		}
 	}
 
-	return totalCopiedRecords;
+	return copiedRecordCount;
 }
 
 int32_t BaseMultiPackedFile::ConsolidateDatabaseRecords(cIGZString const& targetPath, cIGZPersistResourceKeyFilter* filter)
 {
+	WaitForIndexing();
+
 	int result = -1;
 
 	cIGZCOM* const pCOM = RZGetFramework()->GetCOMObject();
@@ -559,21 +989,26 @@ int32_t BaseMultiPackedFile::ConsolidateDatabaseRecords(cIGZString const& target
 
 bool BaseMultiPackedFile::FindDBSegment(cGZPersistResourceKey const& key, cIGZPersistDBSegment** outSegment)
 {
+	WaitForIndexing();
+
+	if (!MayContainRecord(key))
+	{
+		return false;
+	}
+
 	auto lock = wil::EnterCriticalSection(&criticalSection);
 
 	bool result = false;
 
 	if (isOpen)
 	{
-		auto item = tgiMap.find(key);
+		cIGZPersistDBSegment* const pSegment = FindSegment(key);
 
-		if (item != tgiMap.end())
+		if (pSegment)
 		{
-			cIGZPersistDBSegment* segment = item->second;
-
-			*outSegment = segment;
+			*outSegment = pSegment;
 
-			segment->AddRef();
+			pSegment->AddRef();
 			result = true;
 		}
 	}
@@ -583,65 +1018,414 @@ bool BaseMultiPackedFile::FindDBSegment(cGZPersistResourceKey const& key, cIGZPe
 
 uint32_t BaseMultiPackedFile::GetSegmentCount()
 {
+	WaitForIndexing();
+
 	return static_cast<uint32_t>(segments.size());
 }
 
 cIGZPersistDBSegment* BaseMultiPackedFile::GetSegmentByIndex(uint32_t index)
 {
+	WaitForIndexing();
+
 	return segments[index];
 }
 
 void BaseMultiPackedFile::AddedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment* pSegment)
 {
+	WaitForIndexing();
+
 	if (pSegment)
 	{
-		tgiMap.insert_or_assign(key, pSegment);
+		// The key is added to the filter and the global key index first, so that a lookup
+		// that is not holding the critical section can never skip a key that is in tgiMap.
+		negativeLookupFilter.Insert(key);
+
+		if (globalKeyIndexPriority != GlobalKeyIndex::NoFile)
+		{
+			GlobalKeyIndex::GetInstance().AddKey(key, globalKeyIndexPriority);
+		}
+
+		tgiMap.Add(key, pSegment);
 	}
 }
 
 void BaseMultiPackedFile::RemovedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment*)
 {
-	tgiMap.erase(key);
+	WaitForIndexing();
+
+	// The key stays in the negative lookup filter, a Bloom filter cannot remove keys.
+	// The lookups for the key are counted as false positives.
+	tgiMap.Remove(key);
+
+	if (globalKeyIndexPriority != GlobalKeyIndex::NoFile)
+	{
+		GlobalKeyIndex::GetInstance().RemoveKey(key, globalKeyIndexPriority);
+	}
 }
 
-bool BaseMultiPackedFile::SetupGZPersistDBSegment(
-	cIGZString const& path,
-	cIGZCOM* const pCOM,
-	PersistResourceKeyList* const pKeyList)
+void BaseMultiPackedFile::WriteAllRecordAccessStatistics()
 {
-	bool result = false;
+	std::lock_guard<std::mutex> lock(recordAccessStatisticsFilesMutex);
 
-	cRZAutoRefCount<cIGZPersistDBSegment> pSegment;
+	for (BaseMultiPackedFile* file : recordAccessStatisticsFiles)
+	{
+		file->WriteRecordAccessStatistics();
+	}
+}
 
-	if (pCOM->GetClassObject(
-		GZCLSID_cGZDBSegmentPackedFile,
-		GZIID_cIGZPersistDBSegment,
-		pSegment.AsPPVoid()))
+void BaseMultiPackedFile::BuildGlobalKeyIndex()
+{
+	SCOPED_TIMER("BuildGlobalKeyIndex");
+
+	std::lock_guard<std::mutex> lock(globalKeyIndexFilesMutex);
+
+	if (globalKeyIndexFiles.empty())
 	{
-		if (pSegment->Init())
+		return;
+	}
+
+	Stopwatch stopwatch;
+	stopwatch.Start();
+
+	double totalLookupNanoseconds = 0;
+	uint32_t measuredFileCount = 0;
+
+	for (BaseMultiPackedFile* file : globalKeyIndexFiles)
+	{
+		// The file's keys are only known after its background indexing has finished.
+		file->WaitForIndexing();
+
+		if (file->isOpen)
 		{
-			if (pSegment->SetPath(path))
-			{
-				if (pSegment->Open(true, false))
-				{
-					pSegment->AddRef();
+			file->AddToGlobalKeyIndex();
 
-					segments.push_back(pSegment);
+			totalLookupNanoseconds += file->MeasureMissingKeyLookupCost();
+			measuredFileCount++;
+		}
+	}
 
-					pKeyList->EraseAll();
-					pSegment->GetResourceKeyList(pKeyList, nullptr);
+	stopwatch.Stop();
 
-					const PersistResourceKeyList::container& keys = pKeyList->GetKeys();
-					for (const cGZPersistResourceKey& key : keys)
-					{
-						tgiMap.insert_or_assign(key, pSegment);
-					}
-					result = true;
-				}
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Built the global key index in %lld ms.",
+		stopwatch.ElapsedMilliseconds());
+
+	if (!GlobalKeyIndexMatchesSearchOrder())
+	{
+		Logger::GetInstance().WriteLine(
+			LogLevel::Error,
+			"The global key index is disabled, the resource manager does not search the plugin folders"
+			" in the reverse order that they were opened.");
+		return;
+	}
+
+	GlobalKeyIndex::GetInstance().Enable(measuredFileCount > 0 ? totalLookupNanoseconds / measuredFileCount : 0.0);
+}
+
+bool BaseMultiPackedFile::GlobalKeyIndexMatchesSearchOrder()
+{
+	// The index gives each file a higher priority than the files that were opened before
+	// it, and a file only skips the keys that a higher priority file owns. This is correct
+	// when the resource manager asks the newest segment first: it adds new segments to the
+	// start of its list, which the loaded file list in DBPFLoadingDllDirector also relies on.
+	// The priorities of the registered files must decrease along the resource manager's list.
+	cIGZPersistResourceManagerPtr pResMan;
+
+	if (!pResMan)
+	{
+		return false;
+	}
+
+	uint32_t previousPriority = GlobalKeyIndex::UnknownFile;
+	const uint32_t segmentCount = pResMan->GetSegmentCount();
+
+	for (uint32_t i = 0; i < segmentCount; i++)
+	{
+		const cIGZPersistDBSegment* const segment = pResMan->GetSegmentByIndex(i);
+
+		const auto file = std::find_if(
+			globalKeyIndexFiles.begin(),
+			globalKeyIndexFiles.end(),
+			[segment](const BaseMultiPackedFile* file) { return static_cast<const cIGZPersistDBSegment*>(file) == segment; });
+
+		if (file != globalKeyIndexFiles.end())
+		{
+			if ((*file)->globalKeyIndexPriority >= previousPriority)
+			{
+				return false;
 			}
+
+			previousPriority = (*file)->globalKeyIndexPriority;
 		}
 	}
 
-	return result;
+	return true;
+}
+
+void BaseMultiPackedFile::StartRecordAccessStatistics()
+{
+	recordAccessStatistics = std::make_unique<RecordAccessStatistics>();
+
+	std::lock_guard<std::mutex> lock(recordAccessStatisticsFilesMutex);
+
+	recordAccessStatisticsFiles.push_back(this);
+}
+
+void BaseMultiPackedFile::StopRecordAccessStatistics()
+{
+	if (recordAccessStatistics)
+	{
+		{
+			std::lock_guard<std::mutex> lock(recordAccessStatisticsFilesMutex);
+
+			std::erase(recordAccessStatisticsFiles, this);
+		}
+
+		WriteRecordAccessStatistics();
+
+		auto lock = wil::EnterCriticalSection(&criticalSection);
+
+		recordAccessStatistics.reset();
+	}
+}
+
+void BaseMultiPackedFile::WriteRecordAccessStatistics()
+{
+	auto lock = wil::EnterCriticalSection(&criticalSection);
+
+	if (recordAccessStatistics)
+	{
+		recordAccessStatistics->Write(folderPath);
+	}
+}
+
+void BaseMultiPackedFile::MergeSegmentIndexes(MultiPackedFileOpenStatistics& statistics)
+{
+	SCOPED_TIMER("MergeSegmentIndexes");
+
+	if (segments.empty())
+	{
+		return;
+	}
+
+	statistics.mergeStopwatch.Start();
+
+	// The keys are merged after all of the segments have been opened, this allows
+	// tgiMap and the key list to be sized once from the segment record counts
+	// instead of growing as each segment is added.
+	size_t totalRecordCount = 0;
+	uint32_t maxRecordCount = 0;
+
+	for (cIGZPersistDBSegment* pSegment : segments)
+	{
+		const uint32_t recordCount = pSegment->GetRecordCount(nullptr);
+
+		totalRecordCount += recordCount;
+		maxRecordCount = std::max(maxRecordCount, recordCount);
+	}
+
+	statistics.indexEntryCount = totalRecordCount;
+
+	// The record count includes the keys that are overridden by later segments,
+	// so it is an upper bound for the tgiMap size.
+	tgiMap.Reserve(tgiMap.GetCount() + totalRecordCount);
+
+	// The key list is only used while merging, it is released when this method returns.
+	cRZAutoRefCount<PersistResourceKeyList> keyList(
+		new PersistResourceKeyList(),
+		cRZAutoRefCount<PersistResourceKeyList>::kAddRef);
+
+	keyList->Reserve(maxRecordCount);
+
+	size_t bucketCount = tgiMap.GetBucketCount();
+
+	for (cIGZPersistDBSegment* pSegment : segments)
+	{
+		StartupTrace::Span span("Index merge");
+
+		MergeSegmentIndex(pSegment, keyList, statistics);
+
+		const size_t newBucketCount = tgiMap.GetBucketCount();
+
+		if (newBucketCount != bucketCount)
+		{
+			statistics.indexRehashCount++;
+			bucketCount = newBucketCount;
+		}
+	}
+
+	statistics.keyListCapacity = keyList->GetCapacity();
+
+	statistics.mergeStopwatch.Stop();
+}
+
+void BaseMultiPackedFile::MergeSegmentIndex(
+	cIGZPersistDBSegment* const pSegment,
+	PersistResourceKeyList* const pKeyList,
+	MultiPackedFileOpenStatistics& statistics)
+{
+	SCOPED_TIMER("MergeSegmentIndex");
+
+	pKeyList->EraseAll();
+	pSegment->GetResourceKeyList(pKeyList, nullptr);
+
+	const PersistResourceKeyList::container& keys = pKeyList->GetKeys();
+
+	if (statistics.collectFileCosts)
+	{
+		// The load cost report tracks the keys that each file overrides, and the
+		// keys that are overridden by later files.
+		LoadCostReport::FileCost& fileCost = statistics.fileCosts[statistics.fileCostIndexes.at(pSegment)];
+		fileCost.indexEntryCount = static_cast<uint32_t>(keys.size());
+
+		tgiMap.AddSegment(pSegment, keys, [&](cIGZPersistDBSegment* const pPreviousSegment)
+		{
+			fileCost.overridingKeyCount++;
+
+			const auto previousFileCost = statistics.fileCostIndexes.find(pPreviousSegment);
+
+			if (previousFileCost != statistics.fileCostIndexes.end())
+			{
+				statistics.fileCosts[previousFileCost->second].shadowedKeyCount++;
+			}
+		});
+	}
+	else
+	{
+		tgiMap.AddSegment(pSegment, keys);
+	}
+}
+
+void BaseMultiPackedFile::BuildNegativeLookupFilter()
+{
+	SCOPED_TIMER("BuildNegativeLookupFilter");
+
+	negativeLookupFilter.Build(
+		tgiMap.GetCount(),
+		[this](const auto& insertKey) { tgiMap.ForEachKey(insertKey); });
+
+	negativeLookupFilter.Enable(folderPath, tgiMap.GetCount(), MeasureMissingKeyLookupCost());
 }
 
+bool BaseMultiPackedFile::MayContainRecord(const cGZPersistResourceKey& key)
+{
+	if (globalKeyIndexPriority != GlobalKeyIndex::NoFile
+		&& !GlobalKeyIndex::GetInstance().MayContain(key, globalKeyIndexPriority))
+	{
+		return false;
+	}
+
+	return negativeLookupFilter.MayContain(key);
+}
+
+void BaseMultiPackedFile::AddToGlobalKeyIndex()
+{
+	auto lock = wil::EnterCriticalSection(&criticalSection);
+
+	GlobalKeyIndex::GetInstance().AddFile(
+		globalKeyIndexPriority,
+		tgiMap.GetCount(),
+		[this](const auto& addKey) { tgiMap.ForEachKey(addKey); });
+}
+
+double BaseMultiPackedFile::MeasureMissingKeyLookupCost()
+{
+	constexpr uint32_t SampleKeyCount = 1024;
+
+	// A file that uses the negative lookup filter answers most of these lookups
+	// without taking the critical section.
+	if (negativeLookupFilter.IsEnabled())
+	{
+		return negativeLookupFilter.GetFilterNanoseconds();
+	}
+
+	const std::vector<cGZPersistResourceKey> sampleKeys = MissingKeySamples::Create(SampleKeyCount);
+
+	const int64_t start = Stopwatch::GetTimestamp();
+
+	for (const cGZPersistResourceKey& key : sampleKeys)
+	{
+		auto lock = wil::EnterCriticalSection(&criticalSection);
+
+		tgiMap.Find(key);
+	}
+
+	const int64_t end = Stopwatch::GetTimestamp();
+
+	const double nanosecondsPerTick = 1e9 / static_cast<double>(Stopwatch::GetFrequency());
+
+	return static_cast<double>(end - start) * nanosecondsPerTick / SampleKeyCount;
+}
+
+cIGZPersistDBSegment* BaseMultiPackedFile::FindSegment(const cGZPersistResourceKey& key)
+{
+	cIGZPersistDBSegment* const pSegment = tgiMap.Find(key);
+
+	negativeLookupFilter.CountLookup(pSegment != nullptr);
+
+	return pSegment;
+}
+
+void BaseMultiPackedFile::GetProcessMemoryUsage(ProcessMemoryUsage& usage)
+{
+	PROCESS_MEMORY_COUNTERS counters{};
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		usage.privateBytes = counters.PagefileUsage;
+		usage.peakPrivateBytes = counters.PeakPagefileUsage;
+	}
+	else
+	{
+		usage = ProcessMemoryUsage();
+	}
+}
+
+void BaseMultiPackedFile::LogIndexMemoryUsage(const MultiPackedFileOpenStatistics& statistics) const
+{
+	ProcessMemoryUsage memoryUsage;
+	GetProcessMemoryUsage(memoryUsage);
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Index for %s: %u keys from %zu index entries, %u rehashes after sizing, key list capacity %zu."
+		" Private bytes %zu KB before the open, %zu KB after, process peak %zu KB.",
+		folderPath.ToChar(),
+		tgiMap.GetCount(),
+		statistics.indexEntryCount,
+		statistics.indexRehashCount,
+		statistics.keyListCapacity,
+		statistics.memoryUsageBeforeOpen.privateBytes / 1024,
+		memoryUsage.privateBytes / 1024,
+		memoryUsage.peakPrivateBytes / 1024);
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Process handle count for %s: %lu before the open, %lu after.",
+		folderPath.ToChar(),
+		statistics.handleCountBeforeOpen,
+		GetProcessHandleCount());
+}
+
+void BaseMultiPackedFile::LogMemoryBackedFiles(const MultiPackedFileOpenStatistics& statistics) const
+{
+	// Each memory-backed file is opened, read with a single ReadFile call and closed, the size
+	// comes from the directory scan. The file is only opened again while the game has one of
+	// its records open as a stream. The other files are opened as a cGZDBSegmentPackedFile
+	// which keeps its handle open.
+	const size_t memoryBackedFileCount = memoryBlockPool->GetAllocationCount();
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Read %zu of %u files from %s into memory and closed them: %zu KB of file data in %zu pooled blocks"
+		" using %zu KB. The other files are larger than %u KB, could not be read or list a key more than once,"
+		" they keep their file handle open.",
+		memoryBackedFileCount,
+		statistics.fileCount,
+		folderPath.ToChar(),
+		memoryBlockPool->GetAllocatedBytes() / 1024,
+		memoryBlockPool->GetBlockCount(),
+		memoryBlockPool->GetReservedBytes() / 1024,
+		Settings::GetInstance().SmallFileMemoryThreshold());
+}
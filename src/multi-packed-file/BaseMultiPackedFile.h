@@ -13,11 +13,23 @@
 #pragma once
 #include "cIGZPersistDBSegment.h"
 #include "cIGZPersistDBSegmentMultiPackedFiles.h"
+#include "cRZAutoRefCount.h"
 #include "cRZBaseString.h"
 #include "cRZBaseUnknown.h"
-#include "PersistResourceKeyBoostHash.h"
+#include "BackgroundIndexing.h"
+#include "MemoryBlockPool.h"
+#include "MultiPackedFileIndex.h"
+#include "MultiPackedFileOpenStatistics.h"
+#include "NegativeLookupFilter.h"
 #include "PersistResourceKeyHash.h"
-#include "boost/unordered/unordered_flat_map.hpp"
+#include "RecordAccessStatistics.h"
+#include "ResourceAccessTrace.h"
+#include "SC4DirectoryEnumerator.h"
+#include "SegmentOpener.h"
+#include "Stopwatch.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <Windows.h>
 
@@ -98,21 +110,132 @@ public:
 	void AddedResource(cGZPersistResourceKey const&, cIGZPersistDBSegment*) override;
 	void RemovedResource(cGZPersistResourceKey const&, cIGZPersistDBSegment*) override;
 
+	// Writes the record access statistics of every open multi-packed file to the log file.
+	static void WriteAllRecordAccessStatistics();
+
+	// Adds the keys of the open multi-packed files to the global key index and enables it,
+	// this waits for any background indexing to finish.
+	static void BuildGlobalKeyIndex();
+
 protected:
-	virtual std::vector<cRZBaseString> GetDBPFFiles(const cIGZString& folderPath) const = 0;
+	// Gets the plugin folder scan options from the settings and the scan exclusion rules.
+	static SC4DirectoryEnumerator::ScanOptions GetScanOptions();
+
+	virtual void EnumerateDBPFFiles(
+		const cIGZString& folderPath,
+		const SC4DirectoryEnumerator::ScanOptions& options,
+		const SC4DirectoryEnumerator::FileFoundCallback& callback) const = 0;
+
+	// Called after the segment indexes have been merged, before the negative lookup filter
+	// is built. When BackgroundIndexing is enabled this runs on the first thread that waits
+	// for the indexing, so it must not call the methods that wait for the indexing to finish.
+	virtual void OnSegmentIndexesMerged(const std::vector<cIGZPersistDBSegment*>& segments);
+
+	// Removes the index entries that the predicate selects, the predicate is called with
+	// each key and its segment. Returns the number of entries that were removed.
+	// This must only be called from OnSegmentIndexesMerged.
+	template<typename TPredicate> uint32_t RemoveIndexEntries(TPredicate&& predicate)
+	{
+		const uint32_t removedCount = tgiMap.RemoveIf(std::forward<TPredicate>(predicate));
+
+		if (removedCount > 0)
+		{
+			keyListsUseIndex = true;
+		}
+
+		return removedCount;
+	}
 
 private:
-	bool SetupGZPersistDBSegment(
-		cIGZString const& path,
+	typedef MultiPackedFileOpenStatistics::ProcessMemoryUsage ProcessMemoryUsage;
+
+	SegmentOpener CreateSegmentOpener(
+		const SC4DirectoryEnumerator::ScanOptions& scanOptions,
+		cIGZCOM* const pCOM,
+		MultiPackedFileOpenStatistics& statistics);
+
+	// Merges the segment indexes and sets up the optional lookup features. When
+	// BackgroundIndexing is enabled this runs on the first thread that waits for the indexing.
+	void FinishOpen(MultiPackedFileOpenStatistics& statistics, Stopwatch& totalStopwatch, const char* openMode);
+
+	// Creates the segments and starts prefetching the files on a background thread.
+	void StartBackgroundIndexing(
+		const SC4DirectoryEnumerator::ScanOptions& scanOptions,
 		cIGZCOM* const pCOM,
-		PersistResourceKeyList* const pKeyList);
+		uint32_t threadCount,
+		MultiPackedFileOpenStatistics&& statistics,
+		const Stopwatch& totalStopwatch);
+
+	// Blocks until the background indexing has finished, every method that uses the
+	// segments or tgiMap calls this first. The caller must not hold the critical section.
+	void WaitForIndexing();
+
+	// Copies the segment's records to the target, a segment that is not a packed file has
+	// its file opened as one for the copy. Returns the number of records that were copied.
+	static int32_t CopySegmentRecords(
+		cIGZPersistDBSegment* pSegment,
+		cIGZPersistDBSegment* target,
+		cIGZPersistResourceKeyFilter* filter);
+
+	void StartRecordAccessStatistics();
+
+	void StopRecordAccessStatistics();
+
+	void WriteRecordAccessStatistics();
+
+	void MergeSegmentIndexes(MultiPackedFileOpenStatistics& statistics);
+
+	void MergeSegmentIndex(
+		cIGZPersistDBSegment* const pSegment,
+		PersistResourceKeyList* const pKeyList,
+		MultiPackedFileOpenStatistics& statistics);
+
+	void BuildNegativeLookupFilter();
+
+	void AddToGlobalKeyIndex();
+
+	// Returns true if the resource manager searches the files that use the global key
+	// index from the highest priority to the lowest.
+	// The caller must hold the global key index file list lock.
+	static bool GlobalKeyIndexMatchesSearchOrder();
+
+	// Returns the average time in nanoseconds that this file takes to answer a lookup
+	// for a missing key.
+	double MeasureMissingKeyLookupCost();
+
+	// Returns false if the global key index or the negative lookup filter shows that
+	// tgiMap does not contain the key.
+	// This is called before the critical section is entered.
+	bool MayContainRecord(const cGZPersistResourceKey& key);
+
+	// Looks up the segment that contains the key, the caller must hold the critical section.
+	cIGZPersistDBSegment* FindSegment(const cGZPersistResourceKey& key);
+
+	static void GetProcessMemoryUsage(ProcessMemoryUsage& usage);
+
+	void LogIndexMemoryUsage(const MultiPackedFileOpenStatistics& statistics) const;
+
+	void LogMemoryBackedFiles(const MultiPackedFileOpenStatistics& statistics) const;
 
 	uint32_t segmentID;
 	cRZBaseString folderPath;
 	bool enumerateSegmentsLastInFirstOut;
 	bool initialized;
-	bool isOpen;
+	// Open cannot know whether any segment loaded while the background indexing is
+	// pending, so the file reports that it is open until WaitForIndexing sets the result.
+	std::atomic<bool> isOpen;
 	CRITICAL_SECTION criticalSection;
-	boost::unordered::unordered_flat_map<const cGZPersistResourceKey, cIGZPersistDBSegment*> tgiMap;
+	MultiPackedFileIndex<cIGZPersistDBSegment> tgiMap;
+	NegativeLookupFilter negativeLookupFilter;
+	// The file's priority in the global key index, or GlobalKeyIndex::NoFile if the
+	// file does not use it.
+	uint32_t globalKeyIndexPriority;
+	// True if entries were removed from tgiMap, the key lists are then built from tgiMap
+	// instead of the segments, so that they match GetRecordCount and TestForRecord.
+	bool keyListsUseIndex;
+	BackgroundIndexing backgroundIndexing;
 	std::vector<cIGZPersistDBSegment*> segments;
+	std::shared_ptr<MemoryBlockPool> memoryBlockPool;
+	std::unique_ptr<RecordAccessStatistics> recordAccessStatistics;
+	std::unique_ptr<ResourceAccessTrace::Container> accessTraceContainer;
 };
@@ -17,7 +17,10 @@ DatMultiPackedFile::DatMultiPackedFile() : BaseMultiPackedFile(false)
 {
 }
 
-std::vector<cRZBaseString> DatMultiPackedFile::GetDBPFFiles(const cIGZString& folderPath) const
+void DatMultiPackedFile::EnumerateDBPFFiles(
+	const cIGZString& folderPath,
+	const SC4DirectoryEnumerator::ScanOptions& options,
+	const SC4DirectoryEnumerator::FileFoundCallback& callback) const
 {
-	return SC4DirectoryEnumerator::GetDatFilesRecurseSubdirectories(folderPath);
+	SC4DirectoryEnumerator::EnumerateDatFilesRecurseSubdirectories(folderPath, options, callback);
 }
@@ -21,5 +21,8 @@ public:
 	DatMultiPackedFile();
 
 protected:
-	std::vector<cRZBaseString> GetDBPFFiles(const cIGZString& path) const override;
+	void EnumerateDBPFFiles(
+		const cIGZString& path,
+		const SC4DirectoryEnumerator::ScanOptions& options,
+		const SC4DirectoryEnumerator::FileFoundCallback& callback) const override;
 };
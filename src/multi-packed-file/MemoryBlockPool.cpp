@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MemoryBlockPool.h"
+#include <iterator>
+
+namespace
+{
+	constexpr size_t AllocationAlignment = 8;
+
+	size_t GetAlignedSize(size_t size)
+	{
+		return (size + (AllocationAlignment - 1)) & ~(AllocationAlignment - 1);
+	}
+}
+
+MemoryBlockPool::MemoryBlockPool(size_t blockSize)
+	: blockSize(blockSize),
+	  mutex(),
+	  blocks(),
+	  allocationCount(0),
+	  allocatedBytes(0),
+	  reservedBytes(0)
+{
+}
+
+uint8_t* MemoryBlockPool::Allocate(size_t size)
+{
+	const size_t alignedSize = GetAlignedSize(size);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Block* pBlock = nullptr;
+
+	// Allocations that are larger than a quarter of the block size are given
+	// their own block, so that they do not waste the rest of the current block.
+	if (alignedSize > blockSize / 4)
+	{
+		Block& block = blocks.emplace_back();
+		block.data = std::make_unique_for_overwrite<uint8_t[]>(alignedSize);
+		block.size = alignedSize;
+		block.used = 0;
+
+		reservedBytes += alignedSize;
+		pBlock = &block;
+
+		// Keep the partially used block at the end of the list.
+		if (blocks.size() > 1)
+		{
+			std::swap(blocks[blocks.size() - 1], blocks[blocks.size() - 2]);
+			pBlock = &blocks[blocks.size() - 2];
+		}
+	}
+	else
+	{
+		if (blocks.empty() || blocks.back().size - blocks.back().used < alignedSize)
+		{
+			Block& block = blocks.emplace_back();
+			block.data = std::make_unique_for_overwrite<uint8_t[]>(blockSize);
+			block.size = blockSize;
+			block.used = 0;
+
+			reservedBytes += blockSize;
+		}
+
+		pBlock = &blocks.back();
+	}
+
+	uint8_t* const pData = pBlock->data.get() + pBlock->used;
+	pBlock->used += alignedSize;
+
+	allocationCount++;
+	allocatedBytes += size;
+
+	return pData;
+}
+
+void MemoryBlockPool::Free(uint8_t* data, size_t size)
+{
+	const size_t alignedSize = GetAlignedSize(size);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// The most recent blocks are searched first, as the allocation that is
+	// being returned is normally the last one that was made.
+	for (auto it = blocks.rbegin(); it != blocks.rend(); ++it)
+	{
+		Block& block = *it;
+
+		if (data >= block.data.get() && data < block.data.get() + block.size)
+		{
+			if (alignedSize > blockSize / 4)
+			{
+				// The allocation has its own block, see Allocate.
+				reservedBytes -= block.size;
+				blocks.erase(std::next(it).base());
+			}
+			else if (data + alignedSize == block.data.get() + block.used)
+			{
+				block.used -= alignedSize;
+			}
+
+			allocationCount--;
+			allocatedBytes -= size;
+			break;
+		}
+	}
+}
+
+size_t MemoryBlockPool::GetAllocationCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return allocationCount;
+}
+
+size_t MemoryBlockPool::GetAllocatedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return allocatedBytes;
+}
+
+size_t MemoryBlockPool::GetReservedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return reservedBytes;
+}
+
+size_t MemoryBlockPool::GetBlockCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return blocks.size();
+}
@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Allocates the file data of the memory-backed segments from large blocks, this
+// avoids a separate heap allocation for each small file.
+// The memory is released when the pool is destroyed.
+class MemoryBlockPool
+{
+public:
+
+	explicit MemoryBlockPool(size_t blockSize);
+
+	// Allocates a buffer that remains valid for the lifetime of the pool.
+	// This method is thread safe.
+	uint8_t* Allocate(size_t size);
+
+	// Returns an allocation that is no longer needed, e.g. when the file could not be read.
+	// The memory is reused if the allocation has its own block or was the last one made
+	// from its block, otherwise it is only released when the pool is destroyed.
+	// This method is thread safe.
+	void Free(uint8_t* data, size_t size);
+
+	size_t GetAllocationCount() const;
+
+	// Gets the total size of the allocations.
+	size_t GetAllocatedBytes() const;
+
+	// Gets the total size of the blocks, including the unused space at the end of each block.
+	size_t GetReservedBytes() const;
+
+	size_t GetBlockCount() const;
+
+private:
+
+	struct Block
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+		size_t used;
+	};
+
+	const size_t blockSize;
+	mutable std::mutex mutex;
+	std::vector<Block> blocks;
+	size_t allocationCount;
+	size_t allocatedBytes;
+	size_t reservedBytes;
+};
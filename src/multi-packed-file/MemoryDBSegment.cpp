@@ -0,0 +1,641 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MemoryDBSegment.h"
+#include "DBPFHeader.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include "QfsCompression.h"
+#include "cIGZCOM.h"
+#include "cIGZDBSegmentPackedFile.h"
+#include "cIGZPersistResourceKeyFilter.h"
+#include "cIGZPersistResourceKeyList.h"
+#include "cRZAutoRefCount.h"
+#include <atomic>
+#include <cstring>
+#include <Windows.h>
+#include "wil/resource.h"
+
+namespace
+{
+	std::atomic<uint32_t> memoryBackedFileCount = 0;
+	std::atomic<uint32_t> fileSegmentOpenCount = 0;
+	std::atomic<uint64_t> memoryBackedFileBytes = 0;
+}
+
+MemoryDBSegment::MemoryDBSegment(
+	cIGZCOM* pCOM,
+	const std::shared_ptr<MemoryBlockPool>& pool,
+	uint32_t maxFileSize,
+	uint64_t fileSize)
+	: pCOM(pCOM),
+	  pool(pool),
+	  maxFileSize(maxFileSize),
+	  fileSize(fileSize),
+	  path(),
+	  segmentID(0),
+	  isOpen(false),
+	  memoryBacked(false),
+	  index(),
+	  fileSegmentMutex(),
+	  fileSegment(nullptr),
+	  fileSegmentUseCount(0)
+{
+}
+
+MemoryDBSegment::~MemoryDBSegment()
+{
+	if (fileSegment)
+	{
+		fileSegment->Release();
+		fileSegment = nullptr;
+	}
+}
+
+bool MemoryDBSegment::QueryInterface(uint32_t riid, void** ppvObj)
+{
+	if (riid == GZIID_cIGZPersistDBSegment)
+	{
+		*ppvObj = static_cast<cIGZPersistDBSegment*>(this);
+		AddRef();
+
+		return true;
+	}
+
+	// The segment does not provide the cGZDBSegmentPackedFile interfaces, such as
+	// cIGZDBSegmentPackedFile, a different object would break the COM identity rules.
+	return cRZBaseUnknown::QueryInterface(riid, ppvObj);
+}
+
+uint32_t MemoryDBSegment::AddRef()
+{
+	return cRZBaseUnknown::AddRef();
+}
+
+uint32_t MemoryDBSegment::Release()
+{
+	return cRZBaseUnknown::Release();
+}
+
+bool MemoryDBSegment::Init()
+{
+	return true;
+}
+
+bool MemoryDBSegment::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (fileSegment)
+	{
+		fileSegment->Shutdown();
+	}
+
+	return true;
+}
+
+bool MemoryDBSegment::Open(bool openRead, bool openWrite)
+{
+	if (isOpen)
+	{
+		return true;
+	}
+
+	if (openRead && !openWrite && LoadFile())
+	{
+		memoryBacked = true;
+		isOpen = true;
+	}
+	else
+	{
+		// The file is opened as a cGZDBSegmentPackedFile, which all of the calls
+		// are forwarded to.
+		cIGZPersistDBSegment* const pSegment = OpenFileSegment(openRead, openWrite);
+
+		if (pSegment)
+		{
+			std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+			fileSegment = pSegment;
+			isOpen = true;
+		}
+	}
+
+	return isOpen;
+}
+
+bool MemoryDBSegment::IsOpen() const
+{
+	return isOpen;
+}
+
+bool MemoryDBSegment::Close()
+{
+	if (isOpen)
+	{
+		isOpen = false;
+		memoryBacked = false;
+		index.Clear();
+
+		std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+		if (fileSegment)
+		{
+			fileSegment->Close();
+			fileSegment->Shutdown();
+			fileSegment->Release();
+			fileSegment = nullptr;
+		}
+
+		fileSegmentUseCount = 0;
+	}
+
+	return true;
+}
+
+bool MemoryDBSegment::Flush()
+{
+	if (memoryBacked)
+	{
+		return true;
+	}
+
+	return fileSegment && fileSegment->Flush();
+}
+
+void MemoryDBSegment::GetPath(cIGZString& path) const
+{
+	path.Copy(this->path);
+}
+
+bool MemoryDBSegment::SetPath(cIGZString const& path)
+{
+	this->path.Copy(path);
+
+	return true;
+}
+
+bool MemoryDBSegment::Lock()
+{
+	return true;
+}
+
+bool MemoryDBSegment::Unlock()
+{
+	return true;
+}
+
+uint32_t MemoryDBSegment::GetSegmentID() const
+{
+	return segmentID;
+}
+
+bool MemoryDBSegment::SetSegmentID(uint32_t const& segmentID)
+{
+	this->segmentID = segmentID;
+
+	return true;
+}
+
+uint32_t MemoryDBSegment::GetRecordCount(cIGZPersistResourceKeyFilter* filter)
+{
+	if (!memoryBacked)
+	{
+		return fileSegment ? fileSegment->GetRecordCount(filter) : 0;
+	}
+
+	const std::vector<Record>& records = index.GetRecords();
+
+	if (!filter)
+	{
+		return static_cast<uint32_t>(records.size());
+	}
+
+	uint32_t count = 0;
+
+	for (const Record& record : records)
+	{
+		if (filter->IsKeyIncluded(record.key))
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+uint32_t MemoryDBSegment::GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter)
+{
+	if (!memoryBacked)
+	{
+		return fileSegment ? fileSegment->GetResourceKeyList(list, filter) : 0;
+	}
+
+	uint32_t count = 0;
+
+	if (list)
+	{
+		for (const Record& record : index.GetRecords())
+		{
+			if (!filter || filter->IsKeyIncluded(record.key))
+			{
+				list->Insert(record.key);
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+bool MemoryDBSegment::GetResourceKeyList(cIGZPersistResourceKeyList& list)
+{
+	if (!memoryBacked)
+	{
+		return fileSegment && fileSegment->GetResourceKeyList(list);
+	}
+
+	for (const Record& record : index.GetRecords())
+	{
+		list.Insert(record.key);
+	}
+
+	return true;
+}
+
+bool MemoryDBSegment::TestForRecord(cGZPersistResourceKey const& key)
+{
+	if (!memoryBacked)
+	{
+		return fileSegment && fileSegment->TestForRecord(key);
+	}
+
+	return index.Find(key) != nullptr;
+}
+
+uint32_t MemoryDBSegment::GetRecordSize(cGZPersistResourceKey const& key)
+{
+	if (!memoryBacked)
+	{
+		return fileSegment ? fileSegment->GetRecordSize(key) : 0;
+	}
+
+	const Record* const pRecord = index.Find(key);
+
+	return pRecord ? pRecord->uncompressedSize : 0;
+}
+
+bool MemoryDBSegment::OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode)
+{
+	if (memoryBacked && !index.Find(key))
+	{
+		return false;
+	}
+
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(true);
+
+	if (!pFileSegment)
+	{
+		return false;
+	}
+
+	const bool result = pFileSegment->OpenRecord(key, record, accessMode);
+
+	// The open record keeps its use until it is closed.
+	if (!result)
+	{
+		ReleaseFileSegment();
+	}
+
+	return result;
+}
+
+bool MemoryDBSegment::CreateNewRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record)
+{
+	if (memoryBacked)
+	{
+		return false;
+	}
+
+	return fileSegment && fileSegment->CreateNewRecord(key, record);
+}
+
+bool MemoryDBSegment::CloseRecord(cIGZPersistDBRecord* record)
+{
+	// A memory-backed file that has no open records does not have the record.
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(false);
+
+	if (!pFileSegment)
+	{
+		return false;
+	}
+
+	const bool result = pFileSegment->CloseRecord(record);
+
+	ReleaseFileSegment();
+
+	if (result)
+	{
+		// Removes the use that the record held.
+		ReleaseFileSegment();
+	}
+
+	return result;
+}
+
+bool MemoryDBSegment::CloseRecord(cIGZPersistDBRecord** record)
+{
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(false);
+
+	if (!pFileSegment)
+	{
+		return false;
+	}
+
+	const bool result = pFileSegment->CloseRecord(record);
+
+	ReleaseFileSegment();
+
+	if (result)
+	{
+		ReleaseFileSegment();
+	}
+
+	return result;
+}
+
+bool MemoryDBSegment::AbortRecord(cIGZPersistDBRecord* record)
+{
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(false);
+
+	if (!pFileSegment)
+	{
+		return false;
+	}
+
+	const bool result = pFileSegment->AbortRecord(record);
+
+	ReleaseFileSegment();
+
+	if (result)
+	{
+		ReleaseFileSegment();
+	}
+
+	return result;
+}
+
+bool MemoryDBSegment::AbortRecord(cIGZPersistDBRecord** record)
+{
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(false);
+
+	if (!pFileSegment)
+	{
+		return false;
+	}
+
+	const bool result = pFileSegment->AbortRecord(record);
+
+	ReleaseFileSegment();
+
+	if (result)
+	{
+		ReleaseFileSegment();
+	}
+
+	return result;
+}
+
+bool MemoryDBSegment::DeleteRecord(cGZPersistResourceKey const& key)
+{
+	if (memoryBacked)
+	{
+		return false;
+	}
+
+	return fileSegment && fileSegment->DeleteRecord(key);
+}
+
+uint32_t MemoryDBSegment::ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize)
+{
+	if (memoryBacked)
+	{
+		const Record* const pRecord = index.Find(key);
+
+		if (!pRecord)
+		{
+			return 0;
+		}
+
+		// The calls that the in-memory copy cannot complete, an empty record or a buffer that
+		// is too small, are forwarded so that the game sees the packed file's behavior.
+		if (buffer && pRecord->uncompressedSize > 0 && pRecord->uncompressedSize <= recordSize)
+		{
+			bool copied = false;
+
+			if (pRecord->compressed)
+			{
+				copied = QfsCompression::Decompress(
+					pRecord->data,
+					pRecord->size,
+					static_cast<uint8_t*>(buffer),
+					pRecord->uncompressedSize);
+			}
+			else
+			{
+				std::memcpy(buffer, pRecord->data, pRecord->size);
+				copied = true;
+			}
+
+			if (copied)
+			{
+				recordSize = pRecord->uncompressedSize;
+				return recordSize;
+			}
+		}
+	}
+
+	cIGZPersistDBSegment* const pFileSegment = AcquireFileSegment(true);
+
+	if (!pFileSegment)
+	{
+		return 0;
+	}
+
+	const uint32_t result = pFileSegment->ReadRecord(key, buffer, recordSize);
+
+	ReleaseFileSegment();
+
+	return result;
+}
+
+bool MemoryDBSegment::WriteRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t recordSize)
+{
+	if (memoryBacked)
+	{
+		return false;
+	}
+
+	return fileSegment && fileSegment->WriteRecord(key, buffer, recordSize);
+}
+
+bool MemoryDBSegment::Init(uint32_t segmentID, cIGZString const& path, bool unknown2)
+{
+	this->segmentID = segmentID;
+	this->path.Copy(path);
+
+	return true;
+}
+
+bool MemoryDBSegment::IsMemoryBacked() const
+{
+	return memoryBacked;
+}
+
+void MemoryDBSegment::WriteStatistics()
+{
+	const uint32_t fileCount = memoryBackedFileCount;
+
+	if (fileCount > 0)
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"%u small files are served from %.1f MB of pooled memory, their files were opened %u times for record access.",
+			fileCount,
+			static_cast<double>(memoryBackedFileBytes) / (1024.0 * 1024.0),
+			fileSegmentOpenCount.load());
+	}
+}
+
+bool MemoryDBSegment::LoadFile()
+{
+	// The size check uses the size from the directory scan, so the files that are too
+	// large are never opened by this method.
+	if (fileSize < DBPFHeader::Size || fileSize > maxFileSize)
+	{
+		return false;
+	}
+
+	std::wstring win32Path = GZStringConvert::ToUtf16(path);
+
+	if (PathUtil::MustAddExtendedPathPrefix(win32Path))
+	{
+		win32Path = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(win32Path));
+	}
+
+	wil::unique_hfile hFile(CreateFileW(
+		win32Path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr));
+
+	if (!hFile)
+	{
+		return false;
+	}
+
+	const uint32_t size = static_cast<uint32_t>(fileSize);
+	uint8_t* const data = pool->Allocate(size);
+
+	DWORD bytesRead = 0;
+
+	if (!ReadFile(hFile.get(), data, size, &bytesRead, nullptr) || bytesRead != size)
+	{
+		pool->Free(data, size);
+		return false;
+	}
+
+	hFile.reset();
+
+	if (!index.Parse(data, size))
+	{
+		pool->Free(data, size);
+		return false;
+	}
+
+	memoryBackedFileCount++;
+	memoryBackedFileBytes += size;
+
+	return true;
+}
+
+cIGZPersistDBSegment* MemoryDBSegment::OpenFileSegment(bool openRead, bool openWrite) const
+{
+	cIGZPersistDBSegment* result = nullptr;
+
+	cRZAutoRefCount<cIGZPersistDBSegment> pSegment;
+
+	if (pCOM->GetClassObject(
+		GZCLSID_cGZDBSegmentPackedFile,
+		GZIID_cIGZPersistDBSegment,
+		pSegment.AsPPVoid()))
+	{
+		if (pSegment->Init() && pSegment->SetPath(path) && pSegment->Open(openRead, openWrite))
+		{
+			pSegment->AddRef();
+			result = pSegment;
+		}
+	}
+
+	return result;
+}
+
+cIGZPersistDBSegment* MemoryDBSegment::AcquireFileSegment(bool openIfClosed)
+{
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (memoryBacked)
+	{
+		if (!fileSegment)
+		{
+			if (!openIfClosed)
+			{
+				return nullptr;
+			}
+
+			fileSegment = OpenFileSegment(true, false);
+
+			if (!fileSegment)
+			{
+				return nullptr;
+			}
+
+			fileSegmentOpenCount++;
+		}
+
+		fileSegmentUseCount++;
+	}
+
+	return fileSegment;
+}
+
+void MemoryDBSegment::ReleaseFileSegment()
+{
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (memoryBacked && fileSegmentUseCount > 0)
+	{
+		fileSegmentUseCount--;
+
+		if (fileSegmentUseCount == 0 && fileSegment)
+		{
+			fileSegment->Close();
+			fileSegment->Shutdown();
+			fileSegment->Release();
+			fileSegment = nullptr;
+		}
+	}
+}
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZPersistDBSegment.h"
+#include "cRZBaseString.h"
+#include "cRZBaseUnknown.h"
+#include "MemoryBlockPool.h"
+#include "MemoryDBSegmentIndex.h"
+#include <memory>
+#include <mutex>
+
+class cIGZCOM;
+
+// A read-only DBPF segment that reads a small file into memory with a single call
+// and closes the file handle.
+//
+// The index queries and ReadRecord are served from memory, the compressed records
+// are decompressed from the in-memory copy. The calls that need a cIGZPersistDBRecord
+// are forwarded to a cGZDBSegmentPackedFile that is opened for them, and closed again
+// when none of its records are open. The file is opened read-only, so the calls that
+// write to it fail.
+// Files that are larger than the size limit, that cannot be parsed or that list a key
+// more than once, forward all of their calls to a cGZDBSegmentPackedFile.
+class MemoryDBSegment final : public cRZBaseUnknown, public cIGZPersistDBSegment
+{
+public:
+	// The file size is the one the directory scan reported, files that are larger than
+	// maxFileSize are not read into memory.
+	MemoryDBSegment(
+		cIGZCOM* pCOM,
+		const std::shared_ptr<MemoryBlockPool>& pool,
+		uint32_t maxFileSize,
+		uint64_t fileSize);
+
+	~MemoryDBSegment();
+
+	bool QueryInterface(uint32_t riid, void** ppvObj) override;
+	uint32_t AddRef() override;
+	uint32_t Release() override;
+
+	// cIGZPersistDBSegment
+
+	bool Init() override;
+	bool Shutdown() override;
+
+	bool Open(bool openRead, bool openWrite) override;
+	bool IsOpen() const override;
+	bool Close() override;
+	bool Flush() override;
+
+	void GetPath(cIGZString& path) const override;
+	bool SetPath(cIGZString const& path) override;
+
+	bool Lock() override;
+	bool Unlock() override;
+
+	uint32_t GetSegmentID() const override;
+	bool SetSegmentID(uint32_t const& segmentID) override;
+
+	uint32_t GetRecordCount(cIGZPersistResourceKeyFilter* filter) override;
+
+	uint32_t GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter) override;
+	bool GetResourceKeyList(cIGZPersistResourceKeyList& list) override;
+
+	bool TestForRecord(cGZPersistResourceKey const& key) override;
+	uint32_t GetRecordSize(cGZPersistResourceKey const& key) override;
+	bool OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode) override;
+	bool CreateNewRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record) override;
+
+	bool CloseRecord(cIGZPersistDBRecord* record) override;
+	bool CloseRecord(cIGZPersistDBRecord** record) override;
+
+	bool AbortRecord(cIGZPersistDBRecord* record) override;
+	bool AbortRecord(cIGZPersistDBRecord** record) override;
+
+	bool DeleteRecord(cGZPersistResourceKey const& key) override;
+	uint32_t ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize) override;
+	bool WriteRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t recordSize) override;
+
+	bool Init(uint32_t segmentID, cIGZString const& path, bool unknown2) override;
+
+	// Returns true if the file's records are served from memory.
+	bool IsMemoryBacked() const;
+
+	// Writes the number of memory-backed files, and how many times their file was
+	// opened again for record access, to the log file.
+	static void WriteStatistics();
+
+private:
+	typedef MemoryDBSegmentIndex::Record Record;
+
+	bool LoadFile();
+
+	// Opens the file as a cGZDBSegmentPackedFile, returns nullptr if it could not be opened.
+	cIGZPersistDBSegment* OpenFileSegment(bool openRead, bool openWrite) const;
+
+	// Gets the cGZDBSegmentPackedFile for the file and adds a use to it, a memory-backed
+	// file opens it if it is not already open and openIfClosed is true.
+	// Returns nullptr if the file is not open, otherwise the use must be removed with
+	// ReleaseFileSegment. Each open record holds a use.
+	cIGZPersistDBSegment* AcquireFileSegment(bool openIfClosed);
+
+	// Removes a use from the cGZDBSegmentPackedFile, a memory-backed file closes it when
+	// the last use is removed.
+	void ReleaseFileSegment();
+
+	cIGZCOM* const pCOM;
+	const std::shared_ptr<MemoryBlockPool> pool;
+	const uint32_t maxFileSize;
+	const uint64_t fileSize;
+	cRZBaseString path;
+	uint32_t segmentID;
+	bool isOpen;
+	bool memoryBacked;
+	MemoryDBSegmentIndex index;
+	std::mutex fileSegmentMutex;
+	cIGZPersistDBSegment* fileSegment;
+	uint32_t fileSegmentUseCount;
+};
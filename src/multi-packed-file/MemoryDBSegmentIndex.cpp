@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "MemoryDBSegmentIndex.h"
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include <cstring>
+
+namespace
+{
+	// The directory record lists the uncompressed size of each compressed record.
+	const cGZPersistResourceKey DirectoryRecordKey(0xE86B1EEF, 0xE86B1EEF, 0x286B1F03);
+
+	uint32_t ReadUInt32(const uint8_t* data)
+	{
+		uint32_t value = 0;
+		std::memcpy(&value, data, sizeof(value));
+
+		return value;
+	}
+}
+
+MemoryDBSegmentIndex::MemoryDBSegmentIndex()
+	: records(),
+	  recordIndexes()
+{
+}
+
+bool MemoryDBSegmentIndex::Parse(const uint8_t* data, uint32_t size)
+{
+	Clear();
+
+	if (size < DBPFHeader::Size)
+	{
+		return false;
+	}
+
+	DBPFHeader header{};
+	std::memcpy(&header, data, sizeof(header));
+
+	if (!DBPFIndexReader::IsValidHeader(header, size))
+	{
+		return false;
+	}
+
+	const DBPFIndexReader indexReader(header, data + header.indexOffset, size);
+	const uint32_t entryCount = indexReader.GetEntryCount();
+
+	records.reserve(entryCount);
+	recordIndexes.reserve(entryCount);
+
+	Record directory{};
+	bool hasDirectory = false;
+
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		DBPFIndexReader::Entry entry{};
+
+		if (!indexReader.TryGetEntry(i, entry))
+		{
+			Clear();
+			return false;
+		}
+
+		Record record{};
+		record.key = cGZPersistResourceKey(entry.type, entry.group, entry.instance);
+		record.data = data + entry.offset;
+		record.size = entry.size;
+		record.uncompressedSize = entry.size;
+		record.compressed = false;
+
+		if (record.key == DirectoryRecordKey)
+		{
+			// The directory is part of the packed file format, it is not one of
+			// the segment's resources.
+			directory = record;
+			hasDirectory = true;
+		}
+		else if (recordIndexes.try_emplace(record.key, static_cast<uint32_t>(records.size())).second)
+		{
+			records.push_back(record);
+		}
+		else
+		{
+			Clear();
+			return false;
+		}
+	}
+
+	if (hasDirectory)
+	{
+		// Each directory entry is the record's key followed by its uncompressed size.
+		const uint32_t directoryEntrySize = DBPFIndexReader::GetEntrySize(header) - sizeof(uint32_t);
+		const uint32_t directoryEntryCount = directory.size / directoryEntrySize;
+
+		for (uint32_t i = 0; i < directoryEntryCount; i++)
+		{
+			const uint8_t* const entry = directory.data + (i * directoryEntrySize);
+
+			const auto recordIndex = recordIndexes.find(cGZPersistResourceKey(
+				ReadUInt32(entry),
+				ReadUInt32(entry + 4),
+				ReadUInt32(entry + 8)));
+
+			if (recordIndex != recordIndexes.end())
+			{
+				Record& record = records[recordIndex->second];
+				record.uncompressedSize = ReadUInt32(entry + directoryEntrySize - sizeof(uint32_t));
+				record.compressed = true;
+			}
+		}
+	}
+
+	return true;
+}
+
+void MemoryDBSegmentIndex::Clear()
+{
+	records.clear();
+	recordIndexes.clear();
+}
+
+const std::vector<MemoryDBSegmentIndex::Record>& MemoryDBSegmentIndex::GetRecords() const
+{
+	return records;
+}
+
+const MemoryDBSegmentIndex::Record* MemoryDBSegmentIndex::Find(const cGZPersistResourceKey& key) const
+{
+	const auto recordIndex = recordIndexes.find(key);
+
+	return recordIndex != recordIndexes.end() ? &records[recordIndex->second] : nullptr;
+}
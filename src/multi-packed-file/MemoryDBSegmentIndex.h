@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyHashers.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <cstdint>
+#include <vector>
+
+// The record index of a DBPF file that has been read into memory.
+// It only depends on the DBPF format headers, so that it can be tested outside of the game.
+class MemoryDBSegmentIndex
+{
+public:
+	struct Record
+	{
+		cGZPersistResourceKey key;
+		const uint8_t* data;
+		uint32_t size;
+		uint32_t uncompressedSize;
+		bool compressed;
+	};
+
+	MemoryDBSegmentIndex();
+
+	// Reads the index and directory of the file data, which must remain valid until
+	// the index is cleared.
+	// Returns false if the data is not a valid DBPF 1.x file, or if its index lists a key
+	// more than once. The game's cGZDBSegmentPackedFile decides which copy of a duplicate
+	// key it uses, so those files are left to it.
+	bool Parse(const uint8_t* data, uint32_t size);
+
+	void Clear();
+
+	const std::vector<Record>& GetRecords() const;
+
+	// Returns nullptr if the file does not have the key.
+	const Record* Find(const cGZPersistResourceKey& key) const;
+
+private:
+	std::vector<Record> records;
+	boost::unordered::unordered_flat_map<
+		cGZPersistResourceKey,
+		uint32_t,
+		PersistResourceKeyHashers::TgiMapHasher,
+		std::equal_to<const cGZPersistResourceKey>> recordIndexes;
+};
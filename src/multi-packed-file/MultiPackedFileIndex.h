@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "PersistResourceKeyHashers.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <stdint.h>
+
+// The combined TGI index of a multi-packed file, it maps each key to the segment
+// that contains the newest version of the resource.
+//
+// The index does not depend on the game's COM objects or the Windows API, this allows
+// the index build and lookups to be benchmarked outside of the game by the
+// MultiPackedFileBenchmark tool. The caller is responsible for any locking.
+// The key hasher is selected at compile time, see PersistResourceKeyHashers.h.
+template<typename TSegment> class MultiPackedFileIndex
+{
+public:
+	MultiPackedFileIndex() : map()
+	{
+	}
+
+	// Adds the keys of a segment, later segments override the earlier ones.
+	template<typename TKeyRange> void AddSegment(TSegment* segment, const TKeyRange& keys)
+	{
+		for (const cGZPersistResourceKey& key : keys)
+		{
+			map.insert_or_assign(key, segment);
+		}
+	}
+
+	// Adds the keys of a segment, calling onOverride with the previous segment for
+	// every key that the segment overrides.
+	template<typename TKeyRange, typename TOverrideCallback>
+	void AddSegment(TSegment* segment, const TKeyRange& keys, TOverrideCallback&& onOverride)
+	{
+		for (const cGZPersistResourceKey& key : keys)
+		{
+			const auto result = map.try_emplace(key, segment);
+
+			if (!result.second)
+			{
+				TSegment* const previousSegment = result.first->second;
+
+				if (previousSegment != segment)
+				{
+					result.first->second = segment;
+					onOverride(previousSegment);
+				}
+			}
+		}
+	}
+
+	void Add(const cGZPersistResourceKey& key, TSegment* segment)
+	{
+		map.insert_or_assign(key, segment);
+	}
+
+	void Remove(const cGZPersistResourceKey& key)
+	{
+		map.erase(key);
+	}
+
+	// Removes the keys that the predicate selects, the predicate is called with each key
+	// and its segment. Returns the number of keys that were removed.
+	template<typename TPredicate> uint32_t RemoveIf(TPredicate&& predicate)
+	{
+		return static_cast<uint32_t>(boost::unordered::erase_if(
+			map,
+			[&predicate](const auto& item) { return predicate(item.first, item.second); }));
+	}
+
+	// Returns the segment that contains the key, or nullptr if the key is not in the index.
+	TSegment* Find(const cGZPersistResourceKey& key) const
+	{
+		const auto item = map.find(key);
+
+		return item != map.end() ? item->second : nullptr;
+	}
+
+	uint32_t GetCount() const
+	{
+		return static_cast<uint32_t>(map.size());
+	}
+
+	template<typename TKeyPredicate> uint32_t GetCount(TKeyPredicate&& isKeyIncluded) const
+	{
+		uint32_t count = 0;
+
+		for (const auto& item : map)
+		{
+			if (isKeyIncluded(item.first))
+			{
+				count++;
+			}
+		}
+
+		return count;
+	}
+
+	template<typename TCallback> void ForEachKey(TCallback&& callback) const
+	{
+		for (const auto& item : map)
+		{
+			callback(item.first);
+		}
+	}
+
+	void Clear()
+	{
+		map.clear();
+	}
+
+	// Ensures that the index can hold the specified number of keys without rehashing.
+	void Reserve(size_t count)
+	{
+		map.reserve(count);
+	}
+
+	size_t GetBucketCount() const
+	{
+		return map.bucket_count();
+	}
+
+private:
+	boost::unordered::unordered_flat_map<
+		const cGZPersistResourceKey,
+		TSegment*,
+		PersistResourceKeyHashers::TgiMapHasher,
+		std::equal_to<const cGZPersistResourceKey>> map;
+};
@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZPersistDBSegment.h"
+#include "LoadCostReport.h"
+#include "Stopwatch.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <vector>
+#include <Windows.h>
+
+// The timings and memory usage that a multi-packed file writes to the log file after it
+// has opened and indexed its segments.
+struct MultiPackedFileOpenStatistics
+{
+	struct ProcessMemoryUsage
+	{
+		size_t privateBytes = 0;
+		size_t peakPrivateBytes = 0;
+	};
+
+	uint32_t fileCount = 0;
+	Stopwatch scanStopwatch;
+	Stopwatch openStopwatch;
+	Stopwatch mergeStopwatch;
+	bool collectFileCosts = LoadCostReport::GetInstance().IsEnabled();
+	std::vector<LoadCostReport::FileCost> fileCosts;
+	boost::unordered::unordered_flat_map<cIGZPersistDBSegment*, size_t> fileCostIndexes;
+	size_t indexEntryCount = 0;
+	uint32_t indexRehashCount = 0;
+	size_t keyListCapacity = 0;
+	ProcessMemoryUsage memoryUsageBeforeOpen;
+	DWORD handleCountBeforeOpen = 0;
+};
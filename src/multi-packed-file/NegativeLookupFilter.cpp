@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "NegativeLookupFilter.h"
+#include "Logger.h"
+#include "MissingKeySamples.h"
+#include "Stopwatch.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// The filters that are enabled, the city load statistics are written for these.
+	std::mutex enabledFiltersMutex;
+	std::vector<NegativeLookupFilter*> enabledFilters;
+}
+
+NegativeLookupFilter::NegativeLookupFilter()
+	: folderPath(),
+	  filter(),
+	  enabled(false),
+	  lookupCount(0),
+	  falsePositiveCount(0),
+	  rejectedCount(0),
+	  filterNanoseconds(0),
+	  indexMissNanoseconds(0),
+	  cityLoadStart()
+{
+}
+
+NegativeLookupFilter::~NegativeLookupFilter()
+{
+	std::lock_guard<std::mutex> lock(enabledFiltersMutex);
+
+	std::erase(enabledFilters, this);
+}
+
+void NegativeLookupFilter::Enable(const cIGZString& folderPath, uint32_t keyCount, double indexMissNanoseconds)
+{
+	this->folderPath.Copy(folderPath);
+	this->indexMissNanoseconds = indexMissNanoseconds;
+
+	lookupCount = 0;
+	falsePositiveCount = 0;
+	rejectedCount = 0;
+
+	MeasureFilterCost(keyCount);
+
+	std::lock_guard<std::mutex> lock(enabledFiltersMutex);
+
+	cityLoadStart = Counts();
+	enabled.store(true, std::memory_order_release);
+	enabledFilters.push_back(this);
+}
+
+void NegativeLookupFilter::Disable()
+{
+	{
+		std::lock_guard<std::mutex> lock(enabledFiltersMutex);
+
+		if (!enabled)
+		{
+			return;
+		}
+
+		enabled = false;
+		std::erase(enabledFilters, this);
+	}
+
+	LogStatistics(GetCounts(), "since the plugins were loaded");
+}
+
+void NegativeLookupFilter::Clear()
+{
+	filter.Clear();
+}
+
+bool NegativeLookupFilter::IsEnabled() const
+{
+	return enabled.load(std::memory_order_acquire);
+}
+
+bool NegativeLookupFilter::MayContain(const cGZPersistResourceKey& key)
+{
+	if (enabled.load(std::memory_order_acquire) && !filter.MayContain(key))
+	{
+		rejectedCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	return true;
+}
+
+void NegativeLookupFilter::CountLookup(bool found)
+{
+	if (enabled.load(std::memory_order_relaxed))
+	{
+		lookupCount.fetch_add(1, std::memory_order_relaxed);
+
+		if (!found)
+		{
+			falsePositiveCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+void NegativeLookupFilter::Insert(const cGZPersistResourceKey& key)
+{
+	if (enabled.load(std::memory_order_acquire))
+	{
+		filter.InsertConcurrent(key);
+	}
+}
+
+double NegativeLookupFilter::GetFilterNanoseconds() const
+{
+	return filterNanoseconds;
+}
+
+void NegativeLookupFilter::StartCityLoadStatistics()
+{
+	std::lock_guard<std::mutex> lock(enabledFiltersMutex);
+
+	for (NegativeLookupFilter* filter : enabledFilters)
+	{
+		filter->cityLoadStart = filter->GetCounts();
+	}
+}
+
+void NegativeLookupFilter::WriteCityLoadStatistics()
+{
+	std::lock_guard<std::mutex> lock(enabledFiltersMutex);
+
+	if (enabledFilters.empty())
+	{
+		return;
+	}
+
+	Counts total;
+	double totalSavedMilliseconds = 0;
+
+	for (const NegativeLookupFilter* filter : enabledFilters)
+	{
+		const Counts& start = filter->cityLoadStart;
+		const Counts current = filter->GetCounts();
+
+		Counts cityLoad;
+		cityLoad.lookupCount = current.lookupCount - start.lookupCount;
+		cityLoad.falsePositiveCount = current.falsePositiveCount - start.falsePositiveCount;
+		cityLoad.rejectedCount = current.rejectedCount - start.rejectedCount;
+
+		totalSavedMilliseconds += filter->LogStatistics(cityLoad, "during the city load");
+
+		total.lookupCount += cityLoad.lookupCount;
+		total.falsePositiveCount += cityLoad.falsePositiveCount;
+		total.rejectedCount += cityLoad.rejectedCount;
+	}
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"City load: %llu lookups in %zu plugin folders, %llu rejected by the negative lookup filters, about %.1f ms saved.",
+		total.lookupCount + total.rejectedCount,
+		enabledFilters.size(),
+		total.rejectedCount,
+		totalSavedMilliseconds);
+}
+
+void NegativeLookupFilter::MeasureFilterCost(uint32_t keyCount)
+{
+	constexpr uint32_t SampleKeyCount = 4096;
+
+	// The sample keys are treated as missing from the file, so every key that passes
+	// the filter is counted as a false positive.
+	const std::vector<cGZPersistResourceKey> sampleKeys = MissingKeySamples::Create(SampleKeyCount);
+
+	uint32_t sampleFalsePositiveCount = 0;
+
+	const int64_t start = Stopwatch::GetTimestamp();
+
+	for (const cGZPersistResourceKey& key : sampleKeys)
+	{
+		if (filter.MayContain(key))
+		{
+			sampleFalsePositiveCount++;
+		}
+	}
+
+	const int64_t end = Stopwatch::GetTimestamp();
+
+	const double nanosecondsPerTick = 1e9 / static_cast<double>(Stopwatch::GetFrequency());
+
+	filterNanoseconds = static_cast<double>(end - start) * nanosecondsPerTick / SampleKeyCount;
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Negative lookup filter for %s: %u keys, %zu KB, %.2f%% sampled false positive rate,"
+		" %.1f ns per filter check, %.1f ns per index lookup.",
+		folderPath.ToChar(),
+		keyCount,
+		filter.GetMemoryUsage() / 1024,
+		100.0 * sampleFalsePositiveCount / SampleKeyCount,
+		filterNanoseconds,
+		indexMissNanoseconds);
+}
+
+NegativeLookupFilter::Counts NegativeLookupFilter::GetCounts() const
+{
+	Counts counts;
+	counts.lookupCount = lookupCount.load(std::memory_order_relaxed);
+	counts.falsePositiveCount = falsePositiveCount.load(std::memory_order_relaxed);
+	counts.rejectedCount = rejectedCount.load(std::memory_order_relaxed);
+
+	return counts;
+}
+
+double NegativeLookupFilter::LogStatistics(const Counts& counts, const char* period) const
+{
+	const uint64_t totalLookupCount = counts.lookupCount + counts.rejectedCount;
+	const uint64_t missCount = counts.rejectedCount + counts.falsePositiveCount;
+
+	const double savedMilliseconds = static_cast<double>(counts.rejectedCount)
+		* std::max(0.0, indexMissNanoseconds - filterNanoseconds)
+		/ 1e6;
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Negative lookups %s for %s: %llu lookups, %llu misses (%.1f%%), %llu rejected by the filter,"
+		" %llu false positives (%.2f%% of the misses), about %.1f ms saved.",
+		period,
+		folderPath.ToChar(),
+		totalLookupCount,
+		missCount,
+		totalLookupCount > 0 ? 100.0 * static_cast<double>(missCount) / static_cast<double>(totalLookupCount) : 0.0,
+		counts.rejectedCount,
+		counts.falsePositiveCount,
+		missCount > 0 ? 100.0 * static_cast<double>(counts.falsePositiveCount) / static_cast<double>(missCount) : 0.0,
+		savedMilliseconds);
+
+	return savedMilliseconds;
+}
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cGZPersistResourceKey.h"
+#include "cRZBaseString.h"
+#include "ResourceKeyBloomFilter.h"
+#include <atomic>
+#include <stdint.h>
+
+class cIGZString;
+
+// A Bloom filter of the keys in a multi-packed file, the file uses it to answer the lookups
+// for the keys that it does not have without taking its critical section.
+// The filter counts the lookups that it answered and the lookups that passed it, and writes
+// the counts to the log file when it is disabled and after each city load.
+class NegativeLookupFilter
+{
+public:
+	NegativeLookupFilter();
+
+	~NegativeLookupFilter();
+
+	// Builds the filter, forEachKey is called with a function that adds one key.
+	// This must be called while the filter is disabled.
+	template<typename TForEachKey> void Build(size_t keyCount, TForEachKey&& forEachKey)
+	{
+		filter.Reset(keyCount);
+
+		forEachKey([this](const cGZPersistResourceKey& key) { filter.Insert(key); });
+	}
+
+	// Starts answering the lookups and counting them. indexMissNanoseconds is the measured
+	// cost of a locked index lookup for a missing key, it is used to estimate the time saved.
+	void Enable(const cIGZString& folderPath, uint32_t keyCount, double indexMissNanoseconds);
+
+	// Stops answering the lookups and writes the counts since Enable to the log file.
+	// The filter storage is kept until Clear, a lookup that does not hold the file's
+	// critical section may have checked the enabled flag before it was cleared.
+	void Disable();
+
+	// Frees the filter storage, this must be called after Disable once no lookups can be
+	// using the filter.
+	void Clear();
+
+	bool IsEnabled() const;
+
+	// Returns false if the filter shows that the file does not have the key.
+	// This can be called from multiple threads.
+	bool MayContain(const cGZPersistResourceKey& key);
+
+	// Counts a lookup that passed the filter, found is true if the file's index had the key.
+	void CountLookup(bool found);
+
+	// Adds a key that the game added to the file while other threads may be using the filter.
+	void Insert(const cGZPersistResourceKey& key);
+
+	// Gets the measured cost of a filter check.
+	double GetFilterNanoseconds() const;
+
+	// Starts counting the lookups of a city load for every enabled filter.
+	static void StartCityLoadStatistics();
+
+	// Writes the counts of every enabled filter since StartCityLoadStatistics to the log file.
+	static void WriteCityLoadStatistics();
+
+private:
+	struct Counts
+	{
+		uint64_t lookupCount = 0;
+		uint64_t falsePositiveCount = 0;
+		uint64_t rejectedCount = 0;
+	};
+
+	void MeasureFilterCost(uint32_t keyCount);
+
+	Counts GetCounts() const;
+
+	// Writes the counts to the log file and returns the estimated time that the filter
+	// saved in milliseconds.
+	double LogStatistics(const Counts& counts, const char* period) const;
+
+	cRZBaseString folderPath;
+	ResourceKeyBloomFilter filter;
+	std::atomic<bool> enabled;
+	// The lookups that passed the filter.
+	std::atomic<uint64_t> lookupCount;
+	std::atomic<uint64_t> falsePositiveCount;
+	// The lookups that the filter rejected.
+	std::atomic<uint64_t> rejectedCount;
+	double filterNanoseconds;
+	double indexMissNanoseconds;
+	Counts cityLoadStart;
+};
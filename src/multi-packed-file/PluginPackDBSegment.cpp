@@ -0,0 +1,779 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PluginPackDBSegment.h"
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "PathUtil.h"
+#include "QfsCompression.h"
+#include "StringViewUtil.h"
+#include "cIGZCOM.h"
+#include "cIGZDBSegmentPackedFile.h"
+#include "cIGZPersistResourceKeyFilter.h"
+#include "cIGZPersistResourceKeyList.h"
+#include "cRZAutoRefCount.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+using namespace PluginPackFormat;
+
+namespace
+{
+	std::wstring GetWin32Path(const cIGZString& path)
+	{
+		std::wstring win32Path = GZStringConvert::ToUtf16(path);
+
+		if (PathUtil::MustAddExtendedPathPrefix(win32Path))
+		{
+			win32Path = PathUtil::Normalize(PathUtil::AddExtendedPathPrefix(win32Path));
+		}
+
+		return win32Path;
+	}
+
+	bool IsInFile(uint32_t offset, uint32_t size, uint32_t fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	bool AreRecordsInFile(const DBPFHeader& header, const IndexEntry* index, uint32_t fileSize)
+	{
+		const DBPFIndexReader indexReader(header, index, fileSize);
+
+		for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+		{
+			DBPFIndexReader::Entry entry{};
+
+			if (!indexReader.TryGetEntry(i, entry))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool IsPackRecord(const IndexEntry& entry)
+	{
+		return (entry.type == InfoRecordType && entry.group == InfoRecordGroup && entry.instance == InfoRecordInstance)
+			|| (entry.type == DirectoryRecordType && entry.group == DirectoryRecordGroup && entry.instance == DirectoryRecordInstance);
+	}
+
+	cGZPersistResourceKey GetKey(const IndexEntry& entry)
+	{
+		return cGZPersistResourceKey(entry.type, entry.group, entry.instance);
+	}
+
+	template<typename TEntry> bool IsSorted(const TEntry* entries, uint32_t count)
+	{
+		for (uint32_t i = 1; i < count; i++)
+		{
+			const TEntry& previous = entries[i - 1];
+			const TEntry& current = entries[i];
+
+			if (!KeyLess(previous.type, previous.group, previous.instance, current.type, current.group, current.instance))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	template<typename TEntry> const TEntry* BinarySearch(
+		const TEntry* entries,
+		uint32_t count,
+		uint32_t type,
+		uint32_t group,
+		uint32_t instance)
+	{
+		const TEntry* const end = entries + count;
+
+		const TEntry* const entry = std::lower_bound(
+			entries,
+			end,
+			cGZPersistResourceKey(type, group, instance),
+			[](const TEntry& item, const cGZPersistResourceKey& key)
+			{
+				return KeyLess(item.type, item.group, item.instance, key.type, key.group, key.instance);
+			});
+
+		if (entry != end && entry->type == type && entry->group == group && entry->instance == instance)
+		{
+			return entry;
+		}
+
+		return nullptr;
+	}
+}
+
+PluginPackDBSegment::PluginPackDBSegment(cIGZCOM* pCOM)
+	: pCOM(pCOM),
+	  path(),
+	  segmentID(0),
+	  isOpen(false),
+	  file(),
+	  fileMapping(),
+	  metadataView(),
+	  index(nullptr),
+	  indexEntryCount(0),
+	  directory(nullptr),
+	  directoryEntryCount(0),
+	  sourceFiles(nullptr),
+	  sourceFilesSize(0),
+	  sourceFileCount(0),
+	  recordCount(0),
+	  fileSegmentMutex(),
+	  fileSegment(nullptr)
+{
+}
+
+PluginPackDBSegment::~PluginPackDBSegment()
+{
+	if (fileSegment)
+	{
+		fileSegment->Release();
+		fileSegment = nullptr;
+	}
+}
+
+bool PluginPackDBSegment::QueryInterface(uint32_t riid, void** ppvObj)
+{
+	if (riid == GZIID_cIGZPersistDBSegment)
+	{
+		*ppvObj = static_cast<cIGZPersistDBSegment*>(this);
+		AddRef();
+
+		return true;
+	}
+	else if (cRZBaseUnknown::QueryInterface(riid, ppvObj))
+	{
+		return true;
+	}
+
+	// The other interfaces, such as cIGZDBSegmentPackedFile, are provided by the
+	// cGZDBSegmentPackedFile for the pack.
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->QueryInterface(riid, ppvObj);
+}
+
+uint32_t PluginPackDBSegment::AddRef()
+{
+	return cRZBaseUnknown::AddRef();
+}
+
+uint32_t PluginPackDBSegment::Release()
+{
+	return cRZBaseUnknown::Release();
+}
+
+bool PluginPackDBSegment::Init()
+{
+	return true;
+}
+
+bool PluginPackDBSegment::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (fileSegment)
+	{
+		fileSegment->Shutdown();
+	}
+
+	return true;
+}
+
+bool PluginPackDBSegment::Open(bool openRead, bool openWrite)
+{
+	// The pack is always read only.
+	if (!isOpen && openRead && !openWrite)
+	{
+		isOpen = MapFile();
+
+		if (!isOpen)
+		{
+			Close();
+		}
+	}
+
+	return isOpen;
+}
+
+bool PluginPackDBSegment::IsOpen() const
+{
+	return isOpen;
+}
+
+bool PluginPackDBSegment::Close()
+{
+	isOpen = false;
+	index = nullptr;
+	indexEntryCount = 0;
+	directory = nullptr;
+	directoryEntryCount = 0;
+	sourceFiles = nullptr;
+	sourceFilesSize = 0;
+	sourceFileCount = 0;
+	recordCount = 0;
+	metadataView.reset();
+	fileMapping.reset();
+	file.reset();
+
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (fileSegment)
+	{
+		fileSegment->Close();
+		fileSegment->Shutdown();
+		fileSegment->Release();
+		fileSegment = nullptr;
+	}
+
+	return true;
+}
+
+bool PluginPackDBSegment::Flush()
+{
+	return true;
+}
+
+void PluginPackDBSegment::GetPath(cIGZString& path) const
+{
+	path.Copy(this->path);
+}
+
+bool PluginPackDBSegment::SetPath(cIGZString const& path)
+{
+	this->path.Copy(path);
+
+	return true;
+}
+
+bool PluginPackDBSegment::Lock()
+{
+	return true;
+}
+
+bool PluginPackDBSegment::Unlock()
+{
+	return true;
+}
+
+uint32_t PluginPackDBSegment::GetSegmentID() const
+{
+	return segmentID;
+}
+
+bool PluginPackDBSegment::SetSegmentID(uint32_t const& segmentID)
+{
+	this->segmentID = segmentID;
+
+	return true;
+}
+
+uint32_t PluginPackDBSegment::GetRecordCount(cIGZPersistResourceKeyFilter* filter)
+{
+	if (!filter)
+	{
+		return recordCount;
+	}
+
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < indexEntryCount; i++)
+	{
+		if (!IsPackRecord(index[i]) && filter->IsKeyIncluded(GetKey(index[i])))
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+uint32_t PluginPackDBSegment::GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter)
+{
+	uint32_t count = 0;
+
+	if (list)
+	{
+		for (uint32_t i = 0; i < indexEntryCount; i++)
+		{
+			if (!IsPackRecord(index[i]))
+			{
+				const cGZPersistResourceKey key = GetKey(index[i]);
+
+				if (!filter || filter->IsKeyIncluded(key))
+				{
+					list->Insert(key);
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+bool PluginPackDBSegment::GetResourceKeyList(cIGZPersistResourceKeyList& list)
+{
+	for (uint32_t i = 0; i < indexEntryCount; i++)
+	{
+		if (!IsPackRecord(index[i]))
+		{
+			list.Insert(GetKey(index[i]));
+		}
+	}
+
+	return isOpen;
+}
+
+bool PluginPackDBSegment::TestForRecord(cGZPersistResourceKey const& key)
+{
+	return FindEntry(key) != nullptr;
+}
+
+uint32_t PluginPackDBSegment::GetRecordSize(cGZPersistResourceKey const& key)
+{
+	const IndexEntry* const pEntry = FindEntry(key);
+
+	if (!pEntry)
+	{
+		return 0;
+	}
+
+	const DirectoryEntry* const pDirectoryEntry = FindDirectoryEntry(*pEntry);
+
+	return pDirectoryEntry ? pDirectoryEntry->uncompressedSize : pEntry->size;
+}
+
+bool PluginPackDBSegment::OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode)
+{
+	if (!FindEntry(key))
+	{
+		return false;
+	}
+
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->OpenRecord(key, record, accessMode);
+}
+
+bool PluginPackDBSegment::CreateNewRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record)
+{
+	return false;
+}
+
+bool PluginPackDBSegment::CloseRecord(cIGZPersistDBRecord* record)
+{
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->CloseRecord(record);
+}
+
+bool PluginPackDBSegment::CloseRecord(cIGZPersistDBRecord** record)
+{
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->CloseRecord(record);
+}
+
+bool PluginPackDBSegment::AbortRecord(cIGZPersistDBRecord* record)
+{
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->AbortRecord(record);
+}
+
+bool PluginPackDBSegment::AbortRecord(cIGZPersistDBRecord** record)
+{
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment && pFileSegment->AbortRecord(record);
+}
+
+bool PluginPackDBSegment::DeleteRecord(cGZPersistResourceKey const& key)
+{
+	return false;
+}
+
+uint32_t PluginPackDBSegment::ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize)
+{
+	const IndexEntry* const pEntry = FindEntry(key);
+
+	if (!pEntry)
+	{
+		return 0;
+	}
+
+	if (buffer)
+	{
+		const DirectoryEntry* const pDirectoryEntry = FindDirectoryEntry(*pEntry);
+		const uint32_t uncompressedSize = pDirectoryEntry ? pDirectoryEntry->uncompressedSize : pEntry->size;
+
+		// The calls that cannot be completed from the pack, an empty record or a buffer that
+		// is too small, are forwarded so that the game sees the packed file's behavior.
+		if (uncompressedSize > 0 && uncompressedSize <= recordSize)
+		{
+			bool copied = false;
+
+			if (pDirectoryEntry)
+			{
+				std::unique_ptr<uint8_t[]> compressedData = std::make_unique_for_overwrite<uint8_t[]>(pEntry->size);
+
+				copied = ReadFileData(pEntry->offset, compressedData.get(), pEntry->size)
+					&& QfsCompression::Decompress(
+						compressedData.get(),
+						pEntry->size,
+						static_cast<uint8_t*>(buffer),
+						uncompressedSize);
+			}
+			else
+			{
+				copied = ReadFileData(pEntry->offset, buffer, pEntry->size);
+			}
+
+			if (copied)
+			{
+				recordSize = uncompressedSize;
+				return recordSize;
+			}
+		}
+	}
+
+	cIGZPersistDBSegment* const pFileSegment = GetFileSegment();
+
+	return pFileSegment ? pFileSegment->ReadRecord(key, buffer, recordSize) : 0;
+}
+
+bool PluginPackDBSegment::WriteRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t recordSize)
+{
+	return false;
+}
+
+bool PluginPackDBSegment::Init(uint32_t segmentID, cIGZString const& path, bool unknown2)
+{
+	this->segmentID = segmentID;
+	this->path.Copy(path);
+
+	return true;
+}
+
+bool PluginPackDBSegment::IsUpToDate(const cIGZString& folderPath, const std::vector<cRZBaseString>& sourcePaths) const
+{
+	Logger& logger = Logger::GetInstance();
+
+	if (sourcePaths.size() != sourceFileCount)
+	{
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"The plugin pack %s is out of date, it was built from %u files and the folder has %u.",
+			path.ToChar(),
+			sourceFileCount,
+			static_cast<uint32_t>(sourcePaths.size()));
+		return false;
+	}
+
+	const std::string_view folder(folderPath.ToChar(), folderPath.Strlen());
+	const uint8_t* entryData = sourceFiles;
+
+	for (const cRZBaseString& sourcePath : sourcePaths)
+	{
+		SourceFile sourceFile{};
+		std::memcpy(&sourceFile, entryData, sizeof(sourceFile));
+
+		const std::string_view packPath(reinterpret_cast<const char*>(entryData + sizeof(sourceFile)), sourceFile.pathLength);
+		entryData += sizeof(sourceFile) + sourceFile.pathLength;
+
+		std::string_view relativePath(sourcePath.ToChar(), sourcePath.Strlen());
+
+		if (StringViewUtil::StartsWithIgnoreCase(relativePath, folder))
+		{
+			relativePath.remove_prefix(folder.size());
+
+			while (!relativePath.empty() && (relativePath.front() == '\\' || relativePath.front() == '/'))
+			{
+				relativePath.remove_prefix(1);
+			}
+		}
+
+		if (!StringViewUtil::EqualsIgnoreCase(relativePath, packPath))
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Info,
+				"The plugin pack %s is out of date, the folder's files have been added, removed or renamed since %.*s.",
+				path.ToChar(),
+				static_cast<int>(packPath.size()),
+				packPath.data());
+			return false;
+		}
+
+		WIN32_FILE_ATTRIBUTE_DATA attributes{};
+
+		if (!GetFileAttributesExW(GetWin32Path(sourcePath).c_str(), GetFileExInfoStandard, &attributes))
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Error,
+				"Failed to get the size and last write time of %s for the plugin pack check.",
+				sourcePath.ToChar());
+			return false;
+		}
+
+		const uint64_t size = (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+		const int64_t lastWriteTime = static_cast<int64_t>(
+			(static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime)
+			- FileTimeToUnixEpochTicks;
+
+		if (size != sourceFile.size || lastWriteTime != sourceFile.lastWriteTime)
+		{
+			logger.WriteLineFormatted(
+				LogLevel::Info,
+				"The plugin pack %s is out of date, %s has changed.",
+				path.ToChar(),
+				sourcePath.ToChar());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t PluginPackDBSegment::GetSourceFileCount() const
+{
+	return sourceFileCount;
+}
+
+bool PluginPackDBSegment::MapFile()
+{
+	file.reset(CreateFileW(
+		GetWin32Path(path).c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		nullptr));
+
+	if (!file)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize{};
+
+	// The DBPF offsets are 32-bit values.
+	if (!GetFileSizeEx(file.get(), &fileSize)
+		|| fileSize.QuadPart < DBPFHeader::Size
+		|| fileSize.QuadPart > UINT32_MAX)
+	{
+		return false;
+	}
+
+	DBPFHeader header{};
+
+	if (!ReadFileData(0, &header, sizeof(header))
+		|| header.signature != DBPFHeader::Signature
+		|| header.majorVersion != 1
+		|| header.indexMajorVersion != 7
+		|| header.indexMinorVersion == 2
+		|| (header.indexOffset % IndexAlignment) != 0)
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Error,
+			"%s is not a plugin pack.",
+			path.ToChar());
+		return false;
+	}
+
+	const uint32_t size = static_cast<uint32_t>(fileSize.QuadPart);
+
+	if (!DBPFIndexReader::IsValidHeader(header, size))
+	{
+		return false;
+	}
+
+	// The pack index uses the 5 value entries, so it is mapped as an IndexEntry array.
+	const uint32_t indexSize = DBPFIndexReader::GetIndexSize(header);
+
+	// The metadata and the index are at the start of the file, the view ends at the
+	// first record.
+	const uint32_t metadataSize = header.indexOffset + indexSize;
+
+	fileMapping.reset(CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+
+	if (!fileMapping)
+	{
+		return false;
+	}
+
+	metadataView.reset(static_cast<uint8_t*>(MapViewOfFile(fileMapping.get(), FILE_MAP_READ, 0, 0, metadataSize)));
+
+	if (!metadataView)
+	{
+		return false;
+	}
+
+	// The view starts on an allocation granularity boundary, so the index is 64-byte aligned in memory.
+	index = reinterpret_cast<const IndexEntry*>(metadataView.get() + header.indexOffset);
+	indexEntryCount = header.indexEntryCount;
+
+	if (!AreRecordsInFile(header, index, size) || !ParseMetadata(metadataSize))
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Error,
+			"The plugin pack %s is damaged.",
+			path.ToChar());
+		return false;
+	}
+
+	return true;
+}
+
+bool PluginPackDBSegment::ParseMetadata(uint32_t metadataSize)
+{
+	// The lookups binary search the index, so its order is checked once here.
+	if (!IsSorted(index, indexEntryCount))
+	{
+		return false;
+	}
+
+	const IndexEntry* const pInfoEntry = FindIndexEntry(InfoRecordType, InfoRecordGroup, InfoRecordInstance);
+
+	if (!pInfoEntry
+		|| pInfoEntry->size < sizeof(InfoHeader)
+		|| !IsInFile(pInfoEntry->offset, pInfoEntry->size, metadataSize))
+	{
+		return false;
+	}
+
+	const uint8_t* const infoData = metadataView.get() + pInfoEntry->offset;
+
+	InfoHeader info{};
+	std::memcpy(&info, infoData, sizeof(info));
+
+	if (info.signature != Signature || info.version != Version)
+	{
+		return false;
+	}
+
+	sourceFiles = infoData + sizeof(InfoHeader);
+	sourceFilesSize = pInfoEntry->size - sizeof(InfoHeader);
+
+	uint32_t remainingSize = sourceFilesSize;
+	const uint8_t* entryData = sourceFiles;
+
+	for (uint32_t i = 0; i < info.sourceFileCount; i++)
+	{
+		SourceFile sourceFile{};
+
+		if (remainingSize < sizeof(sourceFile))
+		{
+			return false;
+		}
+
+		std::memcpy(&sourceFile, entryData, sizeof(sourceFile));
+		remainingSize -= sizeof(sourceFile);
+
+		if (remainingSize < sourceFile.pathLength)
+		{
+			return false;
+		}
+
+		remainingSize -= sourceFile.pathLength;
+		entryData += sizeof(sourceFile) + sourceFile.pathLength;
+	}
+
+	sourceFileCount = info.sourceFileCount;
+
+	const IndexEntry* const pDirectoryEntry = FindIndexEntry(DirectoryRecordType, DirectoryRecordGroup, DirectoryRecordInstance);
+
+	if (pDirectoryEntry)
+	{
+		if (!IsInFile(pDirectoryEntry->offset, pDirectoryEntry->size, metadataSize)
+			|| (pDirectoryEntry->offset % alignof(DirectoryEntry)) != 0)
+		{
+			return false;
+		}
+
+		directory = reinterpret_cast<const DirectoryEntry*>(metadataView.get() + pDirectoryEntry->offset);
+		directoryEntryCount = pDirectoryEntry->size / sizeof(DirectoryEntry);
+
+		if (!IsSorted(directory, directoryEntryCount))
+		{
+			return false;
+		}
+	}
+
+	recordCount = indexEntryCount - (pDirectoryEntry ? 2 : 1);
+
+	return recordCount == info.recordCount;
+}
+
+bool PluginPackDBSegment::ReadFileData(uint32_t offset, void* buffer, uint32_t size) const
+{
+	// The read position is passed with each call, so the reads do not share a file pointer.
+	OVERLAPPED overlapped{};
+	overlapped.Offset = offset;
+
+	DWORD bytesRead = 0;
+
+	return ReadFile(file.get(), buffer, size, &bytesRead, &overlapped) && bytesRead == size;
+}
+
+const IndexEntry* PluginPackDBSegment::FindEntry(cGZPersistResourceKey const& key) const
+{
+	const IndexEntry* const pEntry = FindIndexEntry(key.type, key.group, key.instance);
+
+	// The info and directory records are part of the pack format, they are not
+	// resources of the segment.
+	return pEntry && !IsPackRecord(*pEntry) ? pEntry : nullptr;
+}
+
+const IndexEntry* PluginPackDBSegment::FindIndexEntry(uint32_t type, uint32_t group, uint32_t instance) const
+{
+	return BinarySearch(index, indexEntryCount, type, group, instance);
+}
+
+const DirectoryEntry* PluginPackDBSegment::FindDirectoryEntry(const IndexEntry& entry) const
+{
+	return BinarySearch(directory, directoryEntryCount, entry.type, entry.group, entry.instance);
+}
+
+cIGZPersistDBSegment* PluginPackDBSegment::GetFileSegment()
+{
+	std::lock_guard<std::mutex> lock(fileSegmentMutex);
+
+	if (!fileSegment && isOpen)
+	{
+		cRZAutoRefCount<cIGZPersistDBSegment> pSegment;
+
+		if (pCOM->GetClassObject(
+			GZCLSID_cGZDBSegmentPackedFile,
+			GZIID_cIGZPersistDBSegment,
+			pSegment.AsPPVoid()))
+		{
+			if (pSegment->Init() && pSegment->SetPath(path) && pSegment->Open(true, false))
+			{
+				pSegment->AddRef();
+				fileSegment = pSegment;
+			}
+		}
+	}
+
+	return fileSegment;
+}
@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZPersistDBSegment.h"
+#include "cRZBaseString.h"
+#include "cRZBaseUnknown.h"
+#include "PluginPackFormat.h"
+#include <mutex>
+#include <vector>
+#include <Windows.h>
+#include "wil/resource.h"
+
+class cIGZCOM;
+
+// A read-only DBPF segment for a consolidated plugin pack, see PluginPackFormat.h.
+//
+// The pack's metadata and sorted index are mapped with one view, and the index queries
+// binary search the mapped index without taking a lock. The record data is read from the
+// file when it is requested, the pack for a plugin folder is usually too large to map into
+// the game's 32-bit address space.
+// The calls that need a cIGZPersistDBRecord are forwarded to a cGZDBSegmentPackedFile for
+// the pack, which is opened the first time one of them is made.
+class PluginPackDBSegment final : public cRZBaseUnknown, public cIGZPersistDBSegment
+{
+public:
+	explicit PluginPackDBSegment(cIGZCOM* pCOM);
+
+	~PluginPackDBSegment();
+
+	bool QueryInterface(uint32_t riid, void** ppvObj) override;
+	uint32_t AddRef() override;
+	uint32_t Release() override;
+
+	// cIGZPersistDBSegment
+
+	bool Init() override;
+	bool Shutdown() override;
+
+	bool Open(bool openRead, bool openWrite) override;
+	bool IsOpen() const override;
+	bool Close() override;
+	bool Flush() override;
+
+	void GetPath(cIGZString& path) const override;
+	bool SetPath(cIGZString const& path) override;
+
+	bool Lock() override;
+	bool Unlock() override;
+
+	uint32_t GetSegmentID() const override;
+	bool SetSegmentID(uint32_t const& segmentID) override;
+
+	uint32_t GetRecordCount(cIGZPersistResourceKeyFilter* filter) override;
+
+	uint32_t GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter) override;
+	bool GetResourceKeyList(cIGZPersistResourceKeyList& list) override;
+
+	bool TestForRecord(cGZPersistResourceKey const& key) override;
+	uint32_t GetRecordSize(cGZPersistResourceKey const& key) override;
+	bool OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode) override;
+	bool CreateNewRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record) override;
+
+	bool CloseRecord(cIGZPersistDBRecord* record) override;
+	bool CloseRecord(cIGZPersistDBRecord** record) override;
+
+	bool AbortRecord(cIGZPersistDBRecord* record) override;
+	bool AbortRecord(cIGZPersistDBRecord** record) override;
+
+	bool DeleteRecord(cGZPersistResourceKey const& key) override;
+	uint32_t ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize) override;
+	bool WriteRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t recordSize) override;
+
+	bool Init(uint32_t segmentID, cIGZString const& path, bool unknown2) override;
+
+	// Returns true if the pack was built from the specified .dat files and none of them
+	// have changed since, otherwise the reason is written to the log file.
+	// The paths must be in the plugin's scan order.
+	bool IsUpToDate(const cIGZString& folderPath, const std::vector<cRZBaseString>& sourcePaths) const;
+
+	uint32_t GetSourceFileCount() const;
+
+private:
+
+	bool MapFile();
+
+	bool ParseMetadata(uint32_t metadataSize);
+
+	bool ReadFileData(uint32_t offset, void* buffer, uint32_t size) const;
+
+	// Returns the index entry for the key, or nullptr if the key is not one of the
+	// pack's records.
+	const PluginPackFormat::IndexEntry* FindEntry(cGZPersistResourceKey const& key) const;
+
+	const PluginPackFormat::IndexEntry* FindIndexEntry(uint32_t type, uint32_t group, uint32_t instance) const;
+
+	// Returns the directory entry for a compressed record, or nullptr if the record
+	// is not compressed.
+	const PluginPackFormat::DirectoryEntry* FindDirectoryEntry(const PluginPackFormat::IndexEntry& entry) const;
+
+	// Gets the cGZDBSegmentPackedFile for the pack, opening it on the first call.
+	// Returns nullptr if the pack could not be opened.
+	cIGZPersistDBSegment* GetFileSegment();
+
+	cIGZCOM* const pCOM;
+	cRZBaseString path;
+	uint32_t segmentID;
+	bool isOpen;
+	wil::unique_hfile file;
+	wil::unique_handle fileMapping;
+	wil::unique_mapview_ptr<uint8_t> metadataView;
+	const PluginPackFormat::IndexEntry* index;
+	uint32_t indexEntryCount;
+	const PluginPackFormat::DirectoryEntry* directory;
+	uint32_t directoryEntryCount;
+	const uint8_t* sourceFiles;
+	uint32_t sourceFilesSize;
+	uint32_t sourceFileCount;
+	uint32_t recordCount;
+	std::mutex fileSegmentMutex;
+	cIGZPersistDBSegment* fileSegment;
+};
@@ -0,0 +1,290 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PluginPackMultiPackedFile.h"
+#include "CityAccessHistory.h"
+#include "GZStringConvert.h"
+#include "Logger.h"
+#include "SC4DirectoryEnumerator.h"
+#include "StartupTrace.h"
+#include "Stopwatch.h"
+#include "cIGZCOM.h"
+#include "cIGZFrameWork.h"
+#include "cRZCOMDllDirector.h"
+#include <filesystem>
+
+PluginPackMultiPackedFile::PluginPackMultiPackedFile()
+	: BaseMultiPackedFile(false),
+	  pluginPack()
+{
+}
+
+bool PluginPackMultiPackedFile::Open(bool openRead, bool openWrite)
+{
+	// cIGZPersistMultiPackedFiles are always read only.
+	if (!pluginPack && openRead && !openWrite && OpenPluginPack())
+	{
+		return true;
+	}
+
+	return BaseMultiPackedFile::Open(openRead, openWrite);
+}
+
+bool PluginPackMultiPackedFile::IsOpen() const
+{
+	return pluginPack ? true : BaseMultiPackedFile::IsOpen();
+}
+
+bool PluginPackMultiPackedFile::Close()
+{
+	if (pluginPack)
+	{
+		pluginPack->Close();
+		pluginPack->Shutdown();
+		pluginPack.Reset();
+	}
+
+	return BaseMultiPackedFile::Close();
+}
+
+uint32_t PluginPackMultiPackedFile::GetRecordCount(cIGZPersistResourceKeyFilter* filter)
+{
+	return pluginPack ? pluginPack->GetRecordCount(filter) : BaseMultiPackedFile::GetRecordCount(filter);
+}
+
+uint32_t PluginPackMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter)
+{
+	return pluginPack ? pluginPack->GetResourceKeyList(list, filter) : BaseMultiPackedFile::GetResourceKeyList(list, filter);
+}
+
+bool PluginPackMultiPackedFile::GetResourceKeyList(cIGZPersistResourceKeyList& list)
+{
+	return pluginPack ? pluginPack->GetResourceKeyList(list) : BaseMultiPackedFile::GetResourceKeyList(list);
+}
+
+bool PluginPackMultiPackedFile::TestForRecord(cGZPersistResourceKey const& key)
+{
+	return pluginPack ? pluginPack->TestForRecord(key) : BaseMultiPackedFile::TestForRecord(key);
+}
+
+uint32_t PluginPackMultiPackedFile::GetRecordSize(cGZPersistResourceKey const& key)
+{
+	return pluginPack ? pluginPack->GetRecordSize(key) : BaseMultiPackedFile::GetRecordSize(key);
+}
+
+bool PluginPackMultiPackedFile::OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode)
+{
+	if (!pluginPack)
+	{
+		return BaseMultiPackedFile::OpenRecord(key, record, accessMode);
+	}
+
+	const bool result = pluginPack->OpenRecord(key, record, accessMode);
+
+	if (result && CityAccessHistory::GetInstance().IsRecording())
+	{
+		CityAccessHistory::GetInstance().RecordAccess(pluginPack, key);
+	}
+
+	return result;
+}
+
+bool PluginPackMultiPackedFile::CloseRecord(cIGZPersistDBRecord* record)
+{
+	return pluginPack ? pluginPack->CloseRecord(record) : BaseMultiPackedFile::CloseRecord(record);
+}
+
+bool PluginPackMultiPackedFile::CloseRecord(cIGZPersistDBRecord** record)
+{
+	return pluginPack ? pluginPack->CloseRecord(record) : BaseMultiPackedFile::CloseRecord(record);
+}
+
+bool PluginPackMultiPackedFile::AbortRecord(cIGZPersistDBRecord* record)
+{
+	return pluginPack ? pluginPack->AbortRecord(record) : BaseMultiPackedFile::AbortRecord(record);
+}
+
+bool PluginPackMultiPackedFile::AbortRecord(cIGZPersistDBRecord** record)
+{
+	return pluginPack ? pluginPack->AbortRecord(record) : BaseMultiPackedFile::AbortRecord(record);
+}
+
+uint32_t PluginPackMultiPackedFile::ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize)
+{
+	if (!pluginPack)
+	{
+		return BaseMultiPackedFile::ReadRecord(key, buffer, recordSize);
+	}
+
+	const uint32_t result = pluginPack->ReadRecord(key, buffer, recordSize);
+
+	if (result > 0 && buffer && CityAccessHistory::GetInstance().IsRecording())
+	{
+		CityAccessHistory::GetInstance().RecordAccess(pluginPack, key);
+	}
+
+	return result;
+}
+
+bool PluginPackMultiPackedFile::FindDBSegment(cGZPersistResourceKey const& key, cIGZPersistDBSegment** outSegment)
+{
+	if (!pluginPack)
+	{
+		return BaseMultiPackedFile::FindDBSegment(key, outSegment);
+	}
+
+	bool result = false;
+
+	if (pluginPack->TestForRecord(key))
+	{
+		*outSegment = pluginPack;
+
+		pluginPack->AddRef();
+		result = true;
+	}
+
+	return result;
+}
+
+uint32_t PluginPackMultiPackedFile::GetSegmentCount()
+{
+	return pluginPack ? 1 : BaseMultiPackedFile::GetSegmentCount();
+}
+
+cIGZPersistDBSegment* PluginPackMultiPackedFile::GetSegmentByIndex(uint32_t index)
+{
+	return pluginPack ? pluginPack : BaseMultiPackedFile::GetSegmentByIndex(index);
+}
+
+void PluginPackMultiPackedFile::AddedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment* pSegment)
+{
+	// The pack is read only, its index never changes.
+	if (!pluginPack)
+	{
+		BaseMultiPackedFile::AddedResource(key, pSegment);
+	}
+}
+
+void PluginPackMultiPackedFile::RemovedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment* pSegment)
+{
+	if (!pluginPack)
+	{
+		BaseMultiPackedFile::RemovedResource(key, pSegment);
+	}
+}
+
+void PluginPackMultiPackedFile::EnumerateDBPFFiles(
+	const cIGZString& folderPath,
+	const SC4DirectoryEnumerator::ScanOptions& options,
+	const SC4DirectoryEnumerator::FileFoundCallback& callback) const
+{
+	SC4DirectoryEnumerator::EnumerateDatFilesRecurseSubdirectories(folderPath, options, callback);
+}
+
+bool PluginPackMultiPackedFile::OpenPluginPack()
+{
+	cRZBaseString folderPath;
+	GetPath(folderPath);
+
+	if (folderPath.Strlen() == 0)
+	{
+		return false;
+	}
+
+	std::filesystem::path packFilePath = GZStringConvert::ToFileSystemPath(folderPath);
+	packFilePath /= PluginPackFormat::FileName;
+
+	std::error_code error;
+
+	if (!std::filesystem::is_regular_file(packFilePath, error))
+	{
+		return false;
+	}
+
+	StartupTrace::Span span("PluginPackMultiPackedFile::OpenPluginPack", folderPath.ToChar());
+
+	bool result = false;
+
+	try
+	{
+		Stopwatch totalStopwatch;
+		totalStopwatch.Start();
+
+		const cRZBaseString packPath = GZStringConvert::FromFileSystemPath(packFilePath);
+		cIGZCOM* const pCOM = RZGetFramework()->GetCOMObject();
+
+		cRZAutoRefCount<PluginPackDBSegment> pack(
+			new PluginPackDBSegment(pCOM),
+			cRZAutoRefCount<PluginPackDBSegment>::kAddRef);
+
+		if (pack->Init(GetSegmentID(), packPath, false) && pack->Open(true, false))
+		{
+			// The fingerprint check uses the same scan as the normal load, without the DBPF
+			// header checks, the pack records the files that are not valid DBPF files.
+			SC4DirectoryEnumerator::ScanOptions scanOptions = GetScanOptions();
+			scanOptions.checkDBPFHeaders = false;
+
+			std::vector<cRZBaseString> sourcePaths;
+			sourcePaths.reserve(pack->GetSourceFileCount());
+
+			Stopwatch checkStopwatch;
+			checkStopwatch.Start();
+
+			EnumerateDBPFFiles(
+				folderPath,
+				scanOptions,
+				[&](cRZBaseString&& path, uint64_t) { sourcePaths.push_back(std::move(path)); });
+
+			const bool upToDate = pack->IsUpToDate(folderPath, sourcePaths);
+
+			checkStopwatch.Stop();
+
+			if (upToDate)
+			{
+				pluginPack = pack;
+				totalStopwatch.Stop();
+
+				Logger::GetInstance().WriteLineFormatted(
+					LogLevel::Info,
+					"Loaded %u records of %u files from the plugin pack %s in %lld ms, the fingerprint check took %lld ms.",
+					pack->GetRecordCount(nullptr),
+					pack->GetSourceFileCount(),
+					packPath.ToChar(),
+					totalStopwatch.ElapsedMilliseconds(),
+					checkStopwatch.ElapsedMilliseconds());
+
+				result = true;
+			}
+			else
+			{
+				Logger::GetInstance().WriteLineFormatted(
+					LogLevel::Info,
+					"Loading the .dat files from %s, rebuild the plugin pack to use it.",
+					folderPath.ToChar());
+			}
+		}
+
+		if (!result)
+		{
+			pack->Close();
+			pack->Shutdown();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		Logger::GetInstance().WriteLine(LogLevel::Error, e.what());
+		pluginPack.Reset();
+		result = false;
+	}
+
+	return result;
+}
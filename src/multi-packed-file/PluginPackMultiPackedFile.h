@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "BaseMultiPackedFile.h"
+#include "PluginPackDBSegment.h"
+
+// A cIGZPersistDBSegmentMultiPackedFiles implementation for .DAT files that loads
+// the root folder's consolidated plugin pack, see PluginPackFormat.h.
+//
+// The pack replaces the folder's .dat files when its source file fingerprints match
+// the folder, all of the calls are then served by the pack's segment.
+// When the folder has no pack, or the pack is out of date, the .dat files are loaded
+// in the same way as DatMultiPackedFile.
+class PluginPackMultiPackedFile final : public BaseMultiPackedFile
+{
+public:
+	PluginPackMultiPackedFile();
+
+	// cIGZPersistDBSegment
+
+	bool Open(bool openRead, bool openWrite) override;
+	bool IsOpen() const override;
+	bool Close() override;
+
+	uint32_t GetRecordCount(cIGZPersistResourceKeyFilter* filter) override;
+
+	uint32_t GetResourceKeyList(cIGZPersistResourceKeyList* list, cIGZPersistResourceKeyFilter* filter) override;
+	bool GetResourceKeyList(cIGZPersistResourceKeyList& list) override;
+
+	bool TestForRecord(cGZPersistResourceKey const& key) override;
+	uint32_t GetRecordSize(cGZPersistResourceKey const& key) override;
+	bool OpenRecord(cGZPersistResourceKey const& key, cIGZPersistDBRecord** record, cIGZFile::AccessMode accessMode) override;
+
+	bool CloseRecord(cIGZPersistDBRecord* record) override;
+	bool CloseRecord(cIGZPersistDBRecord** record) override;
+
+	bool AbortRecord(cIGZPersistDBRecord* record) override;
+	bool AbortRecord(cIGZPersistDBRecord** record) override;
+
+	uint32_t ReadRecord(cGZPersistResourceKey const& key, void* buffer, uint32_t& recordSize) override;
+
+	// cIGZPersistDBSegmentMultiPackedFiles
+
+	bool FindDBSegment(cGZPersistResourceKey const& key, cIGZPersistDBSegment** outSegment) override;
+	uint32_t GetSegmentCount() override;
+	cIGZPersistDBSegment* GetSegmentByIndex(uint32_t index) override;
+
+	void AddedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment* pSegment) override;
+	void RemovedResource(cGZPersistResourceKey const& key, cIGZPersistDBSegment* pSegment) override;
+
+protected:
+	void EnumerateDBPFFiles(
+		const cIGZString& path,
+		const SC4DirectoryEnumerator::ScanOptions& options,
+		const SC4DirectoryEnumerator::FileFoundCallback& callback) const override;
+
+private:
+	// Opens the folder's plugin pack, returns false if the folder does not have a pack
+	// or the pack cannot be used.
+	bool OpenPluginPack();
+
+	cRZAutoRefCount<PluginPackDBSegment> pluginPack;
+};
@@ -0,0 +1,253 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RecordAccessStatistics.h"
+#include "Logger.h"
+#include "cIGZString.h"
+#include "cRZBaseString.h"
+#include <algorithm>
+#include <bit>
+#include <Windows.h>
+
+namespace
+{
+	// The number of segments that are listed in the report.
+	constexpr size_t ReportedSegmentCount = 10;
+
+	int64_t GetTimeStamp()
+	{
+		LARGE_INTEGER li{};
+
+		QueryPerformanceCounter(&li);
+
+		return li.QuadPart;
+	}
+
+	int64_t GetTimeStampFrequency()
+	{
+		LARGE_INTEGER li{};
+
+		QueryPerformanceFrequency(&li);
+
+		return li.QuadPart;
+	}
+
+	const char* GetOperationName(uint32_t operation)
+	{
+		switch (operation)
+		{
+		case 0:
+			return "TestForRecord";
+		case 1:
+			return "GetRecordSize";
+		case 2:
+			return "OpenRecord";
+		case 3:
+			return "ReadRecord";
+		default:
+			return "Unknown";
+		}
+	}
+
+	// Measures the cost of timing a call, this is the overhead that the
+	// statistics add to each record access call.
+	double MeasureTimerOverheadNanoseconds()
+	{
+		constexpr int32_t Iterations = 10000;
+
+		const int64_t frequency = GetTimeStampFrequency();
+
+		const int64_t start = GetTimeStamp();
+
+		int64_t sink = 0;
+
+		for (int32_t i = 0; i < Iterations; i++)
+		{
+			const int64_t callStart = GetTimeStamp();
+			sink += GetTimeStamp() - callStart;
+		}
+
+		const int64_t end = GetTimeStamp();
+
+		// Prevent the compiler from removing the loop.
+		if (sink < 0)
+		{
+			return 0.0;
+		}
+
+		return (static_cast<double>(end - start) * 1000000000.0) / (static_cast<double>(frequency) * Iterations);
+	}
+}
+
+RecordAccessStatistics::Timer::Timer(RecordAccessStatistics* const statistics, Operation operation)
+	: statistics(statistics),
+	  segment(nullptr),
+	  startTimeStamp(statistics ? GetTimeStamp() : 0),
+	  operation(operation)
+{
+}
+
+RecordAccessStatistics::Timer::~Timer()
+{
+	if (statistics)
+	{
+		statistics->Add(operation, segment, GetTimeStamp() - startTimeStamp);
+	}
+}
+
+void RecordAccessStatistics::Timer::SetSegment(cIGZPersistDBSegment* const segment)
+{
+	this->segment = segment;
+}
+
+RecordAccessStatistics::OperationStatistics::OperationStatistics()
+	: callCount(0),
+	  missCount(0),
+	  totalTicks(0),
+	  maxTicks(0),
+	  histogram()
+{
+}
+
+RecordAccessStatistics::RecordAccessStatistics()
+	: operations(),
+	  segmentHits(),
+	  timeStampFrequency(GetTimeStampFrequency())
+{
+	static const double timerOverhead = MeasureTimerOverheadNanoseconds();
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Record access statistics enabled, the measured overhead is %.0f ns per call.",
+		timerOverhead);
+}
+
+void RecordAccessStatistics::Write(const cIGZString& folderPath) const
+{
+	uint32_t totalCallCount = 0;
+
+	for (const OperationStatistics& item : operations)
+	{
+		totalCallCount += item.callCount;
+	}
+
+	if (totalCallCount == 0)
+	{
+		return;
+	}
+
+	Logger::GetInstance().WriteLineFormatted(
+		LogLevel::Info,
+		"Record access statistics for %s:",
+		folderPath.ToChar());
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(Operation::Count); i++)
+	{
+		WriteOperation(static_cast<Operation>(i));
+	}
+
+	WriteSegmentHits();
+}
+
+void RecordAccessStatistics::Add(Operation operation, cIGZPersistDBSegment* const segment, int64_t elapsedTicks)
+{
+	OperationStatistics& item = operations[static_cast<size_t>(operation)];
+
+	const uint64_t ticks = static_cast<uint64_t>(std::max<int64_t>(elapsedTicks, 0));
+
+	item.callCount++;
+	item.totalTicks += ticks;
+	item.maxTicks = std::max(item.maxTicks, ticks);
+	item.histogram[std::min<size_t>(std::bit_width(ticks), HistogramBucketCount - 1)]++;
+
+	if (segment)
+	{
+		segmentHits[segment]++;
+	}
+	else
+	{
+		item.missCount++;
+	}
+}
+
+void RecordAccessStatistics::WriteOperation(Operation operation) const
+{
+	const OperationStatistics& item = operations[static_cast<size_t>(operation)];
+
+	if (item.callCount == 0)
+	{
+		return;
+	}
+
+	Logger& logger = Logger::GetInstance();
+
+	const double ticksPerMicrosecond = static_cast<double>(timeStampFrequency) / 1000000.0;
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"  %s: %u calls, %u not found, %.1f ms total, %.2f us average, %.1f us max.",
+		GetOperationName(static_cast<uint32_t>(operation)),
+		item.callCount,
+		item.missCount,
+		static_cast<double>(item.totalTicks) / (ticksPerMicrosecond * 1000.0),
+		static_cast<double>(item.totalTicks) / (ticksPerMicrosecond * item.callCount),
+		static_cast<double>(item.maxTicks) / ticksPerMicrosecond);
+
+	for (size_t bucket = 0; bucket < HistogramBucketCount; bucket++)
+	{
+		const uint32_t count = item.histogram[bucket];
+
+		if (count > 0)
+		{
+			// Bucket N contains the calls that took less than 2^N ticks.
+			const double upperBoundMicroseconds = static_cast<double>(uint64_t(1) << bucket) / ticksPerMicrosecond;
+
+			logger.WriteLineFormatted(
+				LogLevel::Info,
+				"    < %10.2f us: %u",
+				upperBoundMicroseconds,
+				count);
+		}
+	}
+}
+
+void RecordAccessStatistics::WriteSegmentHits() const
+{
+	std::vector<std::pair<cIGZPersistDBSegment*, uint32_t>> hits(segmentHits.begin(), segmentHits.end());
+
+	const size_t count = std::min(hits.size(), ReportedSegmentCount);
+
+	std::partial_sort(
+		hits.begin(),
+		hits.begin() + count,
+		hits.end(),
+		[](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+
+	Logger& logger = Logger::GetInstance();
+
+	logger.WriteLineFormatted(
+		LogLevel::Info,
+		"  %u segments served requests, the most used segments are:",
+		static_cast<uint32_t>(hits.size()));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		cRZBaseString path;
+		hits[i].first->GetPath(path);
+
+		logger.WriteLineFormatted(
+			LogLevel::Info,
+			"    %8u  %s",
+			hits[i].second,
+			path.ToChar());
+	}
+}
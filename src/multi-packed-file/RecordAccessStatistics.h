@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZPersistDBSegment.h"
+#include "boost/unordered/unordered_flat_map.hpp"
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+class cIGZString;
+
+// Counts the record access calls that a multi-packed file receives, along with the
+// time each call took and the segments that served the calls.
+// The multi-packed file methods are serialized by its critical section, so the
+// statistics are plain fields that are updated and read under that lock.
+class RecordAccessStatistics
+{
+public:
+
+	enum class Operation : uint32_t
+	{
+		TestForRecord = 0,
+		GetRecordSize,
+		OpenRecord,
+		ReadRecord,
+		Count
+	};
+
+	// Times a record access call, the call is counted when the timer is destroyed.
+	class Timer
+	{
+	public:
+		Timer(RecordAccessStatistics* const statistics, Operation operation);
+		~Timer();
+
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+
+		void SetSegment(cIGZPersistDBSegment* const segment);
+
+	private:
+		RecordAccessStatistics* const statistics;
+		cIGZPersistDBSegment* segment;
+		int64_t startTimeStamp;
+		const Operation operation;
+	};
+
+	RecordAccessStatistics();
+
+	// Writes the statistics to the log file.
+	void Write(const cIGZString& folderPath) const;
+
+private:
+
+	// The latency histogram uses power of 2 buckets of the performance counter ticks.
+	static constexpr size_t HistogramBucketCount = 32;
+
+	struct OperationStatistics
+	{
+		OperationStatistics();
+
+		uint32_t callCount;
+		uint32_t missCount;
+		uint64_t totalTicks;
+		uint64_t maxTicks;
+		std::array<uint32_t, HistogramBucketCount> histogram;
+	};
+
+	void Add(Operation operation, cIGZPersistDBSegment* const segment, int64_t elapsedTicks);
+
+	void WriteOperation(Operation operation) const;
+
+	void WriteSegmentHits() const;
+
+	std::array<OperationStatistics, static_cast<size_t>(Operation::Count)> operations;
+	boost::unordered::unordered_flat_map<cIGZPersistDBSegment*, uint32_t> segmentHits;
+	int64_t timeStampFrequency;
+};
@@ -11,13 +11,113 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "SC4PluginMultiPackedFile.h"
+#include "Logger.h"
+#include "PathUtil.h"
 #include "SC4DirectoryEnumerator.h"
+#include "boost/unordered/unordered_flat_set.hpp"
+#include <string_view>
 
-SC4PluginMultiPackedFile::SC4PluginMultiPackedFile() : BaseMultiPackedFile(true)
+SC4PluginMultiPackedFile::SC4PluginMultiPackedFile()
+	: BaseMultiPackedFile(true),
+	  lowerPriorityFolders(),
+	  interleavedSegments()
 {
 }
 
-std::vector<cRZBaseString> SC4PluginMultiPackedFile::GetDBPFFiles(const cIGZString& folderPath) const
+void SC4PluginMultiPackedFile::AddLowerPriorityFolder(const cIGZString& folderPath)
 {
-	return SC4DirectoryEnumerator::GetLooseSC4FilesRecurseSubdirectories(folderPath);
+	lowerPriorityFolders.emplace_back().Copy(folderPath);
+}
+
+void SC4PluginMultiPackedFile::AddInterleavedSegment(cIGZPersistDBSegment& segment)
+{
+	interleavedSegments.emplace_back(&segment);
+}
+
+void SC4PluginMultiPackedFile::EnumerateDBPFFiles(
+	const cIGZString& folderPath,
+	const SC4DirectoryEnumerator::ScanOptions& options,
+	const SC4DirectoryEnumerator::FileFoundCallback& callback) const
+{
+	// The files that are found later override the earlier files in the index, so
+	// the lower priority folders are enumerated first.
+	for (const cRZBaseString& lowerPriorityFolder : lowerPriorityFolders)
+	{
+		SC4DirectoryEnumerator::EnumerateLooseSC4FilesRecurseSubdirectories(lowerPriorityFolder, options, callback);
+	}
+
+	SC4DirectoryEnumerator::EnumerateLooseSC4FilesRecurseSubdirectories(folderPath, options, callback);
+}
+
+void SC4PluginMultiPackedFile::OnSegmentIndexesMerged(const std::vector<cIGZPersistDBSegment*>& segments)
+{
+	if (interleavedSegments.empty())
+	{
+		return;
+	}
+
+	boost::unordered::unordered_flat_set<cIGZPersistDBSegment*> lowerPrioritySegments;
+
+	for (cIGZPersistDBSegment* pSegment : segments)
+	{
+		if (IsInLowerPriorityFolder(pSegment))
+		{
+			lowerPrioritySegments.insert(pSegment);
+		}
+	}
+
+	const uint32_t removedCount = RemoveIndexEntries(
+		[this, &lowerPrioritySegments](const cGZPersistResourceKey& key, cIGZPersistDBSegment* pSegment)
+		{
+			if (lowerPrioritySegments.contains(pSegment))
+			{
+				for (auto& interleavedSegment : interleavedSegments)
+				{
+					if (interleavedSegment->TestForRecord(key))
+					{
+						return true;
+					}
+				}
+			}
+
+			return false;
+		});
+
+	if (removedCount > 0)
+	{
+		cRZBaseString folderPath;
+		GetPath(folderPath);
+
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Info,
+			"Removed %u lower priority .SC4* records from the %s index, they are overridden by the segments loaded before it.",
+			removedCount,
+			folderPath.ToChar());
+	}
+
+	// The segments are only needed while the index is built.
+	interleavedSegments.clear();
+}
+
+bool SC4PluginMultiPackedFile::IsInLowerPriorityFolder(cIGZPersistDBSegment* const pSegment) const
+{
+	cRZBaseString segmentPath;
+	pSegment->GetPath(segmentPath);
+
+	const std::string_view path(segmentPath.ToChar(), segmentPath.Strlen());
+
+	for (const cRZBaseString& lowerPriorityFolder : lowerPriorityFolders)
+	{
+		const std::string_view folder(lowerPriorityFolder.ToChar(), lowerPriorityFolder.Strlen());
+
+		// The folder path must be followed by a directory separator, or already end with one.
+		if (path.size() > folder.size()
+			&& path.starts_with(folder)
+			&& (PathUtil::IsDirectorySeparator(folder.back()) || PathUtil::IsDirectorySeparator(path[folder.size()])))
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
@@ -12,6 +12,7 @@
 
 #pragma once
 #include "BaseMultiPackedFile.h"
+#include <vector>
 
 static const uint32_t GZCLSID_SC4PluginMultiPackedFile = 0x9D92571C;
 
@@ -23,6 +24,28 @@ class SC4PluginMultiPackedFile final : public BaseMultiPackedFile
 public:
 	SC4PluginMultiPackedFile();
 
+	// Adds a folder whose files are loaded before the files in the segment's path, the
+	// files in the segment's path override the records in the lower priority folders.
+	// This must be called before the segment is opened.
+	void AddLowerPriorityFolder(const cIGZString& folderPath);
+
+	// Adds a segment that the resource manager searches after this segment, but whose records
+	// override the records in the lower priority folders. The lower priority folder records
+	// for the keys that the segment contains are removed from the index, so the resource manager
+	// finds them in that segment. This must be called before the segment is opened.
+	void AddInterleavedSegment(cIGZPersistDBSegment& segment);
+
 protected:
-	std::vector<cRZBaseString> GetDBPFFiles(const cIGZString& folderPath) const override;
+	void EnumerateDBPFFiles(
+		const cIGZString& folderPath,
+		const SC4DirectoryEnumerator::ScanOptions& options,
+		const SC4DirectoryEnumerator::FileFoundCallback& callback) const override;
+
+	void OnSegmentIndexesMerged(const std::vector<cIGZPersistDBSegment*>& segments) override;
+
+private:
+	bool IsInLowerPriorityFolder(cIGZPersistDBSegment* const pSegment) const;
+
+	std::vector<cRZBaseString> lowerPriorityFolders;
+	std::vector<cRZAutoRefCount<cIGZPersistDBSegment>> interleavedSegments;
 };
@@ -0,0 +1,533 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "SegmentOpener.h"
+#include "BoundedBlockingQueue.h"
+#include "DBPFFilePrefetch.h"
+#include "Logger.h"
+#include "MemoryDBSegment.h"
+#include "ScopedTimer.h"
+#include "SegmentOpenCostHistory.h"
+#include "Settings.h"
+#include "StartupTrace.h"
+#include "cIGZCOM.h"
+#include "cIGZDBSegmentPackedFile.h"
+#include "wil/resource.h"
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+namespace
+{
+	// The maximum number of paths that the pipelined scan can queue before it waits
+	// for the segments to be opened.
+	constexpr size_t PipelinedScanQueueCapacity = 256;
+}
+
+SegmentOpener::Item::Item(const cRZBaseString& path, uint64_t fileSize)
+	: path(path),
+	  fileSize(fileSize),
+	  segment(),
+	  estimatedCost(SegmentOpenCostHistory::UnknownCost),
+	  openCost(0),
+	  created(false),
+	  opened(false)
+{
+}
+
+SegmentOpener::SegmentOpener(
+	const cIGZString& folderPath,
+	EnumerateFilesFunction&& enumerateFiles,
+	cIGZCOM* pCOM,
+	const std::shared_ptr<MemoryBlockPool>& memoryBlockPool,
+	MultiPackedFileOpenStatistics& statistics,
+	std::vector<cIGZPersistDBSegment*>& segments)
+	: folderPath(folderPath),
+	  enumerateFiles(std::move(enumerateFiles)),
+	  pCOM(pCOM),
+	  memoryBlockPool(memoryBlockPool),
+	  statistics(statistics),
+	  segments(segments),
+	  items()
+{
+}
+
+void SegmentOpener::OpenSerial()
+{
+	SCOPED_TIMER("OpenSegmentsSerial");
+
+	std::vector<FoundFile> files;
+
+	statistics.scanStopwatch.Start();
+
+	enumerateFiles([&files](cRZBaseString&& path, uint64_t fileSize) { files.push_back(FoundFile{ std::move(path), fileSize }); });
+
+	statistics.scanStopwatch.Stop();
+
+	segments.reserve(files.size());
+
+	for (const FoundFile& file : files)
+	{
+		LoadSegment(file);
+	}
+}
+
+void SegmentOpener::OpenPipelined()
+{
+	SCOPED_TIMER("OpenSegmentsPipelined");
+
+	// The directory scan runs on a background thread and passes each file to this thread
+	// as soon as it is found, this allows the directory I/O to overlap with the DBPF index
+	// I/O that happens when the segments are opened.
+	// The segments are opened in the order that the scan finds them, so the segment list
+	// and tgiMap are identical to the serial version.
+
+	BoundedBlockingQueue<FoundFile> queue(PipelinedScanQueueCapacity);
+	std::exception_ptr scanException;
+
+	std::thread scanThread(
+		[this, &queue, &scanException]()
+		{
+			statistics.scanStopwatch.Start();
+
+			try
+			{
+				enumerateFiles([&queue](cRZBaseString&& path, uint64_t fileSize) { queue.Push(FoundFile{ std::move(path), fileSize }); });
+			}
+			catch (...)
+			{
+				scanException = std::current_exception();
+			}
+
+			statistics.scanStopwatch.Stop();
+			queue.Complete();
+		});
+
+	// Ensure that the scan thread is stopped if loading a segment throws an exception.
+	auto scanThreadCleanup = wil::scope_exit(
+		[&queue, &scanThread]()
+		{
+			queue.Cancel();
+			scanThread.join();
+		});
+
+	FoundFile file;
+
+	while (queue.Pop(file))
+	{
+		LoadSegment(file);
+	}
+
+	scanThreadCleanup.reset();
+
+	if (scanException)
+	{
+		std::rethrow_exception(scanException);
+	}
+}
+
+void SegmentOpener::OpenParallel(uint32_t threadCount)
+{
+	SCOPED_TIMER("OpenSegmentsParallel");
+
+	if (CreateSegments())
+	{
+		OpenCreatedSegments(threadCount);
+	}
+}
+
+bool SegmentOpener::CreateSegments()
+{
+	statistics.scanStopwatch.Start();
+
+	enumerateFiles([this](cRZBaseString&& path, uint64_t fileSize) { items.emplace_back(path, fileSize); });
+
+	statistics.scanStopwatch.Stop();
+
+	SegmentOpenCostHistory& costHistory = SegmentOpenCostHistory::GetInstance();
+
+	statistics.openStopwatch.Start();
+
+	// The segments are created and opened on the calling thread, the worker threads
+	// only prefetch the files.
+	for (Item& item : items)
+	{
+		item.created = CreateGZPersistDBSegment(item.path, item.fileSize, item.segment);
+		item.estimatedCost = costHistory.GetCost(item.path.ToChar());
+	}
+
+	statistics.openStopwatch.Stop();
+
+	return !items.empty();
+}
+
+void SegmentOpener::OpenCreatedSegments(uint32_t threadCount)
+{
+	statistics.openStopwatch.Start();
+
+	const std::vector<uint32_t> schedule = CreateOpenSchedule();
+	const uint64_t wholeFileSizeLimit = GetPrefetchWholeFileSizeLimit();
+
+	// The game's segments are only used on the calling thread, cGZDBSegmentPackedFile is
+	// not known to be safe to open from other threads. The worker threads read each file's
+	// DBPF header and index into the file system cache with Win32 calls, and the calling
+	// thread opens the segments in the order that the workers finish, so that most of the
+	// reads that the Open calls make are served from the cache.
+	BoundedBlockingQueue<uint32_t> prefetchedItems(items.size());
+	std::atomic<size_t> nextScheduleIndex = 0;
+
+	const size_t workerThreadCount = std::min<size_t>(std::max<uint32_t>(threadCount, 2) - 1, items.size());
+	std::atomic<size_t> runningWorkerCount = workerThreadCount;
+
+	const auto prefetchWorker = [&]()
+	{
+		std::vector<uint8_t> buffer;
+		size_t scheduleIndex;
+
+		while ((scheduleIndex = nextScheduleIndex.fetch_add(1, std::memory_order_relaxed)) < schedule.size())
+		{
+			uint32_t itemIndex = schedule[scheduleIndex];
+
+			PrefetchItem(items[itemIndex], wholeFileSizeLimit, buffer);
+
+			if (!prefetchedItems.Push(std::move(itemIndex)))
+			{
+				break;
+			}
+		}
+
+		if (runningWorkerCount.fetch_sub(1) == 1)
+		{
+			prefetchedItems.Complete();
+		}
+	};
+
+	{
+		std::vector<std::thread> workerThreads;
+		workerThreads.reserve(workerThreadCount);
+
+		auto joinWorkerThreads = wil::scope_exit(
+			[&prefetchedItems, &workerThreads]()
+			{
+				prefetchedItems.Cancel();
+
+				for (std::thread& thread : workerThreads)
+				{
+					thread.join();
+				}
+			});
+
+		for (size_t i = 0; i < workerThreadCount; i++)
+		{
+			workerThreads.emplace_back(prefetchWorker);
+		}
+
+		if (workerThreadCount == 0)
+		{
+			prefetchedItems.Complete();
+		}
+
+		uint32_t itemIndex = 0;
+
+		while (prefetchedItems.Pop(itemIndex))
+		{
+			OpenItem(items[itemIndex]);
+		}
+	}
+
+	statistics.openStopwatch.Stop();
+
+	AddOpenedSegments();
+}
+
+void SegmentOpener::PrefetchCreatedSegments(uint32_t threadCount, const std::atomic<bool>& canceled)
+{
+	const std::vector<uint32_t> schedule = CreateOpenSchedule();
+	const uint64_t wholeFileSizeLimit = GetPrefetchWholeFileSizeLimit();
+
+	std::atomic<size_t> nextScheduleIndex = 0;
+
+	const auto prefetchWorker = [&]()
+	{
+		std::vector<uint8_t> buffer;
+		size_t scheduleIndex;
+
+		while (!canceled.load(std::memory_order_relaxed)
+			&& (scheduleIndex = nextScheduleIndex.fetch_add(1, std::memory_order_relaxed)) < schedule.size())
+		{
+			PrefetchItem(items[schedule[scheduleIndex]], wholeFileSizeLimit, buffer);
+		}
+	};
+
+	// The calling thread is one of the prefetch threads.
+	const size_t workerThreadCount = std::min<size_t>(std::max<uint32_t>(threadCount, 1), items.size()) - 1;
+
+	std::vector<std::thread> workerThreads;
+	workerThreads.reserve(workerThreadCount);
+
+	for (size_t i = 0; i < workerThreadCount; i++)
+	{
+		workerThreads.emplace_back(prefetchWorker);
+	}
+
+	prefetchWorker();
+
+	for (std::thread& thread : workerThreads)
+	{
+		thread.join();
+	}
+}
+
+void SegmentOpener::OpenPrefetchedSegments()
+{
+	statistics.openStopwatch.Start();
+
+	for (Item& item : items)
+	{
+		OpenItem(item);
+	}
+
+	statistics.openStopwatch.Stop();
+
+	AddOpenedSegments();
+}
+
+std::vector<uint32_t> SegmentOpener::CreateOpenSchedule() const
+{
+	// The files that took the longest to open on the previous run are scheduled first,
+	// this prevents a large file near the end of the list from being read by one thread
+	// after the others have run out of work.
+	// Files that are not in the history are treated as the most expensive, and the ties are
+	// kept in the scan order.
+	std::vector<uint32_t> schedule(items.size());
+	std::iota(schedule.begin(), schedule.end(), 0);
+	std::stable_sort(
+		schedule.begin(),
+		schedule.end(),
+		[this](uint32_t lhs, uint32_t rhs) { return items[lhs].estimatedCost > items[rhs].estimatedCost; });
+
+	return schedule;
+}
+
+uint64_t SegmentOpener::GetPrefetchWholeFileSizeLimit() const
+{
+	// The memory-backed segments read the small files in full.
+	return memoryBlockPool ? Settings::GetInstance().SmallFileMemoryThreshold() * 1024ULL : 0;
+}
+
+void SegmentOpener::PrefetchItem(
+	Item& item,
+	uint64_t wholeFileSizeLimit,
+	std::vector<uint8_t>& buffer)
+{
+	if (item.created)
+	{
+		StartupTrace::Span span("Segment prefetch", item.path.ToChar());
+
+		Stopwatch stopwatch;
+		stopwatch.Start();
+
+		DBPFFilePrefetch::Prefetch(item.path, wholeFileSizeLimit, buffer);
+
+		stopwatch.Stop();
+
+		item.openCost = static_cast<uint32_t>(std::min<int64_t>(
+			stopwatch.ElapsedMicroseconds(),
+			SegmentOpenCostHistory::UnknownCost - 1));
+	}
+}
+
+void SegmentOpener::OpenItem(Item& item)
+{
+	if (item.created)
+	{
+		StartupTrace::Span span("Segment open", item.path.ToChar());
+
+		Stopwatch stopwatch;
+		stopwatch.Start();
+
+		item.opened = item.segment->Open(true, false);
+
+		stopwatch.Stop();
+
+		// The recorded cost includes the prefetch, which is the part that the
+		// worker threads run in parallel.
+		item.openCost = static_cast<uint32_t>(std::min<int64_t>(
+			static_cast<int64_t>(item.openCost) + stopwatch.ElapsedMicroseconds(),
+			SegmentOpenCostHistory::UnknownCost - 1));
+	}
+}
+
+void SegmentOpener::AddOpenedSegments()
+{
+	SegmentOpenCostHistory& costHistory = SegmentOpenCostHistory::GetInstance();
+
+	// The segments are added in the scan order, so that the segment list and tgiMap
+	// are identical to the serial version. Their keys are merged into tgiMap by Open.
+	std::vector<SegmentOpenCostHistory::Entry> costs;
+	costs.reserve(items.size());
+
+	segments.reserve(items.size());
+
+	for (const Item& item : items)
+	{
+		statistics.fileCount++;
+
+		if (statistics.collectFileCosts)
+		{
+			AddFileCost(item.path, item.segment, item.opened, item.openCost);
+		}
+
+		if (item.opened)
+		{
+			AddSegment(item.segment);
+
+			costs.emplace_back(item.path.ToChar(), item.openCost);
+		}
+		else
+		{
+			Logger::GetInstance().WriteLineFormatted(
+				LogLevel::Error,
+				"Failed to load: %s",
+				item.path.ToChar());
+		}
+	}
+
+	costHistory.Update(folderPath.ToChar(), costs);
+
+	try
+	{
+		costHistory.Save();
+	}
+	catch (const std::exception& e)
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Error,
+			"Failed to save the file open times: %s",
+			e.what());
+	}
+}
+
+void SegmentOpener::LoadSegment(const FoundFile& file)
+{
+	statistics.fileCount++;
+
+	if (!SetupGZPersistDBSegment(file))
+	{
+		Logger::GetInstance().WriteLineFormatted(
+			LogLevel::Error,
+			"Failed to load: %s",
+			file.path.ToChar());
+	}
+}
+
+bool SegmentOpener::SetupGZPersistDBSegment(const FoundFile& file)
+{
+	SCOPED_TIMER("SetupGZPersistDBSegment");
+
+	const cRZBaseString& path = file.path;
+
+	bool result = false;
+
+	cRZAutoRefCount<cIGZPersistDBSegment> pSegment;
+
+	Stopwatch fileStopwatch;
+
+	statistics.openStopwatch.Start();
+	fileStopwatch.Start();
+
+	{
+		StartupTrace::Span span("Segment open", path.ToChar());
+
+		if (CreateGZPersistDBSegment(path, file.size, pSegment))
+		{
+			result = pSegment->Open(true, false);
+		}
+	}
+
+	fileStopwatch.Stop();
+	statistics.openStopwatch.Stop();
+
+	if (statistics.collectFileCosts)
+	{
+		AddFileCost(
+			path,
+			pSegment,
+			result,
+			static_cast<uint32_t>(fileStopwatch.ElapsedMicroseconds()));
+	}
+
+	if (result)
+	{
+		AddSegment(pSegment);
+	}
+
+	return result;
+}
+
+bool SegmentOpener::CreateGZPersistDBSegment(
+	cIGZString const& path,
+	uint64_t fileSize,
+	cRZAutoRefCount<cIGZPersistDBSegment>& segment) const
+{
+	bool result = false;
+
+	if (memoryBlockPool)
+	{
+		MemoryDBSegment* const pMemorySegment = new MemoryDBSegment(
+			pCOM,
+			memoryBlockPool,
+			Settings::GetInstance().SmallFileMemoryThreshold() * 1024,
+			fileSize);
+
+		if (pMemorySegment->QueryInterface(GZIID_cIGZPersistDBSegment, segment.AsPPVoid()))
+		{
+			if (segment->Init())
+			{
+				result = segment->SetPath(path);
+			}
+		}
+	}
+	else if (pCOM->GetClassObject(
+		GZCLSID_cGZDBSegmentPackedFile,
+		GZIID_cIGZPersistDBSegment,
+		segment.AsPPVoid()))
+	{
+		if (segment->Init())
+		{
+			result = segment->SetPath(path);
+		}
+	}
+
+	return result;
+}
+
+void SegmentOpener::AddSegment(cIGZPersistDBSegment* const pSegment)
+{
+	pSegment->AddRef();
+
+	segments.push_back(pSegment);
+}
+
+void SegmentOpener::AddFileCost(
+	cIGZString const& path,
+	cIGZPersistDBSegment* const pSegment,
+	bool loaded,
+	uint32_t openMicroseconds)
+{
+	if (loaded)
+	{
+		statistics.fileCostIndexes.emplace(pSegment, statistics.fileCosts.size());
+	}
+
+	statistics.fileCosts.emplace_back(path, loaded, openMicroseconds);
+}
@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "cIGZPersistDBSegment.h"
+#include "cRZAutoRefCount.h"
+#include "cRZBaseString.h"
+#include "MemoryBlockPool.h"
+#include "MultiPackedFileOpenStatistics.h"
+#include "SC4DirectoryEnumerator.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class cIGZCOM;
+
+// Opens the DBPF files in a plugin folder as the segments of a multi-packed file.
+// The opened segments are always added in the order that the folder scan found them, the
+// open strategies only change how the folder scan and the file reads overlap.
+// The game's segment objects are only created and opened on the thread that calls the
+// Open methods, the worker threads only read the files with Win32 calls.
+class SegmentOpener
+{
+public:
+	// Scans the folder, the callback is called with each DBPF file that is found.
+	typedef std::function<void(const SC4DirectoryEnumerator::FileFoundCallback& callback)> EnumerateFilesFunction;
+
+	// The opened segments are added to the end of segments, each with a reference that the
+	// caller must release.
+	SegmentOpener(
+		const cIGZString& folderPath,
+		EnumerateFilesFunction&& enumerateFiles,
+		cIGZCOM* pCOM,
+		const std::shared_ptr<MemoryBlockPool>& memoryBlockPool,
+		MultiPackedFileOpenStatistics& statistics,
+		std::vector<cIGZPersistDBSegment*>& segments);
+
+	// Scans the folder and then opens the files one at a time.
+	void OpenSerial();
+
+	// Scans the folder on a background thread and opens each file as soon as it is found.
+	void OpenPipelined();
+
+	// Scans the folder, and then reads the files on worker threads and opens them on the
+	// calling thread in the order that the reads finish.
+	void OpenParallel(uint32_t threadCount);
+
+	// The background indexing runs the parallel open in three steps, only the prefetch
+	// runs on the background thread.
+
+	// Scans the folder and creates the segments without opening them.
+	// Returns false if the folder has no DBPF files.
+	bool CreateSegments();
+
+	// Reads the files into the file system cache, this can be called from any thread.
+	// The prefetch stops early when canceled is set.
+	void PrefetchCreatedSegments(uint32_t threadCount, const std::atomic<bool>& canceled);
+
+	// Opens the segments that CreateSegments created.
+	void OpenPrefetchedSegments();
+
+private:
+	// A file that the folder scan found, the size is the one the directory listing reported.
+	struct FoundFile
+	{
+		cRZBaseString path;
+		uint64_t size;
+	};
+
+	struct Item
+	{
+		Item(const cRZBaseString& path, uint64_t fileSize);
+
+		cRZBaseString path;
+		uint64_t fileSize;
+		cRZAutoRefCount<cIGZPersistDBSegment> segment;
+		uint32_t estimatedCost;
+		uint32_t openCost;
+		bool created;
+		bool opened;
+	};
+
+	void OpenCreatedSegments(uint32_t threadCount);
+
+	std::vector<uint32_t> CreateOpenSchedule() const;
+
+	uint64_t GetPrefetchWholeFileSizeLimit() const;
+
+	static void PrefetchItem(Item& item, uint64_t wholeFileSizeLimit, std::vector<uint8_t>& buffer);
+
+	static void OpenItem(Item& item);
+
+	void AddOpenedSegments();
+
+	void LoadSegment(const FoundFile& file);
+
+	bool SetupGZPersistDBSegment(const FoundFile& file);
+
+	// Creates a MemoryDBSegment when the small file memory mode is enabled, otherwise
+	// a cGZDBSegmentPackedFile.
+	bool CreateGZPersistDBSegment(
+		cIGZString const& path,
+		uint64_t fileSize,
+		cRZAutoRefCount<cIGZPersistDBSegment>& segment) const;
+
+	void AddSegment(cIGZPersistDBSegment* const pSegment);
+
+	void AddFileCost(
+		cIGZString const& path,
+		cIGZPersistDBSegment* const pSegment,
+		bool loaded,
+		uint32_t openMicroseconds);
+
+	cRZBaseString folderPath;
+	EnumerateFilesFunction enumerateFiles;
+	cIGZCOM* pCOM;
+	std::shared_ptr<MemoryBlockPool> memoryBlockPool;
+	MultiPackedFileOpenStatistics& statistics;
+	std::vector<cIGZPersistDBSegment*>& segments;
+	std::vector<Item> items;
+};
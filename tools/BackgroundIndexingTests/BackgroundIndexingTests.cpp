@@ -0,0 +1,296 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Tests the plugin's BackgroundIndexing class outside of the game.
+// FakeMultiPackedFile follows the locking of BaseMultiPackedFile: a recursive mutex stands in
+// for the critical section, Lock and the lookups wait for the indexing before they take it,
+// and the finishing work takes it to add the keys, as AddToGlobalKeyIndex does.
+// A test that has not finished after the deadlock timeout is reported as a failure.
+
+#include "BackgroundIndexing.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	constexpr auto DeadlockTimeout = std::chrono::seconds(10);
+	constexpr auto BackgroundWorkDuration = std::chrono::milliseconds(50);
+	constexpr uint32_t KeyCount = 1000;
+	constexpr uint32_t LookupThreadCount = 8;
+
+	class TestResults
+	{
+	public:
+		void Check(bool condition, const char* description)
+		{
+			checkCount++;
+
+			if (!condition)
+			{
+				failureCount++;
+				std::printf("FAILED: %s\n", description);
+			}
+		}
+
+		size_t GetCheckCount() const
+		{
+			return checkCount;
+		}
+
+		size_t GetFailureCount() const
+		{
+			return failureCount;
+		}
+
+	private:
+		size_t checkCount = 0;
+		size_t failureCount = 0;
+	};
+
+	class FakeMultiPackedFile
+	{
+	public:
+		FakeMultiPackedFile()
+			: finishCount(0), finishLookupResult(true)
+		{
+		}
+
+		// The background work only sleeps, it does not take the mutex.
+		void Open(bool lookupFromFinishWork)
+		{
+			indexing.Start(
+				[](const std::atomic<bool>& canceled)
+				{
+					const auto end = std::chrono::steady_clock::now() + BackgroundWorkDuration;
+
+					while (!canceled && std::chrono::steady_clock::now() < end)
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+				},
+				[this, lookupFromFinishWork]()
+				{
+					finishCount++;
+
+					{
+						std::lock_guard<std::recursive_mutex> lock(mutex);
+
+						for (uint32_t i = 0; i < KeyCount; i++)
+						{
+							keys.insert(i);
+						}
+					}
+
+					if (lookupFromFinishWork)
+					{
+						// The finishing work's own lookups must not wait for it.
+						finishLookupResult = TestForRecord(0);
+					}
+				});
+		}
+
+		// Starts background work that only stops when it is canceled.
+		void OpenWithEndlessBackgroundWork()
+		{
+			indexing.Start(
+				[](const std::atomic<bool>& canceled)
+				{
+					while (!canceled)
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+				},
+				[this]() { finishCount++; });
+		}
+
+		void Lock()
+		{
+			indexing.Wait();
+			mutex.lock();
+		}
+
+		void Unlock()
+		{
+			mutex.unlock();
+		}
+
+		bool TestForRecord(uint32_t key)
+		{
+			indexing.Wait();
+
+			std::lock_guard<std::recursive_mutex> lock(mutex);
+
+			return keys.contains(key);
+		}
+
+		BackgroundIndexing indexing;
+		std::atomic<uint32_t> finishCount;
+		bool finishLookupResult;
+
+	private:
+		std::recursive_mutex mutex;
+		std::unordered_set<uint32_t> keys;
+	};
+
+	// Runs the test on another thread, so that a deadlock is reported instead of hanging the tool.
+	template<typename TTest> bool RunWithTimeout(TTest&& test)
+	{
+		std::packaged_task<void()> task(std::forward<TTest>(test));
+		std::future<void> future = task.get_future();
+
+		std::thread thread(std::move(task));
+
+		if (future.wait_for(DeadlockTimeout) != std::future_status::ready)
+		{
+			std::printf("FAILED: the test did not finish within the deadlock timeout.\n");
+			std::fflush(stdout);
+			std::_Exit(2);
+		}
+
+		thread.join();
+		return true;
+	}
+
+	void TestLockThenLookupWhileIndexingIsPending(TestResults& results)
+	{
+		FakeMultiPackedFile file;
+		file.Open(false);
+
+		results.Check(file.indexing.IsPending(), "The indexing is pending after Open");
+
+		bool found = false;
+
+		RunWithTimeout(
+			[&file, &found]()
+			{
+				file.Lock();
+				found = file.TestForRecord(KeyCount - 1);
+				file.Unlock();
+			});
+
+		results.Check(found, "Lock then lookup while the indexing is pending finds the key");
+		results.Check(!file.indexing.IsPending(), "The indexing is not pending after Lock");
+		results.Check(file.finishCount == 1, "Lock ran the finishing work once");
+	}
+
+	void TestLookupFromFinishWork(TestResults& results)
+	{
+		FakeMultiPackedFile file;
+		file.Open(true);
+
+		RunWithTimeout([&file]() { file.TestForRecord(0); });
+
+		results.Check(file.finishLookupResult, "A lookup from the finishing work returns without waiting");
+		results.Check(file.finishCount == 1, "The finishing work ran once");
+	}
+
+	void TestConcurrentLookups(TestResults& results)
+	{
+		FakeMultiPackedFile file;
+		file.Open(false);
+
+		std::atomic<uint32_t> foundCount = 0;
+
+		RunWithTimeout(
+			[&file, &foundCount]()
+			{
+				std::vector<std::thread> threads;
+
+				for (uint32_t i = 0; i < LookupThreadCount; i++)
+				{
+					threads.emplace_back(
+						[&file, &foundCount, i]()
+						{
+							if ((i % 2) == 0)
+							{
+								file.Lock();
+							}
+
+							if (file.TestForRecord(i))
+							{
+								foundCount++;
+							}
+
+							if ((i % 2) == 0)
+							{
+								file.Unlock();
+							}
+						});
+				}
+
+				for (std::thread& thread : threads)
+				{
+					thread.join();
+				}
+			});
+
+		results.Check(foundCount == LookupThreadCount, "Every concurrent lookup finds its key");
+		results.Check(file.finishCount == 1, "The concurrent lookups ran the finishing work once");
+	}
+
+	void TestCancel(TestResults& results)
+	{
+		uint32_t finishCount = 0;
+
+		RunWithTimeout(
+			[&finishCount]()
+			{
+				FakeMultiPackedFile file;
+				file.OpenWithEndlessBackgroundWork();
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+				file.indexing.Cancel();
+
+				finishCount = file.finishCount;
+				file.indexing.Wait();
+				finishCount += file.finishCount;
+			});
+
+		results.Check(finishCount == 0, "Cancel stops the background work without running the finishing work");
+	}
+
+	void TestDestroyWhilePending(TestResults& results)
+	{
+		RunWithTimeout(
+			[]()
+			{
+				FakeMultiPackedFile file;
+				file.OpenWithEndlessBackgroundWork();
+			});
+
+		results.Check(true, "Destroying a file with pending indexing cancels it");
+	}
+}
+
+int main()
+{
+	TestResults results;
+
+	TestLockThenLookupWhileIndexingIsPending(results);
+	TestLookupFromFinishWork(results);
+	TestConcurrentLookups(results);
+	TestCancel(results);
+	TestDestroyWhilePending(results);
+
+	std::printf("%zu checks, %zu failed.\n", results.GetCheckCount(), results.GetFailureCount());
+
+	return results.GetFailureCount() == 0 ? 0 : 1;
+}
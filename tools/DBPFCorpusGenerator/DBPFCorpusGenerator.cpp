@@ -0,0 +1,709 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Generates a synthetic plugin folder tree for benchmarking the plugin loading.
+//
+// The output is deterministic for a given seed and set of options, the random values
+// are generated with std::mt19937_64 and distribution code in this file because the
+// standard library distributions are implementation defined.
+
+#include "../../src/DBPFHeader.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t DirectoryFileType = 0xE86B1EEF;
+	constexpr uint32_t DirectoryFileGroup = 0xE86B1EEF;
+	constexpr uint32_t DirectoryFileInstance = 0x286B1F03;
+
+	constexpr uint32_t MaxRecordSize = 4 * 1024 * 1024;
+
+	struct Options
+	{
+		std::filesystem::path outputFolder;
+		uint64_t seed = 1;
+		uint32_t datFileCount = 100;
+		uint32_t sc4FileCount = 50;
+		uint32_t directoryDepth = 2;
+		uint32_t foldersPerLevel = 3;
+		uint32_t minRecordsPerFile = 10;
+		uint32_t maxRecordsPerFile = 200;
+		uint32_t recordSizeMedian = 2048;
+		double recordSizeSigma = 1.5;
+		double compressedFraction = 0.3;
+		double overrideRate = 0.05;
+		uint32_t malformedFileCount = 0;
+	};
+
+	struct Key
+	{
+		uint32_t type;
+		uint32_t group;
+		uint32_t instance;
+	};
+
+	struct RecordType
+	{
+		uint32_t type;
+		uint32_t weight;
+		// Some record types, e.g. images and models, do not compress well.
+		bool compressible;
+	};
+
+	// The common SC4 plugin record types, weighted by how often they appear in plugins.
+	constexpr std::array<RecordType, 6> RecordTypes =
+	{
+		RecordType{ 0x6534284A, 40, true },  // Exemplar
+		RecordType{ 0x05342861, 5, true },   // Cohort
+		RecordType{ 0x5AD0E817, 25, true },  // S3D model
+		RecordType{ 0x7AB50E44, 20, false }, // FSH texture
+		RecordType{ 0x856DDBAC, 5, false },  // PNG
+		RecordType{ 0x2026960B, 5, true },   // LText
+	};
+
+	enum class MalformedKind
+	{
+		EmptyFile,
+		FileTooSmall,
+		MissingSignature,
+		IndexOutOfRange,
+		Count
+	};
+
+	class Random
+	{
+	public:
+		explicit Random(uint64_t seed) : engine(seed)
+		{
+		}
+
+		// Returns a value in [0, count).
+		uint32_t Next(uint32_t count)
+		{
+			return static_cast<uint32_t>((static_cast<uint64_t>(static_cast<uint32_t>(engine() >> 32)) * count) >> 32);
+		}
+
+		// Returns a value in [min, max].
+		uint32_t Next(uint32_t min, uint32_t max)
+		{
+			return min + Next(max - min + 1);
+		}
+
+		uint32_t NextUInt32()
+		{
+			return static_cast<uint32_t>(engine() >> 32);
+		}
+
+		// Returns a value in [0, 1).
+		double NextDouble()
+		{
+			return static_cast<double>(engine() >> 11) * (1.0 / 9007199254740992.0);
+		}
+
+		bool NextBool(double probability)
+		{
+			return NextDouble() < probability;
+		}
+
+		// An approximately normal value with a mean of 0 and a standard deviation of 1,
+		// the Irwin-Hall sum only uses basic arithmetic so it is the same on every platform.
+		double NextNormal()
+		{
+			double sum = 0;
+
+			for (int i = 0; i < 12; i++)
+			{
+				sum += NextDouble();
+			}
+
+			return sum - 6.0;
+		}
+
+	private:
+		std::mt19937_64 engine;
+	};
+
+	void WriteUInt32(std::vector<uint8_t>& buffer, uint32_t value)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			buffer.push_back(static_cast<uint8_t>(value >> (i * 8)));
+		}
+	}
+
+	// Compresses the data with the QFS/RefPack format that SC4 uses for compressed records.
+	// This is a simple greedy compressor, it only needs to produce valid data with a realistic
+	// compression ratio and decompression cost.
+	std::vector<uint8_t> QfsCompress(const std::vector<uint8_t>& input)
+	{
+		constexpr size_t MaxOffset = 131072;
+		constexpr size_t MaxLength = 1028;
+		constexpr size_t HashSize = 1 << 16;
+
+		std::vector<uint8_t> output;
+		output.reserve(input.size() + input.size() / 16 + 16);
+
+		// The compressed size is filled in after the data is compressed.
+		WriteUInt32(output, 0);
+		output.push_back(0x10);
+		output.push_back(0xFB);
+		output.push_back(static_cast<uint8_t>(input.size() >> 16));
+		output.push_back(static_cast<uint8_t>(input.size() >> 8));
+		output.push_back(static_cast<uint8_t>(input.size()));
+
+		std::vector<int64_t> hashTable(HashSize, -1);
+
+		size_t literalStart = 0;
+		size_t position = 0;
+
+		const auto flushLiterals = [&](size_t keep)
+		{
+			// Writes the pending literals in multiples of 4, leaving up to 3 for the next control code.
+			while (position - literalStart > keep)
+			{
+				const size_t count = std::min<size_t>((position - literalStart) & ~size_t(3), 112);
+
+				if (count == 0)
+				{
+					break;
+				}
+
+				output.push_back(static_cast<uint8_t>(0xE0 + ((count - 4) >> 2)));
+				output.insert(output.end(), input.begin() + literalStart, input.begin() + literalStart + count);
+				literalStart += count;
+			}
+		};
+
+		while (position + 3 <= input.size())
+		{
+			const uint32_t hash = ((input[position] << 16 | input[position + 1] << 8 | input[position + 2]) * 2654435761U) >> 16;
+			const int64_t candidate = hashTable[hash];
+			hashTable[hash] = static_cast<int64_t>(position);
+
+			size_t length = 0;
+			size_t offset = 0;
+
+			if (candidate >= 0 && position - candidate <= MaxOffset)
+			{
+				offset = position - static_cast<size_t>(candidate);
+
+				while (length < MaxLength
+					&& position + length < input.size()
+					&& input[candidate + length] == input[position + length])
+				{
+					length++;
+				}
+			}
+
+			const bool shortForm = length >= 3 && length <= 10 && offset <= 1024;
+			const bool mediumForm = length >= 4 && length <= 67 && offset <= 16384;
+			const bool longForm = length >= 5;
+
+			if (!shortForm && !mediumForm && !longForm)
+			{
+				position++;
+				continue;
+			}
+
+			flushLiterals(3);
+
+			const size_t plain = position - literalStart;
+			const size_t encodedOffset = offset - 1;
+
+			if (shortForm)
+			{
+				output.push_back(static_cast<uint8_t>(((encodedOffset >> 3) & 0x60) | ((length - 3) << 2) | plain));
+				output.push_back(static_cast<uint8_t>(encodedOffset));
+			}
+			else if (mediumForm)
+			{
+				output.push_back(static_cast<uint8_t>(0x80 | (length - 4)));
+				output.push_back(static_cast<uint8_t>((plain << 6) | (encodedOffset >> 8)));
+				output.push_back(static_cast<uint8_t>(encodedOffset));
+			}
+			else
+			{
+				const size_t encodedLength = length - 5;
+
+				output.push_back(static_cast<uint8_t>(0xC0 | ((encodedOffset >> 12) & 0x10) | ((encodedLength >> 6) & 0x0C) | plain));
+				output.push_back(static_cast<uint8_t>(encodedOffset >> 8));
+				output.push_back(static_cast<uint8_t>(encodedOffset));
+				output.push_back(static_cast<uint8_t>(encodedLength));
+			}
+
+			output.insert(output.end(), input.begin() + literalStart, input.begin() + position);
+
+			position += length;
+			literalStart = position;
+		}
+
+		position = input.size();
+		flushLiterals(3);
+
+		const size_t plain = position - literalStart;
+		output.push_back(static_cast<uint8_t>(0xFC | plain));
+		output.insert(output.end(), input.begin() + literalStart, input.end());
+
+		const uint32_t compressedSize = static_cast<uint32_t>(output.size());
+
+		for (int i = 0; i < 4; i++)
+		{
+			output[i] = static_cast<uint8_t>(compressedSize >> (i * 8));
+		}
+
+		return output;
+	}
+
+	class CorpusGenerator
+	{
+	public:
+		explicit CorpusGenerator(const Options& options)
+			: options(options),
+			  random(options.seed),
+			  directories(),
+			  generatedKeys(),
+			  fileCount(0),
+			  recordCount(0),
+			  compressedRecordCount(0),
+			  overridingRecordCount(0),
+			  totalBytes(0)
+		{
+		}
+
+		void Run()
+		{
+			CreateDirectories(options.outputFolder, 0);
+
+			for (uint32_t i = 0; i < options.datFileCount; i++)
+			{
+				WriteDBPFFile(GetFilePath("File", i, ".dat"));
+			}
+
+			static constexpr std::array<std::string_view, 4> SC4Extensions = { ".SC4Desc", ".SC4Lot", ".SC4Model", "" };
+
+			for (uint32_t i = 0; i < options.sc4FileCount; i++)
+			{
+				WriteDBPFFile(GetFilePath("Loose", i, SC4Extensions[random.Next(static_cast<uint32_t>(SC4Extensions.size()))]));
+			}
+
+			for (uint32_t i = 0; i < options.malformedFileCount; i++)
+			{
+				const MalformedKind kind = static_cast<MalformedKind>(i % static_cast<uint32_t>(MalformedKind::Count));
+
+				WriteMalformedFile(GetFilePath("Malformed", i, (i & 1) != 0 ? ".SC4Lot" : ".dat"), kind);
+			}
+
+			std::printf(
+				"Generated %u DBPF files and %u malformed files in %zu folders: %llu records (%llu compressed, %llu overriding"
+				" an earlier key), %.1f MB.\n",
+				fileCount,
+				options.malformedFileCount,
+				directories.size(),
+				static_cast<unsigned long long>(recordCount),
+				static_cast<unsigned long long>(compressedRecordCount),
+				static_cast<unsigned long long>(overridingRecordCount),
+				static_cast<double>(totalBytes) / (1024.0 * 1024.0));
+		}
+
+	private:
+		void CreateDirectories(const std::filesystem::path& folder, uint32_t depth)
+		{
+			std::filesystem::create_directories(folder);
+			directories.push_back(folder);
+
+			if (depth < options.directoryDepth)
+			{
+				for (uint32_t i = 0; i < options.foldersPerLevel; i++)
+				{
+					CreateDirectories(folder / ("Folder" + std::to_string(depth + 1) + "_" + std::to_string(i)), depth + 1);
+				}
+			}
+		}
+
+		std::filesystem::path GetFilePath(std::string_view prefix, uint32_t index, std::string_view extension)
+		{
+			const std::filesystem::path& folder = directories[random.Next(static_cast<uint32_t>(directories.size()))];
+
+			return folder / (std::string(prefix) + std::to_string(index) + std::string(extension));
+		}
+
+		Key NextKey()
+		{
+			if (!generatedKeys.empty() && random.NextBool(options.overrideRate))
+			{
+				overridingRecordCount++;
+				return generatedKeys[random.Next(static_cast<uint32_t>(generatedKeys.size()))];
+			}
+
+			uint32_t weight = random.Next(TotalRecordTypeWeight());
+			uint32_t type = RecordTypes[0].type;
+
+			for (const RecordType& recordType : RecordTypes)
+			{
+				if (weight < recordType.weight)
+				{
+					type = recordType.type;
+					break;
+				}
+
+				weight -= recordType.weight;
+			}
+
+			const Key key{ type, random.NextUInt32(), random.NextUInt32() };
+			generatedKeys.push_back(key);
+
+			return key;
+		}
+
+		static uint32_t TotalRecordTypeWeight()
+		{
+			uint32_t total = 0;
+
+			for (const RecordType& recordType : RecordTypes)
+			{
+				total += recordType.weight;
+			}
+
+			return total;
+		}
+
+		static bool IsCompressible(uint32_t type)
+		{
+			for (const RecordType& recordType : RecordTypes)
+			{
+				if (recordType.type == type)
+				{
+					return recordType.compressible;
+				}
+			}
+
+			return true;
+		}
+
+		uint32_t NextRecordSize()
+		{
+			const double size = options.recordSizeMedian * std::exp(options.recordSizeSigma * random.NextNormal());
+
+			return static_cast<uint32_t>(std::clamp(size, 16.0, static_cast<double>(MaxRecordSize)));
+		}
+
+		std::vector<uint8_t> CreateRecordData(uint32_t size, bool compressible)
+		{
+			std::vector<uint8_t> data(size);
+
+			if (compressible)
+			{
+				// Repeats short random phrases, similar to the property lists in exemplars.
+				std::array<uint8_t, 64> phrase{};
+
+				for (uint8_t& value : phrase)
+				{
+					value = static_cast<uint8_t>(random.Next(256));
+				}
+
+				for (uint32_t i = 0; i < size; i++)
+				{
+					data[i] = random.Next(8) == 0 ? static_cast<uint8_t>(random.Next(256)) : phrase[i % phrase.size()];
+				}
+			}
+			else
+			{
+				for (uint8_t& value : data)
+				{
+					value = static_cast<uint8_t>(random.Next(256));
+				}
+			}
+
+			return data;
+		}
+
+		void WriteDBPFFile(const std::filesystem::path& path)
+		{
+			struct IndexEntry
+			{
+				Key key;
+				uint32_t offset;
+				uint32_t size;
+				uint32_t uncompressedSize;
+				bool compressed;
+			};
+
+			std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to create " + path.string());
+			}
+
+			DBPFHeader header{};
+			stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			const uint32_t records = random.Next(options.minRecordsPerFile, options.maxRecordsPerFile);
+
+			std::vector<IndexEntry> index;
+			index.reserve(records + 1);
+
+			uint32_t offset = DBPFHeader::Size;
+
+			for (uint32_t i = 0; i < records; i++)
+			{
+				const Key key = NextKey();
+				std::vector<uint8_t> data = CreateRecordData(NextRecordSize(), IsCompressible(key.type));
+
+				const uint32_t uncompressedSize = static_cast<uint32_t>(data.size());
+				bool compressed = false;
+
+				if (random.NextBool(options.compressedFraction))
+				{
+					data = QfsCompress(data);
+					compressed = true;
+					compressedRecordCount++;
+				}
+
+				stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+				index.push_back(IndexEntry{ key, offset, static_cast<uint32_t>(data.size()), uncompressedSize, compressed });
+				offset += static_cast<uint32_t>(data.size());
+				recordCount++;
+			}
+
+			// The DIR record lists the uncompressed size of every compressed record in the file.
+			std::vector<uint8_t> directory;
+
+			for (const IndexEntry& entry : index)
+			{
+				if (entry.compressed)
+				{
+					WriteUInt32(directory, entry.key.type);
+					WriteUInt32(directory, entry.key.group);
+					WriteUInt32(directory, entry.key.instance);
+					WriteUInt32(directory, entry.uncompressedSize);
+				}
+			}
+
+			if (!directory.empty())
+			{
+				stream.write(reinterpret_cast<const char*>(directory.data()), static_cast<std::streamsize>(directory.size()));
+
+				const Key directoryKey{ DirectoryFileType, DirectoryFileGroup, DirectoryFileInstance };
+				index.push_back(IndexEntry{ directoryKey, offset, static_cast<uint32_t>(directory.size()), 0, false });
+				offset += static_cast<uint32_t>(directory.size());
+			}
+
+			std::vector<uint8_t> indexData;
+			indexData.reserve(index.size() * 20);
+
+			for (const IndexEntry& entry : index)
+			{
+				WriteUInt32(indexData, entry.key.type);
+				WriteUInt32(indexData, entry.key.group);
+				WriteUInt32(indexData, entry.key.instance);
+				WriteUInt32(indexData, entry.offset);
+				WriteUInt32(indexData, entry.size);
+			}
+
+			stream.write(reinterpret_cast<const char*>(indexData.data()), static_cast<std::streamsize>(indexData.size()));
+
+			header.signature = DBPFHeader::Signature;
+			header.majorVersion = 1;
+			header.indexMajorVersion = 7;
+			header.indexEntryCount = static_cast<uint32_t>(index.size());
+			header.indexOffset = offset;
+			header.indexSize = static_cast<uint32_t>(indexData.size());
+
+			stream.seekp(0);
+			stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to write " + path.string());
+			}
+
+			fileCount++;
+			totalBytes += offset + indexData.size();
+		}
+
+		void WriteMalformedFile(const std::filesystem::path& path, MalformedKind kind)
+		{
+			std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to create " + path.string());
+			}
+
+			DBPFHeader header{};
+			header.signature = DBPFHeader::Signature;
+			header.majorVersion = 1;
+			header.indexMajorVersion = 7;
+			header.indexEntryCount = 10;
+			header.indexOffset = DBPFHeader::Size;
+			header.indexSize = 200;
+
+			switch (kind)
+			{
+			case MalformedKind::EmptyFile:
+				break;
+			case MalformedKind::FileTooSmall:
+				stream.write(reinterpret_cast<const char*>(&header), DBPFHeader::Size / 2);
+				break;
+			case MalformedKind::MissingSignature:
+				header.signature = 0x20545854; // TXT
+				stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				break;
+			case MalformedKind::IndexOutOfRange:
+			default:
+				// A truncated download, the index is past the end of the file.
+				header.indexOffset = 1024 * 1024;
+				stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				break;
+			}
+		}
+
+		const Options& options;
+		Random random;
+		std::vector<std::filesystem::path> directories;
+		std::vector<Key> generatedKeys;
+		uint32_t fileCount;
+		uint64_t recordCount;
+		uint64_t compressedRecordCount;
+		uint64_t overridingRecordCount;
+		uint64_t totalBytes;
+	};
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: DBPFCorpusGenerator <output folder> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --seed <value>                The random seed, defaults to 1.\n"
+			"  --dat-files <count>           The number of .dat files, defaults to 100.\n"
+			"  --sc4-files <count>           The number of .SC4Desc/.SC4Lot/.SC4Model/extensionless files, defaults to 50.\n"
+			"  --depth <count>               The folder depth below the output folder, defaults to 2.\n"
+			"  --folders-per-level <count>   The number of sub folders in each folder, defaults to 3.\n"
+			"  --records <min>-<max>         The number of records in each file, defaults to 10-200.\n"
+			"  --record-size-median <bytes>  The median uncompressed record size, defaults to 2048.\n"
+			"  --record-size-sigma <value>   The log-normal spread of the record sizes, defaults to 1.5.\n"
+			"  --compressed-fraction <value> The fraction of records that are QFS compressed, defaults to 0.3.\n"
+			"  --override-rate <value>       The fraction of records that reuse the TGI of an earlier record, defaults to 0.05.\n"
+			"  --malformed-files <count>     The number of empty, truncated and non-DBPF files, defaults to 0.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+			const bool hasValue = i + 1 < argc;
+
+			if (argument.starts_with("--") && !hasValue)
+			{
+				return false;
+			}
+
+			if (argument == "--seed")
+			{
+				options.seed = std::strtoull(argv[++i], nullptr, 0);
+			}
+			else if (argument == "--dat-files")
+			{
+				options.datFileCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--sc4-files")
+			{
+				options.sc4FileCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--depth")
+			{
+				options.directoryDepth = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--folders-per-level")
+			{
+				options.foldersPerLevel = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--records")
+			{
+				char* end = nullptr;
+				options.minRecordsPerFile = static_cast<uint32_t>(std::strtoul(argv[++i], &end, 10));
+				options.maxRecordsPerFile = *end == '-' ? static_cast<uint32_t>(std::strtoul(end + 1, nullptr, 10)) : options.minRecordsPerFile;
+			}
+			else if (argument == "--record-size-median")
+			{
+				options.recordSizeMedian = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--record-size-sigma")
+			{
+				options.recordSizeSigma = std::strtod(argv[++i], nullptr);
+			}
+			else if (argument == "--compressed-fraction")
+			{
+				options.compressedFraction = std::strtod(argv[++i], nullptr);
+			}
+			else if (argument == "--override-rate")
+			{
+				options.overrideRate = std::strtod(argv[++i], nullptr);
+			}
+			else if (argument == "--malformed-files")
+			{
+				options.malformedFileCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (options.outputFolder.empty() && !argument.starts_with("--"))
+			{
+				options.outputFolder = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return !options.outputFolder.empty()
+			&& options.minRecordsPerFile <= options.maxRecordsPerFile
+			&& options.foldersPerLevel > 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		CorpusGenerator generator(options);
+		generator.Run();
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,620 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Replays a resource access trace that was recorded by the plugin's ResourceAccessTrace
+// setting, outside of the game.
+//
+// The DBPF files are either the recorded plugin files, with the Windows paths mapped to
+// local paths, or synthetic files that are generated from the keys and record sizes in the
+// trace. This allows index lookup changes to be measured without starting SimCity 4.
+
+#include "../../src/DBPFHeader.h"
+#include "../../src/DBPFIndexReader.h"
+#include "../../src/ResourceAccessTraceFormat.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace ResourceAccessTraceFormat;
+
+namespace
+{
+	struct Key
+	{
+		uint32_t type;
+		uint32_t group;
+		uint32_t instance;
+
+		bool operator==(const Key& other) const = default;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const noexcept
+		{
+			uint64_t hash = 14695981039346656037ULL;
+
+			for (uint32_t value : { key.type, key.group, key.instance })
+			{
+				hash = (hash ^ value) * 1099511628211ULL;
+			}
+
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	struct IndexEntry
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct Segment
+	{
+		std::string tracePath;
+		std::filesystem::path localPath;
+		std::unordered_map<Key, IndexEntry, KeyHash> entries;
+		std::unique_ptr<std::ifstream> stream;
+	};
+
+	struct SegmentRecordItem
+	{
+		uint32_t segmentIndex;
+		IndexEntry entry;
+	};
+
+	struct Container
+	{
+		std::string tracePath;
+		std::vector<Segment> segments;
+		// The combined index of all segments, later segments override the earlier ones.
+		std::unordered_map<Key, SegmentRecordItem, KeyHash> tgiMap;
+	};
+
+	struct Trace
+	{
+		int64_t timeStampFrequency = 0;
+		std::map<uint16_t, Container> containers;
+		std::vector<AccessRecord> accesses;
+	};
+
+	struct PathMapping
+	{
+		std::string from;
+		std::string to;
+	};
+
+	struct Options
+	{
+		std::filesystem::path tracePath;
+		std::filesystem::path syntheticFolder;
+		std::vector<PathMapping> pathMappings;
+		int iterations = 1;
+	};
+
+	constexpr size_t OperationCount = static_cast<size_t>(RecordType::ReadRecord) + 1;
+
+	const char* GetOperationName(RecordType type)
+	{
+		switch (type)
+		{
+		case RecordType::TestForRecord:
+			return "TestForRecord";
+		case RecordType::GetRecordSize:
+			return "GetRecordSize";
+		case RecordType::OpenRecord:
+			return "OpenRecord";
+		case RecordType::ReadRecord:
+			return "ReadRecord";
+		default:
+			return "Unknown";
+		}
+	}
+
+	template<typename T> void ReadValue(std::ifstream& stream, T& value)
+	{
+		stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+
+		if (!stream)
+		{
+			throw std::runtime_error("Unexpected end of file.");
+		}
+	}
+
+	Trace ReadTrace(const std::filesystem::path& path)
+	{
+		std::ifstream stream(path, std::ios::binary);
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to open the trace file: " + path.string());
+		}
+
+		FileHeader header{};
+		ReadValue(stream, header);
+
+		if (header.signature != Signature || header.version != Version)
+		{
+			throw std::runtime_error("The trace file has an unsupported format.");
+		}
+
+		Trace trace;
+		trace.timeStampFrequency = header.timeStampFrequency;
+
+		while (stream.peek() != std::char_traits<char>::eof())
+		{
+			const RecordType type = static_cast<RecordType>(stream.peek());
+
+			if (type == RecordType::Container || type == RecordType::Segment)
+			{
+				PathRecord record{};
+				ReadValue(stream, record);
+
+				std::string recordPath(record.pathLength, '\0');
+				stream.read(recordPath.data(), record.pathLength);
+
+				if (!stream)
+				{
+					throw std::runtime_error("Unexpected end of file.");
+				}
+
+				if (type == RecordType::Container)
+				{
+					Container& container = trace.containers[record.containerID];
+					container.tracePath = std::move(recordPath);
+					container.segments.clear();
+				}
+				else
+				{
+					Segment& segment = trace.containers.at(record.containerID).segments.emplace_back();
+					segment.tracePath = std::move(recordPath);
+				}
+			}
+			else if (type >= RecordType::TestForRecord && type <= RecordType::ReadRecord)
+			{
+				AccessRecord record{};
+				ReadValue(stream, record);
+
+				trace.accesses.push_back(record);
+			}
+			else
+			{
+				throw std::runtime_error("Unknown trace record type: " + std::to_string(static_cast<int>(type)));
+			}
+		}
+
+		return trace;
+	}
+
+	std::filesystem::path MapPath(const std::string& tracePath, const std::vector<PathMapping>& mappings)
+	{
+		std::string path = tracePath;
+
+		for (const PathMapping& mapping : mappings)
+		{
+			if (path.starts_with(mapping.from))
+			{
+				path = mapping.to + path.substr(mapping.from.size());
+				break;
+			}
+		}
+
+		if (!mappings.empty())
+		{
+			std::replace(path.begin(), path.end(), '\\', '/');
+		}
+
+		return std::filesystem::path(std::u8string(path.begin(), path.end()));
+	}
+
+	void LoadSegmentIndex(Segment& segment)
+	{
+		segment.stream = std::make_unique<std::ifstream>(segment.localPath, std::ios::binary);
+		std::ifstream& stream = *segment.stream;
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to open " + segment.localPath.string());
+		}
+
+		const uint64_t fileSize = std::filesystem::file_size(segment.localPath);
+
+		DBPFHeader header{};
+		ReadValue(stream, header);
+
+		if (!DBPFIndexReader::IsValidHeader(header, fileSize))
+		{
+			throw std::runtime_error(segment.localPath.string() + " is not a DBPF file.");
+		}
+
+		std::vector<uint8_t> index(DBPFIndexReader::GetIndexSize(header));
+
+		stream.seekg(header.indexOffset);
+		stream.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size()));
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to read the index of " + segment.localPath.string());
+		}
+
+		const DBPFIndexReader indexReader(header, index.data(), fileSize);
+		segment.entries.reserve(indexReader.GetEntryCount());
+
+		for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+		{
+			DBPFIndexReader::Entry entry{};
+
+			if (!indexReader.TryGetEntry(i, entry))
+			{
+				throw std::runtime_error(segment.localPath.string() + " has a record that is outside the file.");
+			}
+
+			segment.entries.insert_or_assign(Key{ entry.type, entry.group, entry.instance }, IndexEntry{ entry.offset, entry.size });
+		}
+	}
+
+	void BuildContainerIndex(Container& container)
+	{
+		for (size_t i = 0; i < container.segments.size(); i++)
+		{
+			for (const auto& [key, entry] : container.segments[i].entries)
+			{
+				container.tgiMap.insert_or_assign(key, SegmentRecordItem{ static_cast<uint32_t>(i), entry });
+			}
+		}
+	}
+
+	void WriteSyntheticSegment(
+		const std::filesystem::path& path,
+		const std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t>& records)
+	{
+		std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to create " + path.string());
+		}
+
+		DBPFHeader header{};
+		header.signature = DBPFHeader::Signature;
+		header.majorVersion = 1;
+		header.indexMajorVersion = 7;
+		header.indexEntryCount = static_cast<uint32_t>(records.size());
+
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<uint32_t> index;
+		index.reserve(records.size() * 5);
+
+		std::vector<char> data;
+		uint32_t offset = DBPFHeader::Size;
+
+		for (const auto& [key, size] : records)
+		{
+			data.assign(size, static_cast<char>(std::get<2>(key)));
+			stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+
+			index.insert(index.end(), { std::get<0>(key), std::get<1>(key), std::get<2>(key), offset, size });
+			offset += size;
+		}
+
+		header.indexOffset = offset;
+		header.indexSize = static_cast<uint32_t>(index.size() * sizeof(uint32_t));
+
+		stream.write(reinterpret_cast<const char*>(index.data()), header.indexSize);
+		stream.seekp(0);
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to write " + path.string());
+		}
+	}
+
+	// Creates a DBPF file for every recorded segment that contains the keys the
+	// game found in that segment, using the recorded record sizes.
+	void CreateSyntheticSegments(Trace& trace, const std::filesystem::path& folder)
+	{
+		// The size used for keys that were only tested or opened, not read.
+		constexpr uint32_t DefaultRecordSize = 1024;
+
+		std::filesystem::create_directories(folder);
+
+		std::map<std::pair<uint16_t, uint32_t>, std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t>> segmentRecords;
+
+		for (const AccessRecord& record : trace.accesses)
+		{
+			if (record.segmentIndex != NoSegment)
+			{
+				uint32_t& size = segmentRecords[{ record.containerID, record.segmentIndex }][{ record.keyType, record.keyGroup, record.keyInstance }];
+
+				if (record.size != 0)
+				{
+					size = std::max(size, record.size);
+				}
+				else if (size == 0)
+				{
+					size = DefaultRecordSize;
+				}
+			}
+		}
+
+		for (auto& [containerID, container] : trace.containers)
+		{
+			for (size_t i = 0; i < container.segments.size(); i++)
+			{
+				const std::filesystem::path path = folder / ("c" + std::to_string(containerID) + "_s" + std::to_string(i) + ".dat");
+
+				const auto records = segmentRecords.find({ containerID, static_cast<uint32_t>(i) });
+
+				WriteSyntheticSegment(path, records != segmentRecords.end() ? records->second : decltype(records->second){});
+				container.segments[i].localPath = path;
+			}
+		}
+	}
+
+	struct OperationResults
+	{
+		std::vector<double> replayMicroseconds;
+		std::vector<double> recordedMicroseconds;
+		uint64_t mismatchCount = 0;
+		uint64_t readErrorCount = 0;
+	};
+
+	double Percentile(std::vector<double>& values, double percentile)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		const size_t index = std::min(values.size() - 1, static_cast<size_t>(percentile * static_cast<double>(values.size())));
+
+		std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+
+		return values[index];
+	}
+
+	void Replay(Trace& trace, int iterations)
+	{
+		std::array<OperationResults, OperationCount> results;
+		std::vector<char> buffer;
+
+		const double recordedTicksToMicroseconds = trace.timeStampFrequency > 0
+			? 1e6 / static_cast<double>(trace.timeStampFrequency)
+			: 0.0;
+
+		const auto replayStart = std::chrono::steady_clock::now();
+
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			for (const AccessRecord& record : trace.accesses)
+			{
+				const auto container = trace.containers.find(record.containerID);
+
+				if (container == trace.containers.end())
+				{
+					continue;
+				}
+
+				OperationResults& operation = results[static_cast<size_t>(record.type)];
+
+				const auto start = std::chrono::steady_clock::now();
+
+				const auto item = container->second.tgiMap.find(Key{ record.keyType, record.keyGroup, record.keyInstance });
+				const bool found = item != container->second.tgiMap.end();
+
+				if (found && record.type == RecordType::ReadRecord)
+				{
+					std::ifstream& stream = *container->second.segments[item->second.segmentIndex].stream;
+					buffer.resize(item->second.entry.size);
+
+					stream.clear();
+					stream.seekg(item->second.entry.offset);
+					stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+					if (!stream)
+					{
+						operation.readErrorCount++;
+					}
+				}
+
+				const auto end = std::chrono::steady_clock::now();
+
+				operation.replayMicroseconds.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+
+				if (iteration == 0)
+				{
+					operation.recordedMicroseconds.push_back(record.durationTicks * recordedTicksToMicroseconds);
+
+					const uint32_t segmentIndex = found ? item->second.segmentIndex : NoSegment;
+
+					if ((record.found != 0) != found || (record.segmentIndex != NoSegment && record.segmentIndex != segmentIndex))
+					{
+						operation.mismatchCount++;
+					}
+				}
+			}
+		}
+
+		const double replaySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+
+		std::printf(
+			"Replayed %zu requests x %d iterations in %.3f ms (%.0f requests/s).\n\n",
+			trace.accesses.size(),
+			iterations,
+			replaySeconds * 1e3,
+			replaySeconds > 0 ? static_cast<double>(trace.accesses.size()) * iterations / replaySeconds : 0.0);
+
+		std::printf(
+			"%-14s %10s %12s %10s %10s %10s %10s %12s %12s %10s\n",
+			"Operation", "Count", "Ops/s", "p50 us", "p90 us", "p99 us", "Max us", "Rec p50 us", "Rec p99 us", "Mismatch");
+
+		for (size_t i = static_cast<size_t>(RecordType::TestForRecord); i < OperationCount; i++)
+		{
+			OperationResults& operation = results[i];
+
+			if (operation.replayMicroseconds.empty())
+			{
+				continue;
+			}
+
+			double totalMicroseconds = 0;
+
+			for (double value : operation.replayMicroseconds)
+			{
+				totalMicroseconds += value;
+			}
+
+			std::printf(
+				"%-14s %10zu %12.0f %10.3f %10.3f %10.3f %10.3f %12.3f %12.3f %10llu\n",
+				GetOperationName(static_cast<RecordType>(i)),
+				operation.replayMicroseconds.size(),
+				totalMicroseconds > 0 ? operation.replayMicroseconds.size() / (totalMicroseconds / 1e6) : 0.0,
+				Percentile(operation.replayMicroseconds, 0.50),
+				Percentile(operation.replayMicroseconds, 0.90),
+				Percentile(operation.replayMicroseconds, 0.99),
+				*std::max_element(operation.replayMicroseconds.begin(), operation.replayMicroseconds.end()),
+				Percentile(operation.recordedMicroseconds, 0.50),
+				Percentile(operation.recordedMicroseconds, 0.99),
+				static_cast<unsigned long long>(operation.mismatchCount));
+
+			if (operation.readErrorCount > 0)
+			{
+				std::printf("  %llu reads failed.\n", static_cast<unsigned long long>(operation.readErrorCount));
+			}
+		}
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: DBPFTraceReplay <trace file> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --path-map <from>=<to>  Replaces the <from> prefix of the recorded file paths with <to>.\n"
+			"                          Backslashes are converted to forward slashes. Can be repeated.\n"
+			"  --synthetic <folder>    Generates DBPF files in <folder> from the recorded keys and sizes,\n"
+			"                          instead of reading the recorded plugin files.\n"
+			"  --iterations <count>    The number of times the trace is replayed, defaults to 1.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+
+			if (argument == "--path-map" && i + 1 < argc)
+			{
+				const std::string value = argv[++i];
+				const size_t separator = value.find('=');
+
+				if (separator == std::string::npos)
+				{
+					return false;
+				}
+
+				options.pathMappings.push_back(PathMapping{ value.substr(0, separator), value.substr(separator + 1) });
+			}
+			else if (argument == "--synthetic" && i + 1 < argc)
+			{
+				options.syntheticFolder = argv[++i];
+			}
+			else if (argument == "--iterations" && i + 1 < argc)
+			{
+				options.iterations = std::max(1, std::atoi(argv[++i]));
+			}
+			else if (options.tracePath.empty() && !argument.starts_with("--"))
+			{
+				options.tracePath = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return !options.tracePath.empty();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		Trace trace = ReadTrace(options.tracePath);
+
+		if (options.syntheticFolder.empty())
+		{
+			for (auto& [containerID, container] : trace.containers)
+			{
+				for (Segment& segment : container.segments)
+				{
+					segment.localPath = MapPath(segment.tracePath, options.pathMappings);
+				}
+			}
+		}
+		else
+		{
+			CreateSyntheticSegments(trace, options.syntheticFolder);
+		}
+
+		size_t segmentCount = 0;
+
+		for (auto& [containerID, container] : trace.containers)
+		{
+			for (Segment& segment : container.segments)
+			{
+				LoadSegmentIndex(segment);
+			}
+
+			BuildContainerIndex(container);
+			segmentCount += container.segments.size();
+		}
+
+		std::printf(
+			"Loaded %zu containers with %zu segments, %zu recorded requests.\n",
+			trace.containers.size(),
+			segmentCount,
+			trace.accesses.size());
+
+		Replay(trace, options.iterations);
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,757 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Tests and benchmarks the ASCII fast path of the GZStringConvert conversions on any platform.
+// The plugin converts the leading ASCII characters with AsciiConvert and passes the rest of
+// the string to the Windows UTF converter. The Windows converter is replaced here by a scalar
+// converter that handles the invalid sequences in the same way, the test mode checks that
+// splitting the string at the end of the ASCII prefix never changes the result.
+
+#include "AsciiConvert.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	constexpr char16_t ReplacementCharacter = 0xFFFD;
+
+	struct Options
+	{
+		std::filesystem::path input;
+		bool runTests = false;
+		int iterations = 10;
+		uint64_t seed = 1;
+	};
+
+	bool IsHighSurrogate(char16_t c)
+	{
+		return c >= 0xD800 && c <= 0xDBFF;
+	}
+
+	bool IsLowSurrogate(char16_t c)
+	{
+		return c >= 0xDC00 && c <= 0xDFFF;
+	}
+
+	// Converts UTF-8 to UTF-16 in the same way as MultiByteToWideChar without the
+	// MB_ERR_INVALID_CHARS flag, each maximal subpart of an invalid sequence is
+	// replaced with a single U+FFFD character.
+	void DecodeUtf8(const char* src, size_t length, std::u16string& dest)
+	{
+		size_t i = 0;
+
+		while (i < length)
+		{
+			const uint8_t lead = static_cast<uint8_t>(src[i]);
+
+			if (lead < 0x80)
+			{
+				dest.push_back(lead);
+				i++;
+				continue;
+			}
+
+			size_t trailCount = 0;
+			uint32_t codePoint = 0;
+			uint8_t lowerBound = 0x80;
+			uint8_t upperBound = 0xBF;
+
+			if (lead >= 0xC2 && lead <= 0xDF)
+			{
+				trailCount = 1;
+				codePoint = lead & 0x1F;
+			}
+			else if (lead >= 0xE0 && lead <= 0xEF)
+			{
+				trailCount = 2;
+				codePoint = lead & 0x0F;
+				// Rejects the overlong forms and the UTF-16 surrogates.
+				lowerBound = lead == 0xE0 ? 0xA0 : 0x80;
+				upperBound = lead == 0xED ? 0x9F : 0xBF;
+			}
+			else if (lead >= 0xF0 && lead <= 0xF4)
+			{
+				trailCount = 3;
+				codePoint = lead & 0x07;
+				// Rejects the overlong forms and the code points above U+10FFFF.
+				lowerBound = lead == 0xF0 ? 0x90 : 0x80;
+				upperBound = lead == 0xF4 ? 0x8F : 0xBF;
+			}
+			else
+			{
+				dest.push_back(ReplacementCharacter);
+				i++;
+				continue;
+			}
+
+			size_t next = i + 1;
+			bool valid = true;
+
+			for (size_t j = 0; j < trailCount; j++)
+			{
+				const uint8_t trail = next < length ? static_cast<uint8_t>(src[next]) : 0;
+
+				if (next >= length || trail < lowerBound || trail > upperBound)
+				{
+					valid = false;
+					break;
+				}
+
+				codePoint = (codePoint << 6) | (trail & 0x3F);
+				lowerBound = 0x80;
+				upperBound = 0xBF;
+				next++;
+			}
+
+			if (!valid)
+			{
+				// The bytes up to the one that failed are one maximal subpart.
+				dest.push_back(ReplacementCharacter);
+			}
+			else if (codePoint >= 0x10000)
+			{
+				codePoint -= 0x10000;
+				dest.push_back(static_cast<char16_t>(0xD800 + (codePoint >> 10)));
+				dest.push_back(static_cast<char16_t>(0xDC00 + (codePoint & 0x3FF)));
+			}
+			else
+			{
+				dest.push_back(static_cast<char16_t>(codePoint));
+			}
+
+			i = next;
+		}
+	}
+
+	// Converts UTF-16 to UTF-8 in the same way as WideCharToMultiByte, an unpaired
+	// surrogate is replaced with U+FFFD.
+	void EncodeUtf16(const char16_t* src, size_t length, std::string& dest)
+	{
+		for (size_t i = 0; i < length; i++)
+		{
+			uint32_t codePoint = src[i];
+
+			if (IsHighSurrogate(src[i]) && i + 1 < length && IsLowSurrogate(src[i + 1]))
+			{
+				codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+				i++;
+			}
+			else if (IsHighSurrogate(src[i]) || IsLowSurrogate(src[i]))
+			{
+				codePoint = ReplacementCharacter;
+			}
+
+			if (codePoint < 0x80)
+			{
+				dest.push_back(static_cast<char>(codePoint));
+			}
+			else if (codePoint < 0x800)
+			{
+				dest.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+				dest.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+			else if (codePoint < 0x10000)
+			{
+				dest.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+				dest.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+				dest.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+			else
+			{
+				dest.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+				dest.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+				dest.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+				dest.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+		}
+	}
+
+	std::u16string ScalarToUtf16(const std::string& str)
+	{
+		std::u16string result;
+		DecodeUtf8(str.data(), str.size(), result);
+
+		return result;
+	}
+
+	std::string ScalarFromUtf16(const std::u16string& str)
+	{
+		std::string result;
+		EncodeUtf16(str.data(), str.size(), result);
+
+		return result;
+	}
+
+	// The conversion that the plugin used before the fast path, the output size is
+	// found with a first pass over the string, as the Windows size query does.
+	std::u16string TwoPassToUtf16(const std::string& str)
+	{
+		std::u16string sizeQuery;
+		DecodeUtf8(str.data(), str.size(), sizeQuery);
+
+		std::u16string result;
+		result.reserve(sizeQuery.size());
+		DecodeUtf8(str.data(), str.size(), result);
+
+		return result;
+	}
+
+	std::string TwoPassFromUtf16(const std::u16string& str)
+	{
+		std::string sizeQuery;
+		EncodeUtf16(str.data(), str.size(), sizeQuery);
+
+		std::string result;
+		result.reserve(sizeQuery.size());
+		EncodeUtf16(str.data(), str.size(), result);
+
+		return result;
+	}
+
+	// Mirrors GZStringConvert::ToUtf16, the worst case output size is allocated up
+	// front and the rest of the string after the ASCII prefix is converted in one pass.
+	std::u16string FastToUtf16(const std::string& str)
+	{
+		std::u16string result(str.size(), u'\0');
+
+		const size_t asciiLength = AsciiConvert::WidenPrefix(str.data(), str.size(), result.data());
+		size_t utf16Length = asciiLength;
+
+		if (asciiLength < str.size())
+		{
+			std::u16string rest;
+			DecodeUtf8(str.data() + asciiLength, str.size() - asciiLength, rest);
+
+			if (rest.size() > str.size() - asciiLength)
+			{
+				throw std::runtime_error("The UTF-16 buffer is smaller than the converted string.");
+			}
+
+			std::copy(rest.begin(), rest.end(), result.begin() + asciiLength);
+			utf16Length += rest.size();
+		}
+
+		result.resize(utf16Length);
+
+		return result;
+	}
+
+	// Mirrors GZStringConvert::FromUtf16.
+	std::string FastFromUtf16(const std::u16string& str)
+	{
+		const size_t maxUtf8Length = str.size() * 3;
+		std::string result(maxUtf8Length, '\0');
+
+		const size_t asciiLength = AsciiConvert::NarrowPrefix(str.data(), str.size(), result.data());
+		size_t utf8Length = asciiLength;
+
+		if (asciiLength < str.size())
+		{
+			std::string rest;
+			EncodeUtf16(str.data() + asciiLength, str.size() - asciiLength, rest);
+
+			if (rest.size() > maxUtf8Length - asciiLength)
+			{
+				throw std::runtime_error("The UTF-8 buffer is smaller than the converted string.");
+			}
+
+			std::copy(rest.begin(), rest.end(), result.begin() + asciiLength);
+			utf8Length += rest.size();
+		}
+
+		result.resize(utf8Length);
+
+		return result;
+	}
+
+	class TestResults
+	{
+	public:
+		void Check(bool condition, const std::string& description)
+		{
+			checkCount++;
+
+			if (!condition)
+			{
+				failureCount++;
+
+				if (failureCount <= 20)
+				{
+					std::printf("FAILED: %s\n", description.c_str());
+				}
+			}
+		}
+
+		size_t GetCheckCount() const
+		{
+			return checkCount;
+		}
+
+		size_t GetFailureCount() const
+		{
+			return failureCount;
+		}
+
+	private:
+		size_t checkCount = 0;
+		size_t failureCount = 0;
+	};
+
+	std::string ToHex(std::string_view bytes)
+	{
+		std::string hex;
+		char buffer[4]{};
+
+		for (const char c : bytes)
+		{
+			std::snprintf(buffer, sizeof(buffer), "%02X ", static_cast<uint8_t>(c));
+			hex += buffer;
+		}
+
+		return hex;
+	}
+
+	std::string ToHex(std::u16string_view units)
+	{
+		std::string hex;
+		char buffer[8]{};
+
+		for (const char16_t c : units)
+		{
+			std::snprintf(buffer, sizeof(buffer), "%04X ", static_cast<unsigned>(c));
+			hex += buffer;
+		}
+
+		return hex;
+	}
+
+	void CheckUtf8(TestResults& results, const std::string& str)
+	{
+		results.Check(FastToUtf16(str) == ScalarToUtf16(str), "ToUtf16 of " + ToHex(str));
+	}
+
+	void CheckUtf16(TestResults& results, const std::u16string& str)
+	{
+		results.Check(FastFromUtf16(str) == ScalarFromUtf16(str), "FromUtf16 of " + ToHex(str));
+	}
+
+	// Places a non-ASCII character at every position of strings up to 4 SSE2 blocks
+	// long, so that the prefix is checked in the vector loop and the scalar tail.
+	void TestAsciiPrefixLengths(TestResults& results)
+	{
+		const uint8_t nonAsciiBytes[] = { 0x80, 0xC3, 0xFF };
+		// 0x100 and above would saturate to 0xFF if the vector check only tested the low byte.
+		const char16_t nonAsciiUnits[] = { 0x80, 0xFF, 0x100, 0x7FFF, 0x8000, 0xD800, 0xFFFF };
+
+		for (size_t length = 0; length <= 64; length++)
+		{
+			std::string utf8(length, 'a');
+			std::u16string utf16(length, u'a');
+
+			for (size_t i = 0; i < length; i++)
+			{
+				utf8[i] = static_cast<char>('!' + (i % 90));
+				utf16[i] = static_cast<char16_t>(utf8[i]);
+			}
+
+			std::u16string widened(length, u'\0');
+			std::string narrowed(length, '\0');
+
+			results.Check(
+				AsciiConvert::WidenPrefix(utf8.data(), length, widened.data()) == length && widened == utf16,
+				"WidenPrefix of " + std::to_string(length) + " ASCII characters");
+			results.Check(
+				AsciiConvert::NarrowPrefix(utf16.data(), length, narrowed.data()) == length && narrowed == utf8,
+				"NarrowPrefix of " + std::to_string(length) + " ASCII characters");
+
+			for (size_t position = 0; position < length; position++)
+			{
+				for (const uint8_t value : nonAsciiBytes)
+				{
+					std::string str = utf8;
+					str[position] = static_cast<char>(value);
+
+					results.Check(
+						AsciiConvert::WidenPrefix(str.data(), length, widened.data()) == position,
+						"WidenPrefix stops at position " + std::to_string(position) + " of " + ToHex(str));
+				}
+
+				for (const char16_t value : nonAsciiUnits)
+				{
+					std::u16string str = utf16;
+					str[position] = value;
+
+					results.Check(
+						AsciiConvert::NarrowPrefix(str.data(), length, narrowed.data()) == position,
+						"NarrowPrefix stops at position " + std::to_string(position) + " of " + ToHex(str));
+				}
+			}
+		}
+	}
+
+	// The ASCII prefix lengths that end before, at, and after the SSE2 block boundaries.
+	const size_t PrefixLengths[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 48 };
+
+	void TestInvalidUtf8(TestResults& results)
+	{
+		struct Case
+		{
+			const char* name;
+			std::string bytes;
+			std::u16string expected;
+		};
+
+		const std::u16string R(1, ReplacementCharacter);
+
+		const std::vector<Case> cases =
+		{
+			{ "2 byte sequence", "\xC3\xA9", u"é" },
+			{ "3 byte sequence", "\xE2\x82\xAC", u"€" },
+			{ "4 byte sequence", "\xF0\x9D\x84\x9E", u"\U0001D11E" },
+			{ "lone continuation byte", "\x80", R },
+			{ "continuation bytes", "\x80\xBF", R + R },
+			{ "truncated 2 byte sequence", "\xC3", R },
+			{ "truncated 3 byte sequence", "\xE2\x82", R },
+			{ "truncated 4 byte sequence", "\xF0\x9D\x84", R },
+			{ "truncated sequence before ASCII", "\xE2\x82" "a", R + u"a" },
+			{ "overlong 2 byte sequence", "\xC0\xAF", R + R },
+			{ "overlong 3 byte sequence", "\xE0\x80\xAF", R + R + R },
+			{ "overlong 4 byte sequence", "\xF0\x80\x80\xAF", R + R + R + R },
+			{ "UTF-8 encoded surrogate", "\xED\xA0\x80", R + R + R },
+			{ "code point above U+10FFFF", "\xF4\x90\x80\x80", R + R + R + R },
+			{ "invalid lead byte F5", "\xF5\x80", R + R },
+			{ "invalid lead byte FF", "\xFF", R },
+			{ "lead byte followed by a lead byte", "\xC3\xC3\xA9", R + u"é" },
+		};
+
+		for (const Case& testCase : cases)
+		{
+			results.Check(ScalarToUtf16(testCase.bytes) == testCase.expected, std::string("scalar decoding of the ") + testCase.name);
+
+			for (const size_t prefixLength : PrefixLengths)
+			{
+				const std::string prefix(prefixLength, 'p');
+
+				CheckUtf8(results, prefix + testCase.bytes);
+				CheckUtf8(results, prefix + testCase.bytes + "\\suffix.dat");
+				CheckUtf8(results, prefix + testCase.bytes + testCase.bytes);
+			}
+		}
+	}
+
+	void TestInvalidUtf16(TestResults& results)
+	{
+		struct Case
+		{
+			const char* name;
+			std::u16string units;
+			std::string expected;
+		};
+
+		const std::string R = "\xEF\xBF\xBD";
+
+		const std::vector<Case> cases =
+		{
+			{ "2 byte character", u"é", "\xC3\xA9" },
+			{ "3 byte character", u"€", "\xE2\x82\xAC" },
+			{ "surrogate pair", u"\U0001D11E", "\xF0\x9D\x84\x9E" },
+			{ "lone high surrogate", std::u16string(1, 0xD834), R },
+			{ "lone low surrogate", std::u16string(1, 0xDD1E), R },
+			{ "high surrogate before ASCII", std::u16string(1, 0xD834) + u"a", R + "a" },
+			{ "reversed surrogate pair", std::u16string{ 0xDD1E, 0xD834 }, R + R },
+			{ "two high surrogates", std::u16string{ 0xD834, 0xD834, 0xDD1E }, R + "\xF0\x9D\x84\x9E" },
+		};
+
+		for (const Case& testCase : cases)
+		{
+			results.Check(ScalarFromUtf16(testCase.units) == testCase.expected, std::string("scalar encoding of the ") + testCase.name);
+
+			for (const size_t prefixLength : PrefixLengths)
+			{
+				const std::u16string prefix(prefixLength, u'p');
+
+				CheckUtf16(results, prefix + testCase.units);
+				CheckUtf16(results, prefix + testCase.units + u"\\suffix.dat");
+				CheckUtf16(results, prefix + testCase.units + testCase.units);
+			}
+		}
+	}
+
+	// Random strings that are mostly ASCII path text with runs of random bytes or
+	// code units, which include every kind of invalid sequence.
+	void TestRandomStrings(TestResults& results, uint64_t seed)
+	{
+		std::mt19937_64 random(seed);
+
+		for (int i = 0; i < 200000; i++)
+		{
+			const size_t length = random() % 80;
+			std::string utf8;
+			std::u16string utf16;
+
+			while (utf8.size() < length)
+			{
+				if (random() % 4 == 0)
+				{
+					utf8.push_back(static_cast<char>(random()));
+					utf16.push_back(static_cast<char16_t>(random() % 2 == 0 ? random() : 0xD800 + (random() % 0x800)));
+				}
+				else
+				{
+					const char c = static_cast<char>(' ' + (random() % 95));
+					utf8.push_back(c);
+					utf16.push_back(static_cast<char16_t>(c));
+				}
+			}
+
+			CheckUtf8(results, utf8);
+			CheckUtf16(results, utf16);
+		}
+	}
+
+	bool RunTests(uint64_t seed)
+	{
+		TestResults results;
+
+		TestAsciiPrefixLengths(results);
+		TestInvalidUtf8(results);
+		TestInvalidUtf16(results);
+		TestRandomStrings(results, seed);
+
+		std::printf("%zu checks, %zu failed.\n", results.GetCheckCount(), results.GetFailureCount());
+
+		return results.GetFailureCount() == 0;
+	}
+
+	std::vector<std::string> ReadPaths(const std::filesystem::path& input)
+	{
+		std::vector<std::string> paths;
+
+		if (std::filesystem::is_directory(input))
+		{
+			for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(input))
+			{
+				const std::u8string path = entry.path().u8string();
+				paths.emplace_back(path.begin(), path.end());
+			}
+		}
+		else
+		{
+			std::ifstream stream(input);
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to open " + input.string());
+			}
+
+			std::string line;
+
+			while (std::getline(stream, line))
+			{
+				if (!line.empty() && line.back() == '\r')
+				{
+					line.pop_back();
+				}
+
+				if (!line.empty())
+				{
+					paths.push_back(line);
+				}
+			}
+		}
+
+		return paths;
+	}
+
+	template<typename TInput, typename TFunc> double MeasureNanosecondsPerPath(
+		const std::vector<TInput>& paths,
+		int iterations,
+		TFunc&& convert,
+		size_t& outputLength)
+	{
+		double fastest = 0;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			outputLength = 0;
+
+			const auto start = std::chrono::steady_clock::now();
+
+			for (const TInput& path : paths)
+			{
+				outputLength += convert(path).size();
+			}
+
+			const double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			if (i == 0 || nanoseconds < fastest)
+			{
+				fastest = nanoseconds;
+			}
+		}
+
+		return fastest / static_cast<double>(paths.size());
+	}
+
+	void RunBenchmark(const Options& options)
+	{
+		const std::vector<std::string> utf8Paths = ReadPaths(options.input);
+
+		if (utf8Paths.empty())
+		{
+			throw std::runtime_error("The path list is empty.");
+		}
+
+		std::vector<std::u16string> utf16Paths;
+		utf16Paths.reserve(utf8Paths.size());
+
+		size_t asciiPathCount = 0;
+		size_t totalLength = 0;
+
+		for (const std::string& path : utf8Paths)
+		{
+			utf16Paths.push_back(ScalarToUtf16(path));
+			totalLength += path.size();
+
+			if (std::all_of(path.begin(), path.end(), [](char c) { return static_cast<uint8_t>(c) < 0x80; }))
+			{
+				asciiPathCount++;
+			}
+		}
+
+		std::printf(
+			"%zu paths, %.1f%% pure ASCII, %.1f bytes on average.\n\n",
+			utf8Paths.size(),
+			static_cast<double>(asciiPathCount) * 100.0 / static_cast<double>(utf8Paths.size()),
+			static_cast<double>(totalLength) / static_cast<double>(utf8Paths.size()));
+
+		std::printf("%-30s %12s %12s\n", "Conversion", "ns/path", "MB/s");
+
+		const auto print = [&](const char* name, double nanoseconds)
+		{
+			const double megabytesPerSecond = (static_cast<double>(totalLength) / static_cast<double>(utf8Paths.size())) * 1000.0 / nanoseconds;
+
+			std::printf("%-30s %12.1f %12.1f\n", name, nanoseconds, megabytesPerSecond);
+		};
+
+		size_t twoPassLength = 0;
+		size_t scalarLength = 0;
+		size_t fastLength = 0;
+
+		print("ToUtf16 two pass scalar", MeasureNanosecondsPerPath(utf8Paths, options.iterations, TwoPassToUtf16, twoPassLength));
+		print("ToUtf16 scalar", MeasureNanosecondsPerPath(utf8Paths, options.iterations, ScalarToUtf16, scalarLength));
+		print("ToUtf16 ASCII fast path", MeasureNanosecondsPerPath(utf8Paths, options.iterations, FastToUtf16, fastLength));
+
+		if (twoPassLength != fastLength || scalarLength != fastLength)
+		{
+			throw std::runtime_error("The ToUtf16 conversions produced different output.");
+		}
+
+		print("FromUtf16 two pass scalar", MeasureNanosecondsPerPath(utf16Paths, options.iterations, TwoPassFromUtf16, twoPassLength));
+		print("FromUtf16 scalar", MeasureNanosecondsPerPath(utf16Paths, options.iterations, ScalarFromUtf16, scalarLength));
+		print("FromUtf16 ASCII fast path", MeasureNanosecondsPerPath(utf16Paths, options.iterations, FastFromUtf16, fastLength));
+
+		if (twoPassLength != fastLength || scalarLength != fastLength)
+		{
+			throw std::runtime_error("The FromUtf16 conversions produced different output.");
+		}
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: GZStringConvertBenchmark --test [options]\n"
+			"       GZStringConvertBenchmark <path list file or folder> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --test                  Checks that the ASCII fast path produces the same output as the scalar\n"
+			"                          conversion, including for invalid UTF-8 and UTF-16 sequences.\n"
+			"  --iterations <count>    The number of times each conversion is run, defaults to 10.\n"
+			"  --seed <value>          The random seed for the test strings, defaults to 1.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+
+			if (argument == "--test")
+			{
+				options.runTests = true;
+			}
+			else if (argument.starts_with("--") && i + 1 >= argc)
+			{
+				return false;
+			}
+			else if (argument == "--iterations")
+			{
+				options.iterations = std::max(1, std::atoi(argv[++i]));
+			}
+			else if (argument == "--seed")
+			{
+				options.seed = std::strtoull(argv[++i], nullptr, 0);
+			}
+			else if (options.input.empty() && !argument.starts_with("--"))
+			{
+				options.input = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return options.runTests || !options.input.empty();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		if (options.runTests && !RunTests(options.seed))
+		{
+			return 1;
+		}
+
+		if (!options.input.empty())
+		{
+			RunBenchmark(options);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Tests the plugin's global key index outside of the game.
+// Each test file has a set of keys and a priority, and the resource manager's search is
+// simulated by asking the files from the newest to the oldest until one of them has the key.
+// The search that skips the files the index answers for must find the same file as the
+// search that asks every file.
+
+#include "GlobalKeyIndex.h"
+#include "MissingKeySamples.h"
+#include <cstdint>
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+	class TestResults
+	{
+	public:
+		void Check(bool condition, const char* description)
+		{
+			checkCount++;
+
+			if (!condition)
+			{
+				failureCount++;
+				std::printf("FAILED: %s\n", description);
+			}
+		}
+
+		size_t GetCheckCount() const
+		{
+			return checkCount;
+		}
+
+		size_t GetFailureCount() const
+		{
+			return failureCount;
+		}
+
+	private:
+		size_t checkCount = 0;
+		size_t failureCount = 0;
+	};
+
+	struct KeyHasher
+	{
+		size_t operator()(const cGZPersistResourceKey& key) const noexcept
+		{
+			return PersistResourceKeyHashers::TgiMapHasher()(key);
+		}
+	};
+
+	// A multi-packed file with a fixed set of keys.
+	struct TestFile
+	{
+		TestFile(std::vector<cGZPersistResourceKey>&& keys)
+			: priority(GlobalKeyIndex::GetInstance().AllocatePriority()),
+			  keys(keys.begin(), keys.end())
+		{
+		}
+
+		void AddToIndex() const
+		{
+			GlobalKeyIndex::GetInstance().AddFile(
+				priority,
+				keys.size(),
+				[this](const auto& addKey)
+				{
+					for (const cGZPersistResourceKey& key : keys)
+					{
+						addKey(key);
+					}
+				});
+		}
+
+		bool HasKey(const cGZPersistResourceKey& key) const
+		{
+			return keys.contains(key);
+		}
+
+		uint32_t priority;
+		std::unordered_set<cGZPersistResourceKey, KeyHasher> keys;
+	};
+
+	// Returns the priority of the file that the resource manager would load the key from,
+	// or GlobalKeyIndex::NoFile if no file has it. The files are in the resource manager's
+	// order, newest first.
+	uint32_t FindKey(const std::vector<TestFile*>& files, const cGZPersistResourceKey& key, bool useIndex)
+	{
+		for (const TestFile* file : files)
+		{
+			if (useIndex && !GlobalKeyIndex::GetInstance().MayContain(key, file->priority))
+			{
+				continue;
+			}
+
+			if (file->HasKey(key))
+			{
+				return file->priority;
+			}
+		}
+
+		return GlobalKeyIndex::NoFile;
+	}
+
+	bool SearchesMatch(const std::vector<TestFile*>& files, const std::vector<cGZPersistResourceKey>& keys)
+	{
+		for (const cGZPersistResourceKey& key : keys)
+		{
+			if (FindKey(files, key, true) != FindKey(files, key, false))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+int main()
+{
+	TestResults results;
+	GlobalKeyIndex& index = GlobalKeyIndex::GetInstance();
+
+	const cGZPersistResourceKey overriddenKey(0x6534284A, 0x12345678, 0x00000001);
+	const cGZPersistResourceKey olderOnlyKey(0x6534284A, 0x12345678, 0x00000002);
+	const cGZPersistResourceKey newerOnlyKey(0x6534284A, 0x12345678, 0x00000003);
+	// A second pair of files that override a key, they are added to the index newest first.
+	const cGZPersistResourceKey reverseOverriddenKey(0x6534284A, 0x12345678, 0x00000004);
+
+	// The files are opened oldest first, so the newer files have the higher priorities.
+	TestFile older({ overriddenKey, olderOnlyKey });
+	TestFile newer({ overriddenKey, newerOnlyKey });
+	TestFile reverseOlder({ reverseOverriddenKey });
+	TestFile reverseNewer({ reverseOverriddenKey });
+
+	results.Check(older.priority < newer.priority, "A file that is opened later has a higher priority");
+
+	older.AddToIndex();
+	newer.AddToIndex();
+	reverseNewer.AddToIndex();
+	reverseOlder.AddToIndex();
+
+	index.Enable(0.0);
+
+	// The resource manager asks the newest segment first.
+	const std::vector<TestFile*> files = { &reverseNewer, &reverseOlder, &newer, &older };
+
+	std::vector<cGZPersistResourceKey> keys = MissingKeySamples::Create(64);
+	keys.push_back(overriddenKey);
+	keys.push_back(olderOnlyKey);
+	keys.push_back(newerOnlyKey);
+	keys.push_back(reverseOverriddenKey);
+
+	results.Check(FindKey(files, overriddenKey, true) == newer.priority, "The overridden key is loaded from the newer file");
+	results.Check(
+		FindKey(files, reverseOverriddenKey, true) == reverseNewer.priority,
+		"The overridden key is loaded from the newer file when the newer file was indexed first");
+	results.Check(index.MayContain(overriddenKey, newer.priority), "The newer file is asked for the overridden key");
+	results.Check(!index.MayContain(olderOnlyKey, newer.priority), "The newer file is not asked for the older file's key");
+	results.Check(index.MayContain(olderOnlyKey, older.priority), "The older file is asked for its own key");
+	results.Check(
+		!index.MayContain(keys.front(), older.priority) && !index.MayContain(keys.front(), newer.priority),
+		"No file is asked for a missing key");
+	results.Check(SearchesMatch(files, keys), "The indexed search matches the full search");
+
+	// The game removes the overridden key from the newer file, the older file's copy is loaded.
+	newer.keys.erase(overriddenKey);
+	index.RemoveKey(overriddenKey, newer.priority);
+
+	results.Check(FindKey(files, overriddenKey, true) == older.priority, "The older file's copy is loaded after the removal");
+	results.Check(SearchesMatch(files, keys), "The indexed search matches the full search after the removal");
+
+	// The game adds the key back to the newer file.
+	newer.keys.insert(overriddenKey);
+	index.AddKey(overriddenKey, newer.priority);
+
+	results.Check(FindKey(files, overriddenKey, true) == newer.priority, "The newer file's copy is loaded after it is added back");
+	results.Check(SearchesMatch(files, keys), "The indexed search matches the full search after the key is added back");
+
+	std::printf("%zu checks, %zu failed.\n", results.GetCheckCount(), results.GetFailureCount());
+
+	return results.GetFailureCount() == 0 ? 0 : 1;
+}
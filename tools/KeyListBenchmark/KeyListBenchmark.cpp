@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Measures the IsPresent and Erase cost of IndexedResourceKeyList with and without its
+// hash index across a range of list sizes, this is used to pick the index threshold.
+// The linear search is also compared to the field by field loop that PersistResourceKeyList
+// used before the SSE2 instance search.
+
+#include "IndexedResourceKeyList.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	constexpr size_t LinearOnly = std::numeric_limits<size_t>::max();
+	constexpr size_t AlwaysIndexed = 0;
+
+	// The maximum number of keys that are looked up in each list, the linear search of
+	// the large lists would otherwise take minutes.
+	constexpr size_t MaxLookupCount = 4096;
+
+	size_t GetLookupStride(size_t keyCount)
+	{
+		return std::max<size_t>(1, keyCount / MaxLookupCount);
+	}
+
+	bool ScalarIsPresent(const std::vector<cGZPersistResourceKey>& keys, const cGZPersistResourceKey& key)
+	{
+		for (const cGZPersistResourceKey& entry : keys)
+		{
+			if (entry.instance == key.instance
+				&& entry.group == key.group
+				&& entry.type == key.type)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::vector<cGZPersistResourceKey> CreateKeys(std::mt19937_64& random, size_t count)
+	{
+		std::vector<cGZPersistResourceKey> keys;
+		keys.reserve(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			keys.emplace_back(static_cast<uint32_t>(random()), static_cast<uint32_t>(random()), static_cast<uint32_t>(random()));
+		}
+
+		return keys;
+	}
+
+	template<typename TFunc> double MeasureNanoseconds(TFunc&& func)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double MeasureScalarIsPresent(
+		const std::vector<cGZPersistResourceKey>& keys,
+		const std::vector<cGZPersistResourceKey>& missingKeys,
+		uint32_t repeatCount)
+	{
+		const size_t stride = GetLookupStride(keys.size());
+
+		size_t foundCount = 0;
+		size_t lookupCount = 0;
+		double total = 0;
+
+		for (uint32_t repeat = 0; repeat < repeatCount; repeat++)
+		{
+			total += MeasureNanoseconds([&]
+			{
+				for (size_t i = 0; i < keys.size(); i += stride)
+				{
+					foundCount += ScalarIsPresent(keys, keys[i]);
+					foundCount += ScalarIsPresent(keys, missingKeys[i]);
+					lookupCount++;
+				}
+			});
+		}
+
+		if (foundCount != lookupCount)
+		{
+			std::fprintf(stderr, "IsPresent returned the wrong result.\n");
+			std::exit(1);
+		}
+
+		return total / (static_cast<double>(lookupCount) * 2);
+	}
+
+	// Fills a list and then looks up its keys along with an equal number of
+	// missing keys, the index build is included in the time.
+	double MeasureIsPresent(
+		const std::vector<cGZPersistResourceKey>& keys,
+		const std::vector<cGZPersistResourceKey>& missingKeys,
+		size_t indexThreshold,
+		uint32_t repeatCount)
+	{
+		const size_t stride = GetLookupStride(keys.size());
+
+		size_t foundCount = 0;
+		size_t lookupCount = 0;
+		double total = 0;
+
+		for (uint32_t repeat = 0; repeat < repeatCount; repeat++)
+		{
+			IndexedResourceKeyList list(indexThreshold);
+
+			for (const cGZPersistResourceKey& key : keys)
+			{
+				list.Insert(key);
+			}
+
+			total += MeasureNanoseconds([&]
+			{
+				for (size_t i = 0; i < keys.size(); i += stride)
+				{
+					foundCount += list.IsPresent(keys[i]);
+					foundCount += list.IsPresent(missingKeys[i]);
+					lookupCount++;
+				}
+			});
+		}
+
+		if (foundCount != lookupCount)
+		{
+			std::fprintf(stderr, "IsPresent returned the wrong result.\n");
+			std::exit(1);
+		}
+
+		return total / (static_cast<double>(lookupCount) * 2);
+	}
+
+	// Fills a list and then erases all of its keys in a random order.
+	double MeasureErase(
+		const std::vector<cGZPersistResourceKey>& keys,
+		const std::vector<cGZPersistResourceKey>& eraseOrder,
+		size_t indexThreshold,
+		uint32_t repeatCount)
+	{
+		double total = 0;
+
+		for (uint32_t repeat = 0; repeat < repeatCount; repeat++)
+		{
+			IndexedResourceKeyList list(indexThreshold);
+
+			for (const cGZPersistResourceKey& key : keys)
+			{
+				list.Insert(key);
+			}
+
+			total += MeasureNanoseconds([&]
+			{
+				for (const cGZPersistResourceKey& key : eraseOrder)
+				{
+					list.Erase(key);
+				}
+			});
+
+			if (list.Size() != 0)
+			{
+				std::fprintf(stderr, "Erase did not remove all of the keys.\n");
+				std::exit(1);
+			}
+		}
+
+		return total / (static_cast<double>(keys.size()) * repeatCount);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t maxSize = 131072;
+
+	if (argc > 1)
+	{
+		maxSize = std::max<size_t>(4, std::strtoull(argv[1], nullptr, 10));
+	}
+
+	std::mt19937_64 random(1);
+
+	std::printf(
+		"%10s %16s %16s %16s %16s %16s\n",
+		"Keys",
+		"Scalar IsPresent",
+		"Linear IsPresent",
+		"Hashed IsPresent",
+		"Linear Erase",
+		"Hashed Erase");
+
+	size_t isPresentCrossover = 0;
+	size_t eraseCrossover = 0;
+
+	for (size_t size = 4; size <= maxSize; size *= 2)
+	{
+		const std::vector<cGZPersistResourceKey> keys = CreateKeys(random, size);
+		const std::vector<cGZPersistResourceKey> missingKeys = CreateKeys(random, size);
+
+		std::vector<cGZPersistResourceKey> eraseOrder = keys;
+		std::shuffle(eraseOrder.begin(), eraseOrder.end(), random);
+
+		// Repeat the small sizes so that every measurement covers a similar number of operations.
+		const uint32_t repeatCount = static_cast<uint32_t>(std::max<size_t>(1, 262144 / (size * size / 4 + size)));
+
+		const double scalarIsPresent = MeasureScalarIsPresent(keys, missingKeys, repeatCount);
+		const double linearIsPresent = MeasureIsPresent(keys, missingKeys, LinearOnly, repeatCount);
+		const double hashedIsPresent = MeasureIsPresent(keys, missingKeys, AlwaysIndexed, repeatCount);
+		const double linearErase = MeasureErase(keys, eraseOrder, LinearOnly, repeatCount);
+		const double hashedErase = MeasureErase(keys, eraseOrder, AlwaysIndexed, repeatCount);
+
+		if (isPresentCrossover == 0 && hashedIsPresent < linearIsPresent)
+		{
+			isPresentCrossover = size;
+		}
+
+		if (eraseCrossover == 0 && hashedErase < linearErase)
+		{
+			eraseCrossover = size;
+		}
+
+		std::printf(
+			"%10zu %13.1f ns %13.1f ns %13.1f ns %13.1f ns %13.1f ns\n",
+			size,
+			scalarIsPresent,
+			linearIsPresent,
+			hashedIsPresent,
+			linearErase,
+			hashedErase);
+	}
+
+	std::printf(
+		"\nThe hash index is faster from %zu keys for IsPresent and %zu keys for Erase, the default threshold is %zu.\n",
+		isPresentCrossover,
+		eraseCrossover,
+		IndexedResourceKeyList::DefaultIndexThreshold);
+	std::printf(
+		"The plugin's startup calibration picks a threshold of %zu keys on this machine.\n",
+		IndexedResourceKeyList::CalibrateIndexThreshold());
+
+	return 0;
+}
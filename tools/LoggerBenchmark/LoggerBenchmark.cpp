@@ -0,0 +1,314 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Measures the latency of the plugin's Logger calls when many threads write at once, with
+// the messages written directly to the file and with the AsyncLogging background writer.
+//
+// The Logger is a singleton that can only start its asynchronous writer once, so every
+// thread count is run in the synchronous mode first and then in the asynchronous mode.
+// Each message is tagged with its mode and thread count, the log file is read at the end
+// to count the messages that the asynchronous writer dropped.
+
+#include "Logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		std::filesystem::path logFile = std::filesystem::temp_directory_path() / "LoggerBenchmark.log";
+		uint32_t maxThreadCount = 32;
+		uint32_t messagesPerThread = 20000;
+		uint32_t intervalNanoseconds = 0;
+	};
+
+	struct RunResult
+	{
+		std::string tag;
+		uint32_t threadCount;
+		uint64_t messageCount;
+		// The call latency in nanoseconds of every message, across all of the threads.
+		std::vector<uint32_t> latencies;
+		double elapsedMilliseconds;
+	};
+
+	void WaitNanoseconds(uint32_t nanoseconds)
+	{
+		if (nanoseconds > 0)
+		{
+			const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(nanoseconds);
+
+			while (std::chrono::steady_clock::now() < end)
+			{
+			}
+		}
+	}
+
+	RunResult Run(const char* mode, uint32_t threadCount, const Options& options)
+	{
+		RunResult result;
+		result.tag = std::string(mode) + '/' + std::to_string(threadCount);
+		result.threadCount = threadCount;
+		result.messageCount = static_cast<uint64_t>(threadCount) * options.messagesPerThread;
+
+		std::vector<std::vector<uint32_t>> threadLatencies(threadCount);
+		std::atomic<uint32_t> readyCount = 0;
+		std::atomic<bool> start = false;
+
+		const auto producer = [&](uint32_t threadIndex)
+		{
+			std::vector<uint32_t>& latencies = threadLatencies[threadIndex];
+			latencies.reserve(options.messagesPerThread);
+
+			Logger& logger = Logger::GetInstance();
+
+			readyCount++;
+
+			while (!start.load(std::memory_order_acquire))
+			{
+			}
+
+			for (uint32_t i = 0; i < options.messagesPerThread; i++)
+			{
+				const auto callStart = std::chrono::steady_clock::now();
+
+				// A message in the style of the plugin's per-file log lines.
+				logger.WriteLineFormatted(
+					LogLevel::Info,
+					"[%s] Loaded C:\\Users\\Player\\Documents\\SimCity 4\\Plugins\\Folder%02u\\File%06u.dat in %u us.",
+					result.tag.c_str(),
+					threadIndex,
+					i,
+					i * 7);
+
+				latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callStart).count(),
+					UINT32_MAX)));
+
+				WaitNanoseconds(options.intervalNanoseconds);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount);
+
+		for (uint32_t i = 0; i < threadCount; i++)
+		{
+			threads.emplace_back(producer, i);
+		}
+
+		while (readyCount < threadCount)
+		{
+			std::this_thread::yield();
+		}
+
+		const auto runStart = std::chrono::steady_clock::now();
+		start.store(true, std::memory_order_release);
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		result.elapsedMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+
+		for (const std::vector<uint32_t>& latencies : threadLatencies)
+		{
+			result.latencies.insert(result.latencies.end(), latencies.begin(), latencies.end());
+		}
+
+		std::sort(result.latencies.begin(), result.latencies.end());
+
+		return result;
+	}
+
+	uint32_t GetPercentile(const std::vector<uint32_t>& sortedValues, double percentile)
+	{
+		const size_t index = static_cast<size_t>(percentile * static_cast<double>(sortedValues.size() - 1));
+
+		return sortedValues[index];
+	}
+
+	// Counts the messages of each run that reached the log file.
+	std::map<std::string, uint64_t, std::less<>> CountWrittenMessages(const std::filesystem::path& path)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		std::map<std::string, uint64_t, std::less<>> counts;
+		std::string line;
+
+		while (std::getline(stream, line))
+		{
+			if (line.starts_with('['))
+			{
+				const size_t end = line.find(']');
+
+				if (end != std::string::npos)
+				{
+					counts[line.substr(1, end - 1)]++;
+				}
+			}
+		}
+
+		return counts;
+	}
+
+	void PrintResults(const std::vector<RunResult>& results, const std::filesystem::path& logFile)
+	{
+		const std::map<std::string, uint64_t, std::less<>> writtenCounts = CountWrittenMessages(logFile);
+
+		std::printf(
+			"%-12s %8s %10s %10s %10s %10s %12s %10s\n",
+			"Mode",
+			"Threads",
+			"p50",
+			"p99",
+			"p99.9",
+			"Max",
+			"Messages/s",
+			"Dropped");
+
+		for (const RunResult& result : results)
+		{
+			const auto written = writtenCounts.find(result.tag);
+			const uint64_t writtenCount = written != writtenCounts.end() ? written->second : 0;
+
+			std::printf(
+				"%-12s %8u %7u ns %7u ns %7u ns %7u ns %12.0f %9.2f%%\n",
+				result.tag.substr(0, result.tag.find('/')).c_str(),
+				result.threadCount,
+				GetPercentile(result.latencies, 0.5),
+				GetPercentile(result.latencies, 0.99),
+				GetPercentile(result.latencies, 0.999),
+				result.latencies.back(),
+				static_cast<double>(result.messageCount) * 1000.0 / result.elapsedMilliseconds,
+				static_cast<double>(result.messageCount - std::min(writtenCount, result.messageCount)) * 100.0 / static_cast<double>(result.messageCount));
+		}
+	}
+
+	void RunBenchmark(const Options& options)
+	{
+		Logger& logger = Logger::GetInstance();
+		logger.Init(options.logFile, LogLevel::Info);
+		logger.WriteLogFileHeader("LoggerBenchmark");
+
+		std::vector<uint32_t> threadCounts;
+
+		for (uint32_t threadCount = 1; threadCount <= options.maxThreadCount; threadCount *= 2)
+		{
+			threadCounts.push_back(threadCount);
+		}
+
+		std::vector<RunResult> results;
+
+		for (const uint32_t threadCount : threadCounts)
+		{
+			results.push_back(Run("sync", threadCount, options));
+		}
+
+		logger.StartAsyncWriter();
+
+		for (const uint32_t threadCount : threadCounts)
+		{
+			results.push_back(Run("async", threadCount, options));
+
+			// Let the writer thread empty the buffer before the next run.
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		logger.Shutdown();
+
+		PrintResults(results, options.logFile);
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: LoggerBenchmark [options]\n"
+			"\n"
+			"Options:\n"
+			"  --log <file>            The log file that is written, defaults to LoggerBenchmark.log in the temp folder.\n"
+			"  --threads <count>       The largest number of producer threads, defaults to 32.\n"
+			"  --messages <count>      The number of messages each thread writes, defaults to 20000.\n"
+			"  --interval <ns>         The time each thread waits between its messages, defaults to 0.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+
+			if (argument.starts_with("--") && i + 1 >= argc)
+			{
+				return false;
+			}
+			else if (argument == "--log")
+			{
+				options.logFile = argv[++i];
+			}
+			else if (argument == "--threads")
+			{
+				options.maxThreadCount = static_cast<uint32_t>(std::clamp(std::atoi(argv[++i]), 1, 1024));
+			}
+			else if (argument == "--messages")
+			{
+				options.messagesPerThread = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+			}
+			else if (argument == "--interval")
+			{
+				options.intervalNanoseconds = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		RunBenchmark(options);
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Tests the index that the plugin's memory-backed segments build for the small files,
+// the DBPF files are built in memory.
+
+#include "MemoryDBSegmentIndex.h"
+#include "DBPFHeader.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const cGZPersistResourceKey DirectoryRecordKey(0xE86B1EEF, 0xE86B1EEF, 0x286B1F03);
+
+	class TestResults
+	{
+	public:
+		void Check(bool condition, const char* description)
+		{
+			checkCount++;
+
+			if (!condition)
+			{
+				failureCount++;
+				std::printf("FAILED: %s\n", description);
+			}
+		}
+
+		size_t GetCheckCount() const
+		{
+			return checkCount;
+		}
+
+		size_t GetFailureCount() const
+		{
+			return failureCount;
+		}
+
+	private:
+		size_t checkCount = 0;
+		size_t failureCount = 0;
+	};
+
+	struct TestRecord
+	{
+		cGZPersistResourceKey key;
+		std::vector<uint8_t> data;
+	};
+
+	void AppendUInt32(std::vector<uint8_t>& file, uint32_t value)
+	{
+		const size_t offset = file.size();
+
+		file.resize(offset + sizeof(value));
+		std::memcpy(file.data() + offset, &value, sizeof(value));
+	}
+
+	// Builds a DBPF 1.0 file with a 7.0 index, the records are stored in the order
+	// they are listed.
+	std::vector<uint8_t> BuildFile(const std::vector<TestRecord>& records)
+	{
+		std::vector<uint8_t> file(DBPFHeader::Size);
+		std::vector<uint32_t> offsets;
+
+		for (const TestRecord& record : records)
+		{
+			offsets.push_back(static_cast<uint32_t>(file.size()));
+			file.insert(file.end(), record.data.begin(), record.data.end());
+		}
+
+		DBPFHeader header{};
+		header.signature = DBPFHeader::Signature;
+		header.majorVersion = 1;
+		header.indexMajorVersion = 7;
+		header.indexEntryCount = static_cast<uint32_t>(records.size());
+		header.indexOffset = static_cast<uint32_t>(file.size());
+		header.indexSize = header.indexEntryCount * 5 * sizeof(uint32_t);
+
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const TestRecord& record = records[i];
+
+			AppendUInt32(file, record.key.type);
+			AppendUInt32(file, record.key.group);
+			AppendUInt32(file, record.key.instance);
+			AppendUInt32(file, offsets[i]);
+			AppendUInt32(file, static_cast<uint32_t>(record.data.size()));
+		}
+
+		std::memcpy(file.data(), &header, sizeof(header));
+
+		return file;
+	}
+
+	// Builds the directory record that lists the uncompressed size of a record.
+	TestRecord CreateDirectory(const cGZPersistResourceKey& key, uint32_t uncompressedSize)
+	{
+		TestRecord directory{ DirectoryRecordKey, {} };
+
+		AppendUInt32(directory.data, key.type);
+		AppendUInt32(directory.data, key.group);
+		AppendUInt32(directory.data, key.instance);
+		AppendUInt32(directory.data, uncompressedSize);
+
+		return directory;
+	}
+
+	void TestRecordsAreIndexed(TestResults& results)
+	{
+		const cGZPersistResourceKey first(1, 2, 3);
+		const cGZPersistResourceKey second(1, 2, 4);
+
+		const std::vector<uint8_t> file = BuildFile(
+		{
+			{ first, { 'a', 'b', 'c' } },
+			{ second, { 'd', 'e' } },
+		});
+
+		MemoryDBSegmentIndex index;
+
+		results.Check(index.Parse(file.data(), static_cast<uint32_t>(file.size())), "A valid file is parsed.");
+		results.Check(index.GetRecords().size() == 2, "Both records are indexed.");
+
+		const MemoryDBSegmentIndex::Record* const pFirst = index.Find(first);
+
+		results.Check(
+			pFirst && pFirst->size == 3 && pFirst->uncompressedSize == 3 && !pFirst->compressed,
+			"The first record has its stored size.");
+		results.Check(
+			pFirst && std::memcmp(pFirst->data, "abc", 3) == 0,
+			"The first record points at its data.");
+		results.Check(index.Find(cGZPersistResourceKey(1, 2, 5)) == nullptr, "A missing key is not found.");
+	}
+
+	void TestDirectoryMarksCompressedRecords(TestResults& results)
+	{
+		const cGZPersistResourceKey compressed(5, 6, 7);
+		const cGZPersistResourceKey uncompressed(5, 6, 8);
+
+		const std::vector<uint8_t> file = BuildFile(
+		{
+			{ compressed, { 1, 2, 3, 4 } },
+			{ uncompressed, { 5 } },
+			CreateDirectory(compressed, 100),
+		});
+
+		MemoryDBSegmentIndex index;
+
+		results.Check(index.Parse(file.data(), static_cast<uint32_t>(file.size())), "A file with a directory is parsed.");
+		results.Check(index.GetRecords().size() == 2, "The directory is not one of the records.");
+
+		const MemoryDBSegmentIndex::Record* const pCompressed = index.Find(compressed);
+
+		results.Check(
+			pCompressed && pCompressed->compressed && pCompressed->uncompressedSize == 100,
+			"The directory sets the uncompressed size of the compressed record.");
+
+		const MemoryDBSegmentIndex::Record* const pUncompressed = index.Find(uncompressed);
+
+		results.Check(
+			pUncompressed && !pUncompressed->compressed && pUncompressed->uncompressedSize == 1,
+			"A record that is not in the directory is not compressed.");
+	}
+
+	void TestDuplicateKeysAreRejected(TestResults& results)
+	{
+		const cGZPersistResourceKey key(9, 9, 9);
+
+		const std::vector<uint8_t> file = BuildFile(
+		{
+			{ key, { 1 } },
+			{ cGZPersistResourceKey(9, 9, 10), { 2 } },
+			{ key, { 3, 4 } },
+		});
+
+		MemoryDBSegmentIndex index;
+
+		// The game's packed file decides which copy it uses, so the file is left to it.
+		results.Check(!index.Parse(file.data(), static_cast<uint32_t>(file.size())), "A file that lists a key twice is rejected.");
+		results.Check(index.GetRecords().empty() && index.Find(key) == nullptr, "A rejected file has an empty index.");
+	}
+
+	void TestInvalidFilesAreRejected(TestResults& results)
+	{
+		std::vector<uint8_t> file = BuildFile({ { cGZPersistResourceKey(1, 1, 1), { 1, 2, 3 } } });
+
+		MemoryDBSegmentIndex index;
+
+		results.Check(!index.Parse(file.data(), DBPFHeader::Size - 1), "A file that is smaller than the header is rejected.");
+
+		// The record ends past the end of the truncated file.
+		const uint32_t recordOffset = DBPFHeader::Size;
+		const uint32_t indexOffset = recordOffset + 3;
+		const uint32_t largeSize = 1000;
+		std::memcpy(file.data() + indexOffset + 16, &largeSize, sizeof(largeSize));
+
+		results.Check(!index.Parse(file.data(), static_cast<uint32_t>(file.size())), "A record outside of the file is rejected.");
+
+		file[0] = 'X';
+
+		results.Check(!index.Parse(file.data(), static_cast<uint32_t>(file.size())), "A file without the DBPF signature is rejected.");
+	}
+}
+
+int main()
+{
+	TestResults results;
+
+	TestRecordsAreIndexed(results);
+	TestDirectoryMarksCompressedRecords(results);
+	TestDuplicateKeysAreRejected(results);
+	TestInvalidFilesAreRejected(results);
+
+	std::printf("%zu checks, %zu failed.\n", results.GetCheckCount(), results.GetFailureCount());
+
+	return results.GetFailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,656 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Benchmarks the multi-packed file index pipeline outside of the game: the plugin folder
+// enumeration, the DBPF segment opens, the MultiPackedFileIndex build, the key lookups
+// and the filtered record counts.
+//
+// The game's cGZDBSegmentPackedFile is replaced by FileSegment, which reads the DBPF
+// header and index with the C++ standard library.
+
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "MultiPackedFileIndex.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t ExemplarType = 0x6534284A;
+
+	struct Options
+	{
+		std::filesystem::path folder;
+		std::filesystem::path installationFolder;
+		bool sc4Files = false;
+		int iterations = 5;
+		uint32_t lookupCount = 1000000;
+		double missRate = 0.1;
+		uint64_t seed = 1;
+	};
+
+	// A stand-in for the game's DBPF segment, it has its own key index in the same
+	// way as cGZDBSegmentPackedFile.
+	class FileSegment
+	{
+	public:
+		struct IndexEntry
+		{
+			uint32_t offset;
+			uint32_t size;
+		};
+
+		explicit FileSegment(const std::filesystem::path& path) : path(path), keys(), entries()
+		{
+		}
+
+		bool Open()
+		{
+			std::ifstream stream(path, std::ios::binary);
+			std::error_code error;
+			const uint64_t fileSize = std::filesystem::file_size(path, error);
+
+			DBPFHeader header{};
+
+			if (error
+				|| !stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+				|| !DBPFIndexReader::IsValidHeader(header, fileSize))
+			{
+				return false;
+			}
+
+			std::vector<uint8_t> index(DBPFIndexReader::GetIndexSize(header));
+
+			stream.seekg(header.indexOffset);
+
+			if (!stream.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size())))
+			{
+				return false;
+			}
+
+			const DBPFIndexReader indexReader(header, index.data(), fileSize);
+
+			keys.reserve(indexReader.GetEntryCount());
+			entries.reserve(indexReader.GetEntryCount());
+
+			for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+			{
+				DBPFIndexReader::Entry entry{};
+
+				if (!indexReader.TryGetEntry(i, entry))
+				{
+					return false;
+				}
+
+				const cGZPersistResourceKey key(entry.type, entry.group, entry.instance);
+
+				keys.push_back(key);
+				entries.insert_or_assign(key, IndexEntry{ entry.offset, entry.size });
+			}
+
+			return true;
+		}
+
+		const std::vector<cGZPersistResourceKey>& GetKeys() const
+		{
+			return keys;
+		}
+
+		bool TestForRecord(const cGZPersistResourceKey& key) const
+		{
+			return entries.contains(key);
+		}
+
+	private:
+		std::filesystem::path path;
+		std::vector<cGZPersistResourceKey> keys;
+		boost::unordered::unordered_flat_map<const cGZPersistResourceKey, IndexEntry> entries;
+	};
+
+	std::string GetUpperCaseExtension(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+		return extension;
+	}
+
+	bool IsDatFile(const std::filesystem::path& path)
+	{
+		return GetUpperCaseExtension(path) == ".DAT";
+	}
+
+	bool IsSC4File(const std::filesystem::path& path)
+	{
+		const std::string extension = GetUpperCaseExtension(path);
+
+		return extension.empty() || extension.starts_with(".SC4");
+	}
+
+	// Enumerates the files in the same order as SC4DirectoryEnumerator, the files in a
+	// folder are returned before the files in its sub folders.
+	void EnumerateFiles(
+		const std::filesystem::path& folder,
+		bool (*predicate)(const std::filesystem::path&),
+		std::vector<std::filesystem::path>& files)
+	{
+		std::vector<std::filesystem::path> subFolders;
+		std::vector<std::filesystem::path> folderFiles;
+
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(folder))
+		{
+			if (entry.is_directory())
+			{
+				subFolders.push_back(entry.path());
+			}
+			else if (predicate(entry.path()))
+			{
+				folderFiles.push_back(entry.path());
+			}
+		}
+
+		// NTFS returns the names in sorted order, most Linux file systems do not.
+		std::sort(folderFiles.begin(), folderFiles.end());
+		std::sort(subFolders.begin(), subFolders.end());
+
+		files.insert(files.end(), folderFiles.begin(), folderFiles.end());
+
+		for (const std::filesystem::path& subFolder : subFolders)
+		{
+			EnumerateFiles(subFolder, predicate, files);
+		}
+	}
+
+	class StageTimes
+	{
+	public:
+		explicit StageTimes(const char* name) : name(name), milliseconds()
+		{
+		}
+
+		template<typename TFunc> void Measure(TFunc&& func)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			func();
+			milliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		void Print(const char* detail) const
+		{
+			std::vector<double> sorted = milliseconds;
+			std::sort(sorted.begin(), sorted.end());
+
+			std::printf("%-30s %10.3f %10.3f   %s\n", name, sorted.front(), sorted[sorted.size() / 2], detail);
+		}
+
+	private:
+		const char* name;
+		std::vector<double> milliseconds;
+	};
+
+	void RunBenchmark(const Options& options)
+	{
+		StageTimes enumerateTimes("Enumerate");
+		StageTimes openTimes("Open segments");
+		StageTimes buildTimes("Index build");
+		StageTimes reservedBuildTimes("Index build (pre-sized)");
+		StageTimes buildWithOverridesTimes("Index build (override counts)");
+		StageTimes hitLookupTimes("Lookups (index only)");
+		StageTimes segmentLookupTimes("Lookups (index and segment)");
+		StageTimes countTimes("Record count");
+		StageTimes filteredCountTimes("Filtered record count");
+
+		size_t fileCount = 0;
+		size_t segmentCount = 0;
+		size_t keyCount = 0;
+		uint32_t uniqueKeyCount = 0;
+		uint64_t overrideCount = 0;
+		uint64_t hitCount = 0;
+		uint32_t filteredCount = 0;
+
+		for (int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			std::vector<std::filesystem::path> files;
+
+			enumerateTimes.Measure([&]
+			{
+				EnumerateFiles(options.folder, options.sc4Files ? IsSC4File : IsDatFile, files);
+			});
+
+			std::vector<std::unique_ptr<FileSegment>> segments;
+
+			openTimes.Measure([&]
+			{
+				for (const std::filesystem::path& path : files)
+				{
+					auto segment = std::make_unique<FileSegment>(path);
+
+					if (segment->Open())
+					{
+						segments.push_back(std::move(segment));
+					}
+				}
+			});
+
+			MultiPackedFileIndex<FileSegment> index;
+
+			buildTimes.Measure([&]
+			{
+				for (const auto& segment : segments)
+				{
+					index.AddSegment(segment.get(), segment->GetKeys());
+				}
+			});
+
+			MultiPackedFileIndex<FileSegment> reservedIndex;
+
+			reservedBuildTimes.Measure([&]
+			{
+				// Open sizes tgiMap from the segment record counts before merging the keys.
+				size_t totalKeyCount = 0;
+
+				for (const auto& segment : segments)
+				{
+					totalKeyCount += segment->GetKeys().size();
+				}
+
+				reservedIndex.Reserve(totalKeyCount);
+
+				for (const auto& segment : segments)
+				{
+					reservedIndex.AddSegment(segment.get(), segment->GetKeys());
+				}
+			});
+
+			MultiPackedFileIndex<FileSegment> indexWithOverrides;
+			overrideCount = 0;
+
+			buildWithOverridesTimes.Measure([&]
+			{
+				for (const auto& segment : segments)
+				{
+					indexWithOverrides.AddSegment(segment.get(), segment->GetKeys(), [&](FileSegment*) { overrideCount++; });
+				}
+			});
+
+			// The lookup keys are a mix of keys in the index and random keys that are
+			// almost certainly not in it.
+			std::vector<cGZPersistResourceKey> lookupKeys;
+			lookupKeys.reserve(options.lookupCount);
+
+			std::mt19937_64 random(options.seed);
+
+			keyCount = 0;
+
+			for (const auto& segment : segments)
+			{
+				keyCount += segment->GetKeys().size();
+			}
+
+			for (uint32_t i = 0; i < options.lookupCount; i++)
+			{
+				const bool miss = keyCount == 0 || static_cast<double>(random() >> 11) * (1.0 / 9007199254740992.0) < options.missRate;
+
+				if (miss)
+				{
+					lookupKeys.emplace_back(static_cast<uint32_t>(random()), static_cast<uint32_t>(random()), static_cast<uint32_t>(random()));
+				}
+				else
+				{
+					const FileSegment& segment = *segments[random() % segments.size()];
+
+					if (segment.GetKeys().empty())
+					{
+						lookupKeys.emplace_back(0, 0, 0);
+					}
+					else
+					{
+						lookupKeys.push_back(segment.GetKeys()[random() % segment.GetKeys().size()]);
+					}
+				}
+			}
+
+			hitLookupTimes.Measure([&]
+			{
+				hitCount = 0;
+
+				for (const cGZPersistResourceKey& key : lookupKeys)
+				{
+					if (index.Find(key))
+					{
+						hitCount++;
+					}
+				}
+			});
+
+			segmentLookupTimes.Measure([&]
+			{
+				uint64_t foundCount = 0;
+
+				for (const cGZPersistResourceKey& key : lookupKeys)
+				{
+					const FileSegment* const segment = index.Find(key);
+
+					if (segment && segment->TestForRecord(key))
+					{
+						foundCount++;
+					}
+				}
+
+				if (foundCount != hitCount)
+				{
+					throw std::runtime_error("The segment lookups did not match the index lookups.");
+				}
+			});
+
+			countTimes.Measure([&]
+			{
+				uniqueKeyCount = index.GetCount();
+			});
+
+			filteredCountTimes.Measure([&]
+			{
+				filteredCount = index.GetCount([](const cGZPersistResourceKey& key) { return key.type == ExemplarType; });
+			});
+
+			fileCount = files.size();
+			segmentCount = segments.size();
+		}
+
+		std::printf(
+			"%zu files, %zu opened segments, %zu index entries, %u unique keys, %llu overridden keys.\n"
+			"%u lookups per iteration, %.1f%% hit rate. %d iterations.\n\n",
+			fileCount,
+			segmentCount,
+			keyCount,
+			uniqueKeyCount,
+			static_cast<unsigned long long>(overrideCount),
+			options.lookupCount,
+			options.lookupCount > 0 ? 100.0 * static_cast<double>(hitCount) / options.lookupCount : 0.0,
+			options.iterations);
+
+		std::printf("%-30s %10s %10s\n", "Stage", "Min ms", "Median ms");
+
+		char detail[128];
+
+		enumerateTimes.Print("");
+		openTimes.Print("");
+		buildTimes.Print("");
+		reservedBuildTimes.Print("");
+		buildWithOverridesTimes.Print("");
+
+		std::snprintf(detail, sizeof(detail), "%u lookups", options.lookupCount);
+		hitLookupTimes.Print(detail);
+		segmentLookupTimes.Print(detail);
+
+		countTimes.Print("");
+
+		std::snprintf(detail, sizeof(detail), "%u exemplars", filteredCount);
+		filteredCountTimes.Print(detail);
+	}
+
+	std::vector<std::unique_ptr<FileSegment>> OpenSegments(const Options& options, const std::filesystem::path& folder)
+	{
+		std::vector<std::filesystem::path> files;
+		EnumerateFiles(folder, options.sc4Files ? IsSC4File : IsDatFile, files);
+
+		std::vector<std::unique_ptr<FileSegment>> segments;
+
+		for (const std::filesystem::path& path : files)
+		{
+			auto segment = std::make_unique<FileSegment>(path);
+
+			if (segment->Open())
+			{
+				segments.push_back(std::move(segment));
+			}
+		}
+
+		return segments;
+	}
+
+	// A multi-packed file's index and the critical section that each lookup takes.
+	struct LockedIndex
+	{
+		MultiPackedFileIndex<FileSegment> index;
+		std::mutex mutex;
+
+		const FileSegment* Find(const cGZPersistResourceKey& key)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			return index.Find(key);
+		}
+	};
+
+	// Compares the lookup cost of the separate installation and user Plugins folder
+	// segments with one segment that indexes both folders.
+	void RunCombinedFolderBenchmark(const Options& options)
+	{
+		const std::vector<std::unique_ptr<FileSegment>> installationSegments = OpenSegments(options, options.installationFolder);
+		const std::vector<std::unique_ptr<FileSegment>> userSegments = OpenSegments(options, options.folder);
+
+		LockedIndex installationIndex;
+		LockedIndex userIndex;
+		LockedIndex combinedIndex;
+
+		for (const auto& segment : installationSegments)
+		{
+			installationIndex.index.AddSegment(segment.get(), segment->GetKeys());
+			combinedIndex.index.AddSegment(segment.get(), segment->GetKeys());
+		}
+
+		// The user folder is added last, so its files override the installation folder.
+		for (const auto& segment : userSegments)
+		{
+			userIndex.index.AddSegment(segment.get(), segment->GetKeys());
+			combinedIndex.index.AddSegment(segment.get(), segment->GetKeys());
+		}
+
+		std::vector<const FileSegment*> allSegments;
+
+		for (const auto& segment : installationSegments)
+		{
+			allSegments.push_back(segment.get());
+		}
+
+		for (const auto& segment : userSegments)
+		{
+			allSegments.push_back(segment.get());
+		}
+
+		std::vector<cGZPersistResourceKey> lookupKeys;
+		lookupKeys.reserve(options.lookupCount);
+
+		std::mt19937_64 random(options.seed);
+
+		for (uint32_t i = 0; i < options.lookupCount; i++)
+		{
+			const bool miss = allSegments.empty() || static_cast<double>(random() >> 11) * (1.0 / 9007199254740992.0) < options.missRate;
+
+			if (miss)
+			{
+				lookupKeys.emplace_back(static_cast<uint32_t>(random()), static_cast<uint32_t>(random()), static_cast<uint32_t>(random()));
+			}
+			else
+			{
+				const FileSegment& segment = *allSegments[random() % allSegments.size()];
+
+				if (segment.GetKeys().empty())
+				{
+					lookupKeys.emplace_back(0, 0, 0);
+				}
+				else
+				{
+					lookupKeys.push_back(segment.GetKeys()[random() % segment.GetKeys().size()]);
+				}
+			}
+		}
+
+		StageTimes separateTimes("Lookups (two folder segments)");
+		StageTimes combinedTimes("Lookups (combined segment)");
+
+		std::vector<const FileSegment*> separateResults(lookupKeys.size());
+		std::vector<const FileSegment*> combinedResults(lookupKeys.size());
+
+		for (int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			// The resource manager searches the most recently registered segment first,
+			// which is the user Plugins folder.
+			separateTimes.Measure([&]
+			{
+				for (size_t i = 0; i < lookupKeys.size(); i++)
+				{
+					const FileSegment* segment = userIndex.Find(lookupKeys[i]);
+
+					if (!segment)
+					{
+						segment = installationIndex.Find(lookupKeys[i]);
+					}
+
+					separateResults[i] = segment;
+				}
+			});
+
+			combinedTimes.Measure([&]
+			{
+				for (size_t i = 0; i < lookupKeys.size(); i++)
+				{
+					combinedResults[i] = combinedIndex.Find(lookupKeys[i]);
+				}
+			});
+		}
+
+		if (separateResults != combinedResults)
+		{
+			throw std::runtime_error("The combined segment lookups did not match the separate folder lookups.");
+		}
+
+		std::printf(
+			"\n%zu installation folder segments, %zu user folder segments, %u unique keys in the combined index.\n\n",
+			installationSegments.size(),
+			userSegments.size(),
+			combinedIndex.index.GetCount());
+
+		std::printf("%-30s %10s %10s\n", "Stage", "Min ms", "Median ms");
+
+		char detail[128];
+		std::snprintf(detail, sizeof(detail), "%u lookups", options.lookupCount);
+
+		separateTimes.Print(detail);
+		combinedTimes.Print(detail);
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: MultiPackedFileBenchmark <plugin folder> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --sc4-files             Loads the .SC4* files instead of the .dat files.\n"
+			"  --installation-folder <folder>\n"
+			"                          Compares the lookups of separate segments for this folder and the plugin\n"
+			"                          folder with one segment that indexes both folders.\n"
+			"  --iterations <count>    The number of times each stage is run, defaults to 5.\n"
+			"  --lookups <count>       The number of key lookups per iteration, defaults to 1000000.\n"
+			"  --miss-rate <value>     The fraction of lookups for keys that are not in the index, defaults to 0.1.\n"
+			"  --seed <value>          The random seed for the lookup keys, defaults to 1.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+
+			if (argument == "--sc4-files")
+			{
+				options.sc4Files = true;
+			}
+			else if (argument.starts_with("--") && i + 1 >= argc)
+			{
+				return false;
+			}
+			else if (argument == "--installation-folder")
+			{
+				options.installationFolder = argv[++i];
+			}
+			else if (argument == "--iterations")
+			{
+				options.iterations = std::max(1, std::atoi(argv[++i]));
+			}
+			else if (argument == "--lookups")
+			{
+				options.lookupCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--miss-rate")
+			{
+				options.missRate = std::strtod(argv[++i], nullptr);
+			}
+			else if (argument == "--seed")
+			{
+				options.seed = std::strtoull(argv[++i], nullptr, 0);
+			}
+			else if (options.folder.empty() && !argument.starts_with("--"))
+			{
+				options.folder = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return !options.folder.empty();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		RunBenchmark(options);
+
+		if (!options.installationFolder.empty())
+		{
+			RunCombinedFolderBenchmark(options);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,490 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Replays the per-file open costs that the plugin records in SC4DBPFLoadingOpenCosts.txt
+// to compare the ways the parallel segment open can schedule the files across its threads.
+//
+// The simulation uses the same dynamic work queue as BaseMultiPackedFile::OpenCreatedSegments,
+// each thread takes the next file in the schedule when it finishes its current file. Only the
+// schedule order changes between the strategies. The random values are generated with
+// std::mt19937_64 and distribution code in this file because the standard library
+// distributions are implementation defined.
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	// The cost that SegmentOpenCostHistory returns for the files that are not in the history.
+	constexpr uint32_t UnknownCost = UINT32_MAX;
+
+	struct Options
+	{
+		std::filesystem::path profile;
+		std::filesystem::path estimatesProfile;
+		uint32_t syntheticFileCount = 0;
+		uint32_t maxThreadCount = 16;
+		double noise = 0;
+		uint64_t seed = 1;
+	};
+
+	struct FileCost
+	{
+		std::string path;
+		// The open time in microseconds for the replayed run.
+		uint32_t cost;
+		// The open time from the previous run, which the plugin schedules with.
+		uint32_t estimatedCost;
+	};
+
+	double NextDouble(std::mt19937_64& random)
+	{
+		return static_cast<double>(random() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double NextNormal(std::mt19937_64& random)
+	{
+		// The Box-Muller transform.
+		const double u1 = std::max(NextDouble(random), 1e-12);
+		const double u2 = NextDouble(random);
+
+		return std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+	}
+
+	// Reads a cost profile in the SegmentOpenCostHistory format, one file per line:
+	// <open time in microseconds><tab><file path>
+	std::unordered_map<std::string, uint32_t> ReadProfile(const std::filesystem::path& path)
+	{
+		std::ifstream stream(path, std::ios::binary);
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to open " + path.string());
+		}
+
+		std::unordered_map<std::string, uint32_t> costs;
+		std::string line;
+
+		while (std::getline(stream, line))
+		{
+			std::string_view lineView(line);
+
+			if (lineView.ends_with('\r'))
+			{
+				lineView.remove_suffix(1);
+			}
+
+			const size_t separatorIndex = lineView.find('\t');
+
+			if (separatorIndex != std::string_view::npos && separatorIndex < (lineView.size() - 1))
+			{
+				uint32_t cost = 0;
+
+				const char* const costStart = lineView.data();
+				const char* const costEnd = costStart + separatorIndex;
+
+				const std::from_chars_result result = std::from_chars(costStart, costEnd, cost);
+
+				if (result.ec == std::errc() && result.ptr == costEnd)
+				{
+					costs.insert_or_assign(std::string(lineView.substr(separatorIndex + 1)), cost);
+				}
+			}
+		}
+
+		return costs;
+	}
+
+	bool IsDirectorySeparator(char c)
+	{
+		return c == '\\' || c == '/';
+	}
+
+	std::vector<std::string_view> SplitPath(std::string_view path)
+	{
+		std::vector<std::string_view> components;
+		size_t start = 0;
+
+		for (size_t i = 0; i <= path.size(); i++)
+		{
+			if (i == path.size() || IsDirectorySeparator(path[i]))
+			{
+				if (i > start)
+				{
+					components.push_back(path.substr(start, i - start));
+				}
+
+				start = i + 1;
+			}
+		}
+
+		return components;
+	}
+
+	int CompareIgnoreCase(std::string_view lhs, std::string_view rhs)
+	{
+		const size_t length = std::min(lhs.size(), rhs.size());
+
+		for (size_t i = 0; i < length; i++)
+		{
+			const int l = std::toupper(static_cast<unsigned char>(lhs[i]));
+			const int r = std::toupper(static_cast<unsigned char>(rhs[i]));
+
+			if (l != r)
+			{
+				return l - r;
+			}
+		}
+
+		return static_cast<int>(lhs.size()) - static_cast<int>(rhs.size());
+	}
+
+	// The history file is sorted by path, the files are put back in the order that
+	// SC4DirectoryEnumerator scans them: the files in a folder are returned before the
+	// files in its sub folders, and each level is in the NTFS name order.
+	bool IsBeforeInScanOrder(const std::string& lhsPath, const std::string& rhsPath)
+	{
+		const std::vector<std::string_view> lhs = SplitPath(lhsPath);
+		const std::vector<std::string_view> rhs = SplitPath(rhsPath);
+
+		for (size_t i = 0; i < lhs.size() && i < rhs.size(); i++)
+		{
+			const bool lhsIsFile = i == lhs.size() - 1;
+			const bool rhsIsFile = i == rhs.size() - 1;
+
+			if (lhsIsFile != rhsIsFile)
+			{
+				return lhsIsFile;
+			}
+
+			const int result = CompareIgnoreCase(lhs[i], rhs[i]);
+
+			if (result != 0)
+			{
+				return result < 0;
+			}
+		}
+
+		return lhs.size() < rhs.size();
+	}
+
+	std::vector<FileCost> LoadFiles(const Options& options)
+	{
+		const std::unordered_map<std::string, uint32_t> costs = ReadProfile(options.profile);
+		std::unordered_map<std::string, uint32_t> estimates;
+
+		if (!options.estimatesProfile.empty())
+		{
+			estimates = ReadProfile(options.estimatesProfile);
+		}
+
+		std::mt19937_64 random(options.seed);
+		std::vector<FileCost> files;
+		files.reserve(costs.size());
+
+		for (const auto& [path, cost] : costs)
+		{
+			uint32_t estimatedCost = cost;
+
+			if (!options.estimatesProfile.empty())
+			{
+				const auto estimate = estimates.find(path);
+				estimatedCost = estimate != estimates.end() ? estimate->second : UnknownCost;
+			}
+
+			files.push_back(FileCost{ path, cost, estimatedCost });
+		}
+
+		std::sort(files.begin(), files.end(), [](const FileCost& lhs, const FileCost& rhs) { return IsBeforeInScanOrder(lhs.path, rhs.path); });
+
+		if (options.noise > 0)
+		{
+			// The replayed run differs from the previous run by a log-normal factor,
+			// this models the variation of the file cache and the disk between runs.
+			for (FileCost& file : files)
+			{
+				file.cost = static_cast<uint32_t>(std::min(
+					static_cast<double>(file.cost) * std::exp(options.noise * NextNormal(random)),
+					static_cast<double>(UnknownCost - 1)));
+			}
+		}
+
+		return files;
+	}
+
+	// A plugin folder where most files are small and a few texture packs take hundreds
+	// of milliseconds, with the largest packs near the end of the scan order.
+	std::vector<FileCost> CreateSyntheticFiles(const Options& options)
+	{
+		std::mt19937_64 random(options.seed);
+		std::vector<FileCost> files;
+		files.reserve(options.syntheticFileCount);
+
+		for (uint32_t i = 0; i < options.syntheticFileCount; i++)
+		{
+			// A Pareto distribution with a median around 600 microseconds.
+			const double cost = 400.0 / std::pow(std::max(NextDouble(random), 1e-9), 1.0 / 1.2);
+
+			char path[64]{};
+			std::snprintf(path, sizeof(path), "Plugins\\File%06u.dat", i);
+
+			const uint32_t roundedCost = static_cast<uint32_t>(std::min(cost, 2000000.0));
+
+			files.push_back(FileCost{ path, roundedCost, roundedCost });
+		}
+
+		// The 3 largest files are moved to the end, as a z_ prefixed texture pack would be.
+		std::vector<size_t> bySize(files.size());
+		std::iota(bySize.begin(), bySize.end(), 0);
+		std::sort(bySize.begin(), bySize.end(), [&files](size_t lhs, size_t rhs) { return files[lhs].cost > files[rhs].cost; });
+
+		for (size_t i = 0; i < std::min<size_t>(3, bySize.size()); i++)
+		{
+			std::swap(files[bySize[i]].cost, files[files.size() - 1 - i].cost);
+		}
+
+		for (FileCost& file : files)
+		{
+			file.estimatedCost = file.cost;
+		}
+
+		if (options.noise > 0)
+		{
+			for (FileCost& file : files)
+			{
+				file.cost = static_cast<uint32_t>(static_cast<double>(file.cost) * std::exp(options.noise * NextNormal(random)));
+			}
+		}
+
+		return files;
+	}
+
+	// Runs the dynamic work queue, and returns the time that the last thread finishes.
+	uint64_t Simulate(const std::vector<FileCost>& files, const std::vector<uint32_t>& schedule, uint32_t threadCount)
+	{
+		std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> threadFreeTimes;
+
+		for (uint32_t i = 0; i < threadCount; i++)
+		{
+			threadFreeTimes.push(0);
+		}
+
+		uint64_t makespan = 0;
+
+		for (const uint32_t fileIndex : schedule)
+		{
+			const uint64_t start = threadFreeTimes.top();
+			threadFreeTimes.pop();
+
+			const uint64_t end = start + files[fileIndex].cost;
+			makespan = std::max(makespan, end);
+
+			threadFreeTimes.push(end);
+		}
+
+		return makespan;
+	}
+
+	std::vector<uint32_t> CreateScanOrderSchedule(const std::vector<FileCost>& files)
+	{
+		std::vector<uint32_t> schedule(files.size());
+		std::iota(schedule.begin(), schedule.end(), 0);
+
+		return schedule;
+	}
+
+	// The schedule that OpenCreatedSegments uses, the files that are not in the history
+	// are treated as the most expensive and the ties are kept in the scan order.
+	std::vector<uint32_t> CreateLongestFirstSchedule(const std::vector<FileCost>& files)
+	{
+		std::vector<uint32_t> schedule = CreateScanOrderSchedule(files);
+
+		std::stable_sort(
+			schedule.begin(),
+			schedule.end(),
+			[&files](uint32_t lhs, uint32_t rhs) { return files[lhs].estimatedCost > files[rhs].estimatedCost; });
+
+		return schedule;
+	}
+
+	// The schedule that would be used if the costs of the replayed run were known in advance.
+	std::vector<uint32_t> CreateOracleSchedule(const std::vector<FileCost>& files)
+	{
+		std::vector<uint32_t> schedule = CreateScanOrderSchedule(files);
+
+		std::stable_sort(
+			schedule.begin(),
+			schedule.end(),
+			[&files](uint32_t lhs, uint32_t rhs) { return files[lhs].cost > files[rhs].cost; });
+
+		return schedule;
+	}
+
+	double ToMilliseconds(uint64_t microseconds)
+	{
+		return static_cast<double>(microseconds) / 1000.0;
+	}
+
+	void RunSimulation(const std::vector<FileCost>& files, const Options& options)
+	{
+		if (files.empty())
+		{
+			throw std::runtime_error("The cost profile does not contain any files.");
+		}
+
+		uint64_t totalCost = 0;
+		uint32_t maxCost = 0;
+		size_t unknownCount = 0;
+
+		for (const FileCost& file : files)
+		{
+			totalCost += file.cost;
+			maxCost = std::max(maxCost, file.cost);
+
+			if (file.estimatedCost == UnknownCost)
+			{
+				unknownCount++;
+			}
+		}
+
+		std::printf(
+			"%zu files, %.1f ms total open time, the largest file takes %.1f ms, %zu files are not in the previous run.\n\n",
+			files.size(),
+			ToMilliseconds(totalCost),
+			ToMilliseconds(maxCost),
+			unknownCount);
+
+		const std::vector<uint32_t> scanOrder = CreateScanOrderSchedule(files);
+		const std::vector<uint32_t> longestFirst = CreateLongestFirstSchedule(files);
+		const std::vector<uint32_t> oracle = CreateOracleSchedule(files);
+
+		std::printf("%8s %14s %14s %14s %14s %10s\n", "Threads", "Scan order", "Longest first", "Known costs", "Lower bound", "Speedup");
+
+		for (uint32_t threadCount = 1; threadCount <= options.maxThreadCount; threadCount *= 2)
+		{
+			const uint64_t scanOrderTime = Simulate(files, scanOrder, threadCount);
+			const uint64_t longestFirstTime = Simulate(files, longestFirst, threadCount);
+			const uint64_t oracleTime = Simulate(files, oracle, threadCount);
+			const uint64_t lowerBound = std::max<uint64_t>(maxCost, (totalCost + threadCount - 1) / threadCount);
+
+			std::printf(
+				"%8u %11.1f ms %11.1f ms %11.1f ms %11.1f ms %9.2fx\n",
+				threadCount,
+				ToMilliseconds(scanOrderTime),
+				ToMilliseconds(longestFirstTime),
+				ToMilliseconds(oracleTime),
+				ToMilliseconds(lowerBound),
+				static_cast<double>(scanOrderTime) / static_cast<double>(std::max<uint64_t>(1, longestFirstTime)));
+		}
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: OpenScheduleSimulator <cost profile> [options]\n"
+			"       OpenScheduleSimulator --synthetic <file count> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --estimates <profile>   The cost profile of the previous run, which the longest first schedule is\n"
+			"                          built from. Defaults to the replayed profile, i.e. the costs are unchanged.\n"
+			"  --synthetic <count>     Simulates a generated plugin folder with the specified number of files.\n"
+			"  --noise <sigma>         Varies the replayed costs by a log-normal factor with this sigma, defaults to 0.\n"
+			"  --threads <count>       The largest thread count that is simulated, defaults to 16.\n"
+			"  --seed <value>          The random seed for the synthetic costs and the noise, defaults to 1.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+
+			if (argument.starts_with("--") && i + 1 >= argc)
+			{
+				return false;
+			}
+			else if (argument == "--estimates")
+			{
+				options.estimatesProfile = argv[++i];
+			}
+			else if (argument == "--synthetic")
+			{
+				options.syntheticFileCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (argument == "--noise")
+			{
+				options.noise = std::max(0.0, std::strtod(argv[++i], nullptr));
+			}
+			else if (argument == "--threads")
+			{
+				options.maxThreadCount = static_cast<uint32_t>(std::clamp(std::atoi(argv[++i]), 1, 256));
+			}
+			else if (argument == "--seed")
+			{
+				options.seed = std::strtoull(argv[++i], nullptr, 0);
+			}
+			else if (options.profile.empty() && !argument.starts_with("--"))
+			{
+				options.profile = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return options.profile.empty() != (options.syntheticFileCount == 0);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		const std::vector<FileCost> files = options.syntheticFileCount > 0
+			? CreateSyntheticFiles(options)
+			: LoadFiles(options);
+
+		RunSimulation(files, options);
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
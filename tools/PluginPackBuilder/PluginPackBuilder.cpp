@@ -0,0 +1,684 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Builds the consolidated plugin pack that the plugin's PluginPacks setting loads.
+//
+// The effective records of a plugin folder's .dat files, the records that remain after the
+// later files have overridden the earlier ones, are copied into one DBPF file with a sorted
+// index, see PluginPackFormat.h. The compressed records are copied without being decompressed.
+// When a resource access trace is provided, the records are laid out in the order that the
+// game first read them.
+
+#include "../../src/DBPFHeader.h"
+#include "../../src/DBPFIndexReader.h"
+#include "../../src/PluginPackFormat.h"
+#include "../../src/ResourceAccessTraceFormat.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace PluginPackFormat;
+
+namespace
+{
+	typedef std::tuple<uint32_t, uint32_t, uint32_t> Key;
+
+	const Key InfoRecordKey(InfoRecordType, InfoRecordGroup, InfoRecordInstance);
+	const Key DirectoryRecordKey(DirectoryRecordType, DirectoryRecordGroup, DirectoryRecordInstance);
+
+	struct Options
+	{
+		std::filesystem::path folder;
+		std::filesystem::path outputPath;
+		std::filesystem::path accessTracePath;
+	};
+
+	struct SourceFileInfo
+	{
+		std::filesystem::path path;
+		std::string relativePath;
+		uint64_t size = 0;
+		int64_t lastWriteTime = 0;
+	};
+
+	struct Record
+	{
+		uint32_t fileIndex;
+		uint32_t offset;
+		uint32_t size;
+		uint32_t uncompressedSize;
+		bool compressed;
+		// The position of the record in the source file order, used for the records
+		// that are not in the access trace.
+		uint64_t sourceOrder;
+		bool inAccessOrder;
+		uint64_t packOffset;
+	};
+
+	struct BuildStatistics
+	{
+		uint32_t skippedFileCount = 0;
+		uint64_t overriddenRecordCount = 0;
+		uint32_t compressedRecordCount = 0;
+		uint32_t accessOrderedRecordCount = 0;
+	};
+
+	template<typename T> void ReadValue(std::istream& stream, T& value)
+	{
+		if (!stream.read(reinterpret_cast<char*>(&value), sizeof(value)))
+		{
+			throw std::runtime_error("Unexpected end of file.");
+		}
+	}
+
+	template<typename T> void WriteValue(std::ostream& stream, const T& value)
+	{
+		stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	std::string ToUpperCase(const std::string& value)
+	{
+		std::string result = value;
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+		return result;
+	}
+
+	bool IsDatFile(const std::filesystem::path& path)
+	{
+		return ToUpperCase(path.extension().string()) == ".DAT";
+	}
+
+	// NTFS returns the names in upper case ordinal order, the pack must list the files
+	// in the same order as the plugin's scan for the loader to accept it.
+	bool FileNameLess(const std::filesystem::path& left, const std::filesystem::path& right)
+	{
+		return ToUpperCase(left.filename().string()) < ToUpperCase(right.filename().string());
+	}
+
+	// Enumerates the files in the same order as SC4DirectoryEnumerator, the files in a
+	// folder are returned before the files in its sub folders.
+	void EnumerateDatFiles(const std::filesystem::path& folder, std::vector<std::filesystem::path>& files)
+	{
+		std::vector<std::filesystem::path> subFolders;
+		std::vector<std::filesystem::path> folderFiles;
+
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(folder))
+		{
+			if (entry.is_directory())
+			{
+				subFolders.push_back(entry.path());
+			}
+			else if (entry.is_regular_file() && IsDatFile(entry.path()))
+			{
+				folderFiles.push_back(entry.path());
+			}
+		}
+
+		std::sort(folderFiles.begin(), folderFiles.end(), FileNameLess);
+		std::sort(subFolders.begin(), subFolders.end(), FileNameLess);
+
+		files.insert(files.end(), folderFiles.begin(), folderFiles.end());
+
+		for (const std::filesystem::path& subFolder : subFolders)
+		{
+			EnumerateDatFiles(subFolder, files);
+		}
+	}
+
+	SourceFileInfo GetSourceFileInfo(const std::filesystem::path& folder, const std::filesystem::path& path)
+	{
+		SourceFileInfo info;
+		info.path = path;
+		info.size = std::filesystem::file_size(path);
+
+		const auto lastWriteTime = std::chrono::file_clock::to_sys(std::filesystem::last_write_time(path));
+		info.lastWriteTime = std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(
+			lastWriteTime.time_since_epoch()).count();
+
+		const std::u8string relativePath = path.lexically_relative(folder).generic_u8string();
+		info.relativePath.assign(relativePath.begin(), relativePath.end());
+		std::replace(info.relativePath.begin(), info.relativePath.end(), '/', '\\');
+
+		return info;
+	}
+
+	// Reads the uncompressed size from the QFS header of a record that the directory lists
+	// as compressed. The header is used instead of the directory, which cannot tell the
+	// entries apart when a file has more than one entry for a key.
+	bool ReadQfsUncompressedSize(std::ifstream& stream, const Record& record, uint32_t& uncompressedSize)
+	{
+		constexpr uint8_t QfsSignature = 0xFB;
+		constexpr uint8_t LargeSizesFlag = 0x80;
+		constexpr uint8_t CompressedSizeFlag = 0x01;
+
+		uint8_t header[16]{};
+		const uint32_t headerSize = std::min<uint32_t>(record.size, sizeof(header));
+
+		stream.seekg(record.offset);
+
+		if (!stream.read(reinterpret_cast<char*>(header), headerSize))
+		{
+			stream.clear();
+			return false;
+		}
+
+		uint32_t offset = 0;
+
+		// DBPF records usually place the compressed size in the 4 bytes before the header.
+		if (headerSize >= 9 && header[5] == QfsSignature)
+		{
+			offset = 4;
+		}
+		else if (headerSize < 5 || header[1] != QfsSignature)
+		{
+			return false;
+		}
+
+		const uint8_t flags = header[offset];
+		const uint32_t sizeByteCount = (flags & LargeSizesFlag) != 0 ? 4 : 3;
+
+		offset += 2;
+
+		if ((flags & CompressedSizeFlag) != 0)
+		{
+			offset += sizeByteCount;
+		}
+
+		if (headerSize < offset + sizeByteCount)
+		{
+			return false;
+		}
+
+		uncompressedSize = 0;
+
+		for (uint32_t i = 0; i < sizeByteCount; i++)
+		{
+			uncompressedSize = (uncompressedSize << 8) | header[offset + i];
+		}
+
+		return true;
+	}
+
+	// Adds the records of a DBPF file to the effective record map, returns false if the
+	// file is not a valid DBPF file.
+	bool AddFileRecords(
+		const SourceFileInfo& file,
+		uint32_t fileIndex,
+		std::map<Key, Record>& records,
+		uint64_t& sourceOrder,
+		BuildStatistics& statistics)
+	{
+		std::ifstream stream(file.path, std::ios::binary);
+
+		DBPFHeader header{};
+
+		if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| !DBPFIndexReader::IsValidHeader(header, file.size))
+		{
+			return false;
+		}
+
+		std::vector<uint8_t> index(DBPFIndexReader::GetIndexSize(header));
+
+		stream.seekg(header.indexOffset);
+
+		if (!stream.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size())))
+		{
+			return false;
+		}
+
+		const DBPFIndexReader indexReader(header, index.data(), file.size);
+
+		// The first entry for a key is used when a file has more than one, in the same
+		// way as the plugin's in-memory segments.
+		std::map<Key, Record> fileRecords;
+		DBPFIndexReader::Entry directoryEntry{};
+		bool hasDirectory = false;
+
+		for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+		{
+			DBPFIndexReader::Entry entry{};
+
+			if (!indexReader.TryGetEntry(i, entry))
+			{
+				return false;
+			}
+
+			const Key key(entry.type, entry.group, entry.instance);
+
+			if (key == DirectoryRecordKey)
+			{
+				if (!hasDirectory)
+				{
+					directoryEntry = entry;
+					hasDirectory = true;
+				}
+			}
+			else if (key != InfoRecordKey)
+			{
+				fileRecords.try_emplace(key, Record{ fileIndex, entry.offset, entry.size, entry.size, false, 0, false, 0 });
+			}
+		}
+
+		if (hasDirectory)
+		{
+			// Each directory entry is the record's key followed by its uncompressed size.
+			const size_t directoryValuesPerEntry = (DBPFIndexReader::GetEntrySize(header) / sizeof(uint32_t)) - 1;
+			std::vector<uint32_t> directory(directoryEntry.size / (directoryValuesPerEntry * sizeof(uint32_t)) * directoryValuesPerEntry);
+
+			stream.seekg(directoryEntry.offset);
+
+			if (!stream.read(reinterpret_cast<char*>(directory.data()), static_cast<std::streamsize>(directory.size() * sizeof(uint32_t))))
+			{
+				return false;
+			}
+
+			for (size_t i = 0; i < directory.size(); i += directoryValuesPerEntry)
+			{
+				const auto record = fileRecords.find(Key(directory[i], directory[i + 1], directory[i + 2]));
+
+				if (record != fileRecords.end()
+					&& ReadQfsUncompressedSize(stream, record->second, record->second.uncompressedSize))
+				{
+					record->second.compressed = true;
+				}
+			}
+		}
+
+		// The later files override the earlier ones.
+		for (auto& [key, record] : fileRecords)
+		{
+			record.sourceOrder = sourceOrder++;
+
+			if (!records.insert_or_assign(key, record).second)
+			{
+				statistics.overriddenRecordCount++;
+			}
+		}
+
+		return true;
+	}
+
+	// Reads the order that the game first requested each key in, from a trace that was
+	// recorded with the plugin's ResourceAccessTrace setting.
+	std::vector<Key> ReadAccessOrder(const std::filesystem::path& path)
+	{
+		using namespace ResourceAccessTraceFormat;
+		using ResourceAccessTraceFormat::Signature;
+		using ResourceAccessTraceFormat::Version;
+
+		std::ifstream stream(path, std::ios::binary);
+
+		if (!stream)
+		{
+			throw std::runtime_error("Failed to open the trace file: " + path.string());
+		}
+
+		FileHeader header{};
+		ReadValue(stream, header);
+
+		if (header.signature != Signature || header.version != Version)
+		{
+			throw std::runtime_error("The trace file has an unsupported format.");
+		}
+
+		std::vector<Key> orderedKeys;
+		std::map<Key, size_t> seenKeys;
+
+		while (stream.peek() != std::char_traits<char>::eof())
+		{
+			const RecordType type = static_cast<RecordType>(stream.peek());
+
+			if (type == RecordType::Container || type == RecordType::Segment)
+			{
+				PathRecord record{};
+				ReadValue(stream, record);
+
+				stream.seekg(record.pathLength, std::ios::cur);
+			}
+			else if (type >= RecordType::TestForRecord && type <= RecordType::ReadRecord)
+			{
+				AccessRecord record{};
+				ReadValue(stream, record);
+
+				// TestForRecord does not read the record data.
+				if (record.found && type != RecordType::TestForRecord)
+				{
+					const Key key(record.keyType, record.keyGroup, record.keyInstance);
+
+					if (seenKeys.try_emplace(key, orderedKeys.size()).second)
+					{
+						orderedKeys.push_back(key);
+					}
+				}
+			}
+			else
+			{
+				throw std::runtime_error("Unknown trace record type: " + std::to_string(static_cast<int>(type)));
+			}
+		}
+
+		return orderedKeys;
+	}
+
+	uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	void WritePack(
+		const Options& options,
+		const std::vector<SourceFileInfo>& sourceFiles,
+		std::map<Key, Record>& records,
+		const std::vector<Key>& accessOrder,
+		BuildStatistics& statistics)
+	{
+		// The records that the game read are laid out first, in the order that it first
+		// read them, followed by the other records in the source file order.
+		std::vector<Record*> layout;
+		layout.reserve(records.size());
+
+		for (const Key& key : accessOrder)
+		{
+			const auto record = records.find(key);
+
+			if (record != records.end())
+			{
+				record->second.inAccessOrder = true;
+				layout.push_back(&record->second);
+			}
+		}
+
+		statistics.accessOrderedRecordCount = static_cast<uint32_t>(layout.size());
+
+		std::vector<Record*> remainingRecords;
+
+		for (auto& [key, record] : records)
+		{
+			if (record.compressed)
+			{
+				statistics.compressedRecordCount++;
+			}
+
+			remainingRecords.push_back(&record);
+		}
+
+		std::sort(remainingRecords.begin(), remainingRecords.end(), [](const Record* left, const Record* right) { return left->sourceOrder < right->sourceOrder; });
+
+		for (Record* record : remainingRecords)
+		{
+			if (!record->inAccessOrder)
+			{
+				layout.push_back(record);
+			}
+		}
+
+		// The metadata is placed in front of the records, so that the loader can map
+		// it with one view.
+		uint64_t infoSize = sizeof(InfoHeader);
+
+		for (const SourceFileInfo& file : sourceFiles)
+		{
+			infoSize += sizeof(SourceFile) + file.relativePath.size();
+		}
+
+		const bool hasDirectory = statistics.compressedRecordCount > 0;
+		const uint64_t infoOffset = DBPFHeader::Size;
+		const uint64_t directoryOffset = AlignUp(infoOffset + infoSize, alignof(DirectoryEntry));
+		const uint64_t directorySize = static_cast<uint64_t>(statistics.compressedRecordCount) * sizeof(DirectoryEntry);
+		const uint64_t indexOffset = AlignUp(directoryOffset + directorySize, IndexAlignment);
+		const uint64_t indexEntryCount = records.size() + (hasDirectory ? 2 : 1);
+		const uint64_t indexSize = indexEntryCount * sizeof(IndexEntry);
+
+		uint64_t packSize = indexOffset + indexSize;
+
+		for (Record* record : layout)
+		{
+			record->packOffset = packSize;
+			packSize += record->size;
+		}
+
+		if (packSize > UINT32_MAX)
+		{
+			throw std::runtime_error("The pack would be larger than 4 GB, which the DBPF format does not support.");
+		}
+
+		std::vector<IndexEntry> index;
+		index.reserve(indexEntryCount);
+		index.push_back(IndexEntry{ InfoRecordType, InfoRecordGroup, InfoRecordInstance, static_cast<uint32_t>(infoOffset), static_cast<uint32_t>(infoSize) });
+
+		if (hasDirectory)
+		{
+			index.push_back(IndexEntry{ DirectoryRecordType, DirectoryRecordGroup, DirectoryRecordInstance, static_cast<uint32_t>(directoryOffset), static_cast<uint32_t>(directorySize) });
+		}
+
+		for (const auto& [key, record] : records)
+		{
+			index.push_back(IndexEntry{ std::get<0>(key), std::get<1>(key), std::get<2>(key), static_cast<uint32_t>(record.packOffset), record.size });
+		}
+
+		std::sort(index.begin(), index.end(), [](const IndexEntry& left, const IndexEntry& right)
+		{
+			return KeyLess(left.type, left.group, left.instance, right.type, right.group, right.instance);
+		});
+
+		// The pack is written to a temporary file and renamed, so the game never sees a partial pack.
+		std::filesystem::path temporaryPath = options.outputPath;
+		temporaryPath += ".tmp";
+
+		{
+			std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to create " + temporaryPath.string());
+			}
+
+			DBPFHeader header{};
+			header.signature = DBPFHeader::Signature;
+			header.majorVersion = 1;
+			header.indexMajorVersion = 7;
+			header.indexEntryCount = static_cast<uint32_t>(indexEntryCount);
+			header.indexOffset = static_cast<uint32_t>(indexOffset);
+			header.indexSize = static_cast<uint32_t>(indexSize);
+			WriteValue(stream, header);
+
+			InfoHeader info{};
+			info.signature = Signature;
+			info.version = Version;
+			info.sourceFileCount = static_cast<uint32_t>(sourceFiles.size());
+			info.recordCount = static_cast<uint32_t>(records.size());
+			WriteValue(stream, info);
+
+			for (const SourceFileInfo& file : sourceFiles)
+			{
+				SourceFile sourceFile{};
+				sourceFile.size = file.size;
+				sourceFile.lastWriteTime = file.lastWriteTime;
+				sourceFile.pathLength = static_cast<uint32_t>(file.relativePath.size());
+				WriteValue(stream, sourceFile);
+				stream.write(file.relativePath.data(), static_cast<std::streamsize>(file.relativePath.size()));
+			}
+
+			const std::vector<char> padding(IndexAlignment, 0);
+			stream.write(padding.data(), static_cast<std::streamsize>(directoryOffset - (infoOffset + infoSize)));
+
+			for (const auto& [key, record] : records)
+			{
+				if (record.compressed)
+				{
+					WriteValue(stream, DirectoryEntry{ std::get<0>(key), std::get<1>(key), std::get<2>(key), record.uncompressedSize });
+				}
+			}
+
+			stream.write(padding.data(), static_cast<std::streamsize>(indexOffset - (directoryOffset + directorySize)));
+			stream.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(indexSize));
+
+			std::vector<char> buffer;
+			uint32_t openFileIndex = UINT32_MAX;
+			std::ifstream sourceStream;
+
+			for (const Record* record : layout)
+			{
+				// The records that are not in the trace are in source file order, so
+				// each file is usually opened once.
+				if (record->fileIndex != openFileIndex)
+				{
+					sourceStream = std::ifstream(sourceFiles[record->fileIndex].path, std::ios::binary);
+					openFileIndex = record->fileIndex;
+				}
+
+				buffer.resize(record->size);
+				sourceStream.seekg(record->offset);
+
+				if (!sourceStream.read(buffer.data(), record->size))
+				{
+					throw std::runtime_error("Failed to read a record from " + sourceFiles[record->fileIndex].path.string());
+				}
+
+				stream.write(buffer.data(), record->size);
+			}
+
+			if (!stream)
+			{
+				throw std::runtime_error("Failed to write " + temporaryPath.string());
+			}
+		}
+
+		std::filesystem::rename(temporaryPath, options.outputPath);
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: PluginPackBuilder <plugin folder> [options]\n"
+			"\n"
+			"Options:\n"
+			"  --output <file>        The pack file, defaults to SC4DBPFLoading.PluginPack in the plugin folder.\n"
+			"  --access-trace <file>  A trace recorded with the plugin's ResourceAccessTrace setting, the records\n"
+			"                         are laid out in the order that the game first read them.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+
+			if (argument == "--output" && i + 1 < argc)
+			{
+				options.outputPath = argv[++i];
+			}
+			else if (argument == "--access-trace" && i + 1 < argc)
+			{
+				options.accessTracePath = argv[++i];
+			}
+			else if (options.folder.empty() && !argument.starts_with("--"))
+			{
+				options.folder = argument;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		if (!options.folder.empty() && options.outputPath.empty())
+		{
+			options.outputPath = options.folder / FileName;
+		}
+
+		return !options.folder.empty();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		std::vector<std::filesystem::path> paths;
+		EnumerateDatFiles(options.folder, paths);
+
+		std::vector<SourceFileInfo> sourceFiles;
+		sourceFiles.reserve(paths.size());
+
+		std::map<Key, Record> records;
+		BuildStatistics statistics;
+		uint64_t sourceOrder = 0;
+
+		for (const std::filesystem::path& path : paths)
+		{
+			const uint32_t fileIndex = static_cast<uint32_t>(sourceFiles.size());
+
+			// The files that are not valid DBPF files are still listed in the pack, the
+			// loader compares the pack to every .dat file in the folder.
+			sourceFiles.push_back(GetSourceFileInfo(options.folder, path));
+
+			if (!AddFileRecords(sourceFiles.back(), fileIndex, records, sourceOrder, statistics))
+			{
+				std::printf("Skipped %s, it is not a valid DBPF file.\n", path.string().c_str());
+				statistics.skippedFileCount++;
+			}
+		}
+
+		std::vector<Key> accessOrder;
+
+		if (!options.accessTracePath.empty())
+		{
+			accessOrder = ReadAccessOrder(options.accessTracePath);
+		}
+
+		WritePack(options, sourceFiles, records, accessOrder, statistics);
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::printf(
+			"Wrote %zu records from %zu files (%u skipped) to %s in %.1f s.\n"
+			"%llu records were overridden by later files, %u records are compressed, %u records are in the access trace order.\n",
+			records.size(),
+			sourceFiles.size(),
+			statistics.skippedFileCount,
+			options.outputPath.string().c_str(),
+			seconds,
+			static_cast<unsigned long long>(statistics.overriddenRecordCount),
+			statistics.compressedRecordCount,
+			statistics.accessOrderedRecordCount);
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks that SCOPED_TIMER compiles to nothing when the scoped timers are disabled.
+// This file is built without SC4DBPFLOADING_ENABLE_SCOPED_TIMERS, the same way as
+// the plugin's release configuration.
+
+#undef SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
+#include "ScopedTimer.h"
+
+#ifdef SCOPED_TIMER_CONCAT
+#error The ScopedTimer class is declared when the scoped timers are disabled.
+#endif
+
+namespace
+{
+	// A constant expression cannot construct a ScopedTimer, so this only compiles
+	// if the macros expand to an expression without any side effects.
+	constexpr int TimedFunction()
+	{
+		SCOPED_TIMER("TimedFunction");
+		SCOPED_TIMER_WRITE_SUMMARY();
+
+		return 1;
+	}
+
+	static_assert(TimedFunction() == 1);
+}
+
+bool AreScopedTimersCompiledOut()
+{
+	return TimedFunction() == 1;
+}
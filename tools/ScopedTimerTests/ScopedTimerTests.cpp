@@ -0,0 +1,273 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Tests the plugin's scoped timers outside of the game, and measures the cost of a timed scope.
+// The tool is built with SC4DBPFLOADING_ENABLE_SCOPED_TIMERS, and optionally with
+// SC4DBPFLOADING_SCOPED_TIMER_USE_TSC. The summary that ScopedTimer::WriteSummary writes to
+// the log file is read back and checked against the scopes that the tests ran.
+
+#include "Logger.h"
+#include "ScopedTimer.h"
+#include "Stopwatch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef SC4DBPFLOADING_ENABLE_SCOPED_TIMERS
+#error The tool must be built with SC4DBPFLOADING_ENABLE_SCOPED_TIMERS defined.
+#endif
+
+bool AreScopedTimersCompiledOut();
+
+namespace
+{
+	constexpr uint32_t ThreadCount = 4;
+	constexpr uint32_t IterationsPerThread = 1000;
+	constexpr uint32_t OverheadIterations = 1000000;
+
+	// A row of the summary table.
+	struct SummaryRow
+	{
+		std::string name;
+		uint32_t depth;
+		uint32_t threadCount;
+		uint64_t count;
+		double totalMilliseconds;
+		double averageMicroseconds;
+		double minMicroseconds;
+		double maxMicroseconds;
+	};
+
+	class TestResults
+	{
+	public:
+		void Check(bool condition, const char* description)
+		{
+			checkCount++;
+
+			if (!condition)
+			{
+				failureCount++;
+				std::printf("FAILED: %s\n", description);
+			}
+		}
+
+		size_t GetCheckCount() const
+		{
+			return checkCount;
+		}
+
+		size_t GetFailureCount() const
+		{
+			return failureCount;
+		}
+
+	private:
+		size_t checkCount = 0;
+		size_t failureCount = 0;
+	};
+
+	void Sleep(std::chrono::milliseconds duration)
+	{
+		std::this_thread::sleep_for(duration);
+	}
+
+	void RunNestedScopes()
+	{
+		SCOPED_TIMER("Outer");
+
+		for (int i = 0; i < 3; i++)
+		{
+			SCOPED_TIMER("Inner");
+			Sleep(std::chrono::milliseconds(2));
+		}
+	}
+
+	void RunThreadScopes()
+	{
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < ThreadCount; i++)
+		{
+			threads.emplace_back([]()
+			{
+				for (uint32_t j = 0; j < IterationsPerThread; j++)
+				{
+					SCOPED_TIMER("Worker");
+				}
+			});
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	void RunSleepScope()
+	{
+		SCOPED_TIMER("Sleep20ms");
+		Sleep(std::chrono::milliseconds(20));
+	}
+
+	double MeasureScopeOverheadNanoseconds()
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t i = 0; i < OverheadIterations; i++)
+		{
+			SCOPED_TIMER("Overhead");
+		}
+
+		const double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		return nanoseconds / OverheadIterations;
+	}
+
+	std::vector<SummaryRow> ReadSummary(const std::filesystem::path& logFile)
+	{
+		std::ifstream stream(logFile, std::ios::binary);
+		std::vector<SummaryRow> rows;
+		std::string line;
+		bool inTable = false;
+
+		while (std::getline(stream, line))
+		{
+			if (line.starts_with("Scope "))
+			{
+				inTable = true;
+			}
+			else if (inTable && line.size() > 48)
+			{
+				const std::string_view nameColumn = std::string_view(line).substr(0, 48);
+				const size_t nameStart = nameColumn.find_first_not_of(' ');
+				const size_t nameEnd = nameColumn.find_last_not_of(' ');
+
+				if (nameStart == std::string_view::npos)
+				{
+					continue;
+				}
+
+				SummaryRow row{};
+				row.name = std::string(nameColumn.substr(nameStart, nameEnd - nameStart + 1));
+				row.depth = static_cast<uint32_t>(nameStart / 2);
+
+				std::istringstream values(line.substr(48));
+
+				if (values >> row.threadCount >> row.count >> row.totalMilliseconds >> row.averageMicroseconds >> row.minMicroseconds >> row.maxMicroseconds)
+				{
+					rows.push_back(row);
+				}
+			}
+		}
+
+		return rows;
+	}
+
+	const SummaryRow* FindRow(const std::vector<SummaryRow>& rows, std::string_view name, uint32_t depth)
+	{
+		const auto it = std::find_if(
+			rows.begin(),
+			rows.end(),
+			[&](const SummaryRow& row) { return row.name == name && row.depth == depth; });
+
+		return it != rows.end() ? &*it : nullptr;
+	}
+
+	void CheckSummary(TestResults& results, const std::vector<SummaryRow>& rows)
+	{
+		const SummaryRow* const outer = FindRow(rows, "Outer", 0);
+		const SummaryRow* const nestedInner = FindRow(rows, "Inner", 1);
+		const SummaryRow* const topLevelInner = FindRow(rows, "Inner", 0);
+		const SummaryRow* const worker = FindRow(rows, "Worker", 0);
+		const SummaryRow* const sleep = FindRow(rows, "Sleep20ms", 0);
+
+		results.Check(outer && outer->count == 2, "Outer ran twice");
+		results.Check(nestedInner && nestedInner->count == 6, "Inner is grouped under Outer");
+		results.Check(topLevelInner && topLevelInner->count == 1, "Inner outside of Outer is a separate scope");
+
+		if (outer && nestedInner)
+		{
+			const auto outerIndex = outer - rows.data();
+			const auto innerIndex = nestedInner - rows.data();
+
+			results.Check(innerIndex == outerIndex + 1, "Inner is listed after its parent");
+			results.Check(nestedInner->totalMilliseconds <= outer->totalMilliseconds, "Inner takes less time than Outer");
+		}
+
+		results.Check(
+			worker && worker->threadCount == ThreadCount && worker->count == ThreadCount * IterationsPerThread,
+			"Worker is merged across the threads");
+
+		if (sleep)
+		{
+			results.Check(sleep->averageMicroseconds >= 19000.0 && sleep->averageMicroseconds < 200000.0, "Sleep20ms took about 20 ms");
+			results.Check(
+				sleep->minMicroseconds <= sleep->averageMicroseconds && sleep->averageMicroseconds <= sleep->maxMicroseconds,
+				"Sleep20ms minimum <= average <= maximum");
+		}
+		else
+		{
+			results.Check(false, "Sleep20ms is in the summary");
+		}
+	}
+}
+
+int main()
+{
+	const std::filesystem::path logFile = std::filesystem::temp_directory_path() / "ScopedTimerTests.log";
+
+	Logger& logger = Logger::GetInstance();
+	logger.Init(logFile, LogLevel::Info);
+
+	TestResults results;
+
+	results.Check(AreScopedTimersCompiledOut(), "SCOPED_TIMER compiles to nothing when disabled");
+	results.Check(Stopwatch::GetFrequency() > 0, "Stopwatch frequency is positive");
+
+	RunNestedScopes();
+	RunNestedScopes();
+
+	{
+		SCOPED_TIMER("Inner");
+	}
+
+	RunThreadScopes();
+	RunSleepScope();
+
+	const double overheadNanoseconds = MeasureScopeOverheadNanoseconds();
+
+	SCOPED_TIMER_WRITE_SUMMARY();
+
+	// The header is written with std::endl, which flushes the summary to the file.
+	logger.WriteLogFileHeader("End of the scoped timer summary.");
+
+	const std::vector<SummaryRow> rows = ReadSummary(logFile);
+
+	CheckSummary(results, rows);
+
+	std::printf(
+		"A timed scope costs %.1f ns.\n%zu checks, %zu failed.\n",
+		overheadNanoseconds,
+		results.GetCheckCount(),
+		results.GetFailureCount());
+
+	return results.GetFailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,599 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is part of sc4-dbpf-loading, a DLL Plugin for SimCity 4 that
+// optimizes the DBPF loading.
+//
+// Copyright (c) 2024, 2025 Nicholas Hayes
+//
+// This file is licensed under terms of the MIT License.
+// See LICENSE.txt for more information.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Compares the cGZPersistResourceKey hashers in PersistResourceKeyHashers.h on TGI dumps,
+// the keys in a plugin folder and synthetic key distributions.
+//
+// For each key set and hasher the tool reports the number of full hash collisions, the
+// linear probe lengths when the low bits of the hash select the bucket of a half full
+// table, the hash throughput and the flat map lookup throughput for keys that are in the
+// map and keys that are not.
+
+#include "DBPFHeader.h"
+#include "DBPFIndexReader.h"
+#include "PersistResourceKeyHashers.h"
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		std::vector<std::filesystem::path> dumpFiles;
+		std::vector<std::filesystem::path> folders;
+		size_t syntheticCount = 500000;
+		uint32_t lookupCount = 2000000;
+		uint64_t seed = 1;
+	};
+
+	struct KeySet
+	{
+		std::string name;
+		std::vector<cGZPersistResourceKey> keys;
+	};
+
+	using KeySetHash = boost::unordered::unordered_flat_set<
+		cGZPersistResourceKey,
+		PersistResourceKeyHashers::MultiplyXorShift,
+		std::equal_to<const cGZPersistResourceKey>>;
+
+	// Removes the duplicate keys, the override copies of a key in a plugin folder
+	// would otherwise be counted as hash collisions.
+	void RemoveDuplicates(std::vector<cGZPersistResourceKey>& keys)
+	{
+		KeySetHash seen;
+		seen.reserve(keys.size());
+
+		std::erase_if(keys, [&](const cGZPersistResourceKey& key) { return !seen.insert(key).second; });
+	}
+
+	// Reads a text file with one key per line, the type, group and instance are
+	// hexadecimal numbers separated by spaces, commas, colons or dashes.
+	// Empty lines and lines that start with # are skipped.
+	KeySet ReadDumpFile(const std::filesystem::path& path)
+	{
+		std::ifstream stream(path);
+
+		if (!stream)
+		{
+			throw std::runtime_error("Unable to open " + path.string());
+		}
+
+		KeySet keySet{ path.filename().string(), {} };
+
+		std::string line;
+
+		while (std::getline(stream, line))
+		{
+			std::replace_if(line.begin(), line.end(), [](char c) { return c == ',' || c == ':' || c == '-'; }, ' ');
+
+			const char* start = line.c_str();
+
+			while (std::isspace(static_cast<unsigned char>(*start)))
+			{
+				start++;
+			}
+
+			if (*start == '\0' || *start == '#')
+			{
+				continue;
+			}
+
+			uint32_t values[3]{};
+			char* end = nullptr;
+
+			for (uint32_t& value : values)
+			{
+				value = static_cast<uint32_t>(std::strtoul(start, &end, 16));
+
+				if (end == start)
+				{
+					throw std::runtime_error("Invalid key in " + path.string() + ": " + line);
+				}
+
+				start = end;
+			}
+
+			keySet.keys.emplace_back(values[0], values[1], values[2]);
+		}
+
+		RemoveDuplicates(keySet.keys);
+
+		return keySet;
+	}
+
+	std::string GetUpperCaseExtension(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+		return extension;
+	}
+
+	bool IsDBPFFile(const std::filesystem::path& path)
+	{
+		const std::string extension = GetUpperCaseExtension(path);
+
+		return extension == ".DAT" || extension.empty() || extension.starts_with(".SC4");
+	}
+
+	void ReadDBPFIndexKeys(const std::filesystem::path& path, std::vector<cGZPersistResourceKey>& keys)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		std::error_code error;
+		const uint64_t fileSize = std::filesystem::file_size(path, error);
+
+		DBPFHeader header{};
+
+		if (error
+			|| !stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| !DBPFIndexReader::IsValidHeader(header, fileSize))
+		{
+			return;
+		}
+
+		std::vector<uint8_t> index(DBPFIndexReader::GetIndexSize(header));
+
+		stream.seekg(header.indexOffset);
+
+		if (!stream.read(reinterpret_cast<char*>(index.data()), static_cast<std::streamsize>(index.size())))
+		{
+			return;
+		}
+
+		const DBPFIndexReader indexReader(header, index.data(), fileSize);
+
+		for (uint32_t i = 0; i < indexReader.GetEntryCount(); i++)
+		{
+			DBPFIndexReader::Entry entry{};
+
+			if (indexReader.TryGetEntry(i, entry))
+			{
+				keys.emplace_back(entry.type, entry.group, entry.instance);
+			}
+		}
+	}
+
+	KeySet ReadFolderKeys(const std::filesystem::path& folder)
+	{
+		KeySet keySet{ folder.filename().string(), {} };
+
+		if (keySet.name.empty())
+		{
+			keySet.name = folder.parent_path().filename().string();
+		}
+
+		for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(folder))
+		{
+			if (entry.is_regular_file() && IsDBPFFile(entry.path()))
+			{
+				ReadDBPFIndexKeys(entry.path(), keySet.keys);
+			}
+		}
+
+		RemoveDuplicates(keySet.keys);
+
+		return keySet;
+	}
+
+	// Random values for all three fields.
+	KeySet CreateUniformKeys(std::mt19937_64& random, size_t count)
+	{
+		KeySet keySet{ "uniform", {} };
+		keySet.keys.reserve(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			keySet.keys.emplace_back(static_cast<uint32_t>(random()), static_cast<uint32_t>(random()), static_cast<uint32_t>(random()));
+		}
+
+		RemoveDuplicates(keySet.keys);
+
+		return keySet;
+	}
+
+	// A few types and groups with runs of sequential instances, the layout of the
+	// exemplars, S3D models and textures in a typical building or lot pack.
+	KeySet CreateSequentialKeys(std::mt19937_64& random, size_t count)
+	{
+		static constexpr uint32_t Types[] =
+		{
+			0x6534284A, // Exemplar
+			0x5AD0E817, // S3D
+			0x7AB50E44, // FSH
+			0x6BE74C60, // LText
+		};
+
+		KeySet keySet{ "sequential", {} };
+		keySet.keys.reserve(count);
+
+		while (keySet.keys.size() < count)
+		{
+			const uint32_t type = Types[random() % std::size(Types)];
+			const uint32_t group = static_cast<uint32_t>(random() % 64) * 0x01000000 + 0x00C8AB;
+			const uint32_t firstInstance = static_cast<uint32_t>(random()) & 0xFFFFF000;
+			const size_t runLength = std::min<size_t>(count - keySet.keys.size(), 16 + random() % 496);
+
+			for (size_t i = 0; i < runLength; i++)
+			{
+				keySet.keys.emplace_back(type, group, firstInstance + static_cast<uint32_t>(i));
+			}
+		}
+
+		RemoveDuplicates(keySet.keys);
+
+		return keySet;
+	}
+
+	// Instances that differ only in their high bits and a single type and group,
+	// this is hard on hashers that do not mix the high bits into the low bits.
+	KeySet CreateHighBitKeys(std::mt19937_64& random, size_t count)
+	{
+		KeySet keySet{ "high bits", {} };
+		keySet.keys.reserve(count);
+
+		const uint32_t lowBits = static_cast<uint32_t>(random()) & 0xFFF;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			keySet.keys.emplace_back(0x6534284A, 0xE83E0437, (static_cast<uint32_t>(i) << 12) | lowBits);
+		}
+
+		RemoveDuplicates(keySet.keys);
+
+		return keySet;
+	}
+
+	template<typename TFunc> double MeasureNanoseconds(TFunc&& func)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	struct HasherResult
+	{
+		size_t collisionCount;
+		double meanProbeLength;
+		size_t maxProbeLength;
+		double hashNanoseconds;
+		double hitNanoseconds;
+		double missNanoseconds;
+	};
+
+	template<typename THasher> size_t CountCollisions(const std::vector<cGZPersistResourceKey>& keys)
+	{
+		std::vector<size_t> hashes;
+		hashes.reserve(keys.size());
+
+		for (const cGZPersistResourceKey& key : keys)
+		{
+			hashes.push_back(THasher()(key));
+		}
+
+		std::sort(hashes.begin(), hashes.end());
+
+		return static_cast<size_t>(hashes.end() - std::unique(hashes.begin(), hashes.end()));
+	}
+
+	// Inserts the keys into a linear probing table with at least twice as many buckets
+	// as keys, the bucket is selected by the low bits of the raw hash value.
+	template<typename THasher> void MeasureProbeLengths(const std::vector<cGZPersistResourceKey>& keys, HasherResult& result)
+	{
+		size_t bucketCount = 16;
+
+		while (bucketCount < keys.size() * 2)
+		{
+			bucketCount *= 2;
+		}
+
+		const size_t mask = bucketCount - 1;
+
+		std::vector<bool> used(bucketCount);
+		uint64_t totalProbeLength = 0;
+		size_t maxProbeLength = 0;
+
+		for (const cGZPersistResourceKey& key : keys)
+		{
+			size_t bucket = THasher()(key) & mask;
+			size_t probeLength = 1;
+
+			while (used[bucket])
+			{
+				bucket = (bucket + 1) & mask;
+				probeLength++;
+			}
+
+			used[bucket] = true;
+			totalProbeLength += probeLength;
+			maxProbeLength = std::max(maxProbeLength, probeLength);
+		}
+
+		result.meanProbeLength = keys.empty() ? 0.0 : static_cast<double>(totalProbeLength) / keys.size();
+		result.maxProbeLength = maxProbeLength;
+	}
+
+	template<typename THasher> HasherResult MeasureHasher(
+		const std::vector<cGZPersistResourceKey>& keys,
+		const std::vector<cGZPersistResourceKey>& hitKeys,
+		const std::vector<cGZPersistResourceKey>& missKeys)
+	{
+		HasherResult result{};
+
+		result.collisionCount = CountCollisions<THasher>(keys);
+		MeasureProbeLengths<THasher>(keys, result);
+
+		size_t hashSum = 0;
+
+		result.hashNanoseconds = MeasureNanoseconds([&]
+		{
+			for (const cGZPersistResourceKey& key : hitKeys)
+			{
+				hashSum += THasher()(key);
+			}
+		}) / static_cast<double>(hitKeys.size());
+
+		boost::unordered::unordered_flat_map<
+			const cGZPersistResourceKey,
+			uint32_t,
+			THasher,
+			std::equal_to<const cGZPersistResourceKey>> map;
+		map.reserve(keys.size());
+
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			map.emplace(keys[i], static_cast<uint32_t>(i));
+		}
+
+		size_t hitCount = 0;
+
+		result.hitNanoseconds = MeasureNanoseconds([&]
+		{
+			for (const cGZPersistResourceKey& key : hitKeys)
+			{
+				hitCount += map.contains(key);
+			}
+		}) / static_cast<double>(hitKeys.size());
+
+		size_t missCount = 0;
+
+		result.missNanoseconds = MeasureNanoseconds([&]
+		{
+			for (const cGZPersistResourceKey& key : missKeys)
+			{
+				missCount += map.contains(key);
+			}
+		}) / static_cast<double>(missKeys.size());
+
+		if (hitCount != hitKeys.size() || missCount != 0 || hashSum == 1)
+		{
+			throw std::runtime_error("The map lookups returned the wrong result.");
+		}
+
+		return result;
+	}
+
+	template<typename THasher> void PrintHasherResult(
+		const char* name,
+		const std::vector<cGZPersistResourceKey>& keys,
+		const std::vector<cGZPersistResourceKey>& hitKeys,
+		const std::vector<cGZPersistResourceKey>& missKeys)
+	{
+		const HasherResult result = MeasureHasher<THasher>(keys, hitKeys, missKeys);
+
+		std::printf(
+			"  %-18s %10zu %10.3f %10zu %10.2f %10.2f %10.2f\n",
+			name,
+			result.collisionCount,
+			result.meanProbeLength,
+			result.maxProbeLength,
+			result.hashNanoseconds,
+			result.hitNanoseconds,
+			result.missNanoseconds);
+	}
+
+	void RunBenchmark(const KeySet& keySet, const Options& options)
+	{
+		std::printf("%s: %zu unique keys\n", keySet.name.c_str(), keySet.keys.size());
+
+		if (keySet.keys.empty())
+		{
+			std::puts("");
+			return;
+		}
+
+		std::mt19937_64 random(options.seed);
+
+		std::vector<cGZPersistResourceKey> hitKeys;
+		hitKeys.reserve(options.lookupCount);
+
+		for (uint32_t i = 0; i < options.lookupCount; i++)
+		{
+			hitKeys.push_back(keySet.keys[random() % keySet.keys.size()]);
+		}
+
+		// The missing keys keep the type and group of an existing key, as the game's
+		// lookups for optional resources do.
+		const KeySetHash keys(keySet.keys.begin(), keySet.keys.end());
+
+		std::vector<cGZPersistResourceKey> missKeys;
+		missKeys.reserve(options.lookupCount);
+
+		while (missKeys.size() < options.lookupCount)
+		{
+			cGZPersistResourceKey key = keySet.keys[random() % keySet.keys.size()];
+			key.instance = static_cast<uint32_t>(random());
+
+			if (!keys.contains(key))
+			{
+				missKeys.push_back(key);
+			}
+		}
+
+		std::printf(
+			"  %-18s %10s %10s %10s %10s %10s %10s\n",
+			"Hasher",
+			"Collisions",
+			"Mean probe",
+			"Max probe",
+			"Hash ns",
+			"Hit ns",
+			"Miss ns");
+
+		PrintHasherResult<PersistResourceKeyHashers::BoostHashCombine>("BoostHashCombine", keySet.keys, hitKeys, missKeys);
+		PrintHasherResult<PersistResourceKeyHashers::PrimeMultiply>("PrimeMultiply", keySet.keys, hitKeys, missKeys);
+		PrintHasherResult<PersistResourceKeyHashers::MultiplyXorShift>("MultiplyXorShift", keySet.keys, hitKeys, missKeys);
+#ifdef PERSISTRESOURCEKEYHASHERS_HAS_CRC32C
+		PrintHasherResult<PersistResourceKeyHashers::Crc32c>("Crc32c", keySet.keys, hitKeys, missKeys);
+#endif // PERSISTRESOURCEKEYHASHERS_HAS_CRC32C
+
+		std::puts("");
+	}
+
+	const char* GetTgiMapHasherName()
+	{
+		using namespace PersistResourceKeyHashers;
+
+		if constexpr (std::is_same_v<TgiMapHasher, BoostHashCombine>)
+		{
+			return "BoostHashCombine";
+		}
+		else if constexpr (std::is_same_v<TgiMapHasher, PrimeMultiply>)
+		{
+			return "PrimeMultiply";
+		}
+		else if constexpr (std::is_same_v<TgiMapHasher, MultiplyXorShift>)
+		{
+			return "MultiplyXorShift";
+		}
+		else
+		{
+			return "Crc32c";
+		}
+	}
+
+	void PrintUsage()
+	{
+		std::puts(
+			"Usage: TgiHashBenchmark [options]\n"
+			"\n"
+			"Options:\n"
+			"  --dump <file>           A text file with one hexadecimal type, group and instance per line.\n"
+			"  --folder <path>         A plugin folder, the keys are read from the DBPF file indexes.\n"
+			"  --synthetic <count>     The number of keys in each synthetic key set, defaults to 500000.\n"
+			"  --lookups <count>       The number of hit and miss lookups per hasher, defaults to 2000000.\n"
+			"  --seed <value>          The random seed, defaults to 1.\n"
+			"\n"
+			"The --dump and --folder options can be used more than once.");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string_view argument = argv[i];
+
+			if (i + 1 >= argc)
+			{
+				return false;
+			}
+			else if (argument == "--dump")
+			{
+				options.dumpFiles.emplace_back(argv[++i]);
+			}
+			else if (argument == "--folder")
+			{
+				options.folders.emplace_back(argv[++i]);
+			}
+			else if (argument == "--synthetic")
+			{
+				options.syntheticCount = std::strtoull(argv[++i], nullptr, 10);
+			}
+			else if (argument == "--lookups")
+			{
+				options.lookupCount = std::max<uint32_t>(1, static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+			}
+			else if (argument == "--seed")
+			{
+				options.seed = std::strtoull(argv[++i], nullptr, 0);
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	try
+	{
+		std::vector<KeySet> keySets;
+
+		for (const std::filesystem::path& path : options.dumpFiles)
+		{
+			keySets.push_back(ReadDumpFile(path));
+		}
+
+		for (const std::filesystem::path& folder : options.folders)
+		{
+			keySets.push_back(ReadFolderKeys(folder));
+		}
+
+		if (options.syntheticCount > 0)
+		{
+			std::mt19937_64 random(options.seed);
+
+			keySets.push_back(CreateUniformKeys(random, options.syntheticCount));
+			keySets.push_back(CreateSequentialKeys(random, options.syntheticCount));
+			keySets.push_back(CreateHighBitKeys(random, options.syntheticCount));
+		}
+
+		std::printf("The multi-packed file index uses %s (SC4DBPFLOADING_TGI_HASHER=%d).\n\n", GetTgiMapHasherName(), SC4DBPFLOADING_TGI_HASHER);
+
+		for (const KeySet& keySet : keySets)
+		{
+			RunBenchmark(keySet, options);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}